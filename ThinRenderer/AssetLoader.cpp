@@ -0,0 +1,219 @@
+﻿#include "pch.h"
+#include "AssetLoader.h"
+#include "FileSystem.h"
+#include <stdexcept>
+
+
+namespace thinr
+{
+    struct AssetLoader::Pending
+    {
+        std::shared_ptr<Asset> asset;
+        AssetRequest request;
+        std::vector<uint8_t> data;
+        std::shared_ptr<void> result;
+        // 最初に失敗した段の理由。空でなければ後の段は何もしません。
+        std::string error;
+    };
+
+    namespace
+    {
+        // 段の例外をアセットのエラーにします。ジョブとしては失敗させないので、完了の段は必ず実行されます。
+        template <typename Body>
+        void RunStage(std::string &error, Body body)
+        {
+            if (!error.empty())
+            {
+                return;
+            }
+            try
+            {
+                body();
+            }
+            catch (const std::exception &e)
+            {
+                error = e.what();
+                if (error.empty())
+                {
+                    error = "AssetLoader: unknown error";
+                }
+            }
+            catch (...)
+            {
+                error = "AssetLoader: unknown error";
+            }
+        }
+    }
+
+    AssetState Asset::GetState() const
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        return m_state;
+    }
+
+    std::string Asset::GetError() const
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        return m_error;
+    }
+
+    std::shared_ptr<void> Asset::GetResult() const
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        return m_result;
+    }
+
+    AssetLoader::AssetLoader(JobSystem &jobs)
+        : m_jobs(jobs), m_running(0), m_pendingCount(0), m_stats()
+    {
+    }
+
+    AssetLoader::~AssetLoader()
+    {
+        WaitAll();
+    }
+
+    std::shared_ptr<const Asset> AssetLoader::Load(AssetRequest request)
+    {
+        auto pending = std::make_shared<Pending>();
+        pending->asset = std::make_shared<Asset>();
+        pending->asset->m_path = request.path;
+        pending->asset->m_state = AssetState::Loading;
+        pending->request = std::move(request);
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_running++;
+            m_pendingCount++;
+            m_stats.requested++;
+        }
+
+        // 読み込み → 変換 → 作成 → 完了の順に依存するジョブにします。段ごとに別のワーカーで実行されることがあります。
+        JobHandle read = m_jobs.Schedule([this, pending]()
+        {
+            RunStage(pending->error, [this, &pending]()
+            {
+                if (pending->request.open)
+                {
+                    pending->result = pending->request.open(pending->request.path);
+                    return;
+                }
+                if (!ReadWholeFile(pending->request.path, pending->data))
+                {
+                    throw std::runtime_error("AssetLoader: cannot read " + pending->request.path);
+                }
+                std::lock_guard<std::mutex> lock(m_mutex);
+                m_stats.bytesRead += pending->data.size();
+            });
+        });
+
+        JobHandle decode = m_jobs.Schedule([pending]()
+        {
+            RunStage(pending->error, [&pending]()
+            {
+                if (pending->request.open)
+                {
+                    return;
+                }
+                if (pending->request.decode)
+                {
+                    pending->result = pending->request.decode(pending->data);
+                }
+                else
+                {
+                    pending->result = std::make_shared<std::vector<uint8_t>>(std::move(pending->data));
+                }
+                std::vector<uint8_t>().swap(pending->data);
+            });
+        }, { read });
+
+        JobHandle last = decode;
+        if (pending->request.create)
+        {
+            last = m_jobs.Schedule([pending]()
+            {
+                RunStage(pending->error, [&pending]()
+                {
+                    pending->result = pending->request.create(pending->result);
+                });
+            }, { decode });
+        }
+
+        m_jobs.Schedule([this, pending]() { Finish(pending); }, { last });
+        return pending->asset;
+    }
+
+    void AssetLoader::Finish(const std::shared_ptr<Pending> &pending)
+    {
+        {
+            Asset &asset = *pending->asset;
+            std::lock_guard<std::mutex> lock(asset.m_mutex);
+            if (pending->error.empty())
+            {
+                asset.m_state = AssetState::Ready;
+                asset.m_result = std::move(pending->result);
+            }
+            else
+            {
+                asset.m_state = AssetState::Failed;
+                asset.m_error = pending->error;
+                pending->result = nullptr;
+            }
+        }
+
+        // m_idle の通知はロックの中で行い、通知後にこのオブジェクトに触れないようにします (デストラクターが待っているため)。
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if (pending->error.empty())
+        {
+            m_stats.loaded++;
+        }
+        else
+        {
+            m_stats.failed++;
+        }
+        m_completed.push_back(pending);
+        if (--m_running == 0)
+        {
+            m_idle.notify_all();
+        }
+    }
+
+    size_t AssetLoader::Poll()
+    {
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_polling.swap(m_completed);
+        }
+        // completed の中から Load を呼べるよう、ロックの外で呼びます。
+        for (const auto &pending : m_polling)
+        {
+            if (pending->request.completed)
+            {
+                pending->request.completed(*pending->asset);
+            }
+        }
+        size_t count = m_polling.size();
+        m_polling.clear();
+
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_pendingCount -= count;
+        return count;
+    }
+
+    size_t AssetLoader::GetPendingCount() const
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        return m_pendingCount;
+    }
+
+    void AssetLoader::WaitAll()
+    {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        m_idle.wait(lock, [this]() { return m_running == 0; });
+    }
+
+    AssetLoaderStats AssetLoader::GetStats() const
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        return m_stats;
+    }
+}
@@ -0,0 +1,112 @@
+﻿#pragma once
+#include "JobSystem.h"
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <condition_variable>
+#include <string>
+#include <vector>
+#include <cstdint>
+
+
+namespace thinr
+{
+    enum class AssetState
+    {
+        Loading,
+        Ready,
+        Failed,
+    };
+
+    // AssetLoader::Load の結果。状態はワーカーで更新されるので、描画スレッドでは AssetLoader::Poll の
+    // completed コールバックか IsDone で完了を確認してから Get してください。
+    class Asset
+    {
+    public:
+        AssetState GetState() const;
+        bool IsDone() const { return GetState() != AssetState::Loading; }
+        const std::string &GetPath() const { return m_path; }
+        // 失敗した場合の理由。
+        std::string GetError() const;
+
+        // decode (create を指定した場合は create) の結果。失敗した場合は nullptr です。
+        template <typename T>
+        std::shared_ptr<T> Get() const
+        {
+            return std::static_pointer_cast<T>(GetResult());
+        }
+
+    private:
+        friend class AssetLoader;
+        std::shared_ptr<void> GetResult() const;
+
+        std::string m_path;
+        mutable std::mutex m_mutex;
+        AssetState m_state;
+        std::shared_ptr<void> m_result;
+        std::string m_error;
+    };
+
+    struct AssetRequest
+    {
+        // UTF-8 のファイル パス。
+        std::string path;
+        // 指定した場合は、バイト列を読み込む代わりに path を開いた結果を使い、decode は呼びません。
+        // MeshFile のようにファイルをマップして読み込みを省く場合に使います。ワーカーで呼ばれます。
+        std::function<std::shared_ptr<void>(const std::string &path)> open;
+        // 読み込んだバイト列を使える形に変換します。ワーカーで呼ばれます。省略した場合はバイト列 (std::vector<uint8_t>) が結果です。
+        std::function<std::shared_ptr<void>(std::vector<uint8_t> &data)> decode;
+        // decode の結果から GPU リソースなどを作成します。ワーカーで呼ばれます。省略できます。
+        std::function<std::shared_ptr<void>(const std::shared_ptr<void> &decoded)> create;
+        // 完了 (失敗を含む) した後、Poll を呼んだスレッドで呼ばれます。省略できます。
+        std::function<void(const Asset &asset)> completed;
+    };
+
+    struct AssetLoaderStats
+    {
+        uint64_t requested;
+        uint64_t loaded;
+        uint64_t failed;
+        uint64_t bytesRead;
+    };
+
+    // ファイルの読み込み、変換、リソースの作成を、依存関係のある JobSystem のジョブとして実行します。
+    // 多数のアセットを同時に読み込めます。完了は描画スレッドから毎フレーム Poll で受け取ります。
+    class AssetLoader
+    {
+    public:
+        explicit AssetLoader(JobSystem &jobs = JobSystem::GetDefault());
+        // 読み込み中のジョブの完了を待ちます。Poll されていない completed は呼びません。
+        ~AssetLoader();
+        AssetLoader(const AssetLoader &) = delete;
+        AssetLoader &operator=(const AssetLoader &) = delete;
+
+        // すぐに戻ります。読み込みはワーカーで進みます。
+        std::shared_ptr<const Asset> Load(AssetRequest request);
+
+        // 前回から完了したアセットの completed を、完了した順に呼びます。呼んだ数を返します。
+        size_t Poll();
+
+        // 読み込み中 (完了して Poll されていないものを含む) の数。
+        size_t GetPendingCount() const;
+        // すべての読み込みが完了するまで待ちます (Poll はしません)。ツールや起動時の一括読み込み用です。
+        void WaitAll();
+
+        AssetLoaderStats GetStats() const;
+
+    private:
+        struct Pending;
+
+        void Finish(const std::shared_ptr<Pending> &pending);
+
+        JobSystem &m_jobs;
+        mutable std::mutex m_mutex;
+        // ジョブが終わっていない数。0 になったら m_idle で知らせます。
+        size_t m_running;
+        std::condition_variable m_idle;
+        std::vector<std::shared_ptr<Pending>> m_completed;
+        std::vector<std::shared_ptr<Pending>> m_polling;
+        size_t m_pendingCount;
+        AssetLoaderStats m_stats;
+    };
+}
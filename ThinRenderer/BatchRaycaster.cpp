@@ -0,0 +1,143 @@
+﻿#include "pch.h"
+#include "BatchRaycaster.h"
+#include "MeshBvh.h"
+#include "SceneBvh.h"
+#include "ThreadPool.h"
+#include "CpuFeatures.h"
+#include "Profiler.h"
+
+
+namespace thinr
+{
+    namespace
+    {
+        // 1 チャンクで判定するレイの数 (RayPacket::Width の倍数)。
+        const size_t RayGrain = 1024;
+
+        RayKernel ResolveRayKernel(RayKernel kernel)
+        {
+#if defined(_M_IX86) || defined(_M_X64) || defined(__i386__) || defined(__x86_64__)
+            bool packets = GetCpuFeatures().sse2;
+#else
+            bool packets = false;
+#endif
+            if (kernel == RayKernel::Scalar || !packets)
+            {
+                return RayKernel::Scalar;
+            }
+            return RayKernel::SSE2;
+        }
+
+        template<typename BVH>
+        uint64_t RaycastScalar(const BVH &bvh, const Ray *rays, RayHit *hits, size_t begin, size_t end)
+        {
+            uint64_t hitCount = 0;
+            for (size_t i = begin; i < end; ++i)
+            {
+                if (bvh.Raycast(rays[i], hits[i]))
+                {
+                    hitCount++;
+                }
+                else
+                {
+                    hits[i] = RayHit{ rays[i].maxDistance, 0.0f, 0.0f, InvalidRayHitIndex, InvalidRayHitIndex };
+                }
+            }
+            return hitCount;
+        }
+
+        template<typename BVH>
+        uint64_t RaycastPackets(const BVH &bvh, const Ray *rays, RayHit *hits, size_t begin, size_t end)
+        {
+            uint64_t hitCount = 0;
+            RayPacket packet;
+            for (size_t base = begin; base < end; base += RayPacket::Width)
+            {
+                // 端数のレーンは、どこにも当たらない無効なレイで埋めます。
+                packet.activeMask = 0;
+                for (int lane = 0; lane < RayPacket::Width; ++lane)
+                {
+                    bool active = base + lane < end;
+                    const Ray ray = active ? rays[base + lane] : Ray{ Float3{ 0.0f, 0.0f, 0.0f }, Float3{ 1.0f, 1.0f, 1.0f }, -1.0f };
+                    packet.originX[lane] = ray.origin.x;
+                    packet.originY[lane] = ray.origin.y;
+                    packet.originZ[lane] = ray.origin.z;
+                    packet.directionX[lane] = ray.direction.x;
+                    packet.directionY[lane] = ray.direction.y;
+                    packet.directionZ[lane] = ray.direction.z;
+                    packet.tMax[lane] = ray.maxDistance;
+                    packet.u[lane] = 0.0f;
+                    packet.v[lane] = 0.0f;
+                    packet.triangle[lane] = InvalidRayHitIndex;
+                    packet.instance[lane] = InvalidRayHitIndex;
+                    packet.activeMask |= active ? 1u << lane : 0u;
+                }
+
+                bvh.IntersectPacket(packet);
+
+                for (int lane = 0; lane < RayPacket::Width && base + lane < end; ++lane)
+                {
+                    hits[base + lane] = RayHit{ packet.tMax[lane], packet.u[lane], packet.v[lane], packet.triangle[lane], packet.instance[lane] };
+                    if (packet.triangle[lane] != InvalidRayHitIndex)
+                    {
+                        hitCount++;
+                    }
+                }
+            }
+            return hitCount;
+        }
+    }
+
+    BatchRaycaster::BatchRaycaster(ThreadPool *pool)
+        : m_pool(pool ? pool : &ThreadPool::GetDefault()),
+        m_kernel(ResolveRayKernel(RayKernel::Auto)),
+        m_stats()
+    {
+    }
+
+    void BatchRaycaster::SetKernel(RayKernel kernel)
+    {
+        m_kernel = ResolveRayKernel(kernel);
+    }
+
+    void BatchRaycaster::Raycast(const MeshBvh &mesh, const Ray *rays, RayHit *hits, size_t count)
+    {
+        RaycastImpl(mesh, rays, hits, count);
+    }
+
+    void BatchRaycaster::Raycast(const SceneBvh &scene, const Ray *rays, RayHit *hits, size_t count)
+    {
+        RaycastImpl(scene, rays, hits, count);
+    }
+
+    template<typename BVH>
+    void BatchRaycaster::RaycastImpl(const BVH &bvh, const Ray *rays, RayHit *hits, size_t count)
+    {
+        THINR_PROFILE_ZONE("BatchRaycaster::Raycast");
+        if (count == 0)
+        {
+            return;
+        }
+
+        size_t chunkCount = (count + RayGrain - 1) / RayGrain;
+        m_chunkHits.assign(chunkCount, 0);
+        auto &chunkHits = m_chunkHits;
+        bool packets = m_kernel == RayKernel::SSE2;
+        m_pool->ParallelFor(count, RayGrain, [&](size_t begin, size_t end)
+        {
+            chunkHits[begin / RayGrain] = packets
+                ? RaycastPackets(bvh, rays, hits, begin, end)
+                : RaycastScalar(bvh, rays, hits, begin, end);
+        });
+
+        for (uint64_t chunk : m_chunkHits)
+        {
+            m_stats.hits += chunk;
+        }
+        m_stats.rays += count;
+        if (packets)
+        {
+            m_stats.packets += (count + RayPacket::Width - 1) / RayPacket::Width;
+        }
+    }
+}
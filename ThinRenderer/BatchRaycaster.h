@@ -0,0 +1,59 @@
+﻿#pragma once
+#include "Bvh.h"
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+
+
+namespace thinr
+{
+    class ThreadPool;
+    class MeshBvh;
+    class SceneBvh;
+
+    enum class RayKernel
+    {
+        // CPUID で使える中で最速のものを選びます。
+        Auto,
+        // 1 本ずつ Raycast します。
+        Scalar,
+        // 4 本のパケットで走査します (SSE2)。
+        SSE2,
+    };
+
+    struct RayBatchStats
+    {
+        uint64_t rays;
+        uint64_t hits;
+        uint64_t packets;
+    };
+
+    // 多数のレイをまとめて判定します。連続する 4 本をパケットにして走査し、大きなバッチはスレッドに分散します。
+    // 方向の近いレイを隣り合わせに並べると (画面のタイル順など)、パケットの走査が効率よくなります。
+    // 起点も方向もばらばらなレイでは、パケットが木の広い範囲を辿るので RayKernel::Scalar の方が速くなります。
+    class BatchRaycaster
+    {
+    public:
+        // pool が nullptr の場合は ThreadPool::GetDefault を使用します。
+        explicit BatchRaycaster(ThreadPool *pool = nullptr);
+
+        void SetKernel(RayKernel kernel);
+        RayKernel GetKernel() const { return m_kernel; }
+
+        // hits[i] に rays[i] の最も近い交点を書きます。当たらなければ triangle が InvalidRayHitIndex、t が maxDistance です。
+        void Raycast(const MeshBvh &mesh, const Ray *rays, RayHit *hits, size_t count);
+        void Raycast(const SceneBvh &scene, const Ray *rays, RayHit *hits, size_t count);
+
+        const RayBatchStats &GetStats() const { return m_stats; }
+        void ResetStats() { m_stats = RayBatchStats(); }
+
+    private:
+        template<typename BVH>
+        void RaycastImpl(const BVH &bvh, const Ray *rays, RayHit *hits, size_t count);
+
+        ThreadPool *m_pool;
+        RayKernel m_kernel;
+        std::vector<uint64_t> m_chunkHits;
+        RayBatchStats m_stats;
+    };
+}
@@ -0,0 +1,284 @@
+﻿#include "pch.h"
+#include "Bvh.h"
+#include <algorithm>
+#include <limits>
+#include <cmath>
+
+
+namespace thinr
+{
+    namespace
+    {
+        const int SahBinCount = 16;
+        // これより深くなったら SAH をやめて中央で分割し、高さを log2(N) 以内に抑えます。
+        const int SahMaxDepth = 64;
+        // 内部ノード 1 つを辿るコストと、プリミティブ 1 つを判定するコストの比。
+        const float TraversalCost = 1.0f;
+        const float IntersectionCost = 1.0f;
+
+        float Component(const Float3 &v, int axis)
+        {
+            return axis == 0 ? v.x : axis == 1 ? v.y : v.z;
+        }
+
+        struct BuildContext
+        {
+            const Aabb *bounds;
+            std::vector<Float3> centroids;
+            uint32_t maxLeafSize;
+            std::vector<BvhNode> *nodes;
+            std::vector<uint32_t> *order;
+        };
+
+        struct SahBin
+        {
+            Aabb bounds;
+            uint32_t count;
+        };
+
+        // order[begin, end) の箱と重心の箱を求めます。
+        void ComputeRangeBounds(const BuildContext &ctx, uint32_t begin, uint32_t end, Aabb &bounds, Aabb &centroidBounds)
+        {
+            bounds = Aabb::Empty();
+            centroidBounds = Aabb::Empty();
+            const auto &order = *ctx.order;
+            for (uint32_t i = begin; i < end; ++i)
+            {
+                bounds.Grow(ctx.bounds[order[i]]);
+                centroidBounds.Grow(ctx.centroids[order[i]]);
+            }
+        }
+
+        struct SahSplit
+        {
+            int axis;
+            int bin;
+            float lo;
+            float scale;
+            float cost;
+        };
+
+        int BinIndex(const Float3 &centroid, int axis, float lo, float scale)
+        {
+            int b = static_cast<int>((Component(centroid, axis) - lo) * scale);
+            return std::min(b, SahBinCount - 1);
+        }
+
+        // 3 軸のビン境界から SAH コストが最小の分割を探します。候補が無ければ false を返します。
+        bool FindSahSplit(const BuildContext &ctx, uint32_t begin, uint32_t end, const Aabb &bounds, const Aabb &centroidBounds,
+            SahSplit &best)
+        {
+            best.cost = std::numeric_limits<float>::max();
+            bool found = false;
+            float parentArea = bounds.SurfaceArea();
+            const auto &order = *ctx.order;
+
+            for (int axis = 0; axis < 3; ++axis)
+            {
+                float lo = Component(centroidBounds.min, axis);
+                float hi = Component(centroidBounds.max, axis);
+                if (!(hi > lo))
+                {
+                    continue;
+                }
+
+                SahBin bins[SahBinCount];
+                for (auto &bin : bins)
+                {
+                    bin.bounds = Aabb::Empty();
+                    bin.count = 0;
+                }
+                float scale = SahBinCount / (hi - lo);
+                for (uint32_t i = begin; i < end; ++i)
+                {
+                    int b = BinIndex(ctx.centroids[order[i]], axis, lo, scale);
+                    bins[b].bounds.Grow(ctx.bounds[order[i]]);
+                    bins[b].count++;
+                }
+
+                // 右から累積した面積と数を求めてから、左から走査して各境界のコストを評価します。
+                float rightArea[SahBinCount];
+                uint32_t rightCount[SahBinCount];
+                Aabb right = Aabb::Empty();
+                uint32_t rightSum = 0;
+                for (int b = SahBinCount - 1; b > 0; --b)
+                {
+                    right.Grow(bins[b].bounds);
+                    rightSum += bins[b].count;
+                    rightArea[b] = right.SurfaceArea();
+                    rightCount[b] = rightSum;
+                }
+                Aabb left = Aabb::Empty();
+                uint32_t leftSum = 0;
+                for (int b = 1; b < SahBinCount; ++b)
+                {
+                    left.Grow(bins[b - 1].bounds);
+                    leftSum += bins[b - 1].count;
+                    if (leftSum == 0 || rightCount[b] == 0)
+                    {
+                        continue;
+                    }
+                    float cost = TraversalCost
+                        + IntersectionCost * (left.SurfaceArea() * leftSum + rightArea[b] * rightCount[b]) / parentArea;
+                    if (cost < best.cost)
+                    {
+                        best = SahSplit{ axis, b, lo, scale, cost };
+                        found = true;
+                    }
+                }
+            }
+            return found;
+        }
+
+        uint32_t BuildNode(BuildContext &ctx, uint32_t begin, uint32_t end, int depth)
+        {
+            auto &nodes = *ctx.nodes;
+            auto &order = *ctx.order;
+            uint32_t index = static_cast<uint32_t>(nodes.size());
+            nodes.push_back(BvhNode());
+
+            Aabb bounds;
+            Aabb centroidBounds;
+            ComputeRangeBounds(ctx, begin, end, bounds, centroidBounds);
+            nodes[index].boundsMin = bounds.min;
+            nodes[index].boundsMax = bounds.max;
+            nodes[index].offset = begin;
+            nodes[index].count = end - begin;
+
+            uint32_t count = end - begin;
+            SahSplit split;
+            bool haveSplit = depth < SahMaxDepth && count > 1 && FindSahSplit(ctx, begin, end, bounds, centroidBounds, split);
+            if (count <= ctx.maxLeafSize && (!haveSplit || split.cost >= IntersectionCost * count))
+            {
+                return index;
+            }
+
+            uint32_t mid = begin;
+            if (haveSplit)
+            {
+                const auto &centroids = ctx.centroids;
+                mid = static_cast<uint32_t>(std::partition(order.begin() + begin, order.begin() + end, [&](uint32_t prim)
+                {
+                    return BinIndex(centroids[prim], split.axis, split.lo, split.scale) < split.bin;
+                }) - order.begin());
+            }
+            if (mid == begin || mid == end)
+            {
+                // 重心がすべて同じか、深くなりすぎた場合は最長軸の中央値で半分にします。
+                float dx = centroidBounds.max.x - centroidBounds.min.x;
+                float dy = centroidBounds.max.y - centroidBounds.min.y;
+                float dz = centroidBounds.max.z - centroidBounds.min.z;
+                int axis = dx >= dy && dx >= dz ? 0 : dy >= dz ? 1 : 2;
+                mid = begin + count / 2;
+                const auto &centroids = ctx.centroids;
+                std::nth_element(order.begin() + begin, order.begin() + mid, order.begin() + end, [&](uint32_t a, uint32_t b)
+                {
+                    return Component(centroids[a], axis) < Component(centroids[b], axis);
+                });
+            }
+
+            // 左の子は直後に置かれます。右の子の番号は左の部分木を作り終えてから決まります。
+            BuildNode(ctx, begin, mid, depth + 1);
+            uint32_t right = BuildNode(ctx, mid, end, depth + 1);
+            nodes[index].offset = right;
+            nodes[index].count = 0;
+            return index;
+        }
+    }
+
+    Aabb Aabb::Empty()
+    {
+        const float inf = std::numeric_limits<float>::infinity();
+        return Aabb{ Float3{ inf, inf, inf }, Float3{ -inf, -inf, -inf } };
+    }
+
+    void Aabb::Grow(const Float3 &p)
+    {
+        min = Float3{ std::min(min.x, p.x), std::min(min.y, p.y), std::min(min.z, p.z) };
+        max = Float3{ std::max(max.x, p.x), std::max(max.y, p.y), std::max(max.z, p.z) };
+    }
+
+    void Aabb::Grow(const Aabb &box)
+    {
+        min = Float3{ std::min(min.x, box.min.x), std::min(min.y, box.min.y), std::min(min.z, box.min.z) };
+        max = Float3{ std::max(max.x, box.max.x), std::max(max.y, box.max.y), std::max(max.z, box.max.z) };
+    }
+
+    Float3 Aabb::Center() const
+    {
+        return Float3{ (min.x + max.x) * 0.5f, (min.y + max.y) * 0.5f, (min.z + max.z) * 0.5f };
+    }
+
+    float Aabb::SurfaceArea() const
+    {
+        float dx = max.x - min.x;
+        float dy = max.y - min.y;
+        float dz = max.z - min.z;
+        if (dx < 0 || dy < 0 || dz < 0)
+        {
+            return 0.0f;
+        }
+        return 2.0f * (dx * dy + dy * dz + dz * dx);
+    }
+
+    Aabb TransformAabb(const Float4x4 &m, const Aabb &box)
+    {
+        // 中心を変換し、半分の大きさは |M| で広げます (Arvo)。
+        Float3 center = TransformPoint(m, box.Center());
+        float e[3] = { (box.max.x - box.min.x) * 0.5f, (box.max.y - box.min.y) * 0.5f, (box.max.z - box.min.z) * 0.5f };
+        float r[3];
+        for (int i = 0; i < 3; ++i)
+        {
+            r[i] = std::fabs(m.m[i][0]) * e[0] + std::fabs(m.m[i][1]) * e[1] + std::fabs(m.m[i][2]) * e[2];
+        }
+        return Aabb{
+            Float3{ center.x - r[0], center.y - r[1], center.z - r[2] },
+            Float3{ center.x + r[0], center.y + r[1], center.z + r[2] } };
+    }
+
+    void BuildBvh(const Aabb *bounds, size_t count, uint32_t maxLeafSize,
+        std::vector<BvhNode> &nodes, std::vector<uint32_t> &order)
+    {
+        nodes.clear();
+        order.resize(count);
+        if (count == 0)
+        {
+            return;
+        }
+
+        BuildContext ctx;
+        ctx.bounds = bounds;
+        ctx.centroids.resize(count);
+        ctx.maxLeafSize = std::max<uint32_t>(1, maxLeafSize);
+        ctx.nodes = &nodes;
+        ctx.order = &order;
+        for (size_t i = 0; i < count; ++i)
+        {
+            order[i] = static_cast<uint32_t>(i);
+            ctx.centroids[i] = bounds[i].Center();
+        }
+
+        nodes.reserve(2 * count / ctx.maxLeafSize + 1);
+        BuildNode(ctx, 0, static_cast<uint32_t>(count), 0);
+    }
+
+    float ComputeSahCost(const std::vector<BvhNode> &nodes)
+    {
+        if (nodes.empty())
+        {
+            return 0.0f;
+        }
+        float rootArea = Aabb{ nodes[0].boundsMin, nodes[0].boundsMax }.SurfaceArea();
+        if (rootArea <= 0.0f)
+        {
+            return 0.0f;
+        }
+        float cost = 0.0f;
+        for (const auto &node : nodes)
+        {
+            float area = Aabb{ node.boundsMin, node.boundsMax }.SurfaceArea();
+            cost += area * (node.IsLeaf() ? IntersectionCost * node.count : TraversalCost);
+        }
+        return cost / rootArea;
+    }
+}
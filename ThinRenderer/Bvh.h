@@ -0,0 +1,114 @@
+﻿#pragma once
+#include "MathTypes.h"
+#include <vector>
+#include <algorithm>
+#include <cstdint>
+#include <cstddef>
+
+
+namespace thinr
+{
+    struct Aabb
+    {
+        Float3 min;
+        Float3 max;
+
+        // 何も含まない (min > max) 箱。Grow で広げて使います。
+        static Aabb Empty();
+
+        void Grow(const Float3 &p);
+        void Grow(const Aabb &box);
+        Float3 Center() const;
+        float SurfaceArea() const;
+    };
+
+    // アフィン変換した箱を囲む箱。
+    Aabb TransformAabb(const Float4x4 &m, const Aabb &box);
+
+    // 深さ優先に並べた 32 バイトのノード。内部ノードの左の子は直後のノード、右の子は offset です。
+    struct BvhNode
+    {
+        Float3 boundsMin;
+        // 内部ノードなら右の子の番号、葉なら最初のプリミティブ (並べ替え後) の番号。
+        uint32_t offset;
+        Float3 boundsMax;
+        // 葉のプリミティブ数。0 なら内部ノードです。
+        uint32_t count;
+
+        bool IsLeaf() const { return count != 0; }
+    };
+
+    static_assert(sizeof(BvhNode) == 32, "layout");
+
+    // 走査スタックの深さ。構築時にこれを超えないように木の高さを制限します。
+    const int BvhMaxStackDepth = 128;
+
+    // プリミティブの箱から SAH (binned) で BVH を作ります。
+    // order には葉の並び順でのプリミティブ番号が入り、葉の offset/count はこの配列を指します。
+    void BuildBvh(const Aabb *bounds, size_t count, uint32_t maxLeafSize,
+        std::vector<BvhNode> &nodes, std::vector<uint32_t> &order);
+
+    // ルートの表面積で正規化した SAH コスト (内部ノード 1、プリミティブ 1 として数えます)。
+    float ComputeSahCost(const std::vector<BvhNode> &nodes);
+
+    // レイが tMax までに箱を通るなら、入る t を tNear に入れて true を返します。invDirection は 1 / direction。
+    inline bool IntersectRayBox(const Float3 &origin, const Float3 &invDirection, const Float3 &boxMin, const Float3 &boxMax,
+        float tMax, float &tNear)
+    {
+        float tx0 = (boxMin.x - origin.x) * invDirection.x;
+        float tx1 = (boxMax.x - origin.x) * invDirection.x;
+        float ty0 = (boxMin.y - origin.y) * invDirection.y;
+        float ty1 = (boxMax.y - origin.y) * invDirection.y;
+        float tz0 = (boxMin.z - origin.z) * invDirection.z;
+        float tz1 = (boxMax.z - origin.z) * invDirection.z;
+        tNear = std::max(std::max(std::min(tx0, tx1), std::min(ty0, ty1)), std::max(std::min(tz0, tz1), 0.0f));
+        float tFar = std::min(std::min(std::max(tx0, tx1), std::max(ty0, ty1)), std::min(std::max(tz0, tz1), tMax));
+        return tNear <= tFar;
+    }
+
+    inline Float3 Reciprocal(const Float3 &v)
+    {
+        return Float3{ 1.0f / v.x, 1.0f / v.y, 1.0f / v.z };
+    }
+
+    // origin + t * direction (0 <= t <= maxDistance)。direction は正規化しなくても構いません。
+    struct Ray
+    {
+        Float3 origin;
+        Float3 direction;
+        float maxDistance;
+    };
+
+    const uint32_t InvalidRayHitIndex = 0xffffffffu;
+
+    // まとめて判定する 4 本のレイ (SoA)。activeMask のビット i が立っているレーンだけを判定し、
+    // 見つかった交点で tMax, u, v, triangle, instance を更新します。
+    struct alignas(16) RayPacket
+    {
+        static const int Width = 4;
+
+        float originX[Width];
+        float originY[Width];
+        float originZ[Width];
+        float directionX[Width];
+        float directionY[Width];
+        float directionZ[Width];
+        float tMax[Width];
+        float u[Width];
+        float v[Width];
+        uint32_t triangle[Width];
+        uint32_t instance[Width];
+        uint32_t activeMask;
+    };
+
+    // 交点 = (1 - u - v) * v0 + u * v1 + v * v2。triangle は元のインデックス バッファーでの三角形番号です。
+    struct RayHit
+    {
+        float t;
+        float u;
+        float v;
+        uint32_t triangle;
+        // SceneBvh のインスタンス番号。MeshBvh 単体では InvalidRayHitIndex です。
+        uint32_t instance;
+    };
+}
@@ -0,0 +1,109 @@
+﻿#include "pch.h"
+#include "CommandList.h"
+#include "ThreadPool.h"
+#include "Profiler.h"
+
+
+namespace thinr
+{
+    namespace
+    {
+        // value が state と異なるときだけ bind を呼びます。bit は CommandListState::bound のビットです。
+        template<typename BIND>
+        void BindIfChanged(uint32_t &current, uint32_t bit, uint32_t value, CommandListState &state,
+            uint64_t &binds, uint64_t &skipped, BIND bind)
+        {
+            if ((state.bound & bit) && current == value)
+            {
+                skipped++;
+                return;
+            }
+            bind(value);
+            current = value;
+            state.bound |= bit;
+            binds++;
+        }
+    }
+
+    void CommandList::Execute(IDrawSubmitter &submitter, RenderQueueStats &stats, CommandListState &state) const
+    {
+        for (const Command &command : m_commands)
+        {
+            switch (command.type)
+            {
+            case CommandBindPass:
+                BindIfChanged(state.pass, 1u << 0, command.value, state, stats.passBinds, stats.skippedBinds,
+                    [&](uint32_t v) { submitter.BindPass(v); });
+                break;
+            case CommandBindShader:
+                BindIfChanged(state.shader, 1u << 1, command.value, state, stats.shaderBinds, stats.skippedBinds,
+                    [&](uint32_t v) { submitter.BindShader(v); });
+                break;
+            case CommandBindMaterial:
+                BindIfChanged(state.material, 1u << 2, command.value, state, stats.materialBinds, stats.skippedBinds,
+                    [&](uint32_t v) { submitter.BindMaterial(v); });
+                break;
+            case CommandBindMesh:
+                BindIfChanged(state.mesh, 1u << 3, command.value, state, stats.meshBinds, stats.skippedBinds,
+                    [&](uint32_t v) { submitter.BindMesh(v); });
+                break;
+            case CommandDraw:
+                submitter.Draw(command.value);
+                stats.draws++;
+                break;
+            }
+        }
+    }
+
+    void CommandList::Execute(IDrawSubmitter &submitter) const
+    {
+        RenderQueueStats stats = RenderQueueStats();
+        CommandListState state;
+        Execute(submitter, stats, state);
+    }
+
+    ParallelCommandRecorder::ParallelCommandRecorder(ThreadPool *pool)
+        : m_pool(pool ? pool : &ThreadPool::GetDefault()), m_listCount(0), m_stats()
+    {
+    }
+
+    void ParallelCommandRecorder::Record(size_t itemCount, size_t grain,
+        const std::function<void(CommandList &, size_t, size_t)> &record)
+    {
+        THINR_PROFILE_ZONE("ParallelCommandRecorder::Record");
+
+        if (grain == 0)
+        {
+            grain = 1;
+        }
+        m_listCount = (itemCount + grain - 1) / grain;
+        if (m_lists.size() < m_listCount)
+        {
+            m_lists.resize(m_listCount);
+        }
+
+        // ParallelFor の範囲はスレッド数で変わり得るので、チャンクの番号で分けてリストとの対応を固定します。
+        m_pool->ParallelFor(m_listCount, 1, [&](size_t chunkBegin, size_t chunkEnd)
+        {
+            for (size_t chunk = chunkBegin; chunk < chunkEnd; ++chunk)
+            {
+                CommandList &list = m_lists[chunk];
+                list.Reset();
+                size_t begin = chunk * grain;
+                size_t end = begin + grain < itemCount ? begin + grain : itemCount;
+                record(list, begin, end);
+            }
+        });
+    }
+
+    void ParallelCommandRecorder::Submit(IDrawSubmitter &submitter)
+    {
+        THINR_PROFILE_ZONE("ParallelCommandRecorder::Submit");
+
+        CommandListState state;
+        for (size_t i = 0; i < m_listCount; ++i)
+        {
+            m_lists[i].Execute(submitter, m_stats, state);
+        }
+    }
+}
@@ -0,0 +1,103 @@
+﻿#pragma once
+#include "RenderQueue.h"
+#include <functional>
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+
+
+namespace thinr
+{
+    class ThreadPool;
+
+    // CommandList::Execute で発行済みのステート。
+    struct CommandListState
+    {
+        CommandListState() : bound(0), pass(0), shader(0), material(0), mesh(0) {}
+
+        // ビット i が立っていれば i 番目 (pass, shader, material, mesh の順) の値が有効です。
+        uint32_t bound;
+        uint32_t pass;
+        uint32_t shader;
+        uint32_t material;
+        uint32_t mesh;
+    };
+
+    // バックエンドに依存しない描画コマンドの列。IDrawSubmitter の呼び出しをそのまま記録するだけなので、
+    // デバイスやコンテキストに触れずにどのスレッドからでも記録できます (1 つのリストは 1 スレッドで記録してください)。
+    // RenderQueue::Submit の出力先にもできます。
+    class CommandList : public IDrawSubmitter
+    {
+    public:
+        CommandList() {}
+
+        void BindPass(uint32_t pass) override { Push(CommandBindPass, pass); }
+        void BindShader(uint32_t shader) override { Push(CommandBindShader, shader); }
+        void BindMaterial(uint32_t material) override { Push(CommandBindMaterial, material); }
+        void BindMesh(uint32_t mesh) override { Push(CommandBindMesh, mesh); }
+        void Draw(uint32_t payload) override { Push(CommandDraw, payload); }
+
+        // 記録を捨てます。確保したメモリは次のフレームで再利用します。
+        void Reset() { m_commands.clear(); }
+        size_t GetCommandCount() const { return m_commands.size(); }
+        bool IsEmpty() const { return m_commands.empty(); }
+
+        // 記録した順に submitter へ発行します。バインドは state と異なるものだけ呼び、state を更新します。
+        // 複数のリストを同じ state で続けて発行すると、リストの境目でも同じステートの再バインドを省けます。
+        // stats には発行したバインドと描画の数を加算します (skippedBinds は省いたバインドの数です)。
+        void Execute(IDrawSubmitter &submitter, RenderQueueStats &stats, CommandListState &state) const;
+        void Execute(IDrawSubmitter &submitter) const;
+
+    private:
+        enum CommandType : uint32_t
+        {
+            CommandBindPass,
+            CommandBindShader,
+            CommandBindMaterial,
+            CommandBindMesh,
+            CommandDraw,
+        };
+
+        struct Command
+        {
+            CommandType type;
+            uint32_t value;
+        };
+
+        void Push(CommandType type, uint32_t value) { m_commands.push_back(Command{ type, value }); }
+
+        std::vector<Command> m_commands;
+    };
+
+    // 描画項目をチャンクに分け、チャンクごとの CommandList にワーカー スレッドで並列に記録します。
+    // チャンクの分け方は項目数と grain だけで決まり、Submit はチャンクの順に発行するので、
+    // スレッド数や実行のタイミングによらず 1 スレッドで順に記録した場合と同じコマンド列になります。
+    class ParallelCommandRecorder
+    {
+    public:
+        // pool が nullptr の場合は ThreadPool::GetDefault を使用します。
+        explicit ParallelCommandRecorder(ThreadPool *pool = nullptr);
+
+        // [0, itemCount) を grain 個ずつのチャンクに分け、record(list, begin, end) を並列に呼びます。
+        // 各チャンクのリストは空の状態から記録するので、最初の描画の前に必要なステートをすべてバインドしてください
+        // (重複は Submit で省きます)。record が投げた例外は呼び出し元で再送出されます。
+        void Record(size_t itemCount, size_t grain,
+            const std::function<void(CommandList &, size_t, size_t)> &record);
+
+        // 記録したリストをチャンクの順に submitter へ発行します。描画スレッドから呼んでください。
+        void Submit(IDrawSubmitter &submitter);
+
+        size_t GetListCount() const { return m_listCount; }
+        const CommandList &GetList(size_t index) const { return m_lists[index]; }
+
+        const RenderQueueStats &GetStats() const { return m_stats; }
+        void ResetStats() { m_stats = RenderQueueStats(); }
+
+    private:
+        ThreadPool *m_pool;
+        // m_listCount より後ろのリストは前のフレームで使ったもので、メモリの再利用のために残しています。
+        std::vector<CommandList> m_lists;
+        size_t m_listCount;
+        RenderQueueStats m_stats;
+    };
+}
@@ -0,0 +1,57 @@
+﻿#include "pch.h"
+#include "ConstantBufferRing.h"
+#include <cstring>
+
+
+namespace thinr
+{
+    namespace
+    {
+        // D3D11.1 の定数バッファー オフセットは 16 定数 (256 バイト) 単位です。
+        const size_t ConstantAlignment = 256;
+    }
+
+    ConstantBufferRing::ConstantBufferRing(ID3D11Device3 *device, size_t capacity, uint32_t framesInFlight)
+        : m_allocator(capacity, framesInFlight, ConstantAlignment), m_mapped(false)
+    {
+        CD3D11_BUFFER_DESC desc(
+            static_cast<UINT>(capacity),
+            D3D11_BIND_CONSTANT_BUFFER,
+            D3D11_USAGE_DYNAMIC,
+            D3D11_CPU_ACCESS_WRITE
+        );
+        ThrowIfFailed(
+            device->CreateBuffer(&desc, nullptr, &m_buffer)
+        );
+    }
+
+    bool ConstantBufferRing::IsSupported(ID3D11Device3 *device)
+    {
+        D3D11_FEATURE_DATA_D3D11_OPTIONS options = {};
+        if (FAILED(device->CheckFeatureSupport(D3D11_FEATURE_D3D11_OPTIONS, &options, sizeof(options))))
+        {
+            return false;
+        }
+        return options.ConstantBufferOffsetting && options.MapNoOverwriteOnDynamicConstantBuffer;
+    }
+
+    ConstantBufferAllocation ConstantBufferRing::Upload(ID3D11DeviceContext3 *context, const void *data, size_t size)
+    {
+        size_t offset = m_allocator.Allocate(size);
+
+        // 最初の Map だけは DISCARD が必要です。以降はアロケーターが GPU 使用中の領域を避けるので NO_OVERWRITE で書けます。
+        D3D11_MAPPED_SUBRESOURCE mapped;
+        ThrowIfFailed(
+            context->Map(m_buffer.Get(), 0, m_mapped ? D3D11_MAP_WRITE_NO_OVERWRITE : D3D11_MAP_WRITE_DISCARD, 0, &mapped)
+        );
+        m_mapped = true;
+        memcpy(static_cast<uint8_t *>(mapped.pData) + offset, data, size);
+        context->Unmap(m_buffer.Get(), 0);
+
+        ConstantBufferAllocation allocation;
+        allocation.buffer = m_buffer.Get();
+        allocation.firstConstant = static_cast<UINT>(offset / 16);
+        allocation.numConstants = static_cast<UINT>((size + ConstantAlignment - 1) / ConstantAlignment * 16);
+        return allocation;
+    }
+}
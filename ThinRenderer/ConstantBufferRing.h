@@ -0,0 +1,40 @@
+﻿#pragma once
+#include "pch.h"
+#include "FrameRingAllocator.h"
+
+
+namespace thinr
+{
+    // VSSetConstantBuffers1 などにそのまま渡せる割り当て結果。
+    struct ConstantBufferAllocation
+    {
+        ID3D11Buffer *buffer;
+        // 16 バイト (定数 1 個) 単位のオフセットとサイズ。
+        UINT firstConstant;
+        UINT numConstants;
+    };
+
+    // 1 つの大きな動的定数バッファーを FrameRingAllocator で切り分けて、描画ごとの定数を書き込みます。
+    // D3D11_MAP_WRITE_NO_OVERWRITE で書くので、描画ごとに UpdateSubresource で CPU と GPU が同期することはありません。
+    // 定数バッファーのオフセット指定 (D3D11.1) が必要です。IsSupported で確認してください。
+    class ConstantBufferRing
+    {
+    public:
+        ConstantBufferRing(ID3D11Device3 *device, size_t capacity, uint32_t framesInFlight);
+
+        static bool IsSupported(ID3D11Device3 *device);
+
+        // フレームの先頭で 1 回呼び出します。
+        void BeginFrame() { m_allocator.BeginFrame(); }
+
+        // data を書き込んだ領域を返します。空きが無ければ std::runtime_error を送出します。
+        ConstantBufferAllocation Upload(ID3D11DeviceContext3 *context, const void *data, size_t size);
+
+        const FrameRingStats &GetStats() const { return m_allocator.GetStats(); }
+
+    private:
+        Microsoft::WRL::ComPtr<ID3D11Buffer> m_buffer;
+        FrameRingAllocator m_allocator;
+        bool m_mapped;
+    };
+}
@@ -0,0 +1,83 @@
+﻿#include "pch.h"
+#include "CpuFeatures.h"
+
+#if defined(_M_IX86) || defined(_M_X64) || defined(__i386__) || defined(__x86_64__)
+#define THINR_X86 1
+#if defined(_MSC_VER)
+#include <intrin.h>
+#else
+#include <cpuid.h>
+#endif
+#endif
+
+
+namespace thinr
+{
+    namespace
+    {
+#if THINR_X86
+        void CpuId(int leaf, int subLeaf, int regs[4])
+        {
+#if defined(_MSC_VER)
+            __cpuidex(regs, leaf, subLeaf);
+#else
+            unsigned a, b, c, d;
+            __cpuid_count(leaf, subLeaf, a, b, c, d);
+            regs[0] = static_cast<int>(a);
+            regs[1] = static_cast<int>(b);
+            regs[2] = static_cast<int>(c);
+            regs[3] = static_cast<int>(d);
+#endif
+        }
+
+        // OS が YMM レジスタを保存するか (XCR0)。
+        unsigned long long XGetBv()
+        {
+#if defined(_MSC_VER)
+            return _xgetbv(0);
+#else
+            unsigned a, d;
+            __asm__ volatile("xgetbv" : "=a"(a), "=d"(d) : "c"(0));
+            return (static_cast<unsigned long long>(d) << 32) | a;
+#endif
+        }
+#endif
+
+        CpuFeatures DetectCpuFeatures()
+        {
+            CpuFeatures features = {};
+#if THINR_X86
+            int regs[4];
+            CpuId(0, 0, regs);
+            int maxLeaf = regs[0];
+            if (maxLeaf < 1)
+            {
+                return features;
+            }
+
+            CpuId(1, 0, regs);
+            features.sse2 = (regs[3] & (1 << 26)) != 0;
+            features.sse41 = (regs[2] & (1 << 19)) != 0;
+            bool osxsave = (regs[2] & (1 << 27)) != 0;
+            bool avx = (regs[2] & (1 << 28)) != 0;
+            bool fma = (regs[2] & (1 << 12)) != 0;
+            bool ymmEnabled = osxsave && (XGetBv() & 0x6) == 0x6;
+            features.avx = avx && ymmEnabled;
+            features.fma = fma && features.avx;
+
+            if (maxLeaf >= 7)
+            {
+                CpuId(7, 0, regs);
+                features.avx2 = features.avx && (regs[1] & (1 << 5)) != 0;
+            }
+#endif
+            return features;
+        }
+    }
+
+    const CpuFeatures &GetCpuFeatures()
+    {
+        static const CpuFeatures s_features = DetectCpuFeatures();
+        return s_features;
+    }
+}
@@ -0,0 +1,18 @@
+﻿#pragma once
+
+
+namespace thinr
+{
+    // 実行中の CPU が対応する命令セット (CPUID で判定)。
+    struct CpuFeatures
+    {
+        bool sse2;
+        bool sse41;
+        bool avx;
+        bool avx2;
+        bool fma;
+    };
+
+    // 初回呼び出し時に判定し、以後はキャッシュした値を返します。
+    const CpuFeatures &GetCpuFeatures();
+}
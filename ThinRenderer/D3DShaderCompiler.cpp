@@ -0,0 +1,65 @@
+﻿#include "pch.h"
+#include "D3DShaderCompiler.h"
+#include <d3dcompiler.h>
+#include <string>
+
+
+namespace thinr
+{
+    D3DShaderCompiler::D3DShaderCompiler(UINT flags)
+        : m_flags(flags)
+    {
+    }
+
+    UINT D3DShaderCompiler::DefaultFlags()
+    {
+#if defined(_DEBUG)
+        return D3DCOMPILE_DEBUG | D3DCOMPILE_SKIP_OPTIMIZATION | D3DCOMPILE_ENABLE_STRICTNESS;
+#else
+        return D3DCOMPILE_OPTIMIZATION_LEVEL3 | D3DCOMPILE_ENABLE_STRICTNESS;
+#endif
+    }
+
+    std::vector<uint8_t> D3DShaderCompiler::Compile(const ShaderCompileRequest &request)
+    {
+        // D3D_SHADER_MACRO の配列は { nullptr, nullptr } で終わります。
+        std::vector<D3D_SHADER_MACRO> macros;
+        macros.reserve(request.defines.size() + 1);
+        for (const auto &define : request.defines)
+        {
+            macros.push_back(D3D_SHADER_MACRO{ define.name.c_str(), define.value.c_str() });
+        }
+        macros.push_back(D3D_SHADER_MACRO{ nullptr, nullptr });
+
+        Microsoft::WRL::ComPtr<ID3DBlob> code;
+        Microsoft::WRL::ComPtr<ID3DBlob> errors;
+        HRESULT hr = D3DCompile(
+            request.source.data(),
+            request.source.size(),
+            request.sourceName.empty() ? nullptr : request.sourceName.c_str(),
+            macros.data(),
+            nullptr,
+            request.entryPoint.c_str(),
+            request.target.c_str(),
+            m_flags,
+            0,
+            &code,
+            &errors
+            );
+        if (FAILED(hr))
+        {
+            std::string message = errors
+                ? std::string(static_cast<const char *>(errors->GetBufferPointer()), errors->GetBufferSize())
+                : "D3DCompile failed (hr = " + std::to_string(static_cast<long>(hr)) + ")";
+            throw ShaderCompileError(message);
+        }
+
+        const uint8_t *bytes = static_cast<const uint8_t *>(code->GetBufferPointer());
+        return std::vector<uint8_t>(bytes, bytes + code->GetBufferSize());
+    }
+
+    std::string D3DShaderCompiler::GetVersion() const
+    {
+        return "d3dcompiler_" + std::to_string(D3D_COMPILER_VERSION) + " flags=" + std::to_string(m_flags);
+    }
+}
@@ -0,0 +1,23 @@
+﻿#pragma once
+#include "pch.h"
+#include "ShaderCompiler.h"
+
+
+namespace thinr
+{
+    // D3DCompile (d3dcompiler_47) でコンパイルします。#include はサポートしません。
+    class D3DShaderCompiler : public IShaderCompiler
+    {
+    public:
+        // flags は D3DCOMPILE_* の組み合わせ。キャッシュのキーに含まれます。
+        explicit D3DShaderCompiler(UINT flags = D3DShaderCompiler::DefaultFlags());
+
+        static UINT DefaultFlags();
+
+        virtual std::vector<uint8_t> Compile(const ShaderCompileRequest &request);
+        virtual std::string GetVersion() const;
+
+    private:
+        UINT m_flags;
+    };
+}
@@ -1,5 +1,6 @@
 ﻿#include "pch.h"
 #include "DeviceManager.h"
+#include "Profiler.h"
 
 
 using namespace Microsoft::WRL;
@@ -7,8 +8,9 @@ using namespace Microsoft::WRL;
 
 namespace thinr
 {
-    DeviceManager::DeviceManager()
+    DeviceManager::DeviceManager(DeviceBackend backend)
         :
+        m_backend(backend),
         m_screenViewport(),
         m_d3dFeatureLevel(D3D_FEATURE_LEVEL_9_1),
         m_dpi(-1.0f)
@@ -51,8 +53,18 @@ namespace thinr
             )
         );
 
-        ////
+        if (m_backend == DeviceBackend::Software)
+        {
+            // GPU の無い環境用。D3D11/D2D デバイスは作らず、描画は SoftwareRasterizer で行います。
+            m_softwareRasterizer = std::make_shared<SoftwareRasterizer>();
+            return;
+        }
+
+        CreateD3DDevice();
+    }
 
+    void DeviceManager::CreateD3DDevice()
+    {
         //このフラグは、カラー チャネルの順序が API の既定値とは異なるサーフェスのサポートを追加します。
         // これは、Direct2D との互換性を保持するために必要です。
         UINT creationFlags = D3D11_CREATE_DEVICE_BGRA_SUPPORT;
@@ -129,6 +141,12 @@ namespace thinr
             context.As(&m_d3dContext)
         );
 
+        // 1 MB をスワップ チェーンの最大遅延 (既定 3 フレーム) に合わせて使い回します。
+        if (ConstantBufferRing::IsSupported(m_d3dDevice.Get()))
+        {
+            m_constantBufferRing.reset(new ConstantBufferRing(m_d3dDevice.Get(), 1024 * 1024, 3));
+        }
+
         // Direct2D デバイス オブジェクトと、対応するコンテキストを作成します。
         ComPtr<IDXGIDevice3> dxgiDevice;
         ThrowIfFailed(
@@ -154,6 +172,14 @@ namespace thinr
 
     void DeviceManager::ClearContext()
     {
+        THINR_PROFILE_FUNCTION();
+
+        if (m_backend == DeviceBackend::Software)
+        {
+            m_softwareRasterizer->Flush();
+            return;
+        }
+
         // 前のウィンドウ サイズに固有のコンテキストをクリアします。
         ID3D11RenderTargetView* nullViews[] = { nullptr };
         m_d3dContext->OMSetRenderTargets(ARRAYSIZE(nullViews), nullViews, nullptr);
@@ -166,6 +192,13 @@ namespace thinr
 
     void DeviceManager::SetBackbuffer(const Microsoft::WRL::ComPtr<ID3D11Texture2D1> &backBuffer)
     {
+        THINR_PROFILE_FUNCTION();
+
+        if (m_backend == DeviceBackend::Software)
+        {
+            throw std::runtime_error("SetBackbuffer: not available with DeviceBackend::Software");
+        }
+
         ThrowIfFailed(
             m_d3dDevice->CreateRenderTargetView1(
                 backBuffer.Get(),
@@ -250,8 +283,42 @@ namespace thinr
         m_d2dContext->SetTextAntialiasMode(D2D1_TEXT_ANTIALIAS_MODE_GRAYSCALE);
     }
 
+    void DeviceManager::SetOffscreenTarget(const ImageView &pixels)
+    {
+        if (m_backend != DeviceBackend::Software)
+        {
+            // D3D11 ではステージング テクスチャー経由の読み出しになり、コピーを避けられません。
+            throw std::runtime_error("SetOffscreenTarget: requires DeviceBackend::Software");
+        }
+        auto target = std::make_shared<RenderTarget>(pixels);
+        m_softwareRasterizer->SetRenderTarget(target.get());
+        m_offscreenTarget = target;
+        m_logicalSize = D2D1::SizeF(static_cast<float>(pixels.width), static_cast<float>(pixels.height));
+        m_screenViewport = CD3D11_VIEWPORT(0.0f, 0.0f, static_cast<float>(pixels.width), static_cast<float>(pixels.height));
+    }
+
+    void DeviceManager::SetOffscreenTarget(uint32_t width, uint32_t height, PixelFormat format)
+    {
+        if (m_backend != DeviceBackend::Software)
+        {
+            throw std::runtime_error("SetOffscreenTarget: requires DeviceBackend::Software");
+        }
+        auto target = std::make_shared<RenderTarget>(width, height, format);
+        m_softwareRasterizer->SetRenderTarget(target.get());
+        m_offscreenTarget = target;
+        m_logicalSize = D2D1::SizeF(static_cast<float>(width), static_cast<float>(height));
+        m_screenViewport = CD3D11_VIEWPORT(0.0f, 0.0f, static_cast<float>(width), static_cast<float>(height));
+    }
+
     void DeviceManager::DiscardView()
     {
+        THINR_PROFILE_FUNCTION();
+
+        if (m_backend == DeviceBackend::Software)
+        {
+            return;
+        }
+
         // レンダリング ターゲットのコンテンツを破棄します。
         //この操作は、既存のコンテンツ全体が上書きされる場合のみ有効です。
         // dirty rect または scroll rect を使用する場合は、この呼び出しを削除する必要があります。
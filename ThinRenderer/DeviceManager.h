@@ -1,20 +1,43 @@
 ﻿#pragma once
 #include "pch.h"
 #include "DirectXHelper.h"
+#include "SoftwareRasterizer.h"
+#include "ConstantBufferRing.h"
 
 
 namespace thinr
 {
+    // DeviceManager が描画に使うバックエンド。
+    enum class DeviceBackend
+    {
+        // D3D11 ハードウェア デバイス。作成できなければ WARP にフォールバックします。
+        Direct3D11,
+        // GPU を使わない SoftwareRasterizer。D3D11/D2D デバイスは作成しません。
+        Software,
+    };
+
     // すべての DirectX デバイス リソースを制御します。
     class DeviceManager
     {
     public:
-        DeviceManager();
+        explicit DeviceManager(DeviceBackend backend = DeviceBackend::Direct3D11);
         ~DeviceManager();
         void ClearContext();
         void SetBackbuffer(const Microsoft::WRL::ComPtr<ID3D11Texture2D1> &backbuffer);
         void DiscardView();
 
+        DeviceBackend GetBackend() const { return m_backend; }
+
+        // DeviceBackend::Software の場合のみ有効です。
+        const std::shared_ptr<SoftwareRasterizer> &GetSoftwareRasterizer() const { return m_softwareRasterizer; }
+
+        // スワップ チェーンの代わりにメモリ上のバッファーへ描画します (DeviceBackend::Software のみ)。
+        // 呼び出し元のバッファーに直接書き込むので、描画結果の読み出しにコピーは発生しません。
+        void SetOffscreenTarget(const ImageView &pixels);
+        // バッファーを DeviceManager 側で確保する版。結果は GetOffscreenTarget()->GetColorView() で読みます。
+        void SetOffscreenTarget(uint32_t width, uint32_t height, PixelFormat format);
+        const std::shared_ptr<RenderTarget> &GetOffscreenTarget() const { return m_offscreenTarget; }
+
         // D3D アクセサー。
         Microsoft::WRL::ComPtr<ID3D11Device3>				GetD3DDevice() const { return m_d3dDevice; }
         ID3D11DeviceContext3*		GetD3DDeviceContext() const { return m_d3dContext.Get(); }
@@ -23,6 +46,9 @@ namespace thinr
         ID3D11DepthStencilView*		GetDepthStencilView() const { return m_d3dDepthStencilView.Get(); }
         D3D11_VIEWPORT				GetScreenViewport() const { return m_screenViewport; }
 
+        // 描画ごとの定数を書き込む共有リング。定数バッファーのオフセット指定に未対応のデバイスでは nullptr です。
+        ConstantBufferRing*			GetConstantBufferRing() const { return m_constantBufferRing.get(); }
+
         // D2D アクセサー。
         ID2D1Factory3*				GetD2DFactory() const { return m_d2dFactory.Get(); }
         ID2D1Device2*				GetD2DDevice() const { return m_d2dDevice.Get(); }
@@ -42,12 +68,21 @@ namespace thinr
         float GetDpi()const { return m_dpi; }
         void SetDpi(float dpi) {
             m_dpi = dpi;
-            m_d2dContext->SetDpi(m_dpi, m_dpi);
+            if (m_d2dContext)
+            {
+                m_d2dContext->SetDpi(m_dpi, m_dpi);
+            }
         }
         void SetLogicalSize(const D2D1_SIZE_F &size) { m_logicalSize = size; }
         D2D1_SIZE_F GetLogicalSize()const { return m_logicalSize; }
 
     private:
+        void CreateD3DDevice();
+
+        DeviceBackend                                   m_backend;
+        std::shared_ptr<SoftwareRasterizer>             m_softwareRasterizer;
+        std::shared_ptr<RenderTarget>                   m_offscreenTarget;
+
         Microsoft::WRL::ComPtr<ID3D11Device3>			m_d3dDevice;
         Microsoft::WRL::ComPtr<ID3D11DeviceContext3>	m_d3dContext;
 
@@ -55,6 +90,7 @@ namespace thinr
         Microsoft::WRL::ComPtr<ID3D11RenderTargetView1>	m_d3dRenderTargetView;
         Microsoft::WRL::ComPtr<ID3D11DepthStencilView>	m_d3dDepthStencilView;
         D3D11_VIEWPORT									m_screenViewport;
+        std::unique_ptr<ConstantBufferRing>				m_constantBufferRing;
 
         // Direct2D 描画コンポーネント。
         Microsoft::WRL::ComPtr<ID2D1Factory3>		m_d2dFactory;
@@ -17,27 +17,9 @@ namespace thinr
 		}
 	}
 
-#if 0
-	// バイナリ ファイルから非同期に読み取る関数。
-	inline Concurrency::task<std::vector<byte>> ReadDataAsync(const std::wstring& filename)
-	{
-		using namespace Windows::Storage;
-		using namespace Concurrency;
-
-		auto folder = Windows::ApplicationModel::Package::Current->InstalledLocation;
-
-		return create_task(folder->GetFileAsync(Platform::StringReference(filename.c_str()))).then([] (StorageFile^ file) 
-		{
-			return FileIO::ReadBufferAsync(file);
-		}).then([] (Streams::IBuffer^ fileBuffer) -> std::vector<byte> 
-		{
-			std::vector<byte> returnBuffer;
-			returnBuffer.resize(fileBuffer->Length);
-			Streams::DataReader::FromBuffer(fileBuffer)->ReadBytes(Platform::ArrayReference<byte>(returnBuffer.data(), fileBuffer->Length));
-			return returnBuffer;
-		});
-	}
+	// ファイルの非同期読み込みは AssetLoader を使います。
 
+#if 0
 	// デバイスに依存しないピクセル単位 (DIP) の長さを物理的なピクセルの長さに変換します。
 	inline float ConvertDipsToPixels(float dips, float dpi)
 	{
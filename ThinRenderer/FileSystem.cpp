@@ -0,0 +1,152 @@
+﻿#include "pch.h"
+#include "FileSystem.h"
+#include <cstdio>
+#ifndef _WIN32
+#include <sys/stat.h>
+#endif
+
+
+namespace thinr
+{
+    namespace
+    {
+        size_t FindLastSeparator(const std::string &path)
+        {
+            return path.find_last_of("/\\");
+        }
+
+        template <typename Container>
+        bool ReadWholeFileInto(const std::string &path, Container &contents)
+        {
+            std::ifstream file;
+            OpenInputFile(file, path);
+            if (!file)
+            {
+                return false;
+            }
+            file.seekg(0, std::ios::end);
+            std::streamoff size = file.tellg();
+            file.seekg(0, std::ios::beg);
+            if (size < 0)
+            {
+                return false;
+            }
+            contents.resize(static_cast<size_t>(size));
+            if (size > 0)
+            {
+                file.read(reinterpret_cast<char *>(&contents[0]), size);
+            }
+            // 読んでいる間に短くなった場合は読めた分だけにします。
+            contents.resize(static_cast<size_t>(file.gcount()));
+            return true;
+        }
+    }
+
+    void OpenInputFile(std::ifstream &file, const std::string &path)
+    {
+#ifdef _WIN32
+        file.open(ToWidePath(path), std::ios::binary);
+#else
+        file.open(path, std::ios::binary);
+#endif
+    }
+
+    void OpenOutputFile(std::ofstream &file, const std::string &path)
+    {
+#ifdef _WIN32
+        file.open(ToWidePath(path), std::ios::binary | std::ios::trunc);
+#else
+        file.open(path, std::ios::binary | std::ios::trunc);
+#endif
+    }
+
+    bool ReadWholeFile(const std::string &path, std::string &contents)
+    {
+        return ReadWholeFileInto(path, contents);
+    }
+
+    bool ReadWholeFile(const std::string &path, std::vector<uint8_t> &contents)
+    {
+        return ReadWholeFileInto(path, contents);
+    }
+
+    bool RemoveFile(const std::string &path)
+    {
+#ifdef _WIN32
+        return DeleteFileW(ToWidePath(path).c_str()) != 0;
+#else
+        return std::remove(path.c_str()) == 0;
+#endif
+    }
+
+    bool ReplaceExistingFile(const std::string &from, const std::string &to)
+    {
+#ifdef _WIN32
+        return MoveFileExW(ToWidePath(from).c_str(), ToWidePath(to).c_str(), MOVEFILE_REPLACE_EXISTING) != 0;
+#else
+        return std::rename(from.c_str(), to.c_str()) == 0;
+#endif
+    }
+
+    void MakeDirectory(const std::string &path)
+    {
+#ifdef _WIN32
+        CreateDirectoryW(ToWidePath(path).c_str(), nullptr);
+#else
+        mkdir(path.c_str(), 0755);
+#endif
+    }
+
+    FileStamp GetFileStamp(const std::string &path)
+    {
+        FileStamp stamp = {};
+#ifdef _WIN32
+        WIN32_FILE_ATTRIBUTE_DATA data;
+        if (GetFileAttributesExW(ToWidePath(path).c_str(), GetFileExInfoStandard, &data))
+        {
+            stamp.exists = true;
+            stamp.size = (static_cast<uint64_t>(data.nFileSizeHigh) << 32) | data.nFileSizeLow;
+            stamp.modifiedTime = (static_cast<uint64_t>(data.ftLastWriteTime.dwHighDateTime) << 32) | data.ftLastWriteTime.dwLowDateTime;
+        }
+#else
+        struct stat status;
+        if (stat(path.c_str(), &status) == 0)
+        {
+            stamp.exists = true;
+            stamp.size = static_cast<uint64_t>(status.st_size);
+            stamp.modifiedTime = static_cast<uint64_t>(status.st_mtim.tv_sec) * 1000000000ull + status.st_mtim.tv_nsec;
+        }
+#endif
+        return stamp;
+    }
+
+#ifdef _WIN32
+    std::wstring ToWidePath(const std::string &path)
+    {
+        if (path.empty())
+        {
+            return std::wstring();
+        }
+        int length = MultiByteToWideChar(CP_UTF8, 0, path.data(), static_cast<int>(path.size()), nullptr, 0);
+        std::wstring wide(length, L'\0');
+        MultiByteToWideChar(CP_UTF8, 0, path.data(), static_cast<int>(path.size()), &wide[0], length);
+        return wide;
+    }
+#endif
+
+    std::string GetDirectoryName(const std::string &path)
+    {
+        size_t separator = FindLastSeparator(path);
+        if (separator == std::string::npos)
+        {
+            return ".";
+        }
+        return separator == 0 ? path.substr(0, 1) : path.substr(0, separator);
+    }
+
+    std::string GetFileName(const std::string &path)
+    {
+        size_t separator = FindLastSeparator(path);
+        return separator == std::string::npos ? path : path.substr(separator + 1);
+    }
+}
@@ -0,0 +1,51 @@
+﻿#pragma once
+#include <fstream>
+#include <string>
+#include <vector>
+#include <cstdint>
+
+
+namespace thinr
+{
+    // パスはすべて UTF-8 です。Windows ではワイド文字のパスに変換して API を呼び出します。
+
+    // 更新の検出に使うファイルの状態。
+    struct FileStamp
+    {
+        bool exists;
+        uint64_t size;
+        // OS ごとの単位の更新時刻。比較にだけ使います。
+        uint64_t modifiedTime;
+
+        bool operator==(const FileStamp &other) const
+        {
+            return exists == other.exists && size == other.size && modifiedTime == other.modifiedTime;
+        }
+        bool operator!=(const FileStamp &other) const { return !(*this == other); }
+    };
+
+    // バイナリ モードで開きます。
+    void OpenInputFile(std::ifstream &file, const std::string &path);
+    void OpenOutputFile(std::ofstream &file, const std::string &path);
+
+    // ファイル全体を読み込みます。開けない場合は false を返します。
+    bool ReadWholeFile(const std::string &path, std::string &contents);
+    bool ReadWholeFile(const std::string &path, std::vector<uint8_t> &contents);
+
+    bool RemoveFile(const std::string &path);
+    // from で to を置き換えます。書き込み途中で終了しても to が壊れないよう、一時ファイルからの置き換えに使います。
+    bool ReplaceExistingFile(const std::string &from, const std::string &to);
+    // 既にある場合は何もしません。親ディレクトリは作成しません。
+    void MakeDirectory(const std::string &path);
+
+    FileStamp GetFileStamp(const std::string &path);
+
+#ifdef _WIN32
+    // Win32 API に渡すワイド文字のパス。
+    std::wstring ToWidePath(const std::string &path);
+#endif
+
+    // 最後の '/' か '\' で分けた前と後ろ。区切りが無い場合、ディレクトリは "." です。
+    std::string GetDirectoryName(const std::string &path);
+    std::string GetFileName(const std::string &path);
+}
@@ -0,0 +1,227 @@
+﻿#include "pch.h"
+#include "FileWatcher.h"
+#include <algorithm>
+#include <stdexcept>
+#ifdef __linux__
+#include <sys/inotify.h>
+#include <sys/eventfd.h>
+#include <poll.h>
+#include <unistd.h>
+#endif
+
+
+namespace thinr
+{
+    FileWatcher::FileWatcher(const Callback &callback, uint32_t settleMilliseconds, uint32_t pollMilliseconds)
+        : m_callback(callback), m_settle(settleMilliseconds), m_poll(pollMilliseconds), m_quit(false),
+        m_notifyFd(-1), m_stopFd(-1)
+    {
+        if (!callback)
+        {
+            throw std::invalid_argument("FileWatcher: null callback");
+        }
+        if (pollMilliseconds == 0)
+        {
+            throw std::invalid_argument("FileWatcher: pollMilliseconds must be positive");
+        }
+#ifdef __linux__
+        // inotify が使えない (上限に達したなど) 場合はポーリングにします。
+        m_notifyFd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+        if (m_notifyFd >= 0)
+        {
+            m_stopFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+            if (m_stopFd < 0)
+            {
+                close(m_notifyFd);
+                m_notifyFd = -1;
+            }
+        }
+#endif
+        m_thread = std::thread([this]() { ThreadLoop(); });
+    }
+
+    FileWatcher::~FileWatcher()
+    {
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_quit = true;
+        }
+        m_wake.notify_all();
+#ifdef __linux__
+        if (m_stopFd >= 0)
+        {
+            uint64_t one = 1;
+            ssize_t written = write(m_stopFd, &one, sizeof(one));
+            (void)written;
+        }
+#endif
+        m_thread.join();
+#ifdef __linux__
+        if (m_notifyFd >= 0)
+        {
+            close(m_notifyFd);
+            close(m_stopFd);
+        }
+#endif
+    }
+
+    void FileWatcher::Watch(const std::string &path)
+    {
+        WatchedFile file;
+        file.path = path;
+        file.directory = GetDirectoryName(path);
+        file.name = GetFileName(path);
+        file.stamp = GetFileStamp(path);
+        file.pending = false;
+
+        std::lock_guard<std::mutex> lock(m_mutex);
+#ifdef __linux__
+        if (m_notifyFd >= 0)
+        {
+            // 保存で別のファイルに置き換えるエディターもあるので、ファイルではなくディレクトリを監視します。
+            int descriptor = inotify_add_watch(m_notifyFd, file.directory.c_str(),
+                IN_MODIFY | IN_CLOSE_WRITE | IN_CREATE | IN_MOVED_TO);
+            if (descriptor >= 0)
+            {
+                auto found = std::find_if(m_directories.begin(), m_directories.end(),
+                    [descriptor](const std::pair<int, std::string> &entry) { return entry.first == descriptor; });
+                if (found == m_directories.end())
+                {
+                    m_directories.push_back(std::make_pair(descriptor, file.directory));
+                }
+            }
+        }
+#endif
+        m_files.push_back(file);
+    }
+
+    void FileWatcher::ThreadLoop()
+    {
+        std::vector<std::string> changed;
+        std::unique_lock<std::mutex> lock(m_mutex);
+        while (!m_quit)
+        {
+            // 通知待ちのファイルがあれば、落ち着く時刻までに起きます。
+            auto now = std::chrono::steady_clock::now();
+            auto timeout = m_poll;
+            for (const auto &file : m_files)
+            {
+                if (file.pending)
+                {
+                    auto remaining = std::chrono::duration_cast<std::chrono::milliseconds>(file.changedAt + m_settle - now);
+                    timeout = std::max(std::chrono::milliseconds(0), std::min(timeout, remaining + std::chrono::milliseconds(1)));
+                }
+            }
+
+#ifdef __linux__
+            if (m_notifyFd >= 0)
+            {
+                lock.unlock();
+                pollfd fds[2] = { { m_notifyFd, POLLIN, 0 }, { m_stopFd, POLLIN, 0 } };
+                poll(fds, 2, static_cast<int>(timeout.count()));
+                lock.lock();
+                now = std::chrono::steady_clock::now();
+                ReadNotificationsLocked(now);
+            }
+            else
+#endif
+            {
+                m_wake.wait_for(lock, timeout);
+                now = std::chrono::steady_clock::now();
+                CheckStampsLocked(now);
+            }
+            if (m_quit)
+            {
+                break;
+            }
+
+            changed.clear();
+            for (auto &file : m_files)
+            {
+                if (file.pending && now - file.changedAt >= m_settle)
+                {
+                    file.pending = false;
+                    changed.push_back(file.path);
+                }
+            }
+            if (!changed.empty())
+            {
+                // コールバックで Watch を呼べるよう、ロックを外して通知します。
+                lock.unlock();
+                for (const auto &path : changed)
+                {
+                    m_callback(path);
+                }
+                lock.lock();
+            }
+        }
+    }
+
+    void FileWatcher::ReadNotificationsLocked(std::chrono::steady_clock::time_point now)
+    {
+#ifdef __linux__
+        alignas(inotify_event) char buffer[4096];
+        for (;;)
+        {
+            ssize_t length = read(m_notifyFd, buffer, sizeof(buffer));
+            if (length <= 0)
+            {
+                break;
+            }
+            for (ssize_t offset = 0; offset < length; )
+            {
+                const inotify_event *event = reinterpret_cast<const inotify_event *>(buffer + offset);
+                offset += sizeof(inotify_event) + event->len;
+
+                if (event->mask & IN_Q_OVERFLOW)
+                {
+                    // 取りこぼしたので、すべて変わったものとして扱います。
+                    for (auto &file : m_files)
+                    {
+                        MarkChangedLocked(file, now);
+                    }
+                    continue;
+                }
+                if (event->len == 0)
+                {
+                    continue;
+                }
+                auto directory = std::find_if(m_directories.begin(), m_directories.end(),
+                    [event](const std::pair<int, std::string> &entry) { return entry.first == event->wd; });
+                if (directory == m_directories.end())
+                {
+                    continue;
+                }
+                for (auto &file : m_files)
+                {
+                    if (file.directory == directory->second && file.name == event->name)
+                    {
+                        MarkChangedLocked(file, now);
+                    }
+                }
+            }
+        }
+#else
+        (void)now;
+#endif
+    }
+
+    void FileWatcher::CheckStampsLocked(std::chrono::steady_clock::time_point now)
+    {
+        for (auto &file : m_files)
+        {
+            FileStamp stamp = GetFileStamp(file.path);
+            if (stamp != file.stamp)
+            {
+                file.stamp = stamp;
+                MarkChangedLocked(file, now);
+            }
+        }
+    }
+
+    void FileWatcher::MarkChangedLocked(WatchedFile &file, std::chrono::steady_clock::time_point now)
+    {
+        file.pending = true;
+        file.changedAt = now;
+    }
+}
@@ -0,0 +1,73 @@
+﻿#pragma once
+#include "FileSystem.h"
+#include <functional>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
+#include <string>
+#include <vector>
+#include <utility>
+
+
+namespace thinr
+{
+    // ファイルの変更を監視スレッドで検出して通知します。Linux では inotify でファイルのあるディレクトリを監視し、
+    // それ以外では一定間隔で更新時刻とサイズを比べます。エディターが保存を何回かの書き込みや置き換えに分けても、
+    // 最後の変更から settle ミリ秒の間変化が無くなってから 1 回だけ通知します。
+    class FileWatcher
+    {
+    public:
+        // path は Watch に渡したパスのままです。監視スレッドから呼ばれます。
+        typedef std::function<void(const std::string &path)> Callback;
+
+        static const uint32_t DefaultSettleMilliseconds = 100;
+        static const uint32_t DefaultPollMilliseconds = 250;
+
+        explicit FileWatcher(const Callback &callback, uint32_t settleMilliseconds = DefaultSettleMilliseconds,
+            uint32_t pollMilliseconds = DefaultPollMilliseconds);
+        // 監視スレッドを止めます。通知の途中なら終わるまで待ちます。
+        ~FileWatcher();
+        FileWatcher(const FileWatcher &) = delete;
+        FileWatcher &operator=(const FileWatcher &) = delete;
+
+        // path (UTF-8) の監視を始めます。まだ無いファイルも、作成されたら通知します。
+        void Watch(const std::string &path);
+
+        // inotify で監視しているか (false なら更新時刻のポーリング)。
+        bool IsUsingNotifications() const { return m_notifyFd >= 0; }
+
+    private:
+        struct WatchedFile
+        {
+            std::string path;
+            std::string directory;
+            std::string name;
+            FileStamp stamp;
+            bool pending;
+            std::chrono::steady_clock::time_point changedAt;
+        };
+
+        void ThreadLoop();
+        void ReadNotificationsLocked(std::chrono::steady_clock::time_point now);
+        void CheckStampsLocked(std::chrono::steady_clock::time_point now);
+        void MarkChangedLocked(WatchedFile &file, std::chrono::steady_clock::time_point now);
+
+        Callback m_callback;
+        std::chrono::milliseconds m_settle;
+        std::chrono::milliseconds m_poll;
+
+        std::mutex m_mutex;
+        std::condition_variable m_wake;
+        std::vector<WatchedFile> m_files;
+        bool m_quit;
+
+        // Linux のみ。inotify と、監視スレッドを止めるための eventfd。使わない場合は -1 です。
+        int m_notifyFd;
+        int m_stopFd;
+        // inotify の watch 記述子と、そのディレクトリ。
+        std::vector<std::pair<int, std::string>> m_directories;
+
+        std::thread m_thread;
+    };
+}
@@ -0,0 +1,94 @@
+﻿#include "pch.h"
+#include "FrameRingAllocator.h"
+#include <stdexcept>
+
+
+namespace thinr
+{
+    FrameRingAllocator::FrameRingAllocator(size_t capacity, uint32_t framesInFlight, size_t alignment)
+        : m_capacity(capacity), m_alignment(alignment), m_framesInFlight(framesInFlight),
+        m_head(0), m_tail(0), m_frameStart(0), m_frameOpen(false), m_stats()
+    {
+        if (alignment == 0 || (alignment & (alignment - 1)) != 0)
+        {
+            throw std::invalid_argument("FrameRingAllocator: alignment must be a power of two");
+        }
+        if (capacity == 0 || capacity % alignment != 0)
+        {
+            throw std::invalid_argument("FrameRingAllocator: capacity must be a positive multiple of alignment");
+        }
+        if (framesInFlight == 0)
+        {
+            throw std::invalid_argument("FrameRingAllocator: framesInFlight must be positive");
+        }
+    }
+
+    void FrameRingAllocator::BeginFrame()
+    {
+        if (m_frameOpen)
+        {
+            m_frameEnds.push_back(m_head);
+            m_stats.frames++;
+        }
+        m_frameOpen = true;
+
+        // 今から書くフレームを除き、直近 framesInFlight - 1 フレームは GPU がまだ読んでいる可能性があります。
+        while (m_frameEnds.size() > m_framesInFlight - 1)
+        {
+            m_tail = m_frameEnds.front();
+            m_frameEnds.pop_front();
+        }
+
+        m_frameStart = m_head;
+        m_stats.frameBytes = 0;
+    }
+
+    bool FrameRingAllocator::TryAllocate(size_t size, size_t &offset)
+    {
+        size_t aligned = (size + m_alignment - 1) & ~(m_alignment - 1);
+        if (aligned == 0 || aligned > m_capacity)
+        {
+            m_stats.failures++;
+            return false;
+        }
+
+        // m_head は常に整列済みです。末尾に収まらなければ残りを捨てて先頭へ折り返します。
+        uint64_t head = m_head;
+        size_t position = static_cast<size_t>(head % m_capacity);
+        if (position + aligned > m_capacity)
+        {
+            head += m_capacity - position;
+            position = 0;
+        }
+        bool wrapped = position == 0 && head != 0;
+        if (head + aligned - m_tail > m_capacity)
+        {
+            m_stats.failures++;
+            return false;
+        }
+
+        m_head = head + aligned;
+        offset = position;
+        if (wrapped)
+        {
+            m_stats.wrapArounds++;
+        }
+        m_stats.allocations++;
+        m_stats.frameBytes = static_cast<size_t>(m_head - m_frameStart);
+        if (m_stats.frameBytes > m_stats.peakFrameBytes)
+        {
+            m_stats.peakFrameBytes = m_stats.frameBytes;
+        }
+        return true;
+    }
+
+    size_t FrameRingAllocator::Allocate(size_t size)
+    {
+        size_t offset;
+        if (!TryAllocate(size, offset))
+        {
+            throw std::runtime_error("FrameRingAllocator: out of space (increase capacity or reduce frames in flight)");
+        }
+        return offset;
+    }
+}
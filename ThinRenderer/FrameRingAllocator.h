@@ -0,0 +1,62 @@
+﻿#pragma once
+#include <cstdint>
+#include <cstddef>
+#include <deque>
+
+
+namespace thinr
+{
+    struct FrameRingStats
+    {
+        // 現在のフレームで割り当てたバイト数 (整列と折り返しの詰め物を含む)。
+        size_t frameBytes;
+        // これまでのフレームでの frameBytes の最大値。
+        size_t peakFrameBytes;
+        uint64_t allocations;
+        // 末尾に収まらず先頭へ折り返した回数。
+        uint64_t wrapArounds;
+        // 空きが足りず失敗した回数。
+        uint64_t failures;
+        uint64_t frames;
+    };
+
+    // フレーム単位で解放するリング型の線形アロケーター。オフセットを管理するだけで、メモリは持ちません。
+    // GPU が最大 framesInFlight フレーム遅れて読むバッファーの上で、直近のフレームの領域を上書きしないように割り当てます。
+    // BeginFrame を呼ぶと、framesInFlight フレーム前の領域が再利用可能になります。
+    class FrameRingAllocator
+    {
+    public:
+        // alignment は 2 のべき乗。D3D11.1 の定数バッファー オフセットは 256 バイト単位です。
+        FrameRingAllocator(size_t capacity, uint32_t framesInFlight, size_t alignment = 256);
+
+        void BeginFrame();
+
+        // size バイトを割り当てて offset を返します。空きが無ければ false を返します。
+        bool TryAllocate(size_t size, size_t &offset);
+        // 空きが無ければ std::runtime_error を送出します。
+        size_t Allocate(size_t size);
+
+        size_t GetCapacity() const { return m_capacity; }
+        size_t GetAlignment() const { return m_alignment; }
+        uint32_t GetFramesInFlight() const { return m_framesInFlight; }
+        // GPU が使用中かもしれない領域を含めた使用量。
+        size_t GetUsedBytes() const { return static_cast<size_t>(m_head - m_tail); }
+
+        const FrameRingStats &GetStats() const { return m_stats; }
+
+    private:
+        size_t m_capacity;
+        size_t m_alignment;
+        uint32_t m_framesInFlight;
+
+        // 先頭からの累積バイト数。オフセットは head % capacity です。
+        uint64_t m_head;
+        uint64_t m_tail;
+        uint64_t m_frameStart;
+        bool m_frameOpen;
+        // 使用中のフレームの終端 (古い順)。
+        std::deque<uint64_t> m_frameEnds;
+
+        FrameRingStats m_stats;
+    };
+}
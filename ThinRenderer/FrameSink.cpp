@@ -0,0 +1,170 @@
+﻿#include "pch.h"
+#include "FrameSink.h"
+#include "Profiler.h"
+#include <algorithm>
+#include <chrono>
+#include <fstream>
+#include <stdexcept>
+
+
+namespace thinr
+{
+    FrameSink::FrameSink(uint32_t width, uint32_t height, PixelFormat pixelFormat, ImageFileFormat fileFormat,
+        size_t bufferCount, unsigned workerCount)
+        : m_fileFormat(fileFormat), m_busy(0), m_quit(false), m_stats()
+    {
+        if (width == 0 || height == 0 || bufferCount == 0)
+        {
+            throw std::invalid_argument("FrameSink: empty size");
+        }
+
+        for (size_t i = 0; i < bufferCount; ++i)
+        {
+            std::unique_ptr<FrameBuffer> frame(new FrameBuffer);
+            frame->pixels.resize(static_cast<size_t>(width) * height);
+            frame->view.data = reinterpret_cast<uint8_t *>(frame->pixels.data());
+            frame->view.width = width;
+            frame->view.height = height;
+            frame->view.pitch = static_cast<size_t>(width) * 4;
+            frame->view.format = pixelFormat;
+            m_free.push_back(frame.get());
+            m_buffers.push_back(std::move(frame));
+        }
+
+        if (workerCount == 0)
+        {
+            // 1 コアは描画スレッドに残します。
+            unsigned cores = std::thread::hardware_concurrency();
+            workerCount = cores > 1 ? cores - 1 : 1;
+        }
+        for (unsigned i = 0; i < workerCount; ++i)
+        {
+            m_workers.emplace_back([this]() { WorkerLoop(); });
+        }
+    }
+
+    FrameSink::~FrameSink()
+    {
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_quit = true;
+        }
+        m_queueChanged.notify_all();
+        for (auto &t : m_workers)
+        {
+            t.join();
+        }
+    }
+
+    FrameBuffer *FrameSink::Acquire()
+    {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        if (m_free.empty())
+        {
+            m_stats.acquireStalls++;
+            m_bufferFreed.wait(lock, [this]() { return !m_free.empty(); });
+        }
+        FrameBuffer *frame = m_free.back();
+        m_free.pop_back();
+        return frame;
+    }
+
+    void FrameSink::Submit(FrameBuffer *frame, const std::string &path)
+    {
+        frame->path = path;
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_queue.push_back(frame);
+        }
+        m_queueChanged.notify_one();
+    }
+
+    void FrameSink::Release(FrameBuffer *frame)
+    {
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_free.push_back(frame);
+        }
+        // WorkerLoop と同じく、Acquire と Flush の両方を起こします。
+        m_bufferFreed.notify_all();
+    }
+
+    void FrameSink::Flush()
+    {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        m_bufferFreed.wait(lock, [this]() { return m_queue.empty() && m_busy == 0; });
+        if (m_error)
+        {
+            std::exception_ptr error = m_error;
+            m_error = nullptr;
+            std::rethrow_exception(error);
+        }
+    }
+
+    FrameSinkStats FrameSink::GetStats() const
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        return m_stats;
+    }
+
+    void FrameSink::WorkerLoop()
+    {
+        THINR_PROFILE_THREAD("FrameSink worker");
+        // エンコード結果のバッファーはワーカーごとに使い回します。
+        std::vector<uint8_t> encoded;
+        for (;;)
+        {
+            FrameBuffer *frame;
+            {
+                std::unique_lock<std::mutex> lock(m_mutex);
+                m_queueChanged.wait(lock, [this]() { return m_quit || !m_queue.empty(); });
+                if (m_queue.empty())
+                {
+                    // m_quit かつキューが空
+                    return;
+                }
+                frame = m_queue.front();
+                m_queue.pop_front();
+                m_busy++;
+            }
+
+            auto start = std::chrono::steady_clock::now();
+            bool written = false;
+            try
+            {
+                THINR_PROFILE_ZONE("FrameSink::Encode");
+                EncodeImage(m_fileFormat, frame->view, encoded);
+                std::ofstream file(frame->path, std::ios::binary);
+                file.write(reinterpret_cast<const char *>(encoded.data()), encoded.size());
+                if (!file)
+                {
+                    throw std::runtime_error("FrameSink: failed to write " + frame->path);
+                }
+                written = true;
+            }
+            catch (...)
+            {
+                std::lock_guard<std::mutex> lock(m_mutex);
+                if (!m_error)
+                {
+                    m_error = std::current_exception();
+                }
+            }
+            double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+            {
+                std::lock_guard<std::mutex> lock(m_mutex);
+                if (written)
+                {
+                    m_stats.framesWritten++;
+                    m_stats.bytesWritten += encoded.size();
+                }
+                m_stats.encodeSeconds += seconds;
+                m_free.push_back(frame);
+                m_busy--;
+            }
+            // Acquire と Flush の両方が待っている可能性があるので全員起こします。
+            m_bufferFreed.notify_all();
+        }
+    }
+}
@@ -0,0 +1,78 @@
+﻿#pragma once
+#include "RenderTarget.h"
+#include "ImageEncoder.h"
+#include <string>
+#include <vector>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <exception>
+
+
+namespace thinr
+{
+    // FrameSink が所有する 1 フレーム分のピクセル バッファー。
+    // view を RenderTarget(view) に渡せば、描画結果がコピー無しでそのままエンコードされます。
+    struct FrameBuffer
+    {
+        std::vector<uint32_t> pixels;
+        ImageView view;
+        std::string path;
+    };
+
+    struct FrameSinkStats
+    {
+        uint64_t framesWritten;
+        uint64_t bytesWritten;
+        // Acquire で空きバッファーを待った回数 (エンコードが描画に追いついていない指標)。
+        uint64_t acquireStalls;
+        double encodeSeconds;
+    };
+
+    // 描画済みフレームを別スレッドでエンコードしてファイルに書き出します。
+    // 描画スレッド: Acquire -> 描画 -> Submit。ワーカー: エンコード -> 書き込み -> バッファーを返却。
+    // バッファー数 (= キューの上限) を超えて Submit しようとすると Acquire が待つので、メモリは増え続けません。
+    class FrameSink
+    {
+    public:
+        // workerCount が 0 の場合はコア数 - 1 (最低 1) を使います。
+        FrameSink(uint32_t width, uint32_t height, PixelFormat pixelFormat, ImageFileFormat fileFormat,
+            size_t bufferCount = 8, unsigned workerCount = 0);
+        // キューに残ったフレームを書き出してから終了します。
+        ~FrameSink();
+        FrameSink(const FrameSink &) = delete;
+        FrameSink &operator=(const FrameSink &) = delete;
+
+        // 空きバッファーを取得します。全部使用中ならワーカーが返却するまで待ちます。
+        FrameBuffer *Acquire();
+        // 描画済みのバッファーを path に書き出すようキューに積みます。すぐに戻ります。
+        void Submit(FrameBuffer *frame, const std::string &path);
+        // 使わなかったバッファーを返却します。
+        void Release(FrameBuffer *frame);
+
+        // キューが空になるまで待ちます。ワーカーで起きた最初のエラーはここで再送出されます。
+        void Flush();
+
+        ImageFileFormat GetFileFormat() const { return m_fileFormat; }
+        FrameSinkStats GetStats() const;
+
+    private:
+        void WorkerLoop();
+
+        ImageFileFormat m_fileFormat;
+        std::vector<std::unique_ptr<FrameBuffer>> m_buffers;
+
+        mutable std::mutex m_mutex;
+        std::condition_variable m_queueChanged;
+        std::condition_variable m_bufferFreed;
+        std::deque<FrameBuffer *> m_queue;
+        std::vector<FrameBuffer *> m_free;
+        size_t m_busy;
+        bool m_quit;
+        std::exception_ptr m_error;
+        FrameSinkStats m_stats;
+
+        std::vector<std::thread> m_workers;
+    };
+}
@@ -0,0 +1,72 @@
+﻿#include "pch.h"
+#include "FrameStatistics.h"
+#include <algorithm>
+#include <cmath>
+#include <stdexcept>
+
+
+namespace thinr
+{
+    FrameStatistics::FrameStatistics(size_t windowSize, double hitchFactor)
+        : m_samples(windowSize), m_next(0), m_count(0), m_totalFrames(0), m_hitchFactor(hitchFactor)
+    {
+        if (windowSize == 0)
+        {
+            throw std::invalid_argument("FrameStatistics: windowSize must be positive");
+        }
+    }
+
+    void FrameStatistics::Record(double seconds)
+    {
+        m_samples[m_next] = seconds;
+        m_next = (m_next + 1) % m_samples.size();
+        m_count = std::min(m_count + 1, m_samples.size());
+        m_totalFrames++;
+    }
+
+    void FrameStatistics::Reset()
+    {
+        m_next = 0;
+        m_count = 0;
+        m_totalFrames = 0;
+    }
+
+    FrameTimeSummary FrameStatistics::Summarize() const
+    {
+        FrameTimeSummary summary = {};
+        if (m_count == 0)
+        {
+            return summary;
+        }
+
+        // 未使用部分を含まないよう、記録済みの範囲だけ取り出します (順序は関係ありません)。
+        m_sorted.assign(m_samples.begin(), m_samples.begin() + m_count);
+        std::sort(m_sorted.begin(), m_sorted.end());
+
+        // nearest-rank 法
+        auto percentile = [this](double p)
+        {
+            size_t rank = static_cast<size_t>(std::ceil(p * m_sorted.size()));
+            return m_sorted[std::min(m_sorted.size(), std::max<size_t>(rank, 1)) - 1];
+        };
+
+        double sum = 0;
+        for (double s : m_sorted)
+        {
+            sum += s;
+        }
+
+        summary.sampleCount = m_count;
+        summary.minSeconds = m_sorted.front();
+        summary.maxSeconds = m_sorted.back();
+        summary.meanSeconds = sum / m_count;
+        summary.p50Seconds = percentile(0.50);
+        summary.p95Seconds = percentile(0.95);
+        summary.p99Seconds = percentile(0.99);
+
+        double hitchThreshold = summary.p50Seconds * m_hitchFactor;
+        summary.hitchCount = static_cast<size_t>(m_sorted.end()
+            - std::upper_bound(m_sorted.begin(), m_sorted.end(), hitchThreshold));
+        return summary;
+    }
+}
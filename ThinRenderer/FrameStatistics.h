@@ -0,0 +1,50 @@
+﻿#pragma once
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+
+
+namespace thinr
+{
+    // 直近のフレーム時間から求めた統計 (秒単位)。
+    struct FrameTimeSummary
+    {
+        size_t sampleCount;
+        double minSeconds;
+        double maxSeconds;
+        double meanSeconds;
+        double p50Seconds;
+        double p95Seconds;
+        double p99Seconds;
+        // 中央値の hitchFactor 倍を超えたフレームの数。
+        size_t hitchCount;
+    };
+
+    // フレーム時間をリング バッファーに記録し、パーセンタイル等を計算します。
+    class FrameStatistics
+    {
+    public:
+        explicit FrameStatistics(size_t windowSize = 600, double hitchFactor = 2.0);
+
+        void Record(double seconds);
+        void Reset();
+
+        size_t GetWindowSize() const { return m_samples.size(); }
+        void SetHitchFactor(double factor) { m_hitchFactor = factor; }
+        double GetHitchFactor() const { return m_hitchFactor; }
+
+        // 記録開始からの合計フレーム数 (ウィンドウから溢れた分も含む)。
+        uint64_t GetTotalFrames() const { return m_totalFrames; }
+
+        // ウィンドウ内のサンプルを集計します。サンプルが無ければ全て 0 です。
+        FrameTimeSummary Summarize() const;
+
+    private:
+        std::vector<double> m_samples;
+        size_t m_next;
+        size_t m_count;
+        uint64_t m_totalFrames;
+        double m_hitchFactor;
+        mutable std::vector<double> m_sorted;
+    };
+}
@@ -0,0 +1,445 @@
+﻿#include "pch.h"
+#include "FrustumCuller.h"
+#include "ThreadPool.h"
+#include "CpuFeatures.h"
+#include "Profiler.h"
+#include <algorithm>
+#include <cmath>
+
+#if defined(_M_IX86) || defined(_M_X64) || defined(__i386__) || defined(__x86_64__)
+#define THINR_X86 1
+#include <immintrin.h>
+#endif
+
+// GCC/Clang は関数単位で AVX を有効にします (MSVC は指定不要)。
+#if defined(__GNUC__) || defined(__clang__)
+#define THINR_TARGET_AVX __attribute__((target("avx")))
+#else
+#define THINR_TARGET_AVX
+#endif
+
+
+namespace thinr
+{
+    namespace
+    {
+        // 1 チャンクで判定するオブジェクト数 (8 の倍数)。
+        const size_t CullGrain = 4096;
+        const size_t SimdWidth = 8;
+
+        size_t PaddedSize(size_t count)
+        {
+            return (count + SimdWidth - 1) / SimdWidth * SimdWidth;
+        }
+
+        // 平面ごとに、AABB の半径に相当する |a| * ex + |b| * ey + |c| * ez の係数を用意します。
+        struct CullPlanes
+        {
+            float a[6];
+            float b[6];
+            float c[6];
+            float d[6];
+            float absA[6];
+            float absB[6];
+            float absC[6];
+        };
+
+        CullPlanes MakeCullPlanes(const Frustum &frustum)
+        {
+            CullPlanes p;
+            for (int i = 0; i < 6; ++i)
+            {
+                p.a[i] = frustum.planes[i].x;
+                p.b[i] = frustum.planes[i].y;
+                p.c[i] = frustum.planes[i].z;
+                p.d[i] = frustum.planes[i].w;
+                p.absA[i] = std::fabs(p.a[i]);
+                p.absB[i] = std::fabs(p.b[i]);
+                p.absC[i] = std::fabs(p.c[i]);
+            }
+            return p;
+        }
+
+        // どのカーネルも ((a * x + b * y) + c * z) + d の順で計算します。
+        inline float PlaneDistance(const CullPlanes &p, int i, float x, float y, float z)
+        {
+            return p.a[i] * x + p.b[i] * y + p.c[i] * z + p.d[i];
+        }
+
+        inline float BoxRadius(const CullPlanes &p, int i, float ex, float ey, float ez)
+        {
+            return p.absA[i] * ex + p.absB[i] * ey + p.absC[i] * ez;
+        }
+
+        typedef void (*CullSpheresFunc)(const CullPlanes &planes, const BoundingSphereSet &set,
+            size_t begin, size_t end, std::vector<uint32_t> &out);
+        typedef void (*CullBoxesFunc)(const CullPlanes &planes, const BoundingBoxSet &set,
+            size_t begin, size_t end, std::vector<uint32_t> &out);
+
+        void CullSpheresScalar(const CullPlanes &planes, const BoundingSphereSet &set,
+            size_t begin, size_t end, std::vector<uint32_t> &out)
+        {
+            const float *x = set.GetX();
+            const float *y = set.GetY();
+            const float *z = set.GetZ();
+            const float *r = set.GetRadius();
+            for (size_t i = begin; i < end; ++i)
+            {
+                bool outside = false;
+                for (int p = 0; p < 6; ++p)
+                {
+                    outside |= PlaneDistance(planes, p, x[i], y[i], z[i]) < -r[i];
+                }
+                if (!outside)
+                {
+                    out.push_back(static_cast<uint32_t>(i));
+                }
+            }
+        }
+
+        void CullBoxesScalar(const CullPlanes &planes, const BoundingBoxSet &set,
+            size_t begin, size_t end, std::vector<uint32_t> &out)
+        {
+            const float *cx = set.GetCenterX();
+            const float *cy = set.GetCenterY();
+            const float *cz = set.GetCenterZ();
+            const float *ex = set.GetExtentX();
+            const float *ey = set.GetExtentY();
+            const float *ez = set.GetExtentZ();
+            for (size_t i = begin; i < end; ++i)
+            {
+                bool outside = false;
+                for (int p = 0; p < 6; ++p)
+                {
+                    outside |= PlaneDistance(planes, p, cx[i], cy[i], cz[i]) < -BoxRadius(planes, p, ex[i], ey[i], ez[i]);
+                }
+                if (!outside)
+                {
+                    out.push_back(static_cast<uint32_t>(i));
+                }
+            }
+        }
+
+        // outsideMask のビットが 0 のもの (見えるもの) を end 未満だけ出力します。
+        inline void EmitVisible(unsigned outsideMask, unsigned width, size_t base, size_t end, std::vector<uint32_t> &out)
+        {
+            for (unsigned lane = 0; lane < width && base + lane < end; ++lane)
+            {
+                if (!(outsideMask & (1u << lane)))
+                {
+                    out.push_back(static_cast<uint32_t>(base + lane));
+                }
+            }
+        }
+
+#if THINR_X86
+        // 配列は 8 の倍数まで確保してあるので、end を超えた分も読めます (出力はしません)。
+        void CullSpheresSSE2(const CullPlanes &planes, const BoundingSphereSet &set,
+            size_t begin, size_t end, std::vector<uint32_t> &out)
+        {
+            const __m128 sign = _mm_set1_ps(-0.0f);
+            for (size_t i = begin; i < end; i += 4)
+            {
+                __m128 x = _mm_loadu_ps(set.GetX() + i);
+                __m128 y = _mm_loadu_ps(set.GetY() + i);
+                __m128 z = _mm_loadu_ps(set.GetZ() + i);
+                __m128 negR = _mm_xor_ps(_mm_loadu_ps(set.GetRadius() + i), sign);
+                __m128 outside = _mm_setzero_ps();
+                for (int p = 0; p < 6; ++p)
+                {
+                    __m128 d = _mm_mul_ps(_mm_set1_ps(planes.a[p]), x);
+                    d = _mm_add_ps(d, _mm_mul_ps(_mm_set1_ps(planes.b[p]), y));
+                    d = _mm_add_ps(d, _mm_mul_ps(_mm_set1_ps(planes.c[p]), z));
+                    d = _mm_add_ps(d, _mm_set1_ps(planes.d[p]));
+                    outside = _mm_or_ps(outside, _mm_cmplt_ps(d, negR));
+                }
+                EmitVisible(static_cast<unsigned>(_mm_movemask_ps(outside)), 4, i, end, out);
+            }
+        }
+
+        void CullBoxesSSE2(const CullPlanes &planes, const BoundingBoxSet &set,
+            size_t begin, size_t end, std::vector<uint32_t> &out)
+        {
+            const __m128 sign = _mm_set1_ps(-0.0f);
+            for (size_t i = begin; i < end; i += 4)
+            {
+                __m128 cx = _mm_loadu_ps(set.GetCenterX() + i);
+                __m128 cy = _mm_loadu_ps(set.GetCenterY() + i);
+                __m128 cz = _mm_loadu_ps(set.GetCenterZ() + i);
+                __m128 ex = _mm_loadu_ps(set.GetExtentX() + i);
+                __m128 ey = _mm_loadu_ps(set.GetExtentY() + i);
+                __m128 ez = _mm_loadu_ps(set.GetExtentZ() + i);
+                __m128 outside = _mm_setzero_ps();
+                for (int p = 0; p < 6; ++p)
+                {
+                    __m128 d = _mm_mul_ps(_mm_set1_ps(planes.a[p]), cx);
+                    d = _mm_add_ps(d, _mm_mul_ps(_mm_set1_ps(planes.b[p]), cy));
+                    d = _mm_add_ps(d, _mm_mul_ps(_mm_set1_ps(planes.c[p]), cz));
+                    d = _mm_add_ps(d, _mm_set1_ps(planes.d[p]));
+                    __m128 r = _mm_mul_ps(_mm_set1_ps(planes.absA[p]), ex);
+                    r = _mm_add_ps(r, _mm_mul_ps(_mm_set1_ps(planes.absB[p]), ey));
+                    r = _mm_add_ps(r, _mm_mul_ps(_mm_set1_ps(planes.absC[p]), ez));
+                    outside = _mm_or_ps(outside, _mm_cmplt_ps(d, _mm_xor_ps(r, sign)));
+                }
+                EmitVisible(static_cast<unsigned>(_mm_movemask_ps(outside)), 4, i, end, out);
+            }
+        }
+
+        THINR_TARGET_AVX
+        void CullSpheresAVX(const CullPlanes &planes, const BoundingSphereSet &set,
+            size_t begin, size_t end, std::vector<uint32_t> &out)
+        {
+            const __m256 sign = _mm256_set1_ps(-0.0f);
+            for (size_t i = begin; i < end; i += 8)
+            {
+                __m256 x = _mm256_loadu_ps(set.GetX() + i);
+                __m256 y = _mm256_loadu_ps(set.GetY() + i);
+                __m256 z = _mm256_loadu_ps(set.GetZ() + i);
+                __m256 negR = _mm256_xor_ps(_mm256_loadu_ps(set.GetRadius() + i), sign);
+                __m256 outside = _mm256_setzero_ps();
+                for (int p = 0; p < 6; ++p)
+                {
+                    __m256 d = _mm256_mul_ps(_mm256_set1_ps(planes.a[p]), x);
+                    d = _mm256_add_ps(d, _mm256_mul_ps(_mm256_set1_ps(planes.b[p]), y));
+                    d = _mm256_add_ps(d, _mm256_mul_ps(_mm256_set1_ps(planes.c[p]), z));
+                    d = _mm256_add_ps(d, _mm256_set1_ps(planes.d[p]));
+                    outside = _mm256_or_ps(outside, _mm256_cmp_ps(d, negR, _CMP_LT_OQ));
+                }
+                EmitVisible(static_cast<unsigned>(_mm256_movemask_ps(outside)), 8, i, end, out);
+            }
+        }
+
+        THINR_TARGET_AVX
+        void CullBoxesAVX(const CullPlanes &planes, const BoundingBoxSet &set,
+            size_t begin, size_t end, std::vector<uint32_t> &out)
+        {
+            const __m256 sign = _mm256_set1_ps(-0.0f);
+            for (size_t i = begin; i < end; i += 8)
+            {
+                __m256 cx = _mm256_loadu_ps(set.GetCenterX() + i);
+                __m256 cy = _mm256_loadu_ps(set.GetCenterY() + i);
+                __m256 cz = _mm256_loadu_ps(set.GetCenterZ() + i);
+                __m256 ex = _mm256_loadu_ps(set.GetExtentX() + i);
+                __m256 ey = _mm256_loadu_ps(set.GetExtentY() + i);
+                __m256 ez = _mm256_loadu_ps(set.GetExtentZ() + i);
+                __m256 outside = _mm256_setzero_ps();
+                for (int p = 0; p < 6; ++p)
+                {
+                    __m256 d = _mm256_mul_ps(_mm256_set1_ps(planes.a[p]), cx);
+                    d = _mm256_add_ps(d, _mm256_mul_ps(_mm256_set1_ps(planes.b[p]), cy));
+                    d = _mm256_add_ps(d, _mm256_mul_ps(_mm256_set1_ps(planes.c[p]), cz));
+                    d = _mm256_add_ps(d, _mm256_set1_ps(planes.d[p]));
+                    __m256 r = _mm256_mul_ps(_mm256_set1_ps(planes.absA[p]), ex);
+                    r = _mm256_add_ps(r, _mm256_mul_ps(_mm256_set1_ps(planes.absB[p]), ey));
+                    r = _mm256_add_ps(r, _mm256_mul_ps(_mm256_set1_ps(planes.absC[p]), ez));
+                    outside = _mm256_or_ps(outside, _mm256_cmp_ps(d, _mm256_xor_ps(r, sign), _CMP_LT_OQ));
+                }
+                EmitVisible(static_cast<unsigned>(_mm256_movemask_ps(outside)), 8, i, end, out);
+            }
+        }
+#endif
+
+        CullKernel ResolveCullKernel(CullKernel kernel)
+        {
+            const CpuFeatures &cpu = GetCpuFeatures();
+            CullKernel best = cpu.avx ? CullKernel::AVX : cpu.sse2 ? CullKernel::SSE2 : CullKernel::Scalar;
+            switch (kernel)
+            {
+            case CullKernel::Scalar:
+                return CullKernel::Scalar;
+            case CullKernel::SSE2:
+                return cpu.sse2 ? CullKernel::SSE2 : best;
+            case CullKernel::AVX:
+                return cpu.avx ? CullKernel::AVX : best;
+            default:
+                return best;
+            }
+        }
+
+        CullSpheresFunc SelectSphereKernel(CullKernel kernel)
+        {
+            switch (kernel)
+            {
+#if THINR_X86
+            case CullKernel::SSE2:
+                return &CullSpheresSSE2;
+            case CullKernel::AVX:
+                return &CullSpheresAVX;
+#endif
+            default:
+                return &CullSpheresScalar;
+            }
+        }
+
+        CullBoxesFunc SelectBoxKernel(CullKernel kernel)
+        {
+            switch (kernel)
+            {
+#if THINR_X86
+            case CullKernel::SSE2:
+                return &CullBoxesSSE2;
+            case CullKernel::AVX:
+                return &CullBoxesAVX;
+#endif
+            default:
+                return &CullBoxesScalar;
+            }
+        }
+    }
+
+    Frustum Frustum::FromViewProjection(const Float4x4 &viewProjection)
+    {
+        // クリップ座標 c = M * p に対して -w <= x <= w, -w <= y <= w, 0 <= z <= w (Gribb/Hartmann)。
+        const float (*m)[4] = viewProjection.m;
+        Frustum frustum;
+        for (int j = 0; j < 4; ++j)
+        {
+            float row0 = m[0][j];
+            float row1 = m[1][j];
+            float row2 = m[2][j];
+            float row3 = m[3][j];
+            (&frustum.planes[0].x)[j] = row3 + row0; // left
+            (&frustum.planes[1].x)[j] = row3 - row0; // right
+            (&frustum.planes[2].x)[j] = row3 + row1; // bottom
+            (&frustum.planes[3].x)[j] = row3 - row1; // top
+            (&frustum.planes[4].x)[j] = row2;        // near
+            (&frustum.planes[5].x)[j] = row3 - row2; // far
+        }
+        for (auto &plane : frustum.planes)
+        {
+            float length = std::sqrt(plane.x * plane.x + plane.y * plane.y + plane.z * plane.z);
+            if (length > 0)
+            {
+                float inv = 1.0f / length;
+                plane = Float4{ plane.x * inv, plane.y * inv, plane.z * inv, plane.w * inv };
+            }
+        }
+        return frustum;
+    }
+
+    uint32_t BoundingSphereSet::Add(const Float3 &center, float radius)
+    {
+        uint32_t index = static_cast<uint32_t>(m_count++);
+        size_t padded = PaddedSize(m_count);
+        if (m_x.size() < padded)
+        {
+            m_x.resize(padded, 0.0f);
+            m_y.resize(padded, 0.0f);
+            m_z.resize(padded, 0.0f);
+            m_radius.resize(padded, 0.0f);
+        }
+        Set(index, center, radius);
+        return index;
+    }
+
+    void BoundingSphereSet::Set(uint32_t index, const Float3 &center, float radius)
+    {
+        m_x[index] = center.x;
+        m_y[index] = center.y;
+        m_z[index] = center.z;
+        m_radius[index] = radius;
+    }
+
+    void BoundingSphereSet::Clear()
+    {
+        m_count = 0;
+        m_x.clear();
+        m_y.clear();
+        m_z.clear();
+        m_radius.clear();
+    }
+
+    uint32_t BoundingBoxSet::Add(const Float3 &center, const Float3 &extents)
+    {
+        uint32_t index = static_cast<uint32_t>(m_count++);
+        size_t padded = PaddedSize(m_count);
+        if (m_centerX.size() < padded)
+        {
+            m_centerX.resize(padded, 0.0f);
+            m_centerY.resize(padded, 0.0f);
+            m_centerZ.resize(padded, 0.0f);
+            m_extentX.resize(padded, 0.0f);
+            m_extentY.resize(padded, 0.0f);
+            m_extentZ.resize(padded, 0.0f);
+        }
+        Set(index, center, extents);
+        return index;
+    }
+
+    void BoundingBoxSet::Set(uint32_t index, const Float3 &center, const Float3 &extents)
+    {
+        m_centerX[index] = center.x;
+        m_centerY[index] = center.y;
+        m_centerZ[index] = center.z;
+        m_extentX[index] = extents.x;
+        m_extentY[index] = extents.y;
+        m_extentZ[index] = extents.z;
+    }
+
+    void BoundingBoxSet::Clear()
+    {
+        m_count = 0;
+        m_centerX.clear();
+        m_centerY.clear();
+        m_centerZ.clear();
+        m_extentX.clear();
+        m_extentY.clear();
+        m_extentZ.clear();
+    }
+
+    FrustumCuller::FrustumCuller(ThreadPool *pool)
+        : m_pool(pool ? pool : &ThreadPool::GetDefault()),
+        m_kernel(ResolveCullKernel(CullKernel::Auto)),
+        m_stats()
+    {
+    }
+
+    void FrustumCuller::SetKernel(CullKernel kernel)
+    {
+        m_kernel = ResolveCullKernel(kernel);
+    }
+
+    void FrustumCuller::Cull(const Frustum &frustum, const BoundingSphereSet &spheres, std::vector<uint32_t> &visible)
+    {
+        CullImpl(frustum, spheres, SelectSphereKernel(m_kernel), visible);
+    }
+
+    void FrustumCuller::Cull(const Frustum &frustum, const BoundingBoxSet &boxes, std::vector<uint32_t> &visible)
+    {
+        CullImpl(frustum, boxes, SelectBoxKernel(m_kernel), visible);
+    }
+
+    template<typename SET, typename KERNEL>
+    void FrustumCuller::CullImpl(const Frustum &frustum, const SET &set, KERNEL kernel, std::vector<uint32_t> &visible)
+    {
+        THINR_PROFILE_ZONE("FrustumCuller::Cull");
+        visible.clear();
+        size_t count = set.GetSize();
+        if (count == 0)
+        {
+            return;
+        }
+
+        // チャンクごとに出力し、昇順を保って連結します。
+        CullPlanes planes = MakeCullPlanes(frustum);
+        size_t chunkCount = (count + CullGrain - 1) / CullGrain;
+        if (m_chunks.size() < chunkCount)
+        {
+            m_chunks.resize(chunkCount);
+        }
+        auto &chunks = m_chunks;
+        m_pool->ParallelFor(count, CullGrain, [&](size_t begin, size_t end)
+        {
+            auto &out = chunks[begin / CullGrain];
+            out.clear();
+            kernel(planes, set, begin, end, out);
+        });
+
+        for (size_t i = 0; i < chunkCount; ++i)
+        {
+            visible.insert(visible.end(), m_chunks[i].begin(), m_chunks[i].end());
+        }
+        m_stats.tested += count;
+        m_stats.visible += visible.size();
+    }
+}
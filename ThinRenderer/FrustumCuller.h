@@ -0,0 +1,116 @@
+﻿#pragma once
+#include "MathTypes.h"
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+
+
+namespace thinr
+{
+    class ThreadPool;
+
+    // 6 平面の視錐台。平面 (a, b, c, d) は a * x + b * y + c * z + d >= 0 が内側で、(a, b, c) は正規化済みです。
+    struct Frustum
+    {
+        Float4 planes[6];
+
+        // Multiply(projection, view) のような転置済みのビュー射影行列から求めます (D3D のクリップ空間 0 <= z <= w)。
+        static Frustum FromViewProjection(const Float4x4 &viewProjection);
+    };
+
+    // 境界球を SoA で保持します。配列は SIMD の幅 (8) の倍数まで確保します。
+    class BoundingSphereSet
+    {
+    public:
+        BoundingSphereSet() : m_count(0) {}
+
+        uint32_t Add(const Float3 &center, float radius);
+        void Set(uint32_t index, const Float3 &center, float radius);
+        void Clear();
+        size_t GetSize() const { return m_count; }
+
+        const float *GetX() const { return m_x.data(); }
+        const float *GetY() const { return m_y.data(); }
+        const float *GetZ() const { return m_z.data(); }
+        const float *GetRadius() const { return m_radius.data(); }
+
+    private:
+        size_t m_count;
+        std::vector<float> m_x;
+        std::vector<float> m_y;
+        std::vector<float> m_z;
+        std::vector<float> m_radius;
+    };
+
+    // 中心と半分の大きさで表した AABB を SoA で保持します。
+    class BoundingBoxSet
+    {
+    public:
+        BoundingBoxSet() : m_count(0) {}
+
+        uint32_t Add(const Float3 &center, const Float3 &extents);
+        void Set(uint32_t index, const Float3 &center, const Float3 &extents);
+        void Clear();
+        size_t GetSize() const { return m_count; }
+
+        const float *GetCenterX() const { return m_centerX.data(); }
+        const float *GetCenterY() const { return m_centerY.data(); }
+        const float *GetCenterZ() const { return m_centerZ.data(); }
+        const float *GetExtentX() const { return m_extentX.data(); }
+        const float *GetExtentY() const { return m_extentY.data(); }
+        const float *GetExtentZ() const { return m_extentZ.data(); }
+
+    private:
+        size_t m_count;
+        std::vector<float> m_centerX;
+        std::vector<float> m_centerY;
+        std::vector<float> m_centerZ;
+        std::vector<float> m_extentX;
+        std::vector<float> m_extentY;
+        std::vector<float> m_extentZ;
+    };
+
+    enum class CullKernel
+    {
+        // CPUID で使える中で最速のものを選びます。
+        Auto,
+        Scalar,
+        // 4 オブジェクト同時 (SSE2)
+        SSE2,
+        // 8 オブジェクト同時 (AVX)
+        AVX,
+    };
+
+    struct CullStats
+    {
+        uint64_t tested;
+        uint64_t visible;
+    };
+
+    // SoA の境界ボリュームを視錐台と判定し、見えるもののインデックスを昇順で返します。
+    // どのカーネルでも同じ順序の演算で判定するので、結果は一致します。
+    class FrustumCuller
+    {
+    public:
+        // pool が nullptr の場合は ThreadPool::GetDefault を使用します。
+        explicit FrustumCuller(ThreadPool *pool = nullptr);
+
+        void SetKernel(CullKernel kernel);
+        CullKernel GetKernel() const { return m_kernel; }
+
+        void Cull(const Frustum &frustum, const BoundingSphereSet &spheres, std::vector<uint32_t> &visible);
+        void Cull(const Frustum &frustum, const BoundingBoxSet &boxes, std::vector<uint32_t> &visible);
+
+        const CullStats &GetStats() const { return m_stats; }
+        void ResetStats() { m_stats = CullStats(); }
+
+    private:
+        template<typename SET, typename KERNEL>
+        void CullImpl(const Frustum &frustum, const SET &set, KERNEL kernel, std::vector<uint32_t> &visible);
+
+        ThreadPool *m_pool;
+        CullKernel m_kernel;
+        std::vector<std::vector<uint32_t>> m_chunks;
+        CullStats m_stats;
+    };
+}
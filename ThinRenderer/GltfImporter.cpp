@@ -0,0 +1,756 @@
+﻿#include "pch.h"
+#include "GltfImporter.h"
+#include "FileSystem.h"
+#include "Json.h"
+#include <atomic>
+#include <cmath>
+#include <cstring>
+#include <stdexcept>
+
+
+namespace thinr
+{
+    namespace
+    {
+        const uint32_t GlbMagic = 0x46546C67;      // "glTF"
+        const uint32_t GlbChunkJson = 0x4E4F534A;  // "JSON"
+        const uint32_t GlbChunkBin = 0x004E4942;   // "BIN\0"
+
+        const uint32_t ComponentByte = 5120;
+        const uint32_t ComponentUnsignedByte = 5121;
+        const uint32_t ComponentShort = 5122;
+        const uint32_t ComponentUnsignedShort = 5123;
+        const uint32_t ComponentUnsignedInt = 5125;
+        const uint32_t ComponentFloat = 5126;
+
+        const uint32_t ModeTriangles = 4;
+
+        [[noreturn]] void Fail(const std::string &message)
+        {
+            throw std::runtime_error("ImportGltf: " + message);
+        }
+
+        struct BufferData
+        {
+            const uint8_t *data;
+            size_t size;
+        };
+
+        // 読み込み中のファイルとバッファー。変換は複数のスレッドから読み取り専用で参照します。
+        struct ImportContext
+        {
+            MappedFile file;
+            JsonDocument json;
+            std::vector<MappedFile> externalFiles;
+            std::vector<std::vector<uint8_t>> embeddedData;
+            std::vector<BufferData> buffers;
+            JsonValue accessors;
+            JsonValue bufferViews;
+            JsonValue materials;
+        };
+
+        // アクセサーの要素を bufferView の中で直接参照します。data が nullptr の場合はすべて 0 です。
+        struct AccessorView
+        {
+            const uint8_t *data;
+            size_t count;
+            size_t stride;
+            uint32_t componentType;
+            uint32_t components;
+            bool normalized;
+        };
+
+        uint32_t ReadLittle32(const uint8_t *p)
+        {
+            return uint32_t(p[0]) | (uint32_t(p[1]) << 8) | (uint32_t(p[2]) << 16) | (uint32_t(p[3]) << 24);
+        }
+
+        // 0 以上 count 未満の整数でなければエラーにします。
+        size_t GetIndex(const JsonValue &value, size_t count, const char *what)
+        {
+            double number = value.GetNumber(-1.0);
+            if (!(number >= 0.0 && number < static_cast<double>(count)) || number != static_cast<double>(static_cast<size_t>(number)))
+            {
+                Fail(std::string("invalid ") + what + " index");
+            }
+            return static_cast<size_t>(number);
+        }
+
+        size_t GetSize(const JsonValue &value, size_t defaultValue, const char *what)
+        {
+            if (!value.IsValid())
+            {
+                return defaultValue;
+            }
+            double number = value.GetNumber(-1.0);
+            if (!(number >= 0.0 && number < 9007199254740992.0) || number != static_cast<double>(static_cast<uint64_t>(number)))
+            {
+                Fail(std::string("invalid ") + what);
+            }
+            return static_cast<size_t>(number);
+        }
+
+        uint32_t GetComponentSize(uint32_t componentType)
+        {
+            switch (componentType)
+            {
+            case ComponentByte:
+            case ComponentUnsignedByte:
+                return 1;
+            case ComponentShort:
+            case ComponentUnsignedShort:
+                return 2;
+            case ComponentUnsignedInt:
+            case ComponentFloat:
+                return 4;
+            default:
+                Fail("unsupported component type " + std::to_string(componentType));
+            }
+        }
+
+        uint32_t GetComponentCount(const std::string &type)
+        {
+            if (type == "SCALAR") return 1;
+            if (type == "VEC2") return 2;
+            if (type == "VEC3") return 3;
+            if (type == "VEC4") return 4;
+            if (type == "MAT2") return 4;
+            if (type == "MAT3") return 9;
+            if (type == "MAT4") return 16;
+            Fail("unsupported accessor type " + type);
+        }
+
+        int HexDigit(char c)
+        {
+            if (c >= '0' && c <= '9') return c - '0';
+            if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+            if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+            return -1;
+        }
+
+        // URI の %XX を戻します。
+        std::string DecodeUri(const std::string &uri)
+        {
+            std::string result;
+            result.reserve(uri.size());
+            for (size_t i = 0; i < uri.size(); ++i)
+            {
+                if (uri[i] == '%' && i + 2 < uri.size() && HexDigit(uri[i + 1]) >= 0 && HexDigit(uri[i + 2]) >= 0)
+                {
+                    result += static_cast<char>(HexDigit(uri[i + 1]) * 16 + HexDigit(uri[i + 2]));
+                    i += 2;
+                }
+                else
+                {
+                    result += uri[i];
+                }
+            }
+            return result;
+        }
+
+        void DecodeBase64(const char *text, size_t length, std::vector<uint8_t> &out)
+        {
+            static const auto value = [](char c) -> int
+            {
+                if (c >= 'A' && c <= 'Z') return c - 'A';
+                if (c >= 'a' && c <= 'z') return c - 'a' + 26;
+                if (c >= '0' && c <= '9') return c - '0' + 52;
+                if (c == '+' || c == '-') return 62;
+                if (c == '/' || c == '_') return 63;
+                return -1;
+            };
+            out.clear();
+            out.reserve(length / 4 * 3);
+            uint32_t bits = 0;
+            int bitCount = 0;
+            for (size_t i = 0; i < length && text[i] != '='; ++i)
+            {
+                int v = value(text[i]);
+                if (v < 0)
+                {
+                    Fail("invalid base64 data");
+                }
+                bits = (bits << 6) | static_cast<uint32_t>(v);
+                bitCount += 6;
+                if (bitCount >= 8)
+                {
+                    bitCount -= 8;
+                    out.push_back(static_cast<uint8_t>(bits >> bitCount));
+                }
+            }
+        }
+
+        // .glb なら JSON と BIN のチャンクに分けます。それ以外は全体を JSON として扱います。
+        void ParseContainer(ImportContext &context, BufferData &binChunk)
+        {
+            const uint8_t *data = context.file.GetData();
+            size_t size = context.file.GetSize();
+            binChunk = BufferData{ nullptr, 0 };
+            if (size < 12 || ReadLittle32(data) != GlbMagic)
+            {
+                context.json.Parse(reinterpret_cast<const char *>(data), size);
+                return;
+            }
+
+            if (ReadLittle32(data + 4) != 2)
+            {
+                Fail("unsupported GLB version");
+            }
+            size_t length = ReadLittle32(data + 8);
+            if (length > size || length < 12)
+            {
+                Fail("truncated GLB");
+            }
+            bool hasJson = false;
+            size_t offset = 12;
+            while (length - offset >= 8)
+            {
+                size_t chunkLength = ReadLittle32(data + offset);
+                uint32_t chunkType = ReadLittle32(data + offset + 4);
+                offset += 8;
+                if (chunkLength > length - offset)
+                {
+                    Fail("truncated GLB chunk");
+                }
+                if (chunkType == GlbChunkJson && !hasJson)
+                {
+                    context.json.Parse(reinterpret_cast<const char *>(data + offset), chunkLength);
+                    hasJson = true;
+                }
+                else if (chunkType == GlbChunkBin && !binChunk.data)
+                {
+                    binChunk = BufferData{ data + offset, chunkLength };
+                }
+                offset += chunkLength;
+            }
+            if (!hasJson)
+            {
+                Fail("GLB has no JSON chunk");
+            }
+        }
+
+        // 外部ファイルはマップし、data URI は展開します。URI の無いバッファーは GLB の BIN チャンクです。
+        void LoadBuffers(ImportContext &context, const std::string &path, const BufferData &binChunk)
+        {
+            JsonValue buffers = context.json.GetRoot().Find("buffers");
+            size_t count = buffers.GetSize();
+            std::string directory = GetDirectoryName(path);
+            context.externalFiles.reserve(count);
+            context.embeddedData.reserve(count);
+            for (size_t i = 0; i < count; ++i)
+            {
+                JsonValue buffer = buffers[i];
+                size_t byteLength = GetSize(buffer.Find("byteLength"), SIZE_MAX, "buffer byteLength");
+                JsonValue uri = buffer.Find("uri");
+                BufferData data;
+                if (!uri.IsValid())
+                {
+                    if (i != 0 || !binChunk.data)
+                    {
+                        Fail("buffer " + std::to_string(i) + " has no uri");
+                    }
+                    data = binChunk;
+                }
+                else
+                {
+                    std::string text = uri.GetString();
+                    if (text.compare(0, 5, "data:") == 0)
+                    {
+                        size_t comma = text.find(',');
+                        if (comma == std::string::npos || text.rfind(";base64", comma) == std::string::npos)
+                        {
+                            Fail("unsupported data uri in buffer " + std::to_string(i));
+                        }
+                        context.embeddedData.emplace_back();
+                        DecodeBase64(text.data() + comma + 1, text.size() - comma - 1, context.embeddedData.back());
+                        data = BufferData{ context.embeddedData.back().data(), context.embeddedData.back().size() };
+                    }
+                    else
+                    {
+                        context.externalFiles.emplace_back(directory + "/" + DecodeUri(text));
+                        data = BufferData{ context.externalFiles.back().GetData(), context.externalFiles.back().GetSize() };
+                    }
+                }
+                if (byteLength == SIZE_MAX || byteLength > data.size)
+                {
+                    Fail("buffer " + std::to_string(i) + " is shorter than byteLength");
+                }
+                data.size = byteLength;
+                context.buffers.push_back(data);
+            }
+        }
+
+        AccessorView GetAccessor(const ImportContext &context, const JsonValue &indexValue)
+        {
+            JsonValue accessor = context.accessors[GetIndex(indexValue, context.accessors.GetSize(), "accessor")];
+            if (accessor.Find("sparse").IsValid())
+            {
+                Fail("sparse accessors are not supported");
+            }
+            AccessorView view;
+            view.componentType = static_cast<uint32_t>(accessor.Find("componentType").GetNumber(0.0));
+            view.components = GetComponentCount(accessor.Find("type").GetString());
+            view.normalized = accessor.Find("normalized").GetBool();
+            view.count = GetSize(accessor.Find("count"), SIZE_MAX, "accessor count");
+            if (view.count == SIZE_MAX)
+            {
+                Fail("accessor has no count");
+            }
+            size_t elementSize = size_t(GetComponentSize(view.componentType)) * view.components;
+            view.stride = elementSize;
+            view.data = nullptr;
+
+            JsonValue bufferViewIndex = accessor.Find("bufferView");
+            if (!bufferViewIndex.IsValid())
+            {
+                return view;
+            }
+            JsonValue bufferView = context.bufferViews[GetIndex(bufferViewIndex, context.bufferViews.GetSize(), "bufferView")];
+            const BufferData &buffer = context.buffers[GetIndex(bufferView.Find("buffer"), context.buffers.size(), "buffer")];
+            size_t viewOffset = GetSize(bufferView.Find("byteOffset"), 0, "bufferView byteOffset");
+            size_t viewLength = GetSize(bufferView.Find("byteLength"), SIZE_MAX, "bufferView byteLength");
+            if (viewOffset > buffer.size || viewLength > buffer.size - viewOffset)
+            {
+                Fail("bufferView out of range");
+            }
+            view.stride = GetSize(bufferView.Find("byteStride"), elementSize, "bufferView byteStride");
+            if (view.stride < elementSize)
+            {
+                Fail("bufferView byteStride is smaller than the element");
+            }
+            size_t offset = GetSize(accessor.Find("byteOffset"), 0, "accessor byteOffset");
+            if (view.count > 0)
+            {
+                uint64_t end = uint64_t(offset) + uint64_t(view.stride) * (view.count - 1) + elementSize;
+                if (offset > viewLength || end > viewLength || view.count > SIZE_MAX / view.stride)
+                {
+                    Fail("accessor out of range");
+                }
+            }
+            view.data = buffer.data + viewOffset + offset;
+            return view;
+        }
+
+        float ReadComponent(const uint8_t *p, uint32_t componentType, bool normalized)
+        {
+            switch (componentType)
+            {
+            case ComponentFloat:
+            {
+                float value;
+                memcpy(&value, p, sizeof(value));
+                return value;
+            }
+            case ComponentUnsignedByte:
+                return normalized ? p[0] / 255.0f : p[0];
+            case ComponentByte:
+            {
+                float value = static_cast<int8_t>(p[0]);
+                return normalized ? std::fmax(value / 127.0f, -1.0f) : value;
+            }
+            case ComponentUnsignedShort:
+            {
+                uint16_t value;
+                memcpy(&value, p, sizeof(value));
+                return normalized ? value / 65535.0f : value;
+            }
+            case ComponentShort:
+            {
+                int16_t value;
+                memcpy(&value, p, sizeof(value));
+                return normalized ? std::fmax(value / 32767.0f, -1.0f) : value;
+            }
+            default:
+            {
+                uint32_t value;
+                memcpy(&value, p, sizeof(value));
+                return static_cast<float>(value);
+            }
+            }
+        }
+
+        // i 番目の要素の先頭 3 成分。足りない成分は 0 です。
+        Float3 ReadFloat3(const AccessorView &view, size_t i)
+        {
+            Float3 result = { 0.0f, 0.0f, 0.0f };
+            if (!view.data)
+            {
+                return result;
+            }
+            const uint8_t *p = view.data + i * view.stride;
+            if (view.componentType == ComponentFloat && view.components >= 3)
+            {
+                memcpy(&result, p, sizeof(result));
+                return result;
+            }
+            uint32_t componentSize = GetComponentSize(view.componentType);
+            float *out = &result.x;
+            for (uint32_t c = 0; c < view.components && c < 3; ++c)
+            {
+                out[c] = ReadComponent(p + c * componentSize, view.componentType, view.normalized);
+            }
+            return result;
+        }
+
+        uint32_t ReadIndex(const AccessorView &view, size_t i)
+        {
+            if (!view.data)
+            {
+                return 0;
+            }
+            const uint8_t *p = view.data + i * view.stride;
+            switch (view.componentType)
+            {
+            case ComponentUnsignedByte:
+                return p[0];
+            case ComponentUnsignedShort:
+            {
+                uint16_t value;
+                memcpy(&value, p, sizeof(value));
+                return value;
+            }
+            default:
+            {
+                uint32_t value;
+                memcpy(&value, p, sizeof(value));
+                return value;
+            }
+            }
+        }
+
+        Float3 GetBaseColor(const ImportContext &context, const JsonValue &materialIndex)
+        {
+            Float3 color = { 1.0f, 1.0f, 1.0f };
+            if (!materialIndex.IsValid())
+            {
+                return color;
+            }
+            JsonValue material = context.materials[GetIndex(materialIndex, context.materials.GetSize(), "material")];
+            JsonValue factor = material.Find("pbrMetallicRoughness").Find("baseColorFactor");
+            if (factor.GetSize() >= 3)
+            {
+                color = Float3{
+                    static_cast<float>(factor[0].GetNumber(1.0)),
+                    static_cast<float>(factor[1].GetNumber(1.0)),
+                    static_cast<float>(factor[2].GetNumber(1.0)),
+                };
+            }
+            return color;
+        }
+
+        // 先に全プリミティブの頂点数とインデックス数を数えて配列を一度だけ確保し、アクセサーから直接書き込みます。
+        size_t ImportMesh(const ImportContext &context, const JsonValue &mesh, GltfMesh &result)
+        {
+            result.name = mesh.Find("name").GetString();
+            JsonValue primitives = mesh.Find("primitives");
+            size_t skipped = 0;
+            uint64_t vertexTotal = 0;
+            uint64_t indexTotal = 0;
+            for (size_t p = 0; p < primitives.GetSize(); ++p)
+            {
+                JsonValue primitive = primitives[p];
+                if (primitive.Find("mode").GetNumber(ModeTriangles) != ModeTriangles)
+                {
+                    continue;
+                }
+                AccessorView positions = GetAccessor(context, primitive.Find("attributes").Find("POSITION"));
+                JsonValue indices = primitive.Find("indices");
+                vertexTotal += positions.count;
+                indexTotal += indices.IsValid() ? GetAccessor(context, indices).count : positions.count;
+            }
+            if (vertexTotal > UINT32_MAX || indexTotal > UINT32_MAX)
+            {
+                Fail("mesh " + result.name + " is too large");
+            }
+
+            MeshData &data = result.data;
+            data.vertices.resize(static_cast<size_t>(vertexTotal));
+            data.indices.resize(static_cast<size_t>(indexTotal));
+            data.submeshes.clear();
+            uint32_t vertexBase = 0;
+            uint32_t indexBase = 0;
+            for (size_t p = 0; p < primitives.GetSize(); ++p)
+            {
+                JsonValue primitive = primitives[p];
+                if (primitive.Find("mode").GetNumber(ModeTriangles) != ModeTriangles)
+                {
+                    skipped++;
+                    continue;
+                }
+                JsonValue attributes = primitive.Find("attributes");
+                AccessorView positions = GetAccessor(context, attributes.Find("POSITION"));
+                if (positions.components != 3)
+                {
+                    Fail("POSITION must be VEC3");
+                }
+                uint32_t vertexCount = static_cast<uint32_t>(positions.count);
+                VertexPositionColor *vertices = data.vertices.data() + vertexBase;
+                for (uint32_t i = 0; i < vertexCount; ++i)
+                {
+                    vertices[i].pos = ReadFloat3(positions, i);
+                }
+
+                JsonValue colorIndex = attributes.Find("COLOR_0");
+                if (colorIndex.IsValid())
+                {
+                    AccessorView colors = GetAccessor(context, colorIndex);
+                    if (colors.count < vertexCount || colors.components < 3)
+                    {
+                        Fail("COLOR_0 does not match POSITION");
+                    }
+                    for (uint32_t i = 0; i < vertexCount; ++i)
+                    {
+                        vertices[i].color = ReadFloat3(colors, i);
+                    }
+                }
+                else
+                {
+                    Float3 color = GetBaseColor(context, primitive.Find("material"));
+                    for (uint32_t i = 0; i < vertexCount; ++i)
+                    {
+                        vertices[i].color = color;
+                    }
+                }
+
+                uint32_t *indices = data.indices.data() + indexBase;
+                uint32_t indexCount;
+                JsonValue indicesIndex = primitive.Find("indices");
+                if (indicesIndex.IsValid())
+                {
+                    AccessorView view = GetAccessor(context, indicesIndex);
+                    if (view.components != 1 || (view.componentType != ComponentUnsignedByte
+                        && view.componentType != ComponentUnsignedShort && view.componentType != ComponentUnsignedInt))
+                    {
+                        Fail("indices must be unsigned SCALAR");
+                    }
+                    indexCount = static_cast<uint32_t>(view.count);
+                    for (uint32_t i = 0; i < indexCount; ++i)
+                    {
+                        uint32_t index = ReadIndex(view, i);
+                        if (index >= vertexCount)
+                        {
+                            Fail("index out of range in mesh " + result.name);
+                        }
+                        indices[i] = vertexBase + index;
+                    }
+                }
+                else
+                {
+                    indexCount = vertexCount;
+                    for (uint32_t i = 0; i < indexCount; ++i)
+                    {
+                        indices[i] = vertexBase + i;
+                    }
+                }
+
+                JsonValue material = primitive.Find("material");
+                MeshSubmesh submesh = {};
+                submesh.indexStart = indexBase;
+                submesh.indexCount = indexCount;
+                submesh.material = material.IsValid()
+                    ? static_cast<uint32_t>(GetIndex(material, context.materials.GetSize(), "material"))
+                    : GltfNoMaterial;
+                submesh.bounds = Aabb::Empty();
+                data.submeshes.push_back(submesh);
+                vertexBase += vertexCount;
+                indexBase += indexCount;
+            }
+            return skipped;
+        }
+
+        Float4x4 GetLocalTransform(const JsonValue &node)
+        {
+            JsonValue matrix = node.Find("matrix");
+            if (matrix.IsValid())
+            {
+                if (matrix.GetSize() != 16)
+                {
+                    Fail("node matrix must have 16 elements");
+                }
+                // glTF の行列は列優先です。
+                Float4x4 m;
+                for (size_t k = 0; k < 16; ++k)
+                {
+                    m.m[k % 4][k / 4] = static_cast<float>(matrix[k].GetNumber());
+                }
+                return m;
+            }
+
+            JsonValue t = node.Find("translation");
+            JsonValue r = node.Find("rotation");
+            JsonValue s = node.Find("scale");
+            float tx = static_cast<float>(t[0].GetNumber(0.0));
+            float ty = static_cast<float>(t[1].GetNumber(0.0));
+            float tz = static_cast<float>(t[2].GetNumber(0.0));
+            float x = static_cast<float>(r[0].GetNumber(0.0));
+            float y = static_cast<float>(r[1].GetNumber(0.0));
+            float z = static_cast<float>(r[2].GetNumber(0.0));
+            float w = static_cast<float>(r[3].GetNumber(1.0));
+            float sx = static_cast<float>(s[0].GetNumber(1.0));
+            float sy = static_cast<float>(s[1].GetNumber(1.0));
+            float sz = static_cast<float>(s[2].GetNumber(1.0));
+
+            // T * R * S
+            Float4x4 m = {
+                (1.0f - 2.0f * (y * y + z * z)) * sx, 2.0f * (x * y - z * w) * sy, 2.0f * (x * z + y * w) * sz, tx,
+                2.0f * (x * y + z * w) * sx, (1.0f - 2.0f * (x * x + z * z)) * sy, 2.0f * (y * z - x * w) * sz, ty,
+                2.0f * (x * z - y * w) * sx, 2.0f * (y * z + x * w) * sy, (1.0f - 2.0f * (x * x + y * y)) * sz, tz,
+                0.0f, 0.0f, 0.0f, 1.0f,
+            };
+            return m;
+        }
+
+        // children から親を求め、ルートから幅優先に並べます。親が複数あるノードや循環はエラーです。
+        void ImportNodes(const ImportContext &context, size_t meshCount, std::vector<GltfNode> &result)
+        {
+            JsonValue nodes = context.json.GetRoot().Find("nodes");
+            size_t count = nodes.GetSize();
+            std::vector<int32_t> parents(count, -1);
+            for (size_t i = 0; i < count; ++i)
+            {
+                JsonValue children = nodes[i].Find("children");
+                for (size_t c = 0; c < children.GetSize(); ++c)
+                {
+                    size_t child = GetIndex(children[c], count, "node");
+                    if (parents[child] >= 0)
+                    {
+                        Fail("node " + std::to_string(child) + " has more than one parent");
+                    }
+                    parents[child] = static_cast<int32_t>(i);
+                }
+            }
+
+            std::vector<size_t> order;
+            order.reserve(count);
+            for (size_t i = 0; i < count; ++i)
+            {
+                if (parents[i] < 0)
+                {
+                    order.push_back(i);
+                }
+            }
+            std::vector<int32_t> remap(count, -1);
+            for (size_t head = 0; head < order.size(); ++head)
+            {
+                size_t i = order[head];
+                remap[i] = static_cast<int32_t>(head);
+                JsonValue children = nodes[i].Find("children");
+                for (size_t c = 0; c < children.GetSize(); ++c)
+                {
+                    order.push_back(static_cast<size_t>(children[c].GetNumber()));
+                }
+            }
+            if (order.size() != count)
+            {
+                Fail("node hierarchy has a cycle");
+            }
+
+            result.resize(count);
+            for (size_t n = 0; n < count; ++n)
+            {
+                size_t i = order[n];
+                JsonValue node = nodes[i];
+                GltfNode &out = result[n];
+                out.name = node.Find("name").GetString();
+                out.parent = parents[i] < 0 ? -1 : remap[parents[i]];
+                JsonValue mesh = node.Find("mesh");
+                out.mesh = mesh.IsValid() ? static_cast<int32_t>(GetIndex(mesh, meshCount, "mesh")) : -1;
+                out.local = GetLocalTransform(node);
+            }
+        }
+    }
+
+    GltfModel ImportGltf(const std::string &path, ThreadPool &pool)
+    {
+        ImportContext context;
+        context.file = MappedFile(path);
+        BufferData binChunk;
+        ParseContainer(context, binChunk);
+
+        JsonValue root = context.json.GetRoot();
+        JsonValue version = root.Find("asset").Find("version");
+        if (version.GetString().compare(0, 2, "2.") != 0)
+        {
+            Fail("unsupported glTF version " + version.GetString());
+        }
+        LoadBuffers(context, path, binChunk);
+        context.accessors = root.Find("accessors");
+        context.bufferViews = root.Find("bufferViews");
+        context.materials = root.Find("materials");
+
+        GltfModel model;
+        JsonValue meshes = root.Find("meshes");
+        model.meshes.resize(meshes.GetSize());
+        std::atomic<size_t> skipped(0);
+        pool.ParallelFor(model.meshes.size(), 1, [&](size_t begin, size_t end)
+        {
+            for (size_t i = begin; i < end; ++i)
+            {
+                skipped += ImportMesh(context, meshes[i], model.meshes[i]);
+            }
+        });
+        model.skippedPrimitives = skipped.load();
+
+        ImportNodes(context, model.meshes.size(), model.nodes);
+        return model;
+    }
+
+    MeshData FlattenGltfModel(const GltfModel &model)
+    {
+        MeshData result;
+        std::vector<Float4x4> world(model.nodes.size());
+        std::vector<std::pair<const GltfMesh *, Float4x4>> instances;
+        for (size_t i = 0; i < model.nodes.size(); ++i)
+        {
+            const GltfNode &node = model.nodes[i];
+            world[i] = node.parent < 0 ? node.local : Multiply(world[node.parent], node.local);
+            if (node.mesh >= 0)
+            {
+                instances.emplace_back(&model.meshes[node.mesh], world[i]);
+            }
+        }
+        // ノードが無いファイルはメッシュをそのまま並べます。
+        if (model.nodes.empty())
+        {
+            for (const auto &mesh : model.meshes)
+            {
+                instances.emplace_back(&mesh, Float4x4::Identity());
+            }
+        }
+
+        size_t vertexTotal = 0;
+        size_t indexTotal = 0;
+        for (const auto &instance : instances)
+        {
+            vertexTotal += instance.first->data.vertices.size();
+            indexTotal += instance.first->data.indices.size();
+        }
+        if (vertexTotal > UINT32_MAX || indexTotal > UINT32_MAX)
+        {
+            Fail("model is too large to flatten");
+        }
+        result.vertices.reserve(vertexTotal);
+        result.indices.reserve(indexTotal);
+
+        for (const auto &instance : instances)
+        {
+            const MeshData &data = instance.first->data;
+            uint32_t vertexBase = static_cast<uint32_t>(result.vertices.size());
+            uint32_t indexBase = static_cast<uint32_t>(result.indices.size());
+            for (const auto &vertex : data.vertices)
+            {
+                result.vertices.push_back(VertexPositionColor{ TransformPoint(instance.second, vertex.pos), vertex.color });
+            }
+            for (uint32_t index : data.indices)
+            {
+                result.indices.push_back(vertexBase + index);
+            }
+            for (auto submesh : data.submeshes)
+            {
+                submesh.indexStart += indexBase;
+                result.submeshes.push_back(submesh);
+            }
+        }
+        return result;
+    }
+}
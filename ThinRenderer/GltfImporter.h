@@ -0,0 +1,52 @@
+﻿#pragma once
+#include "MeshFile.h"
+#include "MathTypes.h"
+#include "ThreadPool.h"
+#include <string>
+#include <vector>
+#include <cstdint>
+
+
+namespace thinr
+{
+    // マテリアルを指定していないプリミティブの MeshSubmesh::material。
+    const uint32_t GltfNoMaterial = UINT32_MAX;
+
+    struct GltfNode
+    {
+        std::string name;
+        // 親の GltfModel::nodes 内の番号。ルートは -1 です。親は必ず子より前にあります。
+        int32_t parent;
+        // glTF の meshes の番号。無ければ -1 です。
+        int32_t mesh;
+        // 親に対する変換。matrix か TRS から作ります。
+        Float4x4 local;
+    };
+
+    struct GltfMesh
+    {
+        std::string name;
+        // プリミティブごとに 1 つのサブメッシュです。material は glTF の materials の番号です。
+        MeshData data;
+    };
+
+    struct GltfModel
+    {
+        // glTF の meshes と同じ順番です。
+        std::vector<GltfMesh> meshes;
+        // 親が子より前になるよう並べ替えています。
+        std::vector<GltfNode> nodes;
+        // 三角形リスト以外なので読み込まなかったプリミティブの数。
+        size_t skippedPrimitives;
+    };
+
+    // glTF 2.0 のファイル (.gltf か .glb) からメッシュとノードの階層を読み込みます。
+    // 頂点は POSITION と COLOR_0 (無ければマテリアルの baseColorFactor) を VertexPositionColor にします。
+    // 外部の .bin と .glb はマップして、アクセサーから最終的な頂点とインデックスの配列に直接書き込みます。
+    // メッシュごとに pool で並列に変換します。座標系は変換しません (glTF も右手系です)。
+    // 読めない場合や内容が正しくない場合は std::runtime_error を送出します。
+    GltfModel ImportGltf(const std::string &path, ThreadPool &pool = ThreadPool::GetDefault());
+
+    // ノードのワールド変換を適用して、すべてのメッシュを 1 つにまとめます。WriteMeshFile で .tmesh にできます。
+    MeshData FlattenGltfModel(const GltfModel &model);
+}
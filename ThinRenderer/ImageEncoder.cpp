@@ -0,0 +1,537 @@
+﻿#include "pch.h"
+#include "ImageEncoder.h"
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <stdexcept>
+
+
+namespace thinr
+{
+    namespace
+    {
+        void PutU32BE(std::vector<uint8_t> &out, uint32_t v)
+        {
+            out.push_back(static_cast<uint8_t>(v >> 24));
+            out.push_back(static_cast<uint8_t>(v >> 16));
+            out.push_back(static_cast<uint8_t>(v >> 8));
+            out.push_back(static_cast<uint8_t>(v));
+        }
+
+        // 1 行を RGBA の順に取り出します。
+        void ReadRowRGBA(const ImageView &image, uint32_t y, uint8_t *dst)
+        {
+            const uint8_t *src = image.Row(y);
+            size_t bytes = static_cast<size_t>(image.width) * 4;
+            if (image.format == PixelFormat::R8G8B8A8_UNORM)
+            {
+                std::memcpy(dst, src, bytes);
+                return;
+            }
+            for (size_t i = 0; i < bytes; i += 4)
+            {
+                dst[i + 0] = src[i + 2];
+                dst[i + 1] = src[i + 1];
+                dst[i + 2] = src[i + 0];
+                dst[i + 3] = src[i + 3];
+            }
+        }
+
+        void CheckImage(const ImageView &image)
+        {
+            if (!image.data || image.width == 0 || image.height == 0)
+            {
+                throw std::invalid_argument("EncodeImage: empty image");
+            }
+        }
+
+        ///////////////////////////////////////////////////////////////////
+        // deflate (RFC 1951)
+        ///////////////////////////////////////////////////////////////////
+        class BitWriter
+        {
+        public:
+            explicit BitWriter(std::vector<uint8_t> &out) : m_out(out), m_bits(0), m_count(0) {}
+
+            // LSB から順に n ビット書き込みます。
+            void Put(uint32_t value, int n)
+            {
+                m_bits |= static_cast<uint64_t>(value) << m_count;
+                m_count += n;
+                while (m_count >= 8)
+                {
+                    m_out.push_back(static_cast<uint8_t>(m_bits));
+                    m_bits >>= 8;
+                    m_count -= 8;
+                }
+            }
+
+            void Flush()
+            {
+                if (m_count > 0)
+                {
+                    m_out.push_back(static_cast<uint8_t>(m_bits));
+                }
+                m_bits = 0;
+                m_count = 0;
+            }
+
+        private:
+            std::vector<uint8_t> &m_out;
+            uint64_t m_bits;
+            int m_count;
+        };
+
+        uint32_t ReverseBits(uint32_t code, int length)
+        {
+            uint32_t r = 0;
+            for (int i = 0; i < length; ++i)
+            {
+                r = (r << 1) | (code & 1);
+                code >>= 1;
+            }
+            return r;
+        }
+
+        const uint16_t LengthBase[29] = {
+            3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31,
+            35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258,
+        };
+        const uint8_t LengthExtra[29] = {
+            0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2,
+            3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0,
+        };
+        const uint16_t DistanceBase[30] = {
+            1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193,
+            257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097, 6145, 8193, 12289, 16385, 24577,
+        };
+        const uint8_t DistanceExtra[30] = {
+            0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6,
+            7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13,
+        };
+
+        // 固定ハフマン符号 (ビット反転済み) と長さ/距離コードの表。
+        struct FixedTables
+        {
+            uint16_t literalCode[288];
+            uint8_t literalLength[288];
+            uint8_t lengthSymbol[259];
+            uint8_t distanceSymbol[512];
+
+            FixedTables()
+            {
+                for (int s = 0; s < 288; ++s)
+                {
+                    uint32_t code;
+                    int length;
+                    if (s <= 143) { code = 0x30 + s; length = 8; }
+                    else if (s <= 255) { code = 0x190 + (s - 144); length = 9; }
+                    else if (s <= 279) { code = s - 256; length = 7; }
+                    else { code = 0xC0 + (s - 280); length = 8; }
+                    literalCode[s] = static_cast<uint16_t>(ReverseBits(code, length));
+                    literalLength[s] = static_cast<uint8_t>(length);
+                }
+                for (int len = 3; len <= 258; ++len)
+                {
+                    int s = 0;
+                    while (s < 28 && LengthBase[s + 1] <= len)
+                    {
+                        ++s;
+                    }
+                    lengthSymbol[len] = static_cast<uint8_t>(s);
+                }
+                // zlib と同じく、256 以下はそのまま、それ以上は 128 単位で引きます。
+                for (int d = 1; d <= 32768; ++d)
+                {
+                    int s = 0;
+                    while (s < 29 && DistanceBase[s + 1] <= d)
+                    {
+                        ++s;
+                    }
+                    if (d <= 256)
+                    {
+                        distanceSymbol[d - 1] = static_cast<uint8_t>(s);
+                    }
+                    else
+                    {
+                        distanceSymbol[256 + ((d - 1) >> 7)] = static_cast<uint8_t>(s);
+                    }
+                }
+            }
+
+            int DistanceSymbol(int distance) const
+            {
+                return distance <= 256 ? distanceSymbol[distance - 1] : distanceSymbol[256 + ((distance - 1) >> 7)];
+            }
+        };
+
+        const FixedTables &GetFixedTables()
+        {
+            static const FixedTables s_tables;
+            return s_tables;
+        }
+
+        void PutLiteral(BitWriter &writer, const FixedTables &tables, int symbol)
+        {
+            writer.Put(tables.literalCode[symbol], tables.literalLength[symbol]);
+        }
+
+        void PutMatch(BitWriter &writer, const FixedTables &tables, int length, int distance)
+        {
+            int ls = tables.lengthSymbol[length];
+            PutLiteral(writer, tables, 257 + ls);
+            if (LengthExtra[ls])
+            {
+                writer.Put(length - LengthBase[ls], LengthExtra[ls]);
+            }
+            int ds = tables.DistanceSymbol(distance);
+            writer.Put(ReverseBits(ds, 5), 5);
+            if (DistanceExtra[ds])
+            {
+                writer.Put(distance - DistanceBase[ds], DistanceExtra[ds]);
+            }
+        }
+
+        const int WindowSize = 32768;
+        const int HashBits = 15;
+        const int MinMatch = 3;
+        const int MaxMatch = 258;
+        const int MaxChain = 16;
+        const int NiceMatch = 128;
+
+        inline uint32_t Hash3(const uint8_t *p)
+        {
+            uint32_t v = p[0] | (p[1] << 8) | (p[2] << 16);
+            return (v * 2654435761u) >> (32 - HashBits);
+        }
+
+        void Deflate(const uint8_t *data, size_t size, std::vector<uint8_t> &out)
+        {
+            const FixedTables &tables = GetFixedTables();
+            BitWriter writer(out);
+            // BFINAL = 1, BTYPE = 01 (固定ハフマン)
+            writer.Put(1, 1);
+            writer.Put(1, 2);
+
+            std::vector<int32_t> head(1 << HashBits, -1);
+            std::vector<int32_t> prev(WindowSize, -1);
+            auto insert = [&](size_t pos)
+            {
+                uint32_t h = Hash3(data + pos);
+                prev[pos & (WindowSize - 1)] = head[h];
+                head[h] = static_cast<int32_t>(pos);
+            };
+
+            size_t pos = 0;
+            while (pos < size)
+            {
+                int bestLength = 0;
+                int bestDistance = 0;
+                if (pos + MinMatch <= size)
+                {
+                    int maxLength = static_cast<int>(std::min<size_t>(MaxMatch, size - pos));
+                    int32_t candidate = head[Hash3(data + pos)];
+                    for (int chain = 0; chain < MaxChain && candidate >= 0; ++chain)
+                    {
+                        int distance = static_cast<int>(pos - candidate);
+                        if (distance > WindowSize - 1)
+                        {
+                            break;
+                        }
+                        const uint8_t *a = data + candidate;
+                        const uint8_t *b = data + pos;
+                        if (a[bestLength] == b[bestLength])
+                        {
+                            int length = 0;
+                            while (length < maxLength && a[length] == b[length])
+                            {
+                                ++length;
+                            }
+                            if (length > bestLength)
+                            {
+                                bestLength = length;
+                                bestDistance = distance;
+                                if (length >= NiceMatch || length == maxLength)
+                                {
+                                    break;
+                                }
+                            }
+                        }
+                        candidate = prev[candidate & (WindowSize - 1)];
+                    }
+                }
+
+                if (bestLength >= MinMatch)
+                {
+                    PutMatch(writer, tables, bestLength, bestDistance);
+                    size_t end = pos + bestLength;
+                    for (; pos < end; ++pos)
+                    {
+                        if (pos + MinMatch <= size)
+                        {
+                            insert(pos);
+                        }
+                    }
+                }
+                else
+                {
+                    PutLiteral(writer, tables, data[pos]);
+                    if (pos + MinMatch <= size)
+                    {
+                        insert(pos);
+                    }
+                    ++pos;
+                }
+            }
+
+            PutLiteral(writer, tables, 256);
+            writer.Flush();
+        }
+
+        uint32_t Adler32(const uint8_t *data, size_t size)
+        {
+            uint32_t a = 1;
+            uint32_t b = 0;
+            while (size > 0)
+            {
+                size_t n = std::min<size_t>(size, 5552);
+                size -= n;
+                while (n--)
+                {
+                    a += *data++;
+                    b += a;
+                }
+                a %= 65521;
+                b %= 65521;
+            }
+            return (b << 16) | a;
+        }
+
+        ///////////////////////////////////////////////////////////////////
+        // PNG
+        ///////////////////////////////////////////////////////////////////
+        inline uint8_t Paeth(int a, int b, int c)
+        {
+            int p = a + b - c;
+            int pa = std::abs(p - a);
+            int pb = std::abs(p - b);
+            int pc = std::abs(p - c);
+            if (pa <= pb && pa <= pc) return static_cast<uint8_t>(a);
+            if (pb <= pc) return static_cast<uint8_t>(b);
+            return static_cast<uint8_t>(c);
+        }
+
+        // フィルター type を掛けた行を dst に書き、絶対値和 (フィルター選択の指標) を返します。
+        uint32_t FilterRow(int type, const uint8_t *row, const uint8_t *prior, size_t bytes, uint8_t *dst)
+        {
+            const size_t bpp = 4;
+            uint32_t sum = 0;
+            for (size_t i = 0; i < bytes; ++i)
+            {
+                int a = i >= bpp ? row[i - bpp] : 0;
+                int b = prior[i];
+                int c = i >= bpp ? prior[i - bpp] : 0;
+                uint8_t predictor;
+                switch (type)
+                {
+                case 0: predictor = 0; break;
+                case 1: predictor = static_cast<uint8_t>(a); break;
+                case 2: predictor = static_cast<uint8_t>(b); break;
+                case 3: predictor = static_cast<uint8_t>((a + b) >> 1); break;
+                default: predictor = Paeth(a, b, c); break;
+                }
+                uint8_t v = static_cast<uint8_t>(row[i] - predictor);
+                dst[i] = v;
+                sum += v < 128 ? v : 256 - v;
+            }
+            return sum;
+        }
+
+        void PutChunk(std::vector<uint8_t> &out, const char type[4], const uint8_t *data, size_t size)
+        {
+            PutU32BE(out, static_cast<uint32_t>(size));
+            size_t start = out.size();
+            out.insert(out.end(), type, type + 4);
+            out.insert(out.end(), data, data + size);
+            PutU32BE(out, Crc32(out.data() + start, size + 4));
+        }
+    }
+
+    uint32_t Crc32(const uint8_t *data, size_t size, uint32_t crc)
+    {
+        struct Table
+        {
+            uint32_t v[256];
+            Table()
+            {
+                for (uint32_t n = 0; n < 256; ++n)
+                {
+                    uint32_t c = n;
+                    for (int k = 0; k < 8; ++k)
+                    {
+                        c = (c & 1) ? 0xEDB88320u ^ (c >> 1) : c >> 1;
+                    }
+                    v[n] = c;
+                }
+            }
+        };
+        static const Table s_table;
+
+        crc = ~crc;
+        for (size_t i = 0; i < size; ++i)
+        {
+            crc = s_table.v[(crc ^ data[i]) & 0xFF] ^ (crc >> 8);
+        }
+        return ~crc;
+    }
+
+    void ZlibCompress(const uint8_t *data, size_t size, std::vector<uint8_t> &out)
+    {
+        // CMF = deflate / 32K window, FLG = 既定レベル (チェック ビット込み)
+        out.push_back(0x78);
+        out.push_back(0x9C);
+        Deflate(data, size, out);
+        PutU32BE(out, Adler32(data, size));
+    }
+
+    void EncodeQoi(const ImageView &image, std::vector<uint8_t> &out)
+    {
+        CheckImage(image);
+        out.clear();
+        out.reserve(14 + static_cast<size_t>(image.width) * image.height * 2 + 8);
+        out.insert(out.end(), { 'q', 'o', 'i', 'f' });
+        PutU32BE(out, image.width);
+        PutU32BE(out, image.height);
+        out.push_back(4); // RGBA
+        out.push_back(0); // sRGB
+
+        uint32_t index[64] = {};
+        uint8_t prev[4] = { 0, 0, 0, 255 };
+        int run = 0;
+        std::vector<uint8_t> row(static_cast<size_t>(image.width) * 4);
+        size_t pixelCount = static_cast<size_t>(image.width) * image.height;
+        size_t pixel = 0;
+        for (uint32_t y = 0; y < image.height; ++y)
+        {
+            ReadRowRGBA(image, y, row.data());
+            for (uint32_t x = 0; x < image.width; ++x, ++pixel)
+            {
+                const uint8_t *px = &row[x * 4];
+                bool last = pixel + 1 == pixelCount;
+                if (std::memcmp(px, prev, 4) == 0)
+                {
+                    ++run;
+                    if (run == 62 || last)
+                    {
+                        out.push_back(static_cast<uint8_t>(0xC0 | (run - 1)));
+                        run = 0;
+                    }
+                    continue;
+                }
+                if (run > 0)
+                {
+                    out.push_back(static_cast<uint8_t>(0xC0 | (run - 1)));
+                    run = 0;
+                }
+
+                uint32_t value;
+                std::memcpy(&value, px, 4);
+                int hash = (px[0] * 3 + px[1] * 5 + px[2] * 7 + px[3] * 11) % 64;
+                if (index[hash] == value)
+                {
+                    out.push_back(static_cast<uint8_t>(hash));
+                }
+                else
+                {
+                    index[hash] = value;
+                    if (px[3] == prev[3])
+                    {
+                        int dr = static_cast<int8_t>(px[0] - prev[0]);
+                        int dg = static_cast<int8_t>(px[1] - prev[1]);
+                        int db = static_cast<int8_t>(px[2] - prev[2]);
+                        int drdg = dr - dg;
+                        int dbdg = db - dg;
+                        if (dr >= -2 && dr <= 1 && dg >= -2 && dg <= 1 && db >= -2 && db <= 1)
+                        {
+                            out.push_back(static_cast<uint8_t>(0x40 | ((dr + 2) << 4) | ((dg + 2) << 2) | (db + 2)));
+                        }
+                        else if (dg >= -32 && dg <= 31 && drdg >= -8 && drdg <= 7 && dbdg >= -8 && dbdg <= 7)
+                        {
+                            out.push_back(static_cast<uint8_t>(0x80 | (dg + 32)));
+                            out.push_back(static_cast<uint8_t>(((drdg + 8) << 4) | (dbdg + 8)));
+                        }
+                        else
+                        {
+                            out.insert(out.end(), { 0xFE, px[0], px[1], px[2] });
+                        }
+                    }
+                    else
+                    {
+                        out.insert(out.end(), { 0xFF, px[0], px[1], px[2], px[3] });
+                    }
+                }
+                std::memcpy(prev, px, 4);
+            }
+        }
+        out.insert(out.end(), { 0, 0, 0, 0, 0, 0, 0, 1 });
+    }
+
+    void EncodePng(const ImageView &image, std::vector<uint8_t> &out)
+    {
+        CheckImage(image);
+        size_t rowBytes = static_cast<size_t>(image.width) * 4;
+
+        // 行ごとに 5 種類のフィルターを試し、絶対値和が最小のものを選びます (libpng と同じ方針)。
+        std::vector<uint8_t> filtered((rowBytes + 1) * image.height);
+        std::vector<uint8_t> current(rowBytes);
+        std::vector<uint8_t> prior(rowBytes, 0);
+        std::vector<uint8_t> candidate(rowBytes);
+        for (uint32_t y = 0; y < image.height; ++y)
+        {
+            ReadRowRGBA(image, y, current.data());
+            uint8_t *dst = &filtered[(rowBytes + 1) * y];
+            uint32_t best = FilterRow(0, current.data(), prior.data(), rowBytes, dst + 1);
+            dst[0] = 0;
+            for (int type = 1; type < 5; ++type)
+            {
+                uint32_t sum = FilterRow(type, current.data(), prior.data(), rowBytes, candidate.data());
+                if (sum < best)
+                {
+                    best = sum;
+                    dst[0] = static_cast<uint8_t>(type);
+                    std::copy(candidate.begin(), candidate.end(), dst + 1);
+                }
+            }
+            current.swap(prior);
+        }
+
+        std::vector<uint8_t> idat;
+        ZlibCompress(filtered.data(), filtered.size(), idat);
+
+        out.clear();
+        out.reserve(idat.size() + 64);
+        const uint8_t signature[8] = { 0x89, 'P', 'N', 'G', 0x0D, 0x0A, 0x1A, 0x0A };
+        out.insert(out.end(), signature, signature + 8);
+
+        std::vector<uint8_t> ihdr;
+        PutU32BE(ihdr, image.width);
+        PutU32BE(ihdr, image.height);
+        ihdr.insert(ihdr.end(), { 8, 6, 0, 0, 0 }); // 8bit, RGBA, deflate, 標準フィルター, インターレース無し
+        PutChunk(out, "IHDR", ihdr.data(), ihdr.size());
+        PutChunk(out, "IDAT", idat.data(), idat.size());
+        PutChunk(out, "IEND", nullptr, 0);
+    }
+
+    void EncodeImage(ImageFileFormat format, const ImageView &image, std::vector<uint8_t> &out)
+    {
+        switch (format)
+        {
+        case ImageFileFormat::QOI:
+            EncodeQoi(image, out);
+            break;
+        case ImageFileFormat::PNG:
+            EncodePng(image, out);
+            break;
+        }
+    }
+}
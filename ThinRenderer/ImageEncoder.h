@@ -0,0 +1,25 @@
+﻿#pragma once
+#include "RenderTarget.h"
+#include <vector>
+#include <cstdint>
+
+
+namespace thinr
+{
+    enum class ImageFileFormat
+    {
+        QOI,
+        PNG,
+    };
+
+    // WIC を使わない移植可能なエンコーダー。出力は常に RGBA 8bit です (BGRA 入力は並べ替えます)。
+    // out は clear してから書き込むので、使い回すとメモリ確保を避けられます。
+    void EncodeQoi(const ImageView &image, std::vector<uint8_t> &out);
+    void EncodePng(const ImageView &image, std::vector<uint8_t> &out);
+    void EncodeImage(ImageFileFormat format, const ImageView &image, std::vector<uint8_t> &out);
+
+    // zlib 形式 (RFC 1950) で圧縮します。固定ハフマン符号 + LZ77 の高速な実装です。
+    void ZlibCompress(const uint8_t *data, size_t size, std::vector<uint8_t> &out);
+
+    uint32_t Crc32(const uint8_t *data, size_t size, uint32_t crc = 0);
+}
@@ -0,0 +1,300 @@
+﻿#include "pch.h"
+#include "JobSystem.h"
+#include "Profiler.h"
+#include <algorithm>
+#include <climits>
+
+
+namespace thinr
+{
+    struct JobHandle::Job
+    {
+        std::function<void()> body;
+        // 完了していない依存先の数 + 1 (Schedule が依存先への登録を終えるまでの分)。0 になったらキューに入ります。
+        std::atomic<size_t> remaining;
+        std::atomic<bool> complete;
+        // complete を立てる前に書き込みます。
+        std::exception_ptr error;
+
+        // continuations と dependencyError を守ります。
+        std::mutex mutex;
+        // このジョブの完了を待っているジョブ。
+        std::vector<std::shared_ptr<Job>> continuations;
+        // 最初に失敗した依存先の例外。
+        std::exception_ptr dependencyError;
+
+        Job() : remaining(0), complete(false) {}
+    };
+
+    namespace
+    {
+        // 現在のスレッドがワーカーなら、そのジョブ システムとキューの番号。
+        thread_local JobSystem *t_system = nullptr;
+        thread_local unsigned t_index = UINT_MAX;
+    }
+
+    bool JobHandle::IsComplete() const
+    {
+        return !m_job || m_job->complete.load();
+    }
+
+    bool JobHandle::HasFailed() const
+    {
+        return m_job && m_job->complete.load() && m_job->error;
+    }
+
+    std::exception_ptr JobHandle::GetError() const
+    {
+        return IsComplete() && m_job ? m_job->error : nullptr;
+    }
+
+    JobSystem::JobSystem(unsigned threadCount)
+        : m_queued(0), m_nextQueue(0), m_waiters(0), m_quit(false), m_executed(0), m_stolen(0), m_skipped(0)
+    {
+        if (threadCount == 0)
+        {
+            threadCount = std::max(1u, std::thread::hardware_concurrency());
+        }
+        // キューはワーカーの起動前にすべて作っておきます (盗むときに配列を走査するため)。
+        for (unsigned i = 0; i < threadCount; ++i)
+        {
+            m_queues.emplace_back(new Worker());
+        }
+        for (unsigned i = 0; i < threadCount; ++i)
+        {
+            m_workers.emplace_back([this, i]() { WorkerLoop(i); });
+        }
+    }
+
+    JobSystem::~JobSystem()
+    {
+        {
+            std::lock_guard<std::mutex> lock(m_wakeMutex);
+            m_quit = true;
+        }
+        m_wake.notify_all();
+        for (auto &t : m_workers)
+        {
+            t.join();
+        }
+    }
+
+    JobSystem &JobSystem::GetDefault()
+    {
+        static JobSystem s_system;
+        return s_system;
+    }
+
+    JobHandle JobSystem::Schedule(std::function<void()> body, const JobHandle *dependencies, size_t dependencyCount)
+    {
+        auto job = std::make_shared<JobHandle::Job>();
+        job->body = std::move(body);
+        job->remaining = dependencyCount + 1;
+
+        for (size_t i = 0; i < dependencyCount; ++i)
+        {
+            const auto &dependency = dependencies[i].m_job;
+            bool pending = false;
+            if (dependency)
+            {
+                std::lock_guard<std::mutex> lock(dependency->mutex);
+                if (!dependency->complete.load())
+                {
+                    dependency->continuations.push_back(job);
+                    pending = true;
+                }
+            }
+            if (!pending)
+            {
+                if (dependency && dependency->error && !job->dependencyError)
+                {
+                    job->dependencyError = dependency->error;
+                }
+                job->remaining.fetch_sub(1);
+            }
+        }
+
+        if (job->remaining.fetch_sub(1) == 1)
+        {
+            Enqueue(job);
+        }
+        return JobHandle(job);
+    }
+
+    void JobSystem::Wait(const JobHandle &handle)
+    {
+        const auto &job = handle.m_job;
+        if (!job)
+        {
+            return;
+        }
+        unsigned self = t_system == this ? t_index : UINT_MAX;
+        while (!job->complete.load())
+        {
+            auto other = TakeJob(self);
+            if (other)
+            {
+                Execute(other);
+                continue;
+            }
+
+            // 実行できるジョブが無いので、他のワーカーが完了させるのを待ちます。
+            m_waiters.fetch_add(1);
+            {
+                std::unique_lock<std::mutex> lock(m_wakeMutex);
+                m_completed.wait(lock, [this, &job]() { return job->complete.load() || m_queued.load() > 0; });
+            }
+            m_waiters.fetch_sub(1);
+        }
+    }
+
+    JobSystemStats JobSystem::GetStats() const
+    {
+        JobSystemStats stats;
+        stats.executed = m_executed.load();
+        stats.stolen = m_stolen.load();
+        stats.skipped = m_skipped.load();
+        return stats;
+    }
+
+    void JobSystem::Enqueue(const std::shared_ptr<JobHandle::Job> &job)
+    {
+        // ワーカーが入れたジョブはそのワーカーのキューに、それ以外は順番に配ります。
+        unsigned index = t_system == this
+            ? t_index
+            : m_nextQueue.fetch_add(1) % static_cast<unsigned>(m_queues.size());
+
+        // 先に数を増やしておけば、取り出したワーカーが減らしても負になりません。
+        m_queued.fetch_add(1);
+        {
+            std::lock_guard<std::mutex> lock(m_queues[index]->mutex);
+            m_queues[index]->jobs.push_back(job);
+        }
+        {
+            std::lock_guard<std::mutex> lock(m_wakeMutex);
+        }
+        m_wake.notify_one();
+        if (m_waiters.load() > 0)
+        {
+            m_completed.notify_all();
+        }
+    }
+
+    // self のキューの後ろ (最も新しいジョブ) から取り、空なら他のキューの前 (最も古いジョブ) から盗みます。
+    std::shared_ptr<JobHandle::Job> JobSystem::TakeJob(unsigned self)
+    {
+        unsigned count = static_cast<unsigned>(m_queues.size());
+        if (self < count)
+        {
+            Worker &own = *m_queues[self];
+            std::lock_guard<std::mutex> lock(own.mutex);
+            if (!own.jobs.empty())
+            {
+                auto job = std::move(own.jobs.back());
+                own.jobs.pop_back();
+                m_queued.fetch_sub(1);
+                return job;
+            }
+        }
+
+        unsigned start = self < count ? self + 1 : m_nextQueue.load();
+        for (unsigned i = 0; i < count; ++i)
+        {
+            unsigned victim = (start + i) % count;
+            if (victim == self)
+            {
+                continue;
+            }
+            Worker &other = *m_queues[victim];
+            std::lock_guard<std::mutex> lock(other.mutex);
+            if (!other.jobs.empty())
+            {
+                auto job = std::move(other.jobs.front());
+                other.jobs.pop_front();
+                m_queued.fetch_sub(1);
+                m_stolen.fetch_add(1);
+                return job;
+            }
+        }
+        return nullptr;
+    }
+
+    void JobSystem::Execute(const std::shared_ptr<JobHandle::Job> &job)
+    {
+        if (job->dependencyError)
+        {
+            job->error = job->dependencyError;
+            m_skipped.fetch_add(1);
+        }
+        else
+        {
+            try
+            {
+                job->body();
+            }
+            catch (...)
+            {
+                job->error = std::current_exception();
+            }
+            m_executed.fetch_add(1);
+        }
+        // キャプチャした資源をすぐに解放します。
+        job->body = nullptr;
+        Complete(job);
+    }
+
+    void JobSystem::Complete(const std::shared_ptr<JobHandle::Job> &job)
+    {
+        std::vector<std::shared_ptr<JobHandle::Job>> continuations;
+        {
+            std::lock_guard<std::mutex> lock(job->mutex);
+            job->complete.store(true);
+            continuations.swap(job->continuations);
+        }
+
+        for (const auto &continuation : continuations)
+        {
+            if (job->error)
+            {
+                std::lock_guard<std::mutex> lock(continuation->mutex);
+                if (!continuation->dependencyError)
+                {
+                    continuation->dependencyError = job->error;
+                }
+            }
+            if (continuation->remaining.fetch_sub(1) == 1)
+            {
+                Enqueue(continuation);
+            }
+        }
+
+        if (m_waiters.load() > 0)
+        {
+            std::lock_guard<std::mutex> lock(m_wakeMutex);
+            m_completed.notify_all();
+        }
+    }
+
+    void JobSystem::WorkerLoop(unsigned index)
+    {
+        THINR_PROFILE_THREAD("JobSystem worker");
+        t_system = this;
+        t_index = index;
+        for (;;)
+        {
+            auto job = TakeJob(index);
+            if (job)
+            {
+                Execute(job);
+                continue;
+            }
+
+            std::unique_lock<std::mutex> lock(m_wakeMutex);
+            m_wake.wait(lock, [this]() { return m_quit || m_queued.load() > 0; });
+            if (m_quit && m_queued.load() == 0)
+            {
+                return;
+            }
+        }
+    }
+}
@@ -0,0 +1,113 @@
+﻿#pragma once
+#include <functional>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <deque>
+#include <exception>
+#include <initializer_list>
+#include <memory>
+#include <vector>
+
+
+namespace thinr
+{
+    class JobSystem;
+
+    // Schedule したジョブの完了を調べるためのハンドル。コピーできます。
+    class JobHandle
+    {
+    public:
+        JobHandle() {}
+
+        bool IsValid() const { return m_job != nullptr; }
+        // 空のハンドルは完了済みとして扱います。
+        bool IsComplete() const;
+        // 完了したジョブが例外を投げた (依存先が失敗して実行されなかった場合を含む) か。
+        bool HasFailed() const;
+        // ジョブが投げた例外。失敗していなければ nullptr です。
+        std::exception_ptr GetError() const;
+
+    private:
+        friend class JobSystem;
+        struct Job;
+        explicit JobHandle(const std::shared_ptr<Job> &job) : m_job(job) {}
+
+        std::shared_ptr<Job> m_job;
+    };
+
+    struct JobSystemStats
+    {
+        uint64_t executed;
+        // 他のワーカーのキューから取って実行した数。
+        uint64_t stolen;
+        // 依存先が失敗したので実行しなかった数。
+        uint64_t skipped;
+    };
+
+    // 依存関係を持つ小さなジョブを実行するワーク スティーリングのスケジューラー。
+    // ワーカーはそれぞれ自分のキューを持ち、新しいジョブを後ろから取り、空になったら他のワーカーのキューの前から盗みます。
+    // 依存先がすべて完了したジョブは、最後に完了させたワーカーのキューに入るので、続きの処理が同じスレッドで進みます。
+    // ThreadPool::ParallelFor は呼び出し元も参加する一括の並列ループ用で、こちらはファイルの読み込みのように
+    // 待ちを含む処理を大量に非同期で流す用途に使います。
+    class JobSystem
+    {
+    public:
+        // threadCount が 0 の場合は std::thread::hardware_concurrency を使用します。
+        explicit JobSystem(unsigned threadCount = 0);
+        // キューに残ったジョブをすべて実行してから終了します。
+        ~JobSystem();
+        JobSystem(const JobSystem &) = delete;
+        JobSystem &operator=(const JobSystem &) = delete;
+
+        unsigned GetWorkerCount() const { return static_cast<unsigned>(m_workers.size()); }
+
+        // dependencies がすべて完了したら body をワーカーで実行します。依存先のどれかが失敗した場合、body は呼ばずに
+        // 同じ例外で失敗します。どのスレッドからでも、ジョブの中からでも呼べます。
+        JobHandle Schedule(std::function<void()> body, const JobHandle *dependencies, size_t dependencyCount);
+        JobHandle Schedule(std::function<void()> body, std::initializer_list<JobHandle> dependencies = {})
+        {
+            return Schedule(std::move(body), dependencies.begin(), dependencies.size());
+        }
+
+        // 完了するまで待ちます。待つ間は呼び出し元スレッドもジョブを実行します。
+        void Wait(const JobHandle &job);
+
+        JobSystemStats GetStats() const;
+
+        // プロセス共有のジョブ システム。
+        static JobSystem &GetDefault();
+
+    private:
+        struct Worker
+        {
+            std::mutex mutex;
+            std::deque<std::shared_ptr<JobHandle::Job>> jobs;
+        };
+
+        void WorkerLoop(unsigned index);
+        void Enqueue(const std::shared_ptr<JobHandle::Job> &job);
+        std::shared_ptr<JobHandle::Job> TakeJob(unsigned self);
+        void Execute(const std::shared_ptr<JobHandle::Job> &job);
+        void Complete(const std::shared_ptr<JobHandle::Job> &job);
+
+        std::vector<std::unique_ptr<Worker>> m_queues;
+        std::vector<std::thread> m_workers;
+
+        // キューに入っているジョブの数。0 ならワーカーは m_wake で眠ります。
+        std::atomic<size_t> m_queued;
+        // ワーカー以外のスレッドから入れるキューを順番に選ぶためのカウンター。
+        std::atomic<unsigned> m_nextQueue;
+        std::mutex m_wakeMutex;
+        std::condition_variable m_wake;
+        // Wait で眠っているスレッドを、ジョブの完了時に起こします。
+        std::condition_variable m_completed;
+        std::atomic<unsigned> m_waiters;
+        bool m_quit;
+
+        std::atomic<uint64_t> m_executed;
+        std::atomic<uint64_t> m_stolen;
+        std::atomic<uint64_t> m_skipped;
+    };
+}
@@ -0,0 +1,488 @@
+﻿#include "pch.h"
+#include "Json.h"
+#include <cstdlib>
+#include <cstring>
+#include <stdexcept>
+
+
+namespace thinr
+{
+    class JsonDocument::Parser
+    {
+    public:
+        Parser(JsonDocument &document, const char *text, size_t length)
+            : m_document(document), m_begin(text), m_current(text), m_end(text + length)
+        {
+        }
+
+        void Run()
+        {
+            SkipSpace();
+            ParseValue(0);
+            SkipSpace();
+            if (m_current != m_end)
+            {
+                Fail("unexpected character after the root value");
+            }
+        }
+
+    private:
+        [[noreturn]] void Fail(const char *message) const
+        {
+            throw std::runtime_error(std::string("JsonDocument: ") + message
+                + " at offset " + std::to_string(m_current - m_begin));
+        }
+
+        void SkipSpace()
+        {
+            while (m_current != m_end && (*m_current == ' ' || *m_current == '\t' || *m_current == '\n' || *m_current == '\r'))
+            {
+                ++m_current;
+            }
+        }
+
+        bool Consume(const char *literal)
+        {
+            size_t length = strlen(literal);
+            if (static_cast<size_t>(m_end - m_current) < length || memcmp(m_current, literal, length) != 0)
+            {
+                return false;
+            }
+            m_current += length;
+            return true;
+        }
+
+        uint32_t AddValue(JsonType type)
+        {
+            if (m_document.m_values.size() >= UINT32_MAX)
+            {
+                Fail("too many values");
+            }
+            Value value = {};
+            value.type = type;
+            m_document.m_values.push_back(value);
+            return static_cast<uint32_t>(m_document.m_values.size() - 1);
+        }
+
+        uint32_t ParseValue(uint32_t depth)
+        {
+            if (m_current == m_end)
+            {
+                Fail("unexpected end of input");
+            }
+            switch (*m_current)
+            {
+            case '{':
+                return ParseContainer(JsonType::Object, depth);
+            case '[':
+                return ParseContainer(JsonType::Array, depth);
+            case '"':
+            {
+                uint32_t index = AddValue(JsonType::String);
+                uint32_t offset;
+                uint32_t length;
+                ParseString(offset, length);
+                m_document.m_values[index].offset = offset;
+                m_document.m_values[index].length = length;
+                return index;
+            }
+            case 't':
+            case 'f':
+            {
+                bool boolean = *m_current == 't';
+                if (!Consume(boolean ? "true" : "false"))
+                {
+                    Fail("invalid literal");
+                }
+                uint32_t index = AddValue(JsonType::Bool);
+                m_document.m_values[index].boolean = boolean;
+                return index;
+            }
+            case 'n':
+                if (!Consume("null"))
+                {
+                    Fail("invalid literal");
+                }
+                return AddValue(JsonType::Null);
+            default:
+            {
+                double number = ParseNumber();
+                uint32_t index = AddValue(JsonType::Number);
+                m_document.m_values[index].number = number;
+                return index;
+            }
+            }
+        }
+
+        // 子の番号はいったん m_scratch に積み、閉じたときにまとめて m_children に移します。
+        // 入れ子の子は先に閉じるので、m_scratch の末尾は常にこのコンテナーの子です。
+        uint32_t ParseContainer(JsonType type, uint32_t depth)
+        {
+            if (depth >= MaxDepth)
+            {
+                Fail("nesting too deep");
+            }
+            uint32_t index = AddValue(type);
+            size_t scratchStart = m_scratch.size();
+            char close = type == JsonType::Object ? '}' : ']';
+            ++m_current;
+            SkipSpace();
+            if (m_current != m_end && *m_current == close)
+            {
+                ++m_current;
+            }
+            else
+            {
+                for (;;)
+                {
+                    uint32_t nameOffset = 0;
+                    uint32_t nameLength = 0;
+                    if (type == JsonType::Object)
+                    {
+                        if (m_current == m_end || *m_current != '"')
+                        {
+                            Fail("expected a member name");
+                        }
+                        ParseString(nameOffset, nameLength);
+                        SkipSpace();
+                        if (m_current == m_end || *m_current != ':')
+                        {
+                            Fail("expected ':'");
+                        }
+                        ++m_current;
+                        SkipSpace();
+                    }
+                    uint32_t child = ParseValue(depth + 1);
+                    m_document.m_values[child].nameOffset = nameOffset;
+                    m_document.m_values[child].nameLength = nameLength;
+                    m_scratch.push_back(child);
+
+                    SkipSpace();
+                    if (m_current == m_end)
+                    {
+                        Fail("unexpected end of input");
+                    }
+                    if (*m_current == close)
+                    {
+                        ++m_current;
+                        break;
+                    }
+                    if (*m_current != ',')
+                    {
+                        Fail("expected ',' or the end of the container");
+                    }
+                    ++m_current;
+                    SkipSpace();
+                }
+            }
+
+            Value &value = m_document.m_values[index];
+            value.offset = static_cast<uint32_t>(m_document.m_children.size());
+            value.length = static_cast<uint32_t>(m_scratch.size() - scratchStart);
+            m_document.m_children.insert(m_document.m_children.end(), m_scratch.begin() + scratchStart, m_scratch.end());
+            m_scratch.resize(scratchStart);
+            return index;
+        }
+
+        unsigned ParseHex4()
+        {
+            if (m_end - m_current < 4)
+            {
+                Fail("invalid escape");
+            }
+            unsigned code = 0;
+            for (int i = 0; i < 4; ++i)
+            {
+                char c = *m_current++;
+                code <<= 4;
+                if (c >= '0' && c <= '9')
+                {
+                    code |= c - '0';
+                }
+                else if (c >= 'a' && c <= 'f')
+                {
+                    code |= c - 'a' + 10;
+                }
+                else if (c >= 'A' && c <= 'F')
+                {
+                    code |= c - 'A' + 10;
+                }
+                else
+                {
+                    Fail("invalid escape");
+                }
+            }
+            return code;
+        }
+
+        void AppendUtf8(unsigned code)
+        {
+            std::string &out = m_document.m_strings;
+            if (code < 0x80)
+            {
+                out += static_cast<char>(code);
+            }
+            else if (code < 0x800)
+            {
+                out += static_cast<char>(0xC0 | (code >> 6));
+                out += static_cast<char>(0x80 | (code & 0x3F));
+            }
+            else if (code < 0x10000)
+            {
+                out += static_cast<char>(0xE0 | (code >> 12));
+                out += static_cast<char>(0x80 | ((code >> 6) & 0x3F));
+                out += static_cast<char>(0x80 | (code & 0x3F));
+            }
+            else
+            {
+                out += static_cast<char>(0xF0 | (code >> 18));
+                out += static_cast<char>(0x80 | ((code >> 12) & 0x3F));
+                out += static_cast<char>(0x80 | ((code >> 6) & 0x3F));
+                out += static_cast<char>(0x80 | (code & 0x3F));
+            }
+        }
+
+        // m_current は '"' を指しています。UTF-8 の検証はせずにそのまま写します。
+        void ParseString(uint32_t &offset, uint32_t &length)
+        {
+            std::string &out = m_document.m_strings;
+            size_t start = out.size();
+            ++m_current;
+            for (;;)
+            {
+                // エスケープの無い部分はまとめて写します。
+                const char *run = m_current;
+                while (m_current != m_end && *m_current != '"' && *m_current != '\\' && static_cast<unsigned char>(*m_current) >= 0x20)
+                {
+                    ++m_current;
+                }
+                out.append(run, m_current);
+                if (m_current == m_end)
+                {
+                    Fail("unterminated string");
+                }
+                char c = *m_current++;
+                if (c == '"')
+                {
+                    break;
+                }
+                if (c != '\\')
+                {
+                    --m_current;
+                    Fail("control character in string");
+                }
+                if (m_current == m_end)
+                {
+                    Fail("unterminated string");
+                }
+                switch (*m_current++)
+                {
+                case '"': out += '"'; break;
+                case '\\': out += '\\'; break;
+                case '/': out += '/'; break;
+                case 'b': out += '\b'; break;
+                case 'f': out += '\f'; break;
+                case 'n': out += '\n'; break;
+                case 'r': out += '\r'; break;
+                case 't': out += '\t'; break;
+                case 'u':
+                {
+                    unsigned code = ParseHex4();
+                    // サロゲート ペアを 1 つのコード ポイントにします。対になっていないものは U+FFFD にします。
+                    if (code >= 0xD800 && code < 0xDC00)
+                    {
+                        if (m_end - m_current >= 6 && m_current[0] == '\\' && m_current[1] == 'u')
+                        {
+                            m_current += 2;
+                            unsigned low = ParseHex4();
+                            code = low >= 0xDC00 && low < 0xE000
+                                ? 0x10000 + ((code - 0xD800) << 10) + (low - 0xDC00)
+                                : 0xFFFD;
+                        }
+                        else
+                        {
+                            code = 0xFFFD;
+                        }
+                    }
+                    else if (code >= 0xDC00 && code < 0xE000)
+                    {
+                        code = 0xFFFD;
+                    }
+                    AppendUtf8(code);
+                    break;
+                }
+                default:
+                    Fail("invalid escape");
+                }
+            }
+            if (out.size() > UINT32_MAX)
+            {
+                Fail("strings too large");
+            }
+            offset = static_cast<uint32_t>(start);
+            length = static_cast<uint32_t>(out.size() - start);
+        }
+
+        // 文法を確かめてから strtod で変換します。入力は '\0' で終わっていないので、数値の部分だけを写します。
+        double ParseNumber()
+        {
+            const char *start = m_current;
+            if (m_current != m_end && *m_current == '-')
+            {
+                ++m_current;
+            }
+            if (m_current == m_end || !IsDigit(*m_current))
+            {
+                Fail("invalid value");
+            }
+            if (*m_current == '0')
+            {
+                ++m_current;
+            }
+            else
+            {
+                SkipDigits();
+            }
+            if (m_current != m_end && *m_current == '.')
+            {
+                ++m_current;
+                if (m_current == m_end || !IsDigit(*m_current))
+                {
+                    Fail("invalid number");
+                }
+                SkipDigits();
+            }
+            if (m_current != m_end && (*m_current == 'e' || *m_current == 'E'))
+            {
+                ++m_current;
+                if (m_current != m_end && (*m_current == '+' || *m_current == '-'))
+                {
+                    ++m_current;
+                }
+                if (m_current == m_end || !IsDigit(*m_current))
+                {
+                    Fail("invalid number");
+                }
+                SkipDigits();
+            }
+
+            char buffer[64];
+            size_t length = static_cast<size_t>(m_current - start);
+            if (length < sizeof(buffer))
+            {
+                memcpy(buffer, start, length);
+                buffer[length] = '\0';
+                return strtod(buffer, nullptr);
+            }
+            return strtod(std::string(start, m_current).c_str(), nullptr);
+        }
+
+        static bool IsDigit(char c)
+        {
+            return c >= '0' && c <= '9';
+        }
+
+        void SkipDigits()
+        {
+            while (m_current != m_end && IsDigit(*m_current))
+            {
+                ++m_current;
+            }
+        }
+
+        JsonDocument &m_document;
+        const char *m_begin;
+        const char *m_current;
+        const char *m_end;
+        std::vector<uint32_t> m_scratch;
+    };
+
+    void JsonDocument::Parse(const char *text, size_t length)
+    {
+        m_values.clear();
+        m_children.clear();
+        m_strings.clear();
+        try
+        {
+            Parser(*this, text, length).Run();
+        }
+        catch (...)
+        {
+            m_values.clear();
+            m_children.clear();
+            m_strings.clear();
+            throw;
+        }
+    }
+
+    JsonType JsonValue::GetType() const
+    {
+        return IsValid() ? m_document->m_values[m_index].type : JsonType::Null;
+    }
+
+    bool JsonValue::GetBool(bool defaultValue) const
+    {
+        return IsValid() && GetType() == JsonType::Bool ? m_document->m_values[m_index].boolean : defaultValue;
+    }
+
+    double JsonValue::GetNumber(double defaultValue) const
+    {
+        return IsNumber() ? m_document->m_values[m_index].number : defaultValue;
+    }
+
+    std::string JsonValue::GetString(const std::string &defaultValue) const
+    {
+        if (!IsString())
+        {
+            return defaultValue;
+        }
+        const auto &value = m_document->m_values[m_index];
+        return m_document->m_strings.substr(value.offset, value.length);
+    }
+
+    size_t JsonValue::GetSize() const
+    {
+        return IsArray() || IsObject() ? m_document->m_values[m_index].length : 0;
+    }
+
+    JsonValue JsonValue::operator[](size_t i) const
+    {
+        if (i >= GetSize())
+        {
+            return JsonValue();
+        }
+        const auto &value = m_document->m_values[m_index];
+        return JsonValue(m_document, m_document->m_children[value.offset + i]);
+    }
+
+    JsonValue JsonValue::Find(const char *name) const
+    {
+        if (!IsObject())
+        {
+            return JsonValue();
+        }
+        size_t nameLength = strlen(name);
+        const auto &value = m_document->m_values[m_index];
+        for (uint32_t i = 0; i < value.length; ++i)
+        {
+            uint32_t child = m_document->m_children[value.offset + i];
+            const auto &member = m_document->m_values[child];
+            if (member.nameLength == nameLength
+                && memcmp(m_document->m_strings.data() + member.nameOffset, name, nameLength) == 0)
+            {
+                return JsonValue(m_document, child);
+            }
+        }
+        return JsonValue();
+    }
+
+    std::string JsonValue::GetName() const
+    {
+        if (!IsValid())
+        {
+            return std::string();
+        }
+        const auto &value = m_document->m_values[m_index];
+        return m_document->m_strings.substr(value.nameOffset, value.nameLength);
+    }
+}
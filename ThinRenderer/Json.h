@@ -0,0 +1,96 @@
+﻿#pragma once
+#include <string>
+#include <vector>
+#include <cstddef>
+#include <cstdint>
+
+
+namespace thinr
+{
+    class JsonDocument;
+
+    enum class JsonType : uint8_t
+    {
+        Null,
+        Bool,
+        Number,
+        String,
+        Array,
+        Object,
+    };
+
+    // JsonDocument の値への軽い参照。コピーして使います。文書より長く保持しないでください。
+    // 見つからない値は IsValid が false の値として返るので、Find を続けて呼んでも例外になりません。
+    class JsonValue
+    {
+    public:
+        JsonValue() : m_document(nullptr), m_index(0) {}
+
+        bool IsValid() const { return m_document != nullptr; }
+        JsonType GetType() const;
+        bool IsNumber() const { return IsValid() && GetType() == JsonType::Number; }
+        bool IsString() const { return IsValid() && GetType() == JsonType::String; }
+        bool IsArray() const { return IsValid() && GetType() == JsonType::Array; }
+        bool IsObject() const { return IsValid() && GetType() == JsonType::Object; }
+
+        // 型が違う場合や無効な値の場合は defaultValue を返します。
+        bool GetBool(bool defaultValue = false) const;
+        double GetNumber(double defaultValue = 0.0) const;
+        std::string GetString(const std::string &defaultValue = std::string()) const;
+
+        // 配列とオブジェクトの要素数。それ以外は 0 です。
+        size_t GetSize() const;
+        // 配列とオブジェクトの i 番目の要素。範囲外なら無効な値です。
+        JsonValue operator[](size_t i) const;
+        // オブジェクトのメンバー。無ければ無効な値です。メンバーの数に比例した時間がかかります。
+        JsonValue Find(const char *name) const;
+        // オブジェクトのメンバーの名前。メンバーでなければ空です。
+        std::string GetName() const;
+
+    private:
+        friend class JsonDocument;
+        JsonValue(const JsonDocument *document, uint32_t index) : m_document(document), m_index(index) {}
+
+        const JsonDocument *m_document;
+        uint32_t m_index;
+    };
+
+    // RFC 8259 の JSON を読み込んだ読み取り専用の文書。値は 1 つの配列に並べ、子は番号の範囲で持つので、
+    // 値ごとのメモリ確保はありません。読み込んだ後は複数のスレッドから同時に参照できます。
+    class JsonDocument
+    {
+    public:
+        // 入れ子の深さの上限。これより深い文書はエラーになります (再帰で解析するため)。
+        static const uint32_t MaxDepth = 256;
+
+        JsonDocument() {}
+        // text は終端の '\0' が無くてもかまいません。正しくない場合は std::runtime_error を送出します。
+        JsonDocument(const char *text, size_t length) { Parse(text, length); }
+
+        void Parse(const char *text, size_t length);
+        JsonValue GetRoot() const { return m_values.empty() ? JsonValue() : JsonValue(this, 0); }
+
+    private:
+        friend class JsonValue;
+
+        struct Value
+        {
+            JsonType type;
+            bool boolean;
+            // オブジェクトのメンバーなら、名前の m_strings 内の位置と長さ。
+            uint32_t nameOffset;
+            uint32_t nameLength;
+            // 文字列なら m_strings 内の位置と長さ、配列とオブジェクトなら m_children 内の位置と要素数。
+            uint32_t offset;
+            uint32_t length;
+            double number;
+        };
+
+        class Parser;
+
+        std::vector<Value> m_values;
+        std::vector<uint32_t> m_children;
+        // エスケープを戻した文字列をつなげたもの。
+        std::string m_strings;
+    };
+}
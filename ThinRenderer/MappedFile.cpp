@@ -0,0 +1,110 @@
+﻿#include "pch.h"
+#include "MappedFile.h"
+#include "FileSystem.h"
+#include <stdexcept>
+#ifndef _WIN32
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+
+namespace thinr
+{
+    MappedFile::MappedFile(const std::string &path)
+        : m_data(nullptr), m_size(0)
+    {
+#ifdef _WIN32
+        // UWP でも使えるように CreateFile2 と *FromApp の API を使います。
+        HANDLE file = CreateFile2(ToWidePath(path).c_str(), GENERIC_READ, FILE_SHARE_READ, OPEN_EXISTING, nullptr);
+        if (file == INVALID_HANDLE_VALUE)
+        {
+            throw std::runtime_error("MappedFile: cannot open " + path);
+        }
+        LARGE_INTEGER size;
+        if (!GetFileSizeEx(file, &size))
+        {
+            CloseHandle(file);
+            throw std::runtime_error("MappedFile: cannot get the size of " + path);
+        }
+        if (size.QuadPart > 0)
+        {
+            HANDLE mapping = CreateFileMappingFromApp(file, nullptr, PAGE_READONLY, 0, nullptr);
+            // ビューがマッピングを参照するので、ハンドルはすぐに閉じられます。
+            void *view = mapping ? MapViewOfFileFromApp(mapping, FILE_MAP_READ, 0, 0) : nullptr;
+            if (mapping)
+            {
+                CloseHandle(mapping);
+            }
+            if (!view)
+            {
+                CloseHandle(file);
+                throw std::runtime_error("MappedFile: cannot map " + path);
+            }
+            m_data = static_cast<const uint8_t *>(view);
+            m_size = static_cast<size_t>(size.QuadPart);
+        }
+        CloseHandle(file);
+#else
+        int file = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+        if (file < 0)
+        {
+            throw std::runtime_error("MappedFile: cannot open " + path);
+        }
+        struct stat status;
+        if (fstat(file, &status) != 0)
+        {
+            close(file);
+            throw std::runtime_error("MappedFile: cannot get the size of " + path);
+        }
+        if (status.st_size > 0)
+        {
+            void *view = mmap(nullptr, static_cast<size_t>(status.st_size), PROT_READ, MAP_PRIVATE, file, 0);
+            if (view == MAP_FAILED)
+            {
+                close(file);
+                throw std::runtime_error("MappedFile: cannot map " + path);
+            }
+            m_data = static_cast<const uint8_t *>(view);
+            m_size = static_cast<size_t>(status.st_size);
+        }
+        // マップは記述子を閉じても残ります。
+        close(file);
+#endif
+    }
+
+    MappedFile::MappedFile(MappedFile &&other)
+        : m_data(other.m_data), m_size(other.m_size)
+    {
+        other.m_data = nullptr;
+        other.m_size = 0;
+    }
+
+    MappedFile &MappedFile::operator=(MappedFile &&other)
+    {
+        if (this != &other)
+        {
+            Close();
+            m_data = other.m_data;
+            m_size = other.m_size;
+            other.m_data = nullptr;
+            other.m_size = 0;
+        }
+        return *this;
+    }
+
+    void MappedFile::Close()
+    {
+        if (m_data)
+        {
+#ifdef _WIN32
+            UnmapViewOfFile(m_data);
+#else
+            munmap(const_cast<uint8_t *>(m_data), m_size);
+#endif
+        }
+        m_data = nullptr;
+        m_size = 0;
+    }
+}
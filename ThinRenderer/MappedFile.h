@@ -0,0 +1,33 @@
+﻿#pragma once
+#include <string>
+#include <cstddef>
+#include <cstdint>
+
+
+namespace thinr
+{
+    // ファイル全体を読み取り専用でメモリにマップします。ページは触れたときに OS が読み込むので、
+    // 開くだけではファイルを読みません。マップした内容は閉じるまで有効です。
+    class MappedFile
+    {
+    public:
+        MappedFile() : m_data(nullptr), m_size(0) {}
+        // path (UTF-8) を開きます。開けない場合は std::runtime_error を送出します。
+        explicit MappedFile(const std::string &path);
+        ~MappedFile() { Close(); }
+        MappedFile(const MappedFile &) = delete;
+        MappedFile &operator=(const MappedFile &) = delete;
+        MappedFile(MappedFile &&other);
+        MappedFile &operator=(MappedFile &&other);
+
+        void Close();
+
+        // 空のファイルの場合は nullptr です。ページの境界に揃っています。
+        const uint8_t *GetData() const { return m_data; }
+        size_t GetSize() const { return m_size; }
+
+    private:
+        const uint8_t *m_data;
+        size_t m_size;
+    };
+}
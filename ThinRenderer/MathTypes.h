@@ -0,0 +1,124 @@
+﻿#pragma once
+#include <cmath>
+
+
+namespace thinr
+{
+    // DirectX::XMFLOAT3 / XMFLOAT4 / XMFLOAT4X4 とメモリ レイアウトが同じ型。
+    // DirectXMath の無い環境 (ソフトウェア ラスタライザー) でも使えるようにしています。
+    struct Float3
+    {
+        float x;
+        float y;
+        float z;
+    };
+
+    struct Float4
+    {
+        float x;
+        float y;
+        float z;
+        float w;
+    };
+
+    struct Float4x4
+    {
+        float m[4][4];
+
+        static Float4x4 Identity()
+        {
+            Float4x4 r = {
+                1.0f, 0.0f, 0.0f, 0.0f,
+                0.0f, 1.0f, 0.0f, 0.0f,
+                0.0f, 0.0f, 1.0f, 0.0f,
+                0.0f, 0.0f, 0.0f, 1.0f,
+            };
+            return r;
+        }
+    };
+
+    // 定数バッファーの行列は転置して格納されている (XMMatrixTranspose 済み) ので、
+    // 列ベクトルに左から掛ける形で評価します。
+    inline Float4 Transform(const Float4x4 &m, const Float4 &v)
+    {
+        return Float4{
+            m.m[0][0] * v.x + m.m[0][1] * v.y + m.m[0][2] * v.z + m.m[0][3] * v.w,
+            m.m[1][0] * v.x + m.m[1][1] * v.y + m.m[1][2] * v.z + m.m[1][3] * v.w,
+            m.m[2][0] * v.x + m.m[2][1] * v.y + m.m[2][2] * v.z + m.m[2][3] * v.w,
+            m.m[3][0] * v.x + m.m[3][1] * v.y + m.m[3][2] * v.z + m.m[3][3] * v.w,
+        };
+    }
+
+    // 転置済み行列同士の積。Transform(Multiply(a, b), v) == Transform(a, Transform(b, v))
+    inline Float4x4 Multiply(const Float4x4 &a, const Float4x4 &b)
+    {
+        Float4x4 r;
+        for (int i = 0; i < 4; ++i)
+        {
+            for (int j = 0; j < 4; ++j)
+            {
+                r.m[i][j] =
+                    a.m[i][0] * b.m[0][j]
+                    + a.m[i][1] * b.m[1][j]
+                    + a.m[i][2] * b.m[2][j]
+                    + a.m[i][3] * b.m[3][j];
+            }
+        }
+        return r;
+    }
+
+    // 点 (w = 1) を変換します。射影を含まないアフィン変換用です。
+    inline Float3 TransformPoint(const Float4x4 &m, const Float3 &p)
+    {
+        return Float3{
+            m.m[0][0] * p.x + m.m[0][1] * p.y + m.m[0][2] * p.z + m.m[0][3],
+            m.m[1][0] * p.x + m.m[1][1] * p.y + m.m[1][2] * p.z + m.m[1][3],
+            m.m[2][0] * p.x + m.m[2][1] * p.y + m.m[2][2] * p.z + m.m[2][3],
+        };
+    }
+
+    // 方向 (w = 0) を変換します。平行移動は無視されます。
+    inline Float3 TransformDirection(const Float4x4 &m, const Float3 &d)
+    {
+        return Float3{
+            m.m[0][0] * d.x + m.m[0][1] * d.y + m.m[0][2] * d.z,
+            m.m[1][0] * d.x + m.m[1][1] * d.y + m.m[1][2] * d.z,
+            m.m[2][0] * d.x + m.m[2][1] * d.y + m.m[2][2] * d.z,
+        };
+    }
+
+    // 最終行が (0, 0, 0, 1) のアフィン変換の逆行列。特異な場合は単位行列を返します。
+    inline Float4x4 InverseAffine(const Float4x4 &m)
+    {
+        const float (*a)[4] = m.m;
+        float c00 = a[1][1] * a[2][2] - a[1][2] * a[2][1];
+        float c01 = a[1][2] * a[2][0] - a[1][0] * a[2][2];
+        float c02 = a[1][0] * a[2][1] - a[1][1] * a[2][0];
+        float det = a[0][0] * c00 + a[0][1] * c01 + a[0][2] * c02;
+        if (det == 0.0f)
+        {
+            return Float4x4::Identity();
+        }
+        float invDet = 1.0f / det;
+
+        Float4x4 r;
+        r.m[0][0] = c00 * invDet;
+        r.m[0][1] = (a[0][2] * a[2][1] - a[0][1] * a[2][2]) * invDet;
+        r.m[0][2] = (a[0][1] * a[1][2] - a[0][2] * a[1][1]) * invDet;
+        r.m[1][0] = c01 * invDet;
+        r.m[1][1] = (a[0][0] * a[2][2] - a[0][2] * a[2][0]) * invDet;
+        r.m[1][2] = (a[0][2] * a[1][0] - a[0][0] * a[1][2]) * invDet;
+        r.m[2][0] = c02 * invDet;
+        r.m[2][1] = (a[0][1] * a[2][0] - a[0][0] * a[2][1]) * invDet;
+        r.m[2][2] = (a[0][0] * a[1][1] - a[0][1] * a[1][0]) * invDet;
+        for (int i = 0; i < 3; ++i)
+        {
+            r.m[i][3] = -(r.m[i][0] * a[0][3] + r.m[i][1] * a[1][3] + r.m[i][2] * a[2][3]);
+        }
+        r.m[3][0] = 0.0f;
+        r.m[3][1] = 0.0f;
+        r.m[3][2] = 0.0f;
+        r.m[3][3] = 1.0f;
+        return r;
+    }
+}
@@ -0,0 +1,369 @@
+﻿#include "pch.h"
+#include "MeshBvh.h"
+#include <stdexcept>
+
+#if defined(_M_IX86) || defined(_M_X64) || defined(__i386__) || defined(__x86_64__)
+#define THINR_X86 1
+#include <emmintrin.h>
+#endif
+
+
+namespace thinr
+{
+    namespace
+    {
+        inline Float3 Subtract(const Float3 &a, const Float3 &b)
+        {
+            return Float3{ a.x - b.x, a.y - b.y, a.z - b.z };
+        }
+
+        inline Float3 Cross(const Float3 &a, const Float3 &b)
+        {
+            return Float3{ a.y * b.z - a.z * b.y, a.z * b.x - a.x * b.z, a.x * b.y - a.y * b.x };
+        }
+
+        inline float Dot(const Float3 &a, const Float3 &b)
+        {
+            return a.x * b.x + a.y * b.y + a.z * b.z;
+        }
+
+#if THINR_X86
+        // activeMask のビット i を、レーン i の全ビットに広げます。
+        inline __m128 LaneMask(uint32_t bits)
+        {
+            const __m128i lanes = _mm_setr_epi32(1, 2, 4, 8);
+            return _mm_castsi128_ps(_mm_cmpeq_epi32(_mm_and_si128(_mm_set1_epi32(static_cast<int>(bits)), lanes), lanes));
+        }
+
+        inline __m128 Select(__m128 mask, __m128 a, __m128 b)
+        {
+            return _mm_or_ps(_mm_and_ps(mask, a), _mm_andnot_ps(mask, b));
+        }
+
+        // 4 本のレイと箱の判定。当たったレーンのビットを返します。
+        inline int IntersectPacketBox(const BvhNode &node, __m128 ox, __m128 oy, __m128 oz,
+            __m128 ix, __m128 iy, __m128 iz, __m128 tMax)
+        {
+            __m128 tx0 = _mm_mul_ps(_mm_sub_ps(_mm_set1_ps(node.boundsMin.x), ox), ix);
+            __m128 tx1 = _mm_mul_ps(_mm_sub_ps(_mm_set1_ps(node.boundsMax.x), ox), ix);
+            __m128 ty0 = _mm_mul_ps(_mm_sub_ps(_mm_set1_ps(node.boundsMin.y), oy), iy);
+            __m128 ty1 = _mm_mul_ps(_mm_sub_ps(_mm_set1_ps(node.boundsMax.y), oy), iy);
+            __m128 tz0 = _mm_mul_ps(_mm_sub_ps(_mm_set1_ps(node.boundsMin.z), oz), iz);
+            __m128 tz1 = _mm_mul_ps(_mm_sub_ps(_mm_set1_ps(node.boundsMax.z), oz), iz);
+            __m128 tNear = _mm_max_ps(_mm_max_ps(_mm_min_ps(tx0, tx1), _mm_min_ps(ty0, ty1)), _mm_max_ps(_mm_min_ps(tz0, tz1), _mm_setzero_ps()));
+            __m128 tFar = _mm_min_ps(_mm_min_ps(_mm_max_ps(tx0, tx1), _mm_max_ps(ty0, ty1)), _mm_min_ps(_mm_max_ps(tz0, tz1), tMax));
+            return _mm_movemask_ps(_mm_cmple_ps(tNear, tFar));
+        }
+#endif
+    }
+
+    void MeshBvh::Build(const VertexPositionColor *vertices, size_t vertexCount,
+        const uint16_t *indices, size_t indexCount)
+    {
+        BuildImpl(vertices, vertexCount, indices, indexCount);
+    }
+
+    void MeshBvh::Build(const VertexPositionColor *vertices, size_t vertexCount,
+        const uint32_t *indices, size_t indexCount)
+    {
+        BuildImpl(vertices, vertexCount, indices, indexCount);
+    }
+
+    template<typename INDEX>
+    void MeshBvh::BuildImpl(const VertexPositionColor *vertices, size_t vertexCount, const INDEX *indices, size_t indexCount)
+    {
+        if (indexCount % 3 != 0)
+        {
+            throw std::invalid_argument("MeshBvh: index count must be a multiple of 3");
+        }
+        size_t triangleCount = indexCount / 3;
+        std::vector<Aabb> bounds(triangleCount);
+        for (size_t i = 0; i < indexCount; ++i)
+        {
+            if (indices[i] >= vertexCount)
+            {
+                throw std::invalid_argument("MeshBvh: index out of range");
+            }
+        }
+        for (size_t i = 0; i < triangleCount; ++i)
+        {
+            Aabb box = Aabb::Empty();
+            box.Grow(vertices[indices[i * 3 + 0]].pos);
+            box.Grow(vertices[indices[i * 3 + 1]].pos);
+            box.Grow(vertices[indices[i * 3 + 2]].pos);
+            bounds[i] = box;
+        }
+
+        std::vector<uint32_t> order;
+        BuildBvh(bounds.data(), triangleCount, MaxLeafTriangles, m_nodes, order);
+
+        // 葉から連続して読めるように、三角形を葉の順に並べ替えて持ちます。
+        m_triangles.resize(triangleCount);
+        for (size_t i = 0; i < triangleCount; ++i)
+        {
+            uint32_t t = order[i];
+            const Float3 &p0 = vertices[indices[t * 3 + 0]].pos;
+            const Float3 &p1 = vertices[indices[t * 3 + 1]].pos;
+            const Float3 &p2 = vertices[indices[t * 3 + 2]].pos;
+            m_triangles[i] = Triangle{ p0, Subtract(p1, p0), Subtract(p2, p0), t };
+        }
+    }
+
+    Aabb MeshBvh::GetBounds() const
+    {
+        if (m_nodes.empty())
+        {
+            return Aabb::Empty();
+        }
+        return Aabb{ m_nodes[0].boundsMin, m_nodes[0].boundsMax };
+    }
+
+    bool MeshBvh::Raycast(const Ray &ray, RayHit &hit) const
+    {
+        if (m_nodes.empty())
+        {
+            return false;
+        }
+
+        const Float3 origin = ray.origin;
+        const Float3 direction = ray.direction;
+        const Float3 invDirection = Reciprocal(direction);
+        float tMax = ray.maxDistance;
+        bool found = false;
+
+        const BvhNode *nodes = m_nodes.data();
+        float tRoot;
+        if (!IntersectRayBox(origin, invDirection, nodes[0].boundsMin, nodes[0].boundsMax, tMax, tRoot))
+        {
+            return false;
+        }
+
+        // 近い方の子から辿り、遠い方はスタックに積みます。積んだときの入口 t で、後から枝刈りします。
+        uint32_t stack[BvhMaxStackDepth];
+        float stackT[BvhMaxStackDepth];
+        int depth = 0;
+        uint32_t index = 0;
+        for (;;)
+        {
+            const BvhNode &node = nodes[index];
+            if (node.IsLeaf())
+            {
+                for (uint32_t i = node.offset, end = node.offset + node.count; i < end; ++i)
+                {
+                    const Triangle &tri = m_triangles[i];
+                    Float3 p = Cross(direction, tri.edge2);
+                    float det = Dot(tri.edge1, p);
+                    if (det == 0.0f)
+                    {
+                        continue;
+                    }
+                    float invDet = 1.0f / det;
+                    Float3 s = Subtract(origin, tri.v0);
+                    float u = Dot(s, p) * invDet;
+                    if (u < 0.0f || u > 1.0f)
+                    {
+                        continue;
+                    }
+                    Float3 q = Cross(s, tri.edge1);
+                    float v = Dot(direction, q) * invDet;
+                    if (v < 0.0f || u + v > 1.0f)
+                    {
+                        continue;
+                    }
+                    float t = Dot(tri.edge2, q) * invDet;
+                    if (t < 0.0f || t > tMax)
+                    {
+                        continue;
+                    }
+                    tMax = t;
+                    hit = RayHit{ t, u, v, tri.index, InvalidRayHitIndex };
+                    found = true;
+                }
+            }
+            else
+            {
+                uint32_t left = index + 1;
+                uint32_t right = node.offset;
+                float tLeft;
+                float tRight;
+                bool hitLeft = IntersectRayBox(origin, invDirection, nodes[left].boundsMin, nodes[left].boundsMax, tMax, tLeft);
+                bool hitRight = IntersectRayBox(origin, invDirection, nodes[right].boundsMin, nodes[right].boundsMax, tMax, tRight);
+                if (hitLeft && hitRight)
+                {
+                    if (tLeft > tRight)
+                    {
+                        std::swap(left, right);
+                        std::swap(tLeft, tRight);
+                    }
+                    stack[depth] = right;
+                    stackT[depth] = tRight;
+                    ++depth;
+                    index = left;
+                    continue;
+                }
+                if (hitLeft || hitRight)
+                {
+                    index = hitLeft ? left : right;
+                    continue;
+                }
+            }
+
+            // スタックから、今の最短距離より手前で入るノードを取り出します。
+            for (;;)
+            {
+                if (depth == 0)
+                {
+                    return found;
+                }
+                --depth;
+                if (stackT[depth] <= tMax)
+                {
+                    index = stack[depth];
+                    break;
+                }
+            }
+        }
+    }
+
+    void MeshBvh::IntersectPacket(RayPacket &packet) const
+    {
+        if (m_nodes.empty() || packet.activeMask == 0)
+        {
+            return;
+        }
+
+#if THINR_X86
+        const __m128 ox = _mm_load_ps(packet.originX);
+        const __m128 oy = _mm_load_ps(packet.originY);
+        const __m128 oz = _mm_load_ps(packet.originZ);
+        const __m128 dx = _mm_load_ps(packet.directionX);
+        const __m128 dy = _mm_load_ps(packet.directionY);
+        const __m128 dz = _mm_load_ps(packet.directionZ);
+        const __m128 one = _mm_set1_ps(1.0f);
+        const __m128 ix = _mm_div_ps(one, dx);
+        const __m128 iy = _mm_div_ps(one, dy);
+        const __m128 iz = _mm_div_ps(one, dz);
+
+        // 判定しないレーンは tMax を負にして、どの箱にも三角形にも当たらないようにします。
+        const __m128 active = LaneMask(packet.activeMask);
+        const __m128 inputTMax = _mm_load_ps(packet.tMax);
+        __m128 tMax = Select(active, inputTMax, _mm_set1_ps(-1.0f));
+        __m128 hitU = _mm_load_ps(packet.u);
+        __m128 hitV = _mm_load_ps(packet.v);
+        __m128 hitTriangle = _mm_castsi128_ps(_mm_load_si128(reinterpret_cast<const __m128i *>(packet.triangle)));
+
+        // 子を辿る順序は、判定するレイの方向の和で決めます。
+        Float3 order = Float3{ 0.0f, 0.0f, 0.0f };
+        for (int lane = 0; lane < RayPacket::Width; ++lane)
+        {
+            if (packet.activeMask & (1u << lane))
+            {
+                order.x += packet.directionX[lane];
+                order.y += packet.directionY[lane];
+                order.z += packet.directionZ[lane];
+            }
+        }
+
+        const BvhNode *nodes = m_nodes.data();
+        uint32_t stack[BvhMaxStackDepth];
+        int depth = 0;
+        stack[depth++] = 0;
+        while (depth > 0)
+        {
+            uint32_t index = stack[--depth];
+            const BvhNode &node = nodes[index];
+            if (!IntersectPacketBox(node, ox, oy, oz, ix, iy, iz, tMax))
+            {
+                continue;
+            }
+
+            if (!node.IsLeaf())
+            {
+                // 近い方の子が後から積まれ、先に取り出されます。
+                uint32_t left = index + 1;
+                uint32_t right = node.offset;
+                const BvhNode &l = nodes[left];
+                const BvhNode &r = nodes[right];
+                float forward =
+                    (r.boundsMin.x + r.boundsMax.x - l.boundsMin.x - l.boundsMax.x) * order.x
+                    + (r.boundsMin.y + r.boundsMax.y - l.boundsMin.y - l.boundsMax.y) * order.y
+                    + (r.boundsMin.z + r.boundsMax.z - l.boundsMin.z - l.boundsMax.z) * order.z;
+                stack[depth++] = forward >= 0.0f ? right : left;
+                stack[depth++] = forward >= 0.0f ? left : right;
+                continue;
+            }
+
+            // Raycast と同じ順序の演算で、4 本のレイと三角形を判定します。
+            for (uint32_t i = node.offset, end = node.offset + node.count; i < end; ++i)
+            {
+                const Triangle &tri = m_triangles[i];
+                const __m128 e1x = _mm_set1_ps(tri.edge1.x);
+                const __m128 e1y = _mm_set1_ps(tri.edge1.y);
+                const __m128 e1z = _mm_set1_ps(tri.edge1.z);
+                const __m128 e2x = _mm_set1_ps(tri.edge2.x);
+                const __m128 e2y = _mm_set1_ps(tri.edge2.y);
+                const __m128 e2z = _mm_set1_ps(tri.edge2.z);
+
+                __m128 px = _mm_sub_ps(_mm_mul_ps(dy, e2z), _mm_mul_ps(dz, e2y));
+                __m128 py = _mm_sub_ps(_mm_mul_ps(dz, e2x), _mm_mul_ps(dx, e2z));
+                __m128 pz = _mm_sub_ps(_mm_mul_ps(dx, e2y), _mm_mul_ps(dy, e2x));
+                __m128 det = _mm_add_ps(_mm_add_ps(_mm_mul_ps(e1x, px), _mm_mul_ps(e1y, py)), _mm_mul_ps(e1z, pz));
+                __m128 invDet = _mm_div_ps(one, det);
+
+                __m128 sx = _mm_sub_ps(ox, _mm_set1_ps(tri.v0.x));
+                __m128 sy = _mm_sub_ps(oy, _mm_set1_ps(tri.v0.y));
+                __m128 sz = _mm_sub_ps(oz, _mm_set1_ps(tri.v0.z));
+                __m128 u = _mm_mul_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(sx, px), _mm_mul_ps(sy, py)), _mm_mul_ps(sz, pz)), invDet);
+
+                __m128 qx = _mm_sub_ps(_mm_mul_ps(sy, e1z), _mm_mul_ps(sz, e1y));
+                __m128 qy = _mm_sub_ps(_mm_mul_ps(sz, e1x), _mm_mul_ps(sx, e1z));
+                __m128 qz = _mm_sub_ps(_mm_mul_ps(sx, e1y), _mm_mul_ps(sy, e1x));
+                __m128 v = _mm_mul_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(dx, qx), _mm_mul_ps(dy, qy)), _mm_mul_ps(dz, qz)), invDet);
+                __m128 t = _mm_mul_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(e2x, qx), _mm_mul_ps(e2y, qy)), _mm_mul_ps(e2z, qz)), invDet);
+
+                __m128 zero = _mm_setzero_ps();
+                __m128 mask = _mm_cmpneq_ps(det, zero);
+                mask = _mm_and_ps(mask, _mm_cmpge_ps(u, zero));
+                mask = _mm_and_ps(mask, _mm_cmple_ps(u, one));
+                mask = _mm_and_ps(mask, _mm_cmpge_ps(v, zero));
+                mask = _mm_and_ps(mask, _mm_cmple_ps(_mm_add_ps(u, v), one));
+                mask = _mm_and_ps(mask, _mm_cmpge_ps(t, zero));
+                mask = _mm_and_ps(mask, _mm_cmple_ps(t, tMax));
+                if (_mm_movemask_ps(mask) == 0)
+                {
+                    continue;
+                }
+                tMax = Select(mask, t, tMax);
+                hitU = Select(mask, u, hitU);
+                hitV = Select(mask, v, hitV);
+                hitTriangle = Select(mask, _mm_castsi128_ps(_mm_set1_epi32(static_cast<int>(tri.index))), hitTriangle);
+            }
+        }
+
+        _mm_store_ps(packet.tMax, Select(active, tMax, inputTMax));
+        _mm_store_ps(packet.u, hitU);
+        _mm_store_ps(packet.v, hitV);
+        _mm_store_si128(reinterpret_cast<__m128i *>(packet.triangle), _mm_castps_si128(hitTriangle));
+#else
+        for (int lane = 0; lane < RayPacket::Width; ++lane)
+        {
+            if (!(packet.activeMask & (1u << lane)))
+            {
+                continue;
+            }
+            Ray ray = Ray{
+                Float3{ packet.originX[lane], packet.originY[lane], packet.originZ[lane] },
+                Float3{ packet.directionX[lane], packet.directionY[lane], packet.directionZ[lane] },
+                packet.tMax[lane] };
+            RayHit hit;
+            if (Raycast(ray, hit))
+            {
+                packet.tMax[lane] = hit.t;
+                packet.u[lane] = hit.u;
+                packet.v[lane] = hit.v;
+                packet.triangle[lane] = hit.triangle;
+            }
+        }
+#endif
+    }
+}
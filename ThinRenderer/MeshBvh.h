@@ -0,0 +1,50 @@
+﻿#pragma once
+#include "Bvh.h"
+#include "VertexTypes.h"
+#include <vector>
+#include <cstdint>
+
+
+namespace thinr
+{
+    // インデックス付き三角形リストの BVH。SoftwareRasterizer::DrawIndexed と同じ頂点とインデックスを受け取ります。
+    // レイの判定は両面で、モデル空間で行います。
+    class MeshBvh
+    {
+    public:
+        static const uint32_t MaxLeafTriangles = 4;
+
+        MeshBvh() {}
+
+        void Build(const VertexPositionColor *vertices, size_t vertexCount,
+            const uint16_t *indices, size_t indexCount);
+        void Build(const VertexPositionColor *vertices, size_t vertexCount,
+            const uint32_t *indices, size_t indexCount);
+
+        // ray.maxDistance 以内で最も近い交点を求めます。当たらなければ false を返し、hit は変更しません。
+        bool Raycast(const Ray &ray, RayHit &hit) const;
+        // 4 本のレイをまとめて走査します (x86 では SSE2)。まとめて撃つ場合は BatchRaycaster を使用します。
+        void IntersectPacket(RayPacket &packet) const;
+
+        bool IsEmpty() const { return m_nodes.empty(); }
+        size_t GetTriangleCount() const { return m_triangles.size(); }
+        Aabb GetBounds() const;
+        const std::vector<BvhNode> &GetNodes() const { return m_nodes; }
+
+    private:
+        template<typename INDEX>
+        void BuildImpl(const VertexPositionColor *vertices, size_t vertexCount, const INDEX *indices, size_t indexCount);
+
+        // 葉の順に並べた三角形。Möller-Trumbore 用に辺を持ちます。
+        struct Triangle
+        {
+            Float3 v0;
+            Float3 edge1;
+            Float3 edge2;
+            uint32_t index;
+        };
+
+        std::vector<BvhNode> m_nodes;
+        std::vector<Triangle> m_triangles;
+    };
+}
@@ -0,0 +1,196 @@
+﻿#include "pch.h"
+#include "MeshFile.h"
+#include "FileSystem.h"
+#include <cstring>
+#include <fstream>
+#include <stdexcept>
+
+
+namespace thinr
+{
+    namespace
+    {
+        uint64_t AlignUp(uint64_t value)
+        {
+            return (value + MeshFileAlignment - 1) / MeshFileAlignment * MeshFileAlignment;
+        }
+
+        // [offset, offset + size) が [0, fileSize) に収まり、offset が alignment の倍数か。
+        bool IsValidRange(uint64_t offset, uint64_t size, uint64_t fileSize, uint64_t alignment)
+        {
+            return offset % alignment == 0 && offset <= fileSize && size <= fileSize - offset;
+        }
+
+        void WritePadding(std::ofstream &file, uint64_t &position, uint64_t target)
+        {
+            static const char zeros[MeshFileAlignment] = {};
+            file.write(zeros, static_cast<std::streamsize>(target - position));
+            position = target;
+        }
+
+        template <typename T>
+        void WriteBlock(std::ofstream &file, uint64_t &position, const T *data, size_t count)
+        {
+            file.write(reinterpret_cast<const char *>(data), static_cast<std::streamsize>(sizeof(T) * count));
+            position += sizeof(T) * count;
+        }
+    }
+
+    void WriteMeshFile(const std::string &path, const MeshData &mesh)
+    {
+        if (mesh.vertices.size() > UINT32_MAX || mesh.indices.size() > UINT32_MAX)
+        {
+            throw std::invalid_argument("WriteMeshFile: mesh too large");
+        }
+        uint32_t vertexCount = static_cast<uint32_t>(mesh.vertices.size());
+        for (uint32_t index : mesh.indices)
+        {
+            if (index >= vertexCount)
+            {
+                throw std::invalid_argument("WriteMeshFile: index out of range");
+            }
+        }
+
+        std::vector<MeshSubmesh> submeshes = mesh.submeshes;
+        if (submeshes.empty())
+        {
+            submeshes.push_back(MeshSubmesh{ 0, static_cast<uint32_t>(mesh.indices.size()), 0, 0, Aabb() });
+        }
+        for (auto &submesh : submeshes)
+        {
+            if (submesh.indexStart > mesh.indices.size() || submesh.indexCount > mesh.indices.size() - submesh.indexStart)
+            {
+                throw std::invalid_argument("WriteMeshFile: submesh out of range");
+            }
+            submesh.bounds = Aabb::Empty();
+            for (uint32_t i = 0; i < submesh.indexCount; ++i)
+            {
+                submesh.bounds.Grow(mesh.vertices[mesh.indices[submesh.indexStart + i]].pos);
+            }
+            submesh.reserved = 0;
+        }
+
+        MeshFileHeader header = {};
+        memcpy(header.magic, MeshFileMagic, sizeof(header.magic));
+        header.version = MeshFileVersion;
+        header.vertexCount = vertexCount;
+        header.vertexStride = sizeof(VertexPositionColor);
+        header.indexCount = static_cast<uint32_t>(mesh.indices.size());
+        header.indexSize = vertexCount <= 65536 ? 2 : 4;
+        header.submeshCount = static_cast<uint32_t>(submeshes.size());
+        header.vertexOffset = AlignUp(sizeof(MeshFileHeader));
+        header.indexOffset = AlignUp(header.vertexOffset + uint64_t(vertexCount) * sizeof(VertexPositionColor));
+        header.submeshOffset = AlignUp(header.indexOffset + uint64_t(header.indexCount) * header.indexSize);
+        header.bounds = Aabb::Empty();
+        for (const auto &vertex : mesh.vertices)
+        {
+            header.bounds.Grow(vertex.pos);
+        }
+
+        std::string temporary = path + ".tmp";
+        {
+            std::ofstream file;
+            OpenOutputFile(file, temporary);
+            uint64_t position = 0;
+            WriteBlock(file, position, &header, 1);
+            WritePadding(file, position, header.vertexOffset);
+            WriteBlock(file, position, mesh.vertices.data(), mesh.vertices.size());
+            WritePadding(file, position, header.indexOffset);
+            if (header.indexSize == 2)
+            {
+                std::vector<uint16_t> indices(mesh.indices.begin(), mesh.indices.end());
+                WriteBlock(file, position, indices.data(), indices.size());
+            }
+            else
+            {
+                WriteBlock(file, position, mesh.indices.data(), mesh.indices.size());
+            }
+            WritePadding(file, position, header.submeshOffset);
+            WriteBlock(file, position, submeshes.data(), submeshes.size());
+            file.close();
+            if (file.fail())
+            {
+                RemoveFile(temporary);
+                throw std::runtime_error("WriteMeshFile: cannot write " + path);
+            }
+        }
+        if (!ReplaceExistingFile(temporary, path))
+        {
+            RemoveFile(temporary);
+            throw std::runtime_error("WriteMeshFile: cannot replace " + path);
+        }
+    }
+
+    MeshFile::MeshFile(const std::string &path)
+        : m_file(path), m_data(m_file.GetData()), m_header(nullptr)
+    {
+        Validate(m_file.GetSize());
+    }
+
+    MeshFile::MeshFile(const void *data, size_t size)
+        : m_data(static_cast<const uint8_t *>(data)), m_header(nullptr)
+    {
+        if (reinterpret_cast<uintptr_t>(data) % 4 != 0)
+        {
+            throw std::invalid_argument("MeshFile: data must be 4-byte aligned");
+        }
+        Validate(size);
+    }
+
+    void MeshFile::Validate(size_t size)
+    {
+        if (!m_data || size < sizeof(MeshFileHeader))
+        {
+            throw std::runtime_error("MeshFile: file too small");
+        }
+        const MeshFileHeader *header = reinterpret_cast<const MeshFileHeader *>(m_data);
+        if (memcmp(header->magic, MeshFileMagic, sizeof(header->magic)) != 0)
+        {
+            throw std::runtime_error("MeshFile: not a mesh file");
+        }
+        if (header->version != MeshFileVersion)
+        {
+            throw std::runtime_error("MeshFile: unsupported version " + std::to_string(header->version));
+        }
+        if (header->vertexStride != sizeof(VertexPositionColor) || (header->indexSize != 2 && header->indexSize != 4))
+        {
+            throw std::runtime_error("MeshFile: unsupported vertex or index format");
+        }
+        if (!IsValidRange(header->vertexOffset, uint64_t(header->vertexCount) * header->vertexStride, size, 4)
+            || !IsValidRange(header->indexOffset, uint64_t(header->indexCount) * header->indexSize, size, header->indexSize)
+            || !IsValidRange(header->submeshOffset, uint64_t(header->submeshCount) * sizeof(MeshSubmesh), size, 4))
+        {
+            throw std::runtime_error("MeshFile: block out of range");
+        }
+
+        const MeshSubmesh *submeshes = reinterpret_cast<const MeshSubmesh *>(m_data + header->submeshOffset);
+        for (uint32_t i = 0; i < header->submeshCount; ++i)
+        {
+            if (submeshes[i].indexStart > header->indexCount || submeshes[i].indexCount > header->indexCount - submeshes[i].indexStart)
+            {
+                throw std::runtime_error("MeshFile: submesh out of range");
+            }
+        }
+        m_header = header;
+    }
+
+    const VertexPositionColor *MeshFile::GetVertices() const
+    {
+        return reinterpret_cast<const VertexPositionColor *>(m_data + m_header->vertexOffset);
+    }
+
+    const uint16_t *MeshFile::GetIndices16() const
+    {
+        return m_header->indexSize == 2 ? reinterpret_cast<const uint16_t *>(GetIndexData()) : nullptr;
+    }
+
+    const uint32_t *MeshFile::GetIndices32() const
+    {
+        return m_header->indexSize == 4 ? reinterpret_cast<const uint32_t *>(GetIndexData()) : nullptr;
+    }
+
+    const MeshSubmesh *MeshFile::GetSubmeshes() const
+    {
+        return reinterpret_cast<const MeshSubmesh *>(m_data + m_header->submeshOffset);
+    }
+}
@@ -0,0 +1,99 @@
+﻿#pragma once
+#include "MappedFile.h"
+#include "VertexTypes.h"
+#include "Bvh.h"
+#include <string>
+#include <vector>
+#include <cstdint>
+
+
+namespace thinr
+{
+    // メッシュ ファイル (.tmesh) のヘッダー。ファイルはリトル エンディアンで、次の順に並びます。
+    //   ヘッダー | 頂点 (VertexPositionColor) | インデックス (16 / 32 ビット) | サブメッシュ (MeshSubmesh)
+    // 各ブロックは MeshFileAlignment バイトの境界から始まるので、マップしたメモリをそのまま頂点バッファーなどに渡せます。
+    struct MeshFileHeader
+    {
+        char magic[4];
+        uint32_t version;
+        uint32_t vertexCount;
+        uint32_t vertexStride;
+        uint32_t indexCount;
+        // 2 か 4。
+        uint32_t indexSize;
+        uint32_t submeshCount;
+        uint32_t reserved;
+        uint64_t vertexOffset;
+        uint64_t indexOffset;
+        uint64_t submeshOffset;
+        Aabb bounds;
+    };
+
+    // インデックスの範囲 1 つ分の描画単位。
+    struct MeshSubmesh
+    {
+        uint32_t indexStart;
+        uint32_t indexCount;
+        uint32_t material;
+        uint32_t reserved;
+        Aabb bounds;
+    };
+
+    static_assert(sizeof(MeshFileHeader) == 80, "layout");
+    static_assert(sizeof(MeshSubmesh) == 40, "layout");
+
+    const char MeshFileMagic[4] = { 'T', 'M', 'S', 'H' };
+    const uint32_t MeshFileVersion = 1;
+    const uint32_t MeshFileAlignment = 16;
+
+    // WriteMeshFile に渡すメッシュ。
+    struct MeshData
+    {
+        std::vector<VertexPositionColor> vertices;
+        std::vector<uint32_t> indices;
+        // 空の場合は全体を 1 つのサブメッシュとして書き込みます。bounds は書き込み時に計算します。
+        std::vector<MeshSubmesh> submeshes;
+    };
+
+    // 頂点数が 65536 以下なら 16 ビットのインデックスで書き込みます。一時ファイルに書いてから置き換えます。
+    // 書き込めない場合や、インデックスやサブメッシュが範囲外の場合は例外を送出します。
+    void WriteMeshFile(const std::string &path, const MeshData &mesh);
+
+    // メッシュ ファイルをマップして、中身をコピーも変換もせずに参照します。開くときに調べるのはヘッダーと
+    // サブメッシュの範囲だけで、頂点とインデックスのページは使うときに OS が読み込みます。
+    // インデックスが頂点数未満であることは調べません (MeshBvh::Build は調べます)。
+    class MeshFile
+    {
+    public:
+        // path (UTF-8) をマップします。開けない場合や形式が正しくない場合は std::runtime_error を送出します。
+        explicit MeshFile(const std::string &path);
+        // メモリ上のメッシュ ファイルを参照します。data は 4 バイトの境界に揃え、MeshFile より長く生存する必要があります。
+        MeshFile(const void *data, size_t size);
+        MeshFile(const MeshFile &) = delete;
+        MeshFile &operator=(const MeshFile &) = delete;
+
+        uint32_t GetVertexCount() const { return m_header->vertexCount; }
+        const VertexPositionColor *GetVertices() const;
+        size_t GetVertexDataSize() const { return size_t(m_header->vertexCount) * sizeof(VertexPositionColor); }
+
+        uint32_t GetIndexCount() const { return m_header->indexCount; }
+        uint32_t GetIndexSize() const { return m_header->indexSize; }
+        const void *GetIndexData() const { return m_data + m_header->indexOffset; }
+        size_t GetIndexDataSize() const { return size_t(m_header->indexCount) * m_header->indexSize; }
+        // インデックスの幅が違う場合は nullptr を返します。
+        const uint16_t *GetIndices16() const;
+        const uint32_t *GetIndices32() const;
+
+        uint32_t GetSubmeshCount() const { return m_header->submeshCount; }
+        const MeshSubmesh *GetSubmeshes() const;
+
+        const Aabb &GetBounds() const { return m_header->bounds; }
+
+    private:
+        void Validate(size_t size);
+
+        MappedFile m_file;
+        const uint8_t *m_data;
+        const MeshFileHeader *m_header;
+    };
+}
@@ -0,0 +1,415 @@
+﻿#include "pch.h"
+#include "MeshOptimizer.h"
+#include "Profiler.h"
+#include <algorithm>
+#include <cmath>
+#include <stdexcept>
+
+
+namespace thinr
+{
+    namespace
+    {
+        // 頂点ごとに入った時刻を覚える FIFO キャッシュ。時刻を cacheSize + 1 進めれば空にできます。
+        class VertexCacheSimulator
+        {
+        public:
+            VertexCacheSimulator(size_t vertexCount, uint32_t cacheSize)
+                : m_stamps(vertexCount, 0), m_time(cacheSize + 1), m_cacheSize(cacheSize)
+            {
+            }
+
+            // ミスした場合はキャッシュに入れて true を返します。
+            bool Access(uint32_t v)
+            {
+                if (m_time - m_stamps[v] > m_cacheSize)
+                {
+                    m_stamps[v] = m_time++;
+                    return true;
+                }
+                return false;
+            }
+
+            bool Contains(uint32_t v) const { return m_time - m_stamps[v] <= m_cacheSize; }
+            // 入ってからの経過。キャッシュに無い頂点は cacheSize より大きくなります。
+            uint32_t GetAge(uint32_t v) const { return m_time - m_stamps[v]; }
+            void Clear() { m_time += m_cacheSize + 1; }
+
+        private:
+            std::vector<uint32_t> m_stamps;
+            uint32_t m_time;
+            uint32_t m_cacheSize;
+        };
+
+        void CheckIndices(const uint32_t *indices, size_t indexCount, size_t vertexCount, const char *function)
+        {
+            for (size_t i = 0; i < indexCount; ++i)
+            {
+                if (indices[i] >= vertexCount)
+                {
+                    throw std::invalid_argument(std::string(function) + ": index out of range");
+                }
+            }
+        }
+
+        uint32_t CountTriangleMisses(VertexCacheSimulator &cache, const uint32_t *triangle)
+        {
+            return uint32_t(cache.Access(triangle[0])) + uint32_t(cache.Access(triangle[1])) + uint32_t(cache.Access(triangle[2]));
+        }
+
+        size_t CountMisses(const uint32_t *indices, size_t indexCount, size_t vertexCount, uint32_t cacheSize)
+        {
+            VertexCacheSimulator cache(vertexCount, cacheSize);
+            size_t misses = 0;
+            for (size_t i = 0; i + 2 < indexCount; i += 3)
+            {
+                misses += CountTriangleMisses(cache, indices + i);
+            }
+            return misses;
+        }
+
+        Float3 Subtract(const Float3 &a, const Float3 &b)
+        {
+            return Float3{ a.x - b.x, a.y - b.y, a.z - b.z };
+        }
+
+        Float3 Cross(const Float3 &a, const Float3 &b)
+        {
+            return Float3{ a.y * b.z - a.z * b.y, a.z * b.x - a.x * b.z, a.x * b.y - a.y * b.x };
+        }
+    }
+
+    float ComputeAcmr(const uint32_t *indices, size_t indexCount, size_t vertexCount, uint32_t cacheSize)
+    {
+        CheckIndices(indices, indexCount, vertexCount, "ComputeAcmr");
+        size_t triangleCount = indexCount / 3;
+        return triangleCount == 0 ? 0.0f
+            : static_cast<float>(CountMisses(indices, indexCount, vertexCount, cacheSize)) / triangleCount;
+    }
+
+    float ComputeAtvr(const uint32_t *indices, size_t indexCount, size_t vertexCount, uint32_t cacheSize)
+    {
+        CheckIndices(indices, indexCount, vertexCount, "ComputeAtvr");
+        std::vector<uint8_t> used(vertexCount, 0);
+        size_t usedCount = 0;
+        for (size_t i = 0; i < indexCount; ++i)
+        {
+            usedCount += used[indices[i]] ? 0 : 1;
+            used[indices[i]] = 1;
+        }
+        return usedCount == 0 ? 0.0f
+            : static_cast<float>(CountMisses(indices, indexCount, vertexCount, cacheSize)) / usedCount;
+    }
+
+    // 頂点を 1 つ選んで、その頂点を使う未出力の三角形をすべて出力 (扇) し、次の頂点を扇で触れた頂点から選びます。
+    // 候補が無ければ、最近出力した頂点のスタックか、番号順の走査で残りの三角形を持つ頂点を探します。
+    void OptimizeVertexCache(uint32_t *indices, size_t indexCount, size_t vertexCount, uint32_t cacheSize)
+    {
+        THINR_PROFILE_ZONE("OptimizeVertexCache");
+        CheckIndices(indices, indexCount, vertexCount, "OptimizeVertexCache");
+        size_t triangleCount = indexCount / 3;
+        if (triangleCount == 0)
+        {
+            return;
+        }
+
+        // 頂点ごとの三角形の一覧 (CSR) と、未出力の三角形の数。
+        std::vector<uint32_t> live(vertexCount, 0);
+        for (size_t i = 0; i < triangleCount * 3; ++i)
+        {
+            live[indices[i]]++;
+        }
+        std::vector<uint32_t> offsets(vertexCount + 1, 0);
+        for (size_t v = 0; v < vertexCount; ++v)
+        {
+            offsets[v + 1] = offsets[v] + live[v];
+        }
+        std::vector<uint32_t> adjacency(triangleCount * 3);
+        {
+            std::vector<uint32_t> cursor(offsets.begin(), offsets.end() - 1);
+            for (size_t i = 0; i < triangleCount * 3; ++i)
+            {
+                adjacency[cursor[indices[i]]++] = static_cast<uint32_t>(i / 3);
+            }
+        }
+
+        VertexCacheSimulator cache(vertexCount, cacheSize);
+        std::vector<uint8_t> emitted(triangleCount, 0);
+        std::vector<uint32_t> output(triangleCount * 3);
+        std::vector<uint32_t> deadEnd;
+        deadEnd.reserve(triangleCount * 3);
+        std::vector<uint32_t> candidates;
+        size_t outputCount = 0;
+        size_t scan = 0;
+        int64_t fanning = indices[0];
+        while (fanning >= 0)
+        {
+            uint32_t f = static_cast<uint32_t>(fanning);
+            candidates.clear();
+            for (uint32_t a = offsets[f]; a < offsets[f + 1]; ++a)
+            {
+                uint32_t t = adjacency[a];
+                if (emitted[t])
+                {
+                    continue;
+                }
+                emitted[t] = 1;
+                for (int k = 0; k < 3; ++k)
+                {
+                    uint32_t v = indices[t * 3 + k];
+                    output[outputCount++] = v;
+                    deadEnd.push_back(v);
+                    candidates.push_back(v);
+                    live[v]--;
+                    cache.Access(v);
+                }
+            }
+
+            // 残りの三角形を扇で出力してもキャッシュから追い出されない頂点のうち、最も古いものを選びます。
+            fanning = -1;
+            int64_t bestPriority = -1;
+            for (uint32_t v : candidates)
+            {
+                if (live[v] == 0)
+                {
+                    continue;
+                }
+                int64_t priority = 0;
+                if (cache.GetAge(v) + 2 * static_cast<uint64_t>(live[v]) <= cacheSize)
+                {
+                    priority = cache.GetAge(v);
+                }
+                if (priority > bestPriority)
+                {
+                    bestPriority = priority;
+                    fanning = v;
+                }
+            }
+
+            while (fanning < 0 && !deadEnd.empty())
+            {
+                uint32_t v = deadEnd.back();
+                deadEnd.pop_back();
+                if (live[v] > 0)
+                {
+                    fanning = v;
+                }
+            }
+            while (fanning < 0 && scan < vertexCount)
+            {
+                if (live[scan] > 0)
+                {
+                    fanning = static_cast<int64_t>(scan);
+                }
+                scan++;
+            }
+        }
+        std::copy(output.begin(), output.end(), indices);
+    }
+
+    void OptimizeOverdraw(uint32_t *indices, size_t indexCount, const VertexPositionColor *vertices, size_t vertexCount,
+        float threshold, uint32_t cacheSize)
+    {
+        THINR_PROFILE_ZONE("OptimizeOverdraw");
+        CheckIndices(indices, indexCount, vertexCount, "OptimizeOverdraw");
+        size_t triangleCount = indexCount / 3;
+        if (triangleCount < 2)
+        {
+            return;
+        }
+
+        // 3 頂点ともミスする三角形でキャッシュの続きが切れています。
+        VertexCacheSimulator cache(vertexCount, cacheSize);
+        std::vector<uint32_t> hard;
+        for (size_t t = 0; t < triangleCount; ++t)
+        {
+            if (CountTriangleMisses(cache, indices + t * 3) == 3 || t == 0)
+            {
+                hard.push_back(static_cast<uint32_t>(t));
+            }
+        }
+        hard.push_back(static_cast<uint32_t>(triangleCount));
+
+        // まとまりの途中までの ACMR が、まとまり全体の threshold 倍以下になったら分けます。
+        std::vector<uint32_t> clusters;
+        for (size_t h = 0; h + 1 < hard.size(); ++h)
+        {
+            uint32_t start = hard[h];
+            uint32_t end = hard[h + 1];
+            cache.Clear();
+            size_t clusterMisses = 0;
+            for (uint32_t t = start; t < end; ++t)
+            {
+                clusterMisses += CountTriangleMisses(cache, indices + t * 3);
+            }
+            float clusterThreshold = threshold * static_cast<float>(clusterMisses) / (end - start);
+
+            cache.Clear();
+            clusters.push_back(start);
+            uint32_t softStart = start;
+            size_t misses = 0;
+            for (uint32_t t = start; t < end; ++t)
+            {
+                misses += CountTriangleMisses(cache, indices + t * 3);
+                if (t + 1 < end && static_cast<float>(misses) / (t + 1 - softStart) <= clusterThreshold)
+                {
+                    clusters.push_back(t + 1);
+                    softStart = t + 1;
+                    misses = 0;
+                    cache.Clear();
+                }
+            }
+        }
+        clusters.push_back(static_cast<uint32_t>(triangleCount));
+
+        // まとまりごとの面積で重み付けした重心と法線。メッシュの中心から外に向いているものほど先に描きます。
+        size_t clusterCount = clusters.size() - 1;
+        std::vector<Float3> centroids(clusterCount);
+        std::vector<Float3> normals(clusterCount);
+        Float3 meshCentroid = { 0.0f, 0.0f, 0.0f };
+        float meshArea = 0.0f;
+        for (size_t c = 0; c < clusterCount; ++c)
+        {
+            Float3 centroid = { 0.0f, 0.0f, 0.0f };
+            Float3 normal = { 0.0f, 0.0f, 0.0f };
+            float area = 0.0f;
+            for (uint32_t t = clusters[c]; t < clusters[c + 1]; ++t)
+            {
+                const Float3 &p0 = vertices[indices[t * 3 + 0]].pos;
+                const Float3 &p1 = vertices[indices[t * 3 + 1]].pos;
+                const Float3 &p2 = vertices[indices[t * 3 + 2]].pos;
+                Float3 n = Cross(Subtract(p1, p0), Subtract(p2, p0));
+                float a = std::sqrt(n.x * n.x + n.y * n.y + n.z * n.z);
+                centroid.x += (p0.x + p1.x + p2.x) * a;
+                centroid.y += (p0.y + p1.y + p2.y) * a;
+                centroid.z += (p0.z + p1.z + p2.z) * a;
+                normal.x += n.x;
+                normal.y += n.y;
+                normal.z += n.z;
+                area += a;
+            }
+            meshCentroid.x += centroid.x;
+            meshCentroid.y += centroid.y;
+            meshCentroid.z += centroid.z;
+            meshArea += area;
+            float scale = area > 0.0f ? 1.0f / (area * 3.0f) : 0.0f;
+            centroids[c] = Float3{ centroid.x * scale, centroid.y * scale, centroid.z * scale };
+            float length = std::sqrt(normal.x * normal.x + normal.y * normal.y + normal.z * normal.z);
+            float inverse = length > 0.0f ? 1.0f / length : 0.0f;
+            normals[c] = Float3{ normal.x * inverse, normal.y * inverse, normal.z * inverse };
+        }
+        float meshScale = meshArea > 0.0f ? 1.0f / (meshArea * 3.0f) : 0.0f;
+        meshCentroid = Float3{ meshCentroid.x * meshScale, meshCentroid.y * meshScale, meshCentroid.z * meshScale };
+
+        std::vector<float> keys(clusterCount);
+        std::vector<uint32_t> order(clusterCount);
+        for (size_t c = 0; c < clusterCount; ++c)
+        {
+            Float3 d = Subtract(centroids[c], meshCentroid);
+            keys[c] = d.x * normals[c].x + d.y * normals[c].y + d.z * normals[c].z;
+            order[c] = static_cast<uint32_t>(c);
+        }
+        std::stable_sort(order.begin(), order.end(), [&keys](uint32_t a, uint32_t b) { return keys[a] > keys[b]; });
+
+        std::vector<uint32_t> output;
+        output.reserve(triangleCount * 3);
+        for (uint32_t c : order)
+        {
+            output.insert(output.end(), indices + clusters[c] * 3, indices + clusters[c + 1] * 3);
+        }
+        std::copy(output.begin(), output.end(), indices);
+    }
+
+    size_t OptimizeVertexFetch(VertexPositionColor *vertices, size_t vertexCount, uint32_t *indices, size_t indexCount)
+    {
+        THINR_PROFILE_ZONE("OptimizeVertexFetch");
+        CheckIndices(indices, indexCount, vertexCount, "OptimizeVertexFetch");
+        std::vector<uint32_t> remap(vertexCount, UINT32_MAX);
+        uint32_t next = 0;
+        for (size_t i = 0; i < indexCount; ++i)
+        {
+            uint32_t &target = remap[indices[i]];
+            if (target == UINT32_MAX)
+            {
+                target = next++;
+            }
+            indices[i] = target;
+        }
+
+        std::vector<VertexPositionColor> source(vertices, vertices + vertexCount);
+        for (size_t v = 0; v < vertexCount; ++v)
+        {
+            if (remap[v] != UINT32_MAX)
+            {
+                vertices[remap[v]] = source[v];
+            }
+        }
+        return next;
+    }
+
+    MeshOptimizeStats OptimizeMesh(MeshData &mesh, float overdrawThreshold, uint32_t cacheSize)
+    {
+        THINR_PROFILE_ZONE("OptimizeMesh");
+        MeshOptimizeStats stats;
+        uint32_t *indices = mesh.indices.data();
+        size_t indexCount = mesh.indices.size();
+        size_t vertexCount = mesh.vertices.size();
+        stats.vertexCountBefore = vertexCount;
+        stats.acmrBefore = ComputeAcmr(indices, indexCount, vertexCount, cacheSize);
+        stats.atvrBefore = ComputeAtvr(indices, indexCount, vertexCount, cacheSize);
+
+        // サブメッシュが使う頂点だけに 0 から番号を付け直して最適化し、元の番号に戻します。
+        // こうすると各パスの作業領域と走査がサブメッシュの大きさで済み、サブメッシュが多くてもメッシュの頂点数倍になりません。
+        std::vector<uint32_t> toLocal(vertexCount, UINT32_MAX);
+        std::vector<uint32_t> toGlobal;
+        std::vector<VertexPositionColor> localVertices;
+        std::vector<uint32_t> localIndices;
+        auto optimize = [&](uint32_t start, uint32_t count)
+        {
+            toGlobal.clear();
+            localVertices.clear();
+            localIndices.resize(count);
+            for (uint32_t i = 0; i < count; ++i)
+            {
+                uint32_t v = indices[start + i];
+                if (toLocal[v] == UINT32_MAX)
+                {
+                    toLocal[v] = static_cast<uint32_t>(toGlobal.size());
+                    toGlobal.push_back(v);
+                    localVertices.push_back(mesh.vertices[v]);
+                }
+                localIndices[i] = toLocal[v];
+            }
+
+            OptimizeVertexCache(localIndices.data(), count, toGlobal.size(), cacheSize);
+            OptimizeOverdraw(localIndices.data(), count, localVertices.data(), toGlobal.size(), overdrawThreshold, cacheSize);
+
+            for (uint32_t i = 0; i < count; ++i)
+            {
+                indices[start + i] = toGlobal[localIndices[i]];
+            }
+            for (uint32_t v : toGlobal)
+            {
+                toLocal[v] = UINT32_MAX;
+            }
+        };
+        if (mesh.submeshes.empty())
+        {
+            optimize(0, static_cast<uint32_t>(indexCount));
+        }
+        for (const auto &submesh : mesh.submeshes)
+        {
+            if (submesh.indexStart > indexCount || submesh.indexCount > indexCount - submesh.indexStart)
+            {
+                throw std::invalid_argument("OptimizeMesh: submesh out of range");
+            }
+            optimize(submesh.indexStart, submesh.indexCount);
+        }
+
+        stats.vertexCountAfter = OptimizeVertexFetch(mesh.vertices.data(), vertexCount, indices, indexCount);
+        mesh.vertices.resize(stats.vertexCountAfter);
+        stats.acmrAfter = ComputeAcmr(indices, indexCount, stats.vertexCountAfter, cacheSize);
+        stats.atvrAfter = ComputeAtvr(indices, indexCount, stats.vertexCountAfter, cacheSize);
+        return stats;
+    }
+}
@@ -0,0 +1,50 @@
+﻿#pragma once
+#include "MeshFile.h"
+#include "VertexTypes.h"
+#include <vector>
+#include <cstddef>
+#include <cstdint>
+
+
+namespace thinr
+{
+    // ACMR などを測るときの頂点キャッシュのエントリー数。最近の GPU の実効値に近い値です。
+    const uint32_t DefaultVertexCacheSize = 16;
+
+    struct MeshOptimizeStats
+    {
+        // 三角形あたりの頂点シェーダーの実行数 (FIFO キャッシュで測定)。0.5 に近いほど良く、最悪は 3 です。
+        float acmrBefore;
+        float acmrAfter;
+        // 使われている頂点あたりの実行数。1 に近いほど良い値です。
+        float atvrBefore;
+        float atvrAfter;
+        size_t vertexCountBefore;
+        // どのインデックスからも参照されない頂点を除いた数。
+        size_t vertexCountAfter;
+    };
+
+    // cacheSize 個のエントリーを持つ FIFO の頂点キャッシュで、三角形あたりのキャッシュ ミス数を求めます。
+    float ComputeAcmr(const uint32_t *indices, size_t indexCount, size_t vertexCount, uint32_t cacheSize = DefaultVertexCacheSize);
+    // 参照されている頂点あたりのキャッシュ ミス数。
+    float ComputeAtvr(const uint32_t *indices, size_t indexCount, size_t vertexCount, uint32_t cacheSize = DefaultVertexCacheSize);
+
+    // Tipsify (Sander ほか, 2007) で三角形を並べ替えて頂点キャッシュのヒットを増やします。時間はインデックス数と頂点数に比例します。
+    // インデックスが vertexCount 以上の場合は std::invalid_argument を送出します。
+    void OptimizeVertexCache(uint32_t *indices, size_t indexCount, size_t vertexCount,
+        uint32_t cacheSize = DefaultVertexCacheSize);
+
+    // OptimizeVertexCache の後に呼び、三角形のまとまりを外側を向いたものから順に並べ替えて重ね描きを減らします。
+    // キャッシュが切れた位置 (3 頂点ともミスする三角形) で分けたまとまりを、キャッシュの効率が threshold 倍より
+    // 悪くならない範囲でさらに細かく分けます (1.05 なら ACMR の悪化は 5% 程度)。
+    void OptimizeOverdraw(uint32_t *indices, size_t indexCount, const VertexPositionColor *vertices, size_t vertexCount,
+        float threshold = 1.05f, uint32_t cacheSize = DefaultVertexCacheSize);
+
+    // 頂点をインデックスで最初に使われる順に並べ替え、インデックスを付け直します。使われていない頂点は除き、残った数を返します。
+    size_t OptimizeVertexFetch(VertexPositionColor *vertices, size_t vertexCount, uint32_t *indices, size_t indexCount);
+
+    // サブメッシュごとに頂点キャッシュと重ね描きの最適化を行い、最後に頂点の並びを最適化します。
+    // サブメッシュの三角形の集合とインデックスの範囲は変わりません。サブメッシュごとに使っている頂点だけで最適化するので、
+    // 時間はサブメッシュの数によらず、メッシュ全体のインデックス数と頂点数に比例します。
+    MeshOptimizeStats OptimizeMesh(MeshData &mesh, float overdrawThreshold = 1.05f, uint32_t cacheSize = DefaultVertexCacheSize);
+}
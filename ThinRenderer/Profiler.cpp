@@ -0,0 +1,185 @@
+﻿#include "pch.h"
+#include "Profiler.h"
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <fstream>
+#include <stdexcept>
+
+
+namespace thinr
+{
+    // 書き込むのは所有スレッドだけです。head は書き込み済みイベントの総数で、読み出し側との同期に使います。
+    struct Profiler::ThreadBuffer
+    {
+        std::unique_ptr<ProfileEvent[]> events;
+        std::atomic<uint64_t> head;
+        // Clear 時点の head。これより前のイベントは書き出しません。
+        std::atomic<uint64_t> floor;
+        uint32_t threadId;
+        std::string name;
+
+        explicit ThreadBuffer(uint32_t id)
+            : events(new ProfileEvent[EventsPerThread]), head(0), floor(0), threadId(id)
+        {}
+    };
+
+    namespace
+    {
+        int64_t SteadyNowNs()
+        {
+            return std::chrono::duration_cast<std::chrono::nanoseconds>(
+                std::chrono::steady_clock::now().time_since_epoch()).count();
+        }
+
+        void WriteJsonString(std::ostream &stream, const char *text)
+        {
+            stream << '"';
+            for (const char *c = text; *c; ++c)
+            {
+                unsigned char ch = static_cast<unsigned char>(*c);
+                if (ch == '"' || ch == '\\')
+                {
+                    stream << '\\' << *c;
+                }
+                else if (ch < 0x20)
+                {
+                    char escaped[8];
+                    std::snprintf(escaped, sizeof(escaped), "\\u%04x", ch);
+                    stream << escaped;
+                }
+                else
+                {
+                    stream << *c;
+                }
+            }
+            stream << '"';
+        }
+
+        // Chrome のトレースはマイクロ秒単位です。
+        void WriteMicroseconds(std::ostream &stream, int64_t ns)
+        {
+            char text[32];
+            std::snprintf(text, sizeof(text), "%lld.%03lld",
+                static_cast<long long>(ns / 1000), static_cast<long long>(ns % 1000));
+            stream << text;
+        }
+    }
+
+    Profiler::Profiler()
+        : m_enabled(true), m_epoch(SteadyNowNs())
+    {
+        static_assert((EventsPerThread & (EventsPerThread - 1)) == 0, "EventsPerThread must be a power of two");
+    }
+
+    Profiler &Profiler::Get()
+    {
+        static Profiler s_profiler;
+        return s_profiler;
+    }
+
+    int64_t Profiler::Now() const
+    {
+        return SteadyNowNs() - m_epoch;
+    }
+
+    Profiler::ThreadBuffer &Profiler::GetThreadBuffer()
+    {
+        thread_local ThreadBuffer *t_buffer = nullptr;
+        if (!t_buffer)
+        {
+            // スレッド終了後も書き出せるよう、バッファーはプロファイラーが所有します。
+            std::lock_guard<std::mutex> lock(m_mutex);
+            auto buffer = std::make_shared<ThreadBuffer>(static_cast<uint32_t>(m_threads.size()) + 1);
+            m_threads.push_back(buffer);
+            t_buffer = buffer.get();
+        }
+        return *t_buffer;
+    }
+
+    void Profiler::SetThreadName(const char *name)
+    {
+        ThreadBuffer &buffer = GetThreadBuffer();
+        std::lock_guard<std::mutex> lock(m_mutex);
+        buffer.name = name;
+    }
+
+    void Profiler::Record(const char *name, int64_t startNs, int64_t endNs)
+    {
+        ThreadBuffer &buffer = GetThreadBuffer();
+        uint64_t head = buffer.head.load(std::memory_order_relaxed);
+        ProfileEvent &event = buffer.events[head & (EventsPerThread - 1)];
+        event.name = name;
+        event.startNs = startNs;
+        event.endNs = endNs;
+        buffer.head.store(head + 1, std::memory_order_release);
+    }
+
+    void Profiler::Clear()
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        for (auto &buffer : m_threads)
+        {
+            buffer->floor.store(buffer->head.load(std::memory_order_acquire), std::memory_order_relaxed);
+        }
+    }
+
+    void Profiler::WriteChromeTrace(std::ostream &stream) const
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        std::vector<ProfileEvent> events;
+
+        stream << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[";
+        bool first = true;
+        for (const auto &buffer : m_threads)
+        {
+            if (!buffer->name.empty())
+            {
+                stream << (first ? "\n" : ",\n");
+                first = false;
+                stream << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":" << buffer->threadId << ",\"args\":{\"name\":";
+                WriteJsonString(stream, buffer->name.c_str());
+                stream << "}}";
+            }
+
+            // 所有スレッドが書き込み中でも読めるよう、先にコピーしてから上書きされた分を捨てます。
+            uint64_t head = buffer->head.load(std::memory_order_acquire);
+            uint64_t begin = std::max(buffer->floor.load(std::memory_order_relaxed),
+                head > EventsPerThread ? head - EventsPerThread : 0);
+            events.clear();
+            for (uint64_t i = begin; i < head; ++i)
+            {
+                events.push_back(buffer->events[i & (EventsPerThread - 1)]);
+            }
+            uint64_t headAfter = buffer->head.load(std::memory_order_acquire);
+            // Record は head を進める前にスロットへ書くので、次に書かれるスロットの分も捨てます。
+            uint64_t valid = headAfter + 1 > EventsPerThread ? headAfter + 1 - EventsPerThread : 0;
+            size_t skip = valid > begin ? static_cast<size_t>(std::min(valid - begin, head - begin)) : 0;
+
+            for (size_t i = skip; i < events.size(); ++i)
+            {
+                const ProfileEvent &event = events[i];
+                stream << (first ? "\n" : ",\n");
+                first = false;
+                stream << "{\"name\":";
+                WriteJsonString(stream, event.name);
+                stream << ",\"cat\":\"thinr\",\"ph\":\"X\",\"pid\":1,\"tid\":" << buffer->threadId << ",\"ts\":";
+                WriteMicroseconds(stream, event.startNs);
+                stream << ",\"dur\":";
+                WriteMicroseconds(stream, event.endNs - event.startNs);
+                stream << "}";
+            }
+        }
+        stream << "\n]}\n";
+    }
+
+    void Profiler::WriteChromeTrace(const std::string &path) const
+    {
+        std::ofstream file(path, std::ios::binary);
+        WriteChromeTrace(file);
+        if (!file)
+        {
+            throw std::runtime_error("Profiler: failed to write " + path);
+        }
+    }
+}
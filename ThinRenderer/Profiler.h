@@ -0,0 +1,102 @@
+﻿#pragma once
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <vector>
+
+
+// THINR_ENABLE_PROFILER を定義したときだけゾーンが計測されます (プロジェクトの Debug 構成で定義しています)。
+// 未定義の場合、THINR_PROFILE_* マクロは空に展開されるのでコストはありません。
+#ifdef THINR_ENABLE_PROFILER
+#define THINR_PROFILE_CONCAT_INNER(a, b) a##b
+#define THINR_PROFILE_CONCAT(a, b) THINR_PROFILE_CONCAT_INNER(a, b)
+// スコープの終わりまでを name (文字列リテラル) のゾーンとして記録します。
+#define THINR_PROFILE_ZONE(name) ::thinr::ProfileZone THINR_PROFILE_CONCAT(thinrProfileZone, __LINE__)(name)
+#define THINR_PROFILE_FUNCTION() THINR_PROFILE_ZONE(__FUNCTION__)
+// トレースに表示する現在のスレッドの名前を設定します。
+#define THINR_PROFILE_THREAD(name) ::thinr::Profiler::Get().SetThreadName(name)
+#else
+#define THINR_PROFILE_ZONE(name) ((void)0)
+#define THINR_PROFILE_FUNCTION() ((void)0)
+#define THINR_PROFILE_THREAD(name) ((void)0)
+#endif
+
+
+namespace thinr
+{
+    struct ProfileEvent
+    {
+        // 静的な文字列 (リテラルや __FUNCTION__) である必要があります。コピーはしません。
+        const char *name;
+        int64_t startNs;
+        int64_t endNs;
+    };
+
+    // スレッドごとのリング バッファーにゾーンを記録し、Chrome の trace_event 形式で書き出します。
+    // 記録はスレッド ローカルのバッファーへの書き込みだけで、ロックはスレッドの初回記録時にしか取りません。
+    // バッファーが一杯になると古いイベントから上書きされます。
+    class Profiler
+    {
+    public:
+        // スレッドあたりのイベント数 (2 のべき乗)。
+        static const size_t EventsPerThread = 1 << 14;
+
+        static Profiler &Get();
+
+        // 実行時に記録を止めます (THINR_ENABLE_PROFILER が定義されている場合のみ意味があります)。
+        void SetEnabled(bool enabled) { m_enabled.store(enabled, std::memory_order_relaxed); }
+        bool IsEnabled() const { return m_enabled.load(std::memory_order_relaxed); }
+
+        void SetThreadName(const char *name);
+
+        // プロファイラー生成時からの経過時間 (ナノ秒)。
+        int64_t Now() const;
+        void Record(const char *name, int64_t startNs, int64_t endNs);
+
+        // これまでのイベントを捨てます。
+        void Clear();
+
+        // 記録中でも呼び出せます。書き出し中に上書きされた可能性のあるイベントは除外されます。
+        void WriteChromeTrace(std::ostream &stream) const;
+        void WriteChromeTrace(const std::string &path) const;
+
+    private:
+        struct ThreadBuffer;
+
+        Profiler();
+        ThreadBuffer &GetThreadBuffer();
+
+        std::atomic<bool> m_enabled;
+        int64_t m_epoch;
+        mutable std::mutex m_mutex;
+        std::vector<std::shared_ptr<ThreadBuffer>> m_threads;
+    };
+
+    // THINR_PROFILE_ZONE の実体。
+    class ProfileZone
+    {
+    public:
+        explicit ProfileZone(const char *name)
+            : m_name(name), m_start(Profiler::Get().IsEnabled() ? Profiler::Get().Now() : -1)
+        {}
+
+        ~ProfileZone()
+        {
+            if (m_start >= 0)
+            {
+                Profiler &profiler = Profiler::Get();
+                profiler.Record(m_name, m_start, profiler.Now());
+            }
+        }
+
+        ProfileZone(const ProfileZone &) = delete;
+        ProfileZone &operator=(const ProfileZone &) = delete;
+
+    private:
+        const char *m_name;
+        int64_t m_start;
+    };
+}
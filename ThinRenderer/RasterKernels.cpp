@@ -0,0 +1,348 @@
+﻿#include "pch.h"
+#include "RasterKernels.h"
+#include "CpuFeatures.h"
+#include <algorithm>
+
+#if defined(_M_IX86) || defined(_M_X64) || defined(__i386__) || defined(__x86_64__)
+#define THINR_X86 1
+#include <immintrin.h>
+#endif
+
+// GCC/Clang は関数単位で AVX2 を有効にします (MSVC は指定不要)。
+#if defined(__GNUC__) || defined(__clang__)
+#define THINR_TARGET_AVX2 __attribute__((target("avx2")))
+#else
+#define THINR_TARGET_AVX2
+#endif
+
+
+namespace thinr
+{
+    namespace
+    {
+        // 行ごとに一定になる項。SIMD 版もスカラー版と同じ式で計算するので、結果はビット単位で一致します。
+        struct RowSetup
+        {
+            float py;
+            float edge[3];
+            float z;
+            float invW;
+            float color[3];
+        };
+
+        inline void SetupRow(const RasterTriangle &tri, int32_t y, RowSetup &row)
+        {
+            row.py = y + 0.5f;
+            for (int i = 0; i < 3; ++i)
+            {
+                row.edge[i] = tri.edgeB[i] * row.py + tri.edgeC[i];
+                row.color[i] = tri.color[i][1] * row.py + tri.color[i][2];
+            }
+            row.z = tri.z[1] * row.py + tri.z[2];
+            row.invW = tri.invW[1] * row.py + tri.invW[2];
+        }
+
+        inline uint32_t ToByte(float v)
+        {
+            v = std::min(std::max(v, 0.0f), 1.0f);
+            return static_cast<uint32_t>(v * 255.0f + 0.5f);
+        }
+
+        inline void ShadePixel(const RasterTriangle &tri, const RowSetup &row, int32_t x,
+            uint32_t *colorRow, float *depthRow, const RasterSurface &surface)
+        {
+            float px = x + 0.5f;
+            for (int i = 0; i < 3; ++i)
+            {
+                float e = tri.edgeA[i] * px + row.edge[i];
+                if (!(e > 0 || (e == 0 && (tri.topLeftMask & (1u << i)))))
+                {
+                    return;
+                }
+            }
+
+            float z = tri.z[0] * px + row.z;
+            if (!(z < depthRow[x]))
+            {
+                return;
+            }
+            depthRow[x] = z;
+
+            float w = 1.0f / (tri.invW[0] * px + row.invW);
+            uint32_t r = ToByte((tri.color[0][0] * px + row.color[0]) * w);
+            uint32_t g = ToByte((tri.color[1][0] * px + row.color[1]) * w);
+            uint32_t b = ToByte((tri.color[2][0] * px + row.color[2]) * w);
+            colorRow[x] = (r << surface.channelShift[0]) | (g << surface.channelShift[1]) | (b << surface.channelShift[2]) | 0xFF000000u;
+        }
+
+        inline bool ClampRect(const RasterTriangle &tri, int32_t &x0, int32_t &y0, int32_t &x1, int32_t &y1)
+        {
+            x0 = std::max(x0, tri.minX);
+            y0 = std::max(y0, tri.minY);
+            x1 = std::min(x1, tri.maxX);
+            y1 = std::min(y1, tri.maxY);
+            return x0 <= x1 && y0 <= y1;
+        }
+
+#if THINR_X86
+        void RasterizeTriangleSSE2(const RasterTriangle &tri,
+            int32_t x0, int32_t y0, int32_t x1, int32_t y1, const RasterSurface &surface)
+        {
+            if (!ClampRect(tri, x0, y0, x1, y1))
+            {
+                return;
+            }
+
+            const __m128 laneCenter = _mm_setr_ps(0.5f, 1.5f, 2.5f, 3.5f);
+            const __m128i laneIndex = _mm_setr_epi32(0, 1, 2, 3);
+            const __m128 zero = _mm_setzero_ps();
+            const __m128 one = _mm_set1_ps(1.0f);
+            const __m128 scale = _mm_set1_ps(255.0f);
+            const __m128 half = _mm_set1_ps(0.5f);
+            const __m128i alpha = _mm_set1_epi32(static_cast<int>(0xFF000000u));
+            const __m128i rangeMin = _mm_set1_epi32(x0 - 1);
+            const __m128i rangeMax = _mm_set1_epi32(x1 + 1);
+
+            __m128 edgeA[3];
+            __m128 topLeft[3];
+            for (int i = 0; i < 3; ++i)
+            {
+                edgeA[i] = _mm_set1_ps(tri.edgeA[i]);
+                topLeft[i] = _mm_castsi128_ps(_mm_set1_epi32((tri.topLeftMask & (1u << i)) ? -1 : 0));
+            }
+            const __m128 zA = _mm_set1_ps(tri.z[0]);
+            const __m128 invWA = _mm_set1_ps(tri.invW[0]);
+            const __m128 colorA[3] = {
+                _mm_set1_ps(tri.color[0][0]), _mm_set1_ps(tri.color[1][0]), _mm_set1_ps(tri.color[2][0]),
+            };
+            const __m128i shift[3] = {
+                _mm_cvtsi32_si128(surface.channelShift[0]), _mm_cvtsi32_si128(surface.channelShift[1]), _mm_cvtsi32_si128(surface.channelShift[2]),
+            };
+
+            int32_t bxBegin = x0 & ~3;
+            for (int32_t y = y0; y <= y1; ++y)
+            {
+                RowSetup row;
+                SetupRow(tri, y, row);
+                uint32_t *colorRow = surface.color + static_cast<size_t>(y) * surface.colorPitch;
+                float *depthRow = surface.depth + static_cast<size_t>(y) * surface.depthPitch;
+                __m128 rowEdge[3] = { _mm_set1_ps(row.edge[0]), _mm_set1_ps(row.edge[1]), _mm_set1_ps(row.edge[2]) };
+
+                for (int32_t bx = bxBegin; bx <= x1; bx += 4)
+                {
+                    if (bx + 3 >= surface.width)
+                    {
+                        // 行末をはみ出すブロックは隣の行 (別タイル) に触れないようスカラーで処理します。
+                        for (int32_t x = std::max(bx, x0); x <= x1; ++x)
+                        {
+                            ShadePixel(tri, row, x, colorRow, depthRow, surface);
+                        }
+                        break;
+                    }
+
+                    __m128 px = _mm_add_ps(_mm_set1_ps(static_cast<float>(bx)), laneCenter);
+                    __m128i xi = _mm_add_epi32(_mm_set1_epi32(bx), laneIndex);
+                    __m128 mask = _mm_castsi128_ps(_mm_and_si128(_mm_cmpgt_epi32(xi, rangeMin), _mm_cmplt_epi32(xi, rangeMax)));
+                    for (int i = 0; i < 3; ++i)
+                    {
+                        __m128 e = _mm_add_ps(_mm_mul_ps(edgeA[i], px), rowEdge[i]);
+                        __m128 inside = _mm_or_ps(_mm_cmpgt_ps(e, zero), _mm_and_ps(_mm_cmpeq_ps(e, zero), topLeft[i]));
+                        mask = _mm_and_ps(mask, inside);
+                    }
+                    if (_mm_movemask_ps(mask) == 0)
+                    {
+                        continue;
+                    }
+
+                    __m128 z = _mm_add_ps(_mm_mul_ps(zA, px), _mm_set1_ps(row.z));
+                    __m128 d = _mm_loadu_ps(depthRow + bx);
+                    mask = _mm_and_ps(mask, _mm_cmplt_ps(z, d));
+                    if (_mm_movemask_ps(mask) == 0)
+                    {
+                        continue;
+                    }
+                    _mm_storeu_ps(depthRow + bx, _mm_or_ps(_mm_and_ps(mask, z), _mm_andnot_ps(mask, d)));
+
+                    __m128 w = _mm_div_ps(one, _mm_add_ps(_mm_mul_ps(invWA, px), _mm_set1_ps(row.invW)));
+                    __m128i packed = alpha;
+                    for (int i = 0; i < 3; ++i)
+                    {
+                        __m128 c = _mm_mul_ps(_mm_add_ps(_mm_mul_ps(colorA[i], px), _mm_set1_ps(row.color[i])), w);
+                        c = _mm_min_ps(_mm_max_ps(c, zero), one);
+                        __m128i bytes = _mm_cvttps_epi32(_mm_add_ps(_mm_mul_ps(c, scale), half));
+                        packed = _mm_or_si128(packed, _mm_sll_epi32(bytes, shift[i]));
+                    }
+                    __m128i *dst = reinterpret_cast<__m128i *>(colorRow + bx);
+                    __m128i old = _mm_loadu_si128(dst);
+                    __m128i m = _mm_castps_si128(mask);
+                    _mm_storeu_si128(dst, _mm_or_si128(_mm_and_si128(m, packed), _mm_andnot_si128(m, old)));
+                }
+            }
+        }
+
+        THINR_TARGET_AVX2
+        void RasterizeTriangleAVX2(const RasterTriangle &tri,
+            int32_t x0, int32_t y0, int32_t x1, int32_t y1, const RasterSurface &surface)
+        {
+            if (!ClampRect(tri, x0, y0, x1, y1))
+            {
+                return;
+            }
+
+            const __m256 laneCenter = _mm256_setr_ps(0.5f, 1.5f, 2.5f, 3.5f, 4.5f, 5.5f, 6.5f, 7.5f);
+            const __m256i laneIndex = _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7);
+            const __m256 zero = _mm256_setzero_ps();
+            const __m256 one = _mm256_set1_ps(1.0f);
+            const __m256 scale = _mm256_set1_ps(255.0f);
+            const __m256 half = _mm256_set1_ps(0.5f);
+            const __m256i alpha = _mm256_set1_epi32(static_cast<int>(0xFF000000u));
+            const __m256i rangeMin = _mm256_set1_epi32(x0 - 1);
+            const __m256i rangeMax = _mm256_set1_epi32(x1 + 1);
+
+            __m256 edgeA[3];
+            __m256 topLeft[3];
+            for (int i = 0; i < 3; ++i)
+            {
+                edgeA[i] = _mm256_set1_ps(tri.edgeA[i]);
+                topLeft[i] = _mm256_castsi256_ps(_mm256_set1_epi32((tri.topLeftMask & (1u << i)) ? -1 : 0));
+            }
+            const __m256 zA = _mm256_set1_ps(tri.z[0]);
+            const __m256 invWA = _mm256_set1_ps(tri.invW[0]);
+            const __m256 colorA[3] = {
+                _mm256_set1_ps(tri.color[0][0]), _mm256_set1_ps(tri.color[1][0]), _mm256_set1_ps(tri.color[2][0]),
+            };
+            const __m128i shift[3] = {
+                _mm_cvtsi32_si128(surface.channelShift[0]), _mm_cvtsi32_si128(surface.channelShift[1]), _mm_cvtsi32_si128(surface.channelShift[2]),
+            };
+
+            int32_t bxBegin = x0 & ~7;
+            for (int32_t y = y0; y <= y1; ++y)
+            {
+                RowSetup row;
+                SetupRow(tri, y, row);
+                uint32_t *colorRow = surface.color + static_cast<size_t>(y) * surface.colorPitch;
+                float *depthRow = surface.depth + static_cast<size_t>(y) * surface.depthPitch;
+                __m256 rowEdge[3] = { _mm256_set1_ps(row.edge[0]), _mm256_set1_ps(row.edge[1]), _mm256_set1_ps(row.edge[2]) };
+
+                for (int32_t bx = bxBegin; bx <= x1; bx += 8)
+                {
+                    if (bx + 7 >= surface.width)
+                    {
+                        for (int32_t x = std::max(bx, x0); x <= x1; ++x)
+                        {
+                            ShadePixel(tri, row, x, colorRow, depthRow, surface);
+                        }
+                        break;
+                    }
+
+                    __m256 px = _mm256_add_ps(_mm256_set1_ps(static_cast<float>(bx)), laneCenter);
+                    __m256i xi = _mm256_add_epi32(_mm256_set1_epi32(bx), laneIndex);
+                    __m256 mask = _mm256_castsi256_ps(_mm256_and_si256(
+                        _mm256_cmpgt_epi32(xi, rangeMin), _mm256_cmpgt_epi32(rangeMax, xi)));
+                    for (int i = 0; i < 3; ++i)
+                    {
+                        __m256 e = _mm256_add_ps(_mm256_mul_ps(edgeA[i], px), rowEdge[i]);
+                        __m256 inside = _mm256_or_ps(_mm256_cmp_ps(e, zero, _CMP_GT_OQ),
+                            _mm256_and_ps(_mm256_cmp_ps(e, zero, _CMP_EQ_OQ), topLeft[i]));
+                        mask = _mm256_and_ps(mask, inside);
+                    }
+                    if (_mm256_movemask_ps(mask) == 0)
+                    {
+                        continue;
+                    }
+
+                    __m256 z = _mm256_add_ps(_mm256_mul_ps(zA, px), _mm256_set1_ps(row.z));
+                    __m256 d = _mm256_loadu_ps(depthRow + bx);
+                    mask = _mm256_and_ps(mask, _mm256_cmp_ps(z, d, _CMP_LT_OQ));
+                    if (_mm256_movemask_ps(mask) == 0)
+                    {
+                        continue;
+                    }
+                    _mm256_storeu_ps(depthRow + bx, _mm256_blendv_ps(d, z, mask));
+
+                    __m256 w = _mm256_div_ps(one, _mm256_add_ps(_mm256_mul_ps(invWA, px), _mm256_set1_ps(row.invW)));
+                    __m256i packed = alpha;
+                    for (int i = 0; i < 3; ++i)
+                    {
+                        __m256 c = _mm256_mul_ps(_mm256_add_ps(_mm256_mul_ps(colorA[i], px), _mm256_set1_ps(row.color[i])), w);
+                        c = _mm256_min_ps(_mm256_max_ps(c, zero), one);
+                        __m256i bytes = _mm256_cvttps_epi32(_mm256_add_ps(_mm256_mul_ps(c, scale), half));
+                        packed = _mm256_or_si256(packed, _mm256_sll_epi32(bytes, shift[i]));
+                    }
+                    __m256i *dst = reinterpret_cast<__m256i *>(colorRow + bx);
+                    __m256i old = _mm256_loadu_si256(dst);
+                    _mm256_storeu_si256(dst, _mm256_blendv_epi8(old, packed, _mm256_castps_si256(mask)));
+                }
+            }
+        }
+#endif
+    }
+
+    RasterSurface MakeRasterSurface(RenderTarget &target)
+    {
+        RasterSurface surface;
+        surface.color = target.GetColorRow(0);
+        surface.colorPitch = target.GetColorPitch();
+        surface.depth = target.GetDepth();
+        surface.depthPitch = target.GetDepthPitch();
+        surface.width = static_cast<int32_t>(target.GetWidth());
+        surface.height = static_cast<int32_t>(target.GetHeight());
+        bool bgra = target.GetFormat() == PixelFormat::B8G8R8A8_UNORM;
+        surface.channelShift[0] = bgra ? 16 : 0;
+        surface.channelShift[1] = 8;
+        surface.channelShift[2] = bgra ? 0 : 16;
+        return surface;
+    }
+
+    void RasterizeTriangleScalar(const RasterTriangle &tri,
+        int32_t x0, int32_t y0, int32_t x1, int32_t y1, const RasterSurface &surface)
+    {
+        if (!ClampRect(tri, x0, y0, x1, y1))
+        {
+            return;
+        }
+        for (int32_t y = y0; y <= y1; ++y)
+        {
+            RowSetup row;
+            SetupRow(tri, y, row);
+            uint32_t *colorRow = surface.color + static_cast<size_t>(y) * surface.colorPitch;
+            float *depthRow = surface.depth + static_cast<size_t>(y) * surface.depthPitch;
+            for (int32_t x = x0; x <= x1; ++x)
+            {
+                ShadePixel(tri, row, x, colorRow, depthRow, surface);
+            }
+        }
+    }
+
+    RasterKernel ResolveRasterKernel(RasterKernel kernel)
+    {
+        const CpuFeatures &cpu = GetCpuFeatures();
+        RasterKernel best = cpu.avx2 ? RasterKernel::AVX2 : cpu.sse2 ? RasterKernel::SSE2 : RasterKernel::Scalar;
+        switch (kernel)
+        {
+        case RasterKernel::Scalar:
+            return RasterKernel::Scalar;
+        case RasterKernel::SSE2:
+            return cpu.sse2 ? RasterKernel::SSE2 : best;
+        case RasterKernel::AVX2:
+            return cpu.avx2 ? RasterKernel::AVX2 : best;
+        default:
+            return best;
+        }
+    }
+
+    RasterizeTriangleFunc SelectRasterKernel(RasterKernel kernel)
+    {
+        switch (ResolveRasterKernel(kernel))
+        {
+#if THINR_X86
+        case RasterKernel::SSE2:
+            return &RasterizeTriangleSSE2;
+        case RasterKernel::AVX2:
+            return &RasterizeTriangleAVX2;
+#endif
+        default:
+            return &RasterizeTriangleScalar;
+        }
+    }
+}
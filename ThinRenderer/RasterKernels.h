@@ -0,0 +1,44 @@
+﻿#pragma once
+#include "SoftwareRasterizer.h"
+
+
+namespace thinr
+{
+    // カーネルが書き込む描画先。ピッチは要素数単位です。
+    struct RasterSurface
+    {
+        uint32_t *color;
+        size_t colorPitch;
+        float *depth;
+        size_t depthPitch;
+        int32_t width;
+        int32_t height;
+        // R, G, B を詰めるビット位置 (PixelFormat で決まります)。
+        uint32_t channelShift[3];
+    };
+
+    RasterSurface MakeRasterSurface(RenderTarget &target);
+
+    // 1 三角形を矩形 [x0, x1] x [y0, y1] の範囲で描画するカーネル。
+    // 矩形はタイルの内側で、x0 はタイル先頭 (8 の倍数) から始まる前提です。
+    typedef void (*RasterizeTriangleFunc)(const RasterTriangle &tri,
+        int32_t x0, int32_t y0, int32_t x1, int32_t y1, const RasterSurface &surface);
+
+    enum class RasterKernel
+    {
+        // CPUID で使える中で最速のものを選びます。
+        Auto,
+        Scalar,
+        // 4 ピクセル同時 (SSE2)
+        SSE2,
+        // 8 ピクセル同時 (AVX2)
+        AVX2,
+    };
+
+    // CPU が対応していないカーネルを指定した場合は使える中で最速のものにフォールバックします。
+    RasterKernel ResolveRasterKernel(RasterKernel kernel);
+    RasterizeTriangleFunc SelectRasterKernel(RasterKernel kernel);
+
+    void RasterizeTriangleScalar(const RasterTriangle &tri,
+        int32_t x0, int32_t y0, int32_t x1, int32_t y1, const RasterSurface &surface);
+}
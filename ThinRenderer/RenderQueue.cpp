@@ -0,0 +1,118 @@
+﻿#include "pch.h"
+#include "RenderQueue.h"
+#include <stdexcept>
+#include <utility>
+
+
+namespace thinr
+{
+    uint64_t RenderQueue::MakeSortKey(uint32_t pass, uint32_t shader, uint32_t material, uint32_t mesh, float depth)
+    {
+        if (pass > MaxPass || shader > MaxShader || material > MaxMaterial || mesh > MaxMesh)
+        {
+            throw std::invalid_argument("RenderQueue: sort key field out of range");
+        }
+        // NaN も 0 に寄せます。
+        float clamped = depth > 0.0f ? (depth < 1.0f ? depth : 1.0f) : 0.0f;
+        uint64_t quantized = static_cast<uint64_t>(clamped * 65535.0f + 0.5f);
+        return (static_cast<uint64_t>(pass) << 60) | (static_cast<uint64_t>(shader) << 48)
+            | (static_cast<uint64_t>(material) << 32) | (static_cast<uint64_t>(mesh) << 16) | quantized;
+    }
+
+    void RenderQueue::Sort()
+    {
+        size_t count = m_items.size();
+        if (count < 2)
+        {
+            return;
+        }
+
+        // 8 ビットずつ 8 パス。ヒストグラムは 1 回の走査でまとめて作ります。
+        size_t histogram[8][256] = {};
+        for (const Item &item : m_items)
+        {
+            for (int pass = 0; pass < 8; ++pass)
+            {
+                histogram[pass][(item.key >> (pass * 8)) & 0xff]++;
+            }
+        }
+
+        m_scratch.resize(count);
+        Item *src = m_items.data();
+        Item *dst = m_scratch.data();
+        for (int pass = 0; pass < 8; ++pass)
+        {
+            size_t *counts = histogram[pass];
+            // 全項目でこのバイトが同じなら並び替えは不要です (未使用の pass 等)。
+            if (counts[(src[0].key >> (pass * 8)) & 0xff] == count)
+            {
+                continue;
+            }
+
+            size_t offset = 0;
+            for (int digit = 0; digit < 256; ++digit)
+            {
+                size_t n = counts[digit];
+                counts[digit] = offset;
+                offset += n;
+            }
+            for (size_t i = 0; i < count; ++i)
+            {
+                dst[counts[(src[i].key >> (pass * 8)) & 0xff]++] = src[i];
+            }
+            std::swap(src, dst);
+        }
+
+        if (src != m_items.data())
+        {
+            m_items.swap(m_scratch);
+        }
+    }
+
+    void RenderQueue::Submit(IDrawSubmitter &submitter)
+    {
+        bool first = true;
+        uint32_t pass = 0;
+        uint32_t shader = 0;
+        uint32_t material = 0;
+        uint32_t mesh = 0;
+        for (const Item &item : m_items)
+        {
+            uint32_t itemPass = GetPass(item.key);
+            uint32_t itemShader = GetShader(item.key);
+            uint32_t itemMaterial = GetMaterial(item.key);
+            uint32_t itemMesh = GetMesh(item.key);
+
+            if (first || itemPass != pass)
+            {
+                submitter.BindPass(itemPass);
+                pass = itemPass;
+                m_stats.passBinds++;
+            }
+            if (first || itemShader != shader)
+            {
+                submitter.BindShader(itemShader);
+                shader = itemShader;
+                m_stats.shaderBinds++;
+            }
+            if (first || itemMaterial != material)
+            {
+                submitter.BindMaterial(itemMaterial);
+                material = itemMaterial;
+                m_stats.materialBinds++;
+            }
+            if (first || itemMesh != mesh)
+            {
+                submitter.BindMesh(itemMesh);
+                mesh = itemMesh;
+                m_stats.meshBinds++;
+            }
+            first = false;
+
+            submitter.Draw(item.payload);
+            m_stats.draws++;
+        }
+        m_stats.skippedBinds = m_stats.draws * 4
+            - (m_stats.passBinds + m_stats.shaderBinds + m_stats.materialBinds + m_stats.meshBinds);
+    }
+}
@@ -0,0 +1,79 @@
+﻿#pragma once
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+
+
+namespace thinr
+{
+    // RenderQueue::Submit から呼ばれるバックエンド。
+    // Bind* は直前と異なるステートのときだけ呼ばれます。
+    class IDrawSubmitter
+    {
+    public:
+        virtual ~IDrawSubmitter() {}
+        virtual void BindPass(uint32_t pass) = 0;
+        virtual void BindShader(uint32_t shader) = 0;
+        virtual void BindMaterial(uint32_t material) = 0;
+        virtual void BindMesh(uint32_t mesh) = 0;
+        // payload は Push に渡した値 (オブジェクトのインデックス等) です。
+        virtual void Draw(uint32_t payload) = 0;
+    };
+
+    struct RenderQueueStats
+    {
+        uint64_t draws;
+        uint64_t passBinds;
+        uint64_t shaderBinds;
+        uint64_t materialBinds;
+        uint64_t meshBinds;
+        // 毎回すべてバインドした場合と比べて省略したバインド数。
+        uint64_t skippedBinds;
+    };
+
+    // 描画項目を 64 ビットのソート キーで並べ替え、ステートの変化だけをバインドして発行します。
+    // キーは上位から pass (4) | shader (12) | material (16) | mesh (16) | depth (16) ビットです。
+    class RenderQueue
+    {
+    public:
+        static const uint32_t MaxPass = (1u << 4) - 1;
+        static const uint32_t MaxShader = (1u << 12) - 1;
+        static const uint32_t MaxMaterial = (1u << 16) - 1;
+        static const uint32_t MaxMesh = (1u << 16) - 1;
+
+        // depth は [0, 1] に正規化した深度です (範囲外はクランプ)。同じステート内では手前から描かれます。
+        // 半透明のパスでは 1 - depth を渡して奥から描いてください。
+        static uint64_t MakeSortKey(uint32_t pass, uint32_t shader, uint32_t material, uint32_t mesh, float depth);
+
+        static uint32_t GetPass(uint64_t key) { return static_cast<uint32_t>(key >> 60); }
+        static uint32_t GetShader(uint64_t key) { return static_cast<uint32_t>(key >> 48) & MaxShader; }
+        static uint32_t GetMaterial(uint64_t key) { return static_cast<uint32_t>(key >> 32) & MaxMaterial; }
+        static uint32_t GetMesh(uint64_t key) { return static_cast<uint32_t>(key >> 16) & MaxMesh; }
+
+        RenderQueue() : m_stats() {}
+
+        void Clear() { m_items.clear(); }
+        void Push(uint64_t key, uint32_t payload) { m_items.push_back(Item{ key, payload }); }
+        size_t GetSize() const { return m_items.size(); }
+
+        // キーで安定ソートします (LSD 基数ソート)。
+        void Sort();
+
+        // 並び順どおりに submitter へ発行します。バインド状態は Submit ごとにリセットされます。
+        void Submit(IDrawSubmitter &submitter);
+
+        const RenderQueueStats &GetStats() const { return m_stats; }
+        void ResetStats() { m_stats = RenderQueueStats(); }
+
+    private:
+        struct Item
+        {
+            uint64_t key;
+            uint32_t payload;
+        };
+
+        std::vector<Item> m_items;
+        std::vector<Item> m_scratch;
+        RenderQueueStats m_stats;
+    };
+}
@@ -0,0 +1,65 @@
+﻿#include "pch.h"
+#include "RenderTarget.h"
+#include <algorithm>
+#include <stdexcept>
+
+
+namespace thinr
+{
+    RenderTarget::RenderTarget(uint32_t width, uint32_t height, PixelFormat format)
+    {
+        if (width == 0 || height == 0)
+        {
+            throw std::invalid_argument("RenderTarget: empty size");
+        }
+        m_ownedColor.resize(static_cast<size_t>(width) * height);
+        m_view.data = reinterpret_cast<uint8_t *>(m_ownedColor.data());
+        m_view.width = width;
+        m_view.height = height;
+        m_view.pitch = static_cast<size_t>(width) * 4;
+        m_view.format = format;
+        m_depth.resize(static_cast<size_t>(width) * height, 1.0f);
+    }
+
+    RenderTarget::RenderTarget(const ImageView &external)
+        : m_view(external)
+    {
+        if (!external.data || external.width == 0 || external.height == 0)
+        {
+            throw std::invalid_argument("RenderTarget: empty image");
+        }
+        // カーネルは 32bit 単位で読み書きするので、行頭が 4 バイト境界に揃っている必要があります。
+        if (external.pitch < static_cast<size_t>(external.width) * 4 || external.pitch % 4 != 0
+            || reinterpret_cast<uintptr_t>(external.data) % 4 != 0)
+        {
+            throw std::invalid_argument("RenderTarget: pitch and data must be 4 byte aligned");
+        }
+        m_depth.resize(static_cast<size_t>(external.width) * external.height, 1.0f);
+    }
+
+    void RenderTarget::ClearRows(uint32_t beginRow, uint32_t endRow, uint32_t color, float depth)
+    {
+        endRow = std::min(endRow, m_view.height);
+        for (uint32_t y = beginRow; y < endRow; ++y)
+        {
+            uint32_t *row = GetColorRow(y);
+            std::fill(row, row + m_view.width, color);
+        }
+        std::fill(m_depth.begin() + static_cast<size_t>(beginRow) * m_view.width,
+            m_depth.begin() + static_cast<size_t>(endRow) * m_view.width, depth);
+    }
+
+    uint32_t RenderTarget::PackColor(PixelFormat format, float r, float g, float b, float a)
+    {
+        auto toByte = [](float v) -> uint32_t
+        {
+            v = std::min(std::max(v, 0.0f), 1.0f);
+            return static_cast<uint32_t>(v * 255.0f + 0.5f);
+        };
+        if (format == PixelFormat::B8G8R8A8_UNORM)
+        {
+            std::swap(r, b);
+        }
+        return toByte(r) | (toByte(g) << 8) | (toByte(b) << 16) | (toByte(a) << 24);
+    }
+}
@@ -0,0 +1,67 @@
+﻿#pragma once
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+
+
+namespace thinr
+{
+    // 1 ピクセル 32bit のカラー フォーマット。DXGI_FORMAT と同じバイト順です。
+    enum class PixelFormat
+    {
+        R8G8B8A8_UNORM,
+        B8G8R8A8_UNORM,
+    };
+
+    // ピクセル バッファーへの参照 (所有しません)。pitch は 1 行のバイト数です。
+    struct ImageView
+    {
+        uint8_t *data;
+        uint32_t width;
+        uint32_t height;
+        size_t pitch;
+        PixelFormat format;
+
+        uint8_t *Row(uint32_t y) const { return data + pitch * y; }
+        // data から最終行の末尾までのバイト数。
+        size_t GetByteSize() const { return height == 0 ? 0 : pitch * (height - 1) + static_cast<size_t>(width) * 4; }
+    };
+
+    // ソフトウェア ラスタライザーの描画先。32bit カラーと float の深度を持ちます。
+    // カラーは自前で確保するか、呼び出し元のバッファー (ImageView) に直接書き込みます。
+    // どちらの場合も GetColorView がコピー無しで描画結果を返します。
+    class RenderTarget
+    {
+    public:
+        // カラー バッファーを確保します (pitch = width * 4)。
+        RenderTarget(uint32_t width, uint32_t height, PixelFormat format = PixelFormat::R8G8B8A8_UNORM);
+        // 呼び出し元のバッファーに描画します。バッファーは RenderTarget より長く生存している必要があります。
+        explicit RenderTarget(const ImageView &external);
+        RenderTarget(const RenderTarget &) = delete;
+        RenderTarget &operator=(const RenderTarget &) = delete;
+
+        uint32_t GetWidth() const { return m_view.width; }
+        uint32_t GetHeight() const { return m_view.height; }
+        PixelFormat GetFormat() const { return m_view.format; }
+        bool IsExternal() const { return m_ownedColor.empty(); }
+
+        // 描画結果。Flush 後に読めば最新のフレームです。
+        const ImageView &GetColorView() const { return m_view; }
+
+        uint32_t *GetColorRow(uint32_t y) { return reinterpret_cast<uint32_t *>(m_view.Row(y)); }
+        // 4 バイト単位のピッチ。
+        size_t GetColorPitch() const { return m_view.pitch / 4; }
+        float *GetDepth() { return m_depth.data(); }
+        const float *GetDepth() const { return m_depth.data(); }
+        size_t GetDepthPitch() const { return m_view.width; }
+
+        void ClearRows(uint32_t beginRow, uint32_t endRow, uint32_t color, float depth);
+
+        static uint32_t PackColor(PixelFormat format, float r, float g, float b, float a);
+
+    private:
+        ImageView m_view;
+        std::vector<uint32_t> m_ownedColor;
+        std::vector<float> m_depth;
+    };
+}
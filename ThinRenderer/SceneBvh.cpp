@@ -0,0 +1,370 @@
+﻿#include "pch.h"
+#include "SceneBvh.h"
+#include "Profiler.h"
+#include <stdexcept>
+#include <chrono>
+
+
+namespace thinr
+{
+    const float SceneBvh::DefaultRebuildThreshold = 1.5f;
+
+    SceneBvh::SceneBvh()
+        : m_builtSahCost(0.0f), m_currentSahCost(0.0f), m_rebuildThreshold(DefaultRebuildThreshold),
+        m_generation(0), m_rebuildCount(0)
+    {
+    }
+
+    SceneBvh::~SceneBvh()
+    {
+        if (m_rebuild.valid())
+        {
+            m_rebuild.wait();
+        }
+    }
+
+    uint32_t SceneBvh::AddInstance(const std::shared_ptr<const MeshBvh> &mesh, const Float4x4 &transform)
+    {
+        if (!mesh)
+        {
+            throw std::invalid_argument("SceneBvh: null mesh");
+        }
+        uint32_t index = static_cast<uint32_t>(m_instances.size());
+        m_instances.push_back(Instance{ mesh, Float4x4(), Float4x4(), Aabb::Empty() });
+        m_generation++;
+        SetTransform(index, transform);
+        return index;
+    }
+
+    void SceneBvh::SetTransform(uint32_t instance, const Float4x4 &transform)
+    {
+        auto &target = m_instances.at(instance);
+        target.transform = transform;
+        target.inverse = InverseAffine(transform);
+        target.bounds = target.mesh->IsEmpty() ? Aabb::Empty() : TransformAabb(transform, target.mesh->GetBounds());
+    }
+
+    void SceneBvh::Clear()
+    {
+        m_instances.clear();
+        m_nodes.clear();
+        m_order.clear();
+        m_builtSahCost = 0.0f;
+        m_currentSahCost = 0.0f;
+        m_generation++;
+    }
+
+    void SceneBvh::Build()
+    {
+        THINR_PROFILE_FUNCTION();
+        std::vector<Aabb> bounds(m_instances.size());
+        for (size_t i = 0; i < m_instances.size(); ++i)
+        {
+            bounds[i] = m_instances[i].bounds;
+        }
+        BuildBvh(bounds.data(), bounds.size(), MaxLeafInstances, m_nodes, m_order);
+        m_builtSahCost = ComputeSahCost(m_nodes);
+        m_currentSahCost = m_builtSahCost;
+        // 作り直しの途中の結果は古くなったので捨てます。
+        m_generation++;
+    }
+
+    void SceneBvh::Refit()
+    {
+        THINR_PROFILE_FUNCTION();
+        if (m_rebuild.valid() && m_rebuild.wait_for(std::chrono::seconds(0)) == std::future_status::ready)
+        {
+            AdoptRebuild(m_rebuild.get());
+        }
+
+        RefitNodes();
+        m_currentSahCost = ComputeSahCost(m_nodes);
+        if (!m_rebuild.valid() && GetQualityRatio() > m_rebuildThreshold)
+        {
+            StartRebuild();
+        }
+    }
+
+    float SceneBvh::GetQualityRatio() const
+    {
+        return m_builtSahCost > 0.0f ? m_currentSahCost / m_builtSahCost : 1.0f;
+    }
+
+    void SceneBvh::WaitForRebuild()
+    {
+        if (m_rebuild.valid())
+        {
+            AdoptRebuild(m_rebuild.get());
+        }
+    }
+
+    void SceneBvh::RefitNodes()
+    {
+        // 子は必ず親より後ろにあるので、末尾から辿れば子の箱が先に求まります。
+        for (size_t i = m_nodes.size(); i-- > 0;)
+        {
+            BvhNode &node = m_nodes[i];
+            Aabb box = Aabb::Empty();
+            if (node.IsLeaf())
+            {
+                for (uint32_t j = node.offset, end = node.offset + node.count; j < end; ++j)
+                {
+                    box.Grow(m_instances[m_order[j]].bounds);
+                }
+            }
+            else
+            {
+                const BvhNode &left = m_nodes[i + 1];
+                const BvhNode &right = m_nodes[node.offset];
+                box = Aabb{ left.boundsMin, left.boundsMax };
+                box.Grow(Aabb{ right.boundsMin, right.boundsMax });
+            }
+            node.boundsMin = box.min;
+            node.boundsMax = box.max;
+        }
+    }
+
+    void SceneBvh::StartRebuild()
+    {
+        // 現在の箱を写してから別スレッドで構築します。構築中も this の木は Refit と Raycast に使えます。
+        std::vector<Aabb> bounds(m_instances.size());
+        for (size_t i = 0; i < m_instances.size(); ++i)
+        {
+            bounds[i] = m_instances[i].bounds;
+        }
+        uint64_t generation = m_generation;
+        m_rebuild = std::async(std::launch::async, [bounds, generation]()
+        {
+            THINR_PROFILE_ZONE("SceneBvh::Rebuild");
+            RebuildResult result;
+            BuildBvh(bounds.data(), bounds.size(), MaxLeafInstances, result.nodes, result.order);
+            result.generation = generation;
+            return result;
+        });
+    }
+
+    void SceneBvh::AdoptRebuild(RebuildResult result)
+    {
+        if (result.generation != m_generation)
+        {
+            return;
+        }
+        m_nodes.swap(result.nodes);
+        m_order.swap(result.order);
+        // 構築した後に動いた分を反映してから、新しい基準のコストにします。
+        RefitNodes();
+        m_builtSahCost = ComputeSahCost(m_nodes);
+        m_currentSahCost = m_builtSahCost;
+        m_rebuildCount++;
+    }
+
+    bool SceneBvh::Raycast(const Ray &ray, RayHit &hit) const
+    {
+        if (m_nodes.empty())
+        {
+            return false;
+        }
+
+        const Float3 invDirection = Reciprocal(ray.direction);
+        Ray local = ray;
+        bool found = false;
+
+        const BvhNode *nodes = m_nodes.data();
+        float tRoot;
+        if (!IntersectRayBox(ray.origin, invDirection, nodes[0].boundsMin, nodes[0].boundsMax, local.maxDistance, tRoot))
+        {
+            return false;
+        }
+
+        uint32_t stack[BvhMaxStackDepth];
+        float stackT[BvhMaxStackDepth];
+        int depth = 0;
+        uint32_t index = 0;
+        for (;;)
+        {
+            const BvhNode &node = nodes[index];
+            if (node.IsLeaf())
+            {
+                for (uint32_t i = node.offset, end = node.offset + node.count; i < end; ++i)
+                {
+                    uint32_t instanceIndex = m_order[i];
+                    const Instance &instance = m_instances[instanceIndex];
+                    // アフィン変換なので、方向を正規化しなければ t はモデル空間でも同じ値です。
+                    Ray modelRay = Ray{
+                        TransformPoint(instance.inverse, ray.origin),
+                        TransformDirection(instance.inverse, ray.direction),
+                        local.maxDistance };
+                    if (instance.mesh->Raycast(modelRay, hit))
+                    {
+                        local.maxDistance = hit.t;
+                        hit.instance = instanceIndex;
+                        found = true;
+                    }
+                }
+            }
+            else
+            {
+                uint32_t left = index + 1;
+                uint32_t right = node.offset;
+                float tLeft;
+                float tRight;
+                bool hitLeft = IntersectRayBox(ray.origin, invDirection, nodes[left].boundsMin, nodes[left].boundsMax, local.maxDistance, tLeft);
+                bool hitRight = IntersectRayBox(ray.origin, invDirection, nodes[right].boundsMin, nodes[right].boundsMax, local.maxDistance, tRight);
+                if (hitLeft && hitRight)
+                {
+                    if (tLeft > tRight)
+                    {
+                        std::swap(left, right);
+                        std::swap(tLeft, tRight);
+                    }
+                    stack[depth] = right;
+                    stackT[depth] = tRight;
+                    ++depth;
+                    index = left;
+                    continue;
+                }
+                if (hitLeft || hitRight)
+                {
+                    index = hitLeft ? left : right;
+                    continue;
+                }
+            }
+
+            for (;;)
+            {
+                if (depth == 0)
+                {
+                    return found;
+                }
+                --depth;
+                if (stackT[depth] <= local.maxDistance)
+                {
+                    index = stack[depth];
+                    break;
+                }
+            }
+        }
+    }
+
+    void SceneBvh::IntersectPacket(RayPacket &packet) const
+    {
+        if (m_nodes.empty() || packet.activeMask == 0)
+        {
+            return;
+        }
+
+        Float3 invDirection[RayPacket::Width];
+        Float3 order = Float3{ 0.0f, 0.0f, 0.0f };
+        for (int lane = 0; lane < RayPacket::Width; ++lane)
+        {
+            invDirection[lane] = Reciprocal(Float3{ packet.directionX[lane], packet.directionY[lane], packet.directionZ[lane] });
+            if (packet.activeMask & (1u << lane))
+            {
+                order.x += packet.directionX[lane];
+                order.y += packet.directionY[lane];
+                order.z += packet.directionZ[lane];
+            }
+        }
+
+        // 上位の木はインスタンス数程度の大きさなので、箱の判定はレーンごとに行います。
+        const BvhNode *nodes = m_nodes.data();
+        uint32_t stack[BvhMaxStackDepth];
+        int depth = 0;
+        stack[depth++] = 0;
+        while (depth > 0)
+        {
+            uint32_t index = stack[--depth];
+            const BvhNode &node = nodes[index];
+            uint32_t mask = 0;
+            for (int lane = 0; lane < RayPacket::Width; ++lane)
+            {
+                float tNear;
+                if ((packet.activeMask & (1u << lane))
+                    && IntersectRayBox(Float3{ packet.originX[lane], packet.originY[lane], packet.originZ[lane] },
+                        invDirection[lane], node.boundsMin, node.boundsMax, packet.tMax[lane], tNear))
+                {
+                    mask |= 1u << lane;
+                }
+            }
+            if (mask == 0)
+            {
+                continue;
+            }
+
+            if (!node.IsLeaf())
+            {
+                uint32_t left = index + 1;
+                uint32_t right = node.offset;
+                const BvhNode &l = nodes[left];
+                const BvhNode &r = nodes[right];
+                float forward =
+                    (r.boundsMin.x + r.boundsMax.x - l.boundsMin.x - l.boundsMax.x) * order.x
+                    + (r.boundsMin.y + r.boundsMax.y - l.boundsMin.y - l.boundsMax.y) * order.y
+                    + (r.boundsMin.z + r.boundsMax.z - l.boundsMin.z - l.boundsMax.z) * order.z;
+                stack[depth++] = forward >= 0.0f ? right : left;
+                stack[depth++] = forward >= 0.0f ? left : right;
+                continue;
+            }
+
+            for (uint32_t i = node.offset, end = node.offset + node.count; i < end; ++i)
+            {
+                uint32_t instanceIndex = m_order[i];
+                const Instance &instance = m_instances[instanceIndex];
+                if ((mask & (mask - 1)) == 0)
+                {
+                    // 1 本だけならパケットにせず Raycast します。
+                    int lane = mask == 1 ? 0 : mask == 2 ? 1 : mask == 4 ? 2 : 3;
+                    Float3 origin = Float3{ packet.originX[lane], packet.originY[lane], packet.originZ[lane] };
+                    Float3 direction = Float3{ packet.directionX[lane], packet.directionY[lane], packet.directionZ[lane] };
+                    Ray modelRay = Ray{
+                        TransformPoint(instance.inverse, origin),
+                        TransformDirection(instance.inverse, direction),
+                        packet.tMax[lane] };
+                    RayHit hit;
+                    if (instance.mesh->Raycast(modelRay, hit))
+                    {
+                        packet.tMax[lane] = hit.t;
+                        packet.u[lane] = hit.u;
+                        packet.v[lane] = hit.v;
+                        packet.triangle[lane] = hit.triangle;
+                        packet.instance[lane] = instanceIndex;
+                    }
+                    continue;
+                }
+
+                RayPacket local;
+                local.activeMask = mask;
+                for (int lane = 0; lane < RayPacket::Width; ++lane)
+                {
+                    Float3 origin = Float3{ packet.originX[lane], packet.originY[lane], packet.originZ[lane] };
+                    Float3 direction = Float3{ packet.directionX[lane], packet.directionY[lane], packet.directionZ[lane] };
+                    Float3 modelOrigin = TransformPoint(instance.inverse, origin);
+                    Float3 modelDirection = TransformDirection(instance.inverse, direction);
+                    local.originX[lane] = modelOrigin.x;
+                    local.originY[lane] = modelOrigin.y;
+                    local.originZ[lane] = modelOrigin.z;
+                    local.directionX[lane] = modelDirection.x;
+                    local.directionY[lane] = modelDirection.y;
+                    local.directionZ[lane] = modelDirection.z;
+                    local.tMax[lane] = packet.tMax[lane];
+                    local.u[lane] = 0.0f;
+                    local.v[lane] = 0.0f;
+                    local.triangle[lane] = InvalidRayHitIndex;
+                    local.instance[lane] = InvalidRayHitIndex;
+                }
+                instance.mesh->IntersectPacket(local);
+                for (int lane = 0; lane < RayPacket::Width; ++lane)
+                {
+                    if (local.triangle[lane] != InvalidRayHitIndex)
+                    {
+                        packet.tMax[lane] = local.tMax[lane];
+                        packet.u[lane] = local.u[lane];
+                        packet.v[lane] = local.v[lane];
+                        packet.triangle[lane] = local.triangle[lane];
+                        packet.instance[lane] = instanceIndex;
+                    }
+                }
+            }
+        }
+    }
+}
@@ -0,0 +1,90 @@
+﻿#pragma once
+#include "MeshBvh.h"
+#include <memory>
+#include <vector>
+#include <future>
+
+
+namespace thinr
+{
+    // MeshBvh のインスタンスを並べたシーンの上位 BVH。各インスタンスの変換後の箱から SAH で作ります。
+    // レイはインスタンスの逆変換でモデル空間に移して MeshBvh で判定します (t はワールド空間のまま)。
+    class SceneBvh
+    {
+    public:
+        static const uint32_t MaxLeafInstances = 2;
+
+        // Refit 後の SAH コストが構築直後のこの倍率を超えたら、バックグラウンドで作り直します。
+        static const float DefaultRebuildThreshold;
+
+        SceneBvh();
+        // 作り直しの途中なら完了を待ちます。
+        ~SceneBvh();
+        SceneBvh(const SceneBvh &) = delete;
+        SceneBvh &operator=(const SceneBvh &) = delete;
+
+        // transform は定数バッファーと同じく転置して格納したアフィン変換です。インスタンス番号を返します。
+        // インスタンスを追加したら Build、変換だけを変えたら Refit を呼ぶまで Raycast に反映されません。
+        uint32_t AddInstance(const std::shared_ptr<const MeshBvh> &mesh, const Float4x4 &transform);
+        void SetTransform(uint32_t instance, const Float4x4 &transform);
+        void Clear();
+
+        // SAH で木を作り直します。
+        void Build();
+        // 木の形はそのままで、変換後のインスタンスの箱から下から順にノードの箱を更新します。
+        // 形が合わなくなって品質 (GetQualityRatio) が閾値を超えると、現在の箱で作り直す処理を別スレッドで始め、
+        // 完了した後の Refit で新しい木に切り替えます。それまでは古い木の Refit を続けます。
+        void Refit();
+
+        void SetRebuildThreshold(float ratio) { m_rebuildThreshold = ratio; }
+        float GetRebuildThreshold() const { return m_rebuildThreshold; }
+        // 現在の SAH コスト / 構築直後の SAH コスト。1 に近いほど構築直後に近い品質です。
+        float GetQualityRatio() const;
+        bool IsRebuilding() const { return m_rebuild.valid(); }
+        // 作り直しの途中なら完了を待って切り替えます。
+        void WaitForRebuild();
+
+        // ray.maxDistance 以内で最も近い交点を求めます。hit.instance にインスタンス番号が入ります。
+        bool Raycast(const Ray &ray, RayHit &hit) const;
+        // 4 本のレイをまとめて走査します。インスタンスの葉ではレイを変換して MeshBvh::IntersectPacket を呼びます。
+        void IntersectPacket(RayPacket &packet) const;
+
+        size_t GetInstanceCount() const { return m_instances.size(); }
+        const std::vector<BvhNode> &GetNodes() const { return m_nodes; }
+        // バックグラウンドで作り直して切り替えた回数。
+        uint64_t GetRebuildCount() const { return m_rebuildCount; }
+
+    private:
+        struct RebuildResult
+        {
+            std::vector<BvhNode> nodes;
+            std::vector<uint32_t> order;
+            uint64_t generation;
+        };
+
+        void RefitNodes();
+        void StartRebuild();
+        void AdoptRebuild(RebuildResult result);
+
+        struct Instance
+        {
+            std::shared_ptr<const MeshBvh> mesh;
+            Float4x4 transform;
+            Float4x4 inverse;
+            Aabb bounds;
+        };
+
+        std::vector<Instance> m_instances;
+        std::vector<BvhNode> m_nodes;
+        // 葉の順に並べたインスタンス番号。
+        std::vector<uint32_t> m_order;
+
+        float m_builtSahCost;
+        float m_currentSahCost;
+        float m_rebuildThreshold;
+        // インスタンスの追加や削除で増えます。作り直しの途中で変わったら結果を捨てます。
+        uint64_t m_generation;
+        uint64_t m_rebuildCount;
+        std::future<RebuildResult> m_rebuild;
+    };
+}
@@ -0,0 +1,299 @@
+﻿#include "pch.h"
+#include "ShaderCache.h"
+#include "FileSystem.h"
+#include <algorithm>
+#include <fstream>
+#include <sstream>
+
+
+namespace thinr
+{
+    namespace
+    {
+        const char *const IndexHeader = "thinr-shader-cache 1";
+
+        const uint64_t FnvOffsetBasis = 14695981039346656037ull;
+        const uint64_t FnvPrime = 1099511628211ull;
+
+        void HashBytes(uint64_t &hash, const void *data, size_t size)
+        {
+            const uint8_t *bytes = static_cast<const uint8_t *>(data);
+            for (size_t i = 0; i < size; ++i)
+            {
+                hash ^= bytes[i];
+                hash *= FnvPrime;
+            }
+        }
+
+        // 長さを前置して、フィールドの区切りがずれても同じハッシュにならないようにします。
+        void HashString(uint64_t &hash, const std::string &value)
+        {
+            uint64_t length = value.size();
+            uint8_t prefix[8];
+            for (int i = 0; i < 8; ++i)
+            {
+                prefix[i] = static_cast<uint8_t>(length >> (i * 8));
+            }
+            HashBytes(hash, prefix, sizeof(prefix));
+            HashBytes(hash, value.data(), value.size());
+        }
+
+        std::string ToHex(uint64_t value)
+        {
+            char text[17];
+            for (int i = 15; i >= 0; --i)
+            {
+                text[i] = "0123456789abcdef"[value & 0xf];
+                value >>= 4;
+            }
+            text[16] = '\0';
+            return text;
+        }
+
+        bool WriteBlobFile(const std::string &path, const ShaderBytecode &data)
+        {
+            std::ofstream file;
+            OpenOutputFile(file, path);
+            file.write(reinterpret_cast<const char *>(data.data()), data.size());
+            file.close();
+            return !file.fail();
+        }
+
+        bool ReadBlobFile(const std::string &path, size_t expectedSize, ShaderBytecode &data)
+        {
+            std::ifstream file;
+            OpenInputFile(file, path);
+            if (!file)
+            {
+                return false;
+            }
+            data.resize(expectedSize);
+            file.read(reinterpret_cast<char *>(data.data()), expectedSize);
+            // サイズが index と違うファイルは壊れているものとして扱います。
+            return file.gcount() == static_cast<std::streamsize>(expectedSize) && file.peek() == std::char_traits<char>::eof();
+        }
+    }
+
+    ShaderCache::ShaderCache(const std::shared_ptr<IShaderCompiler> &compiler, const std::string &directory,
+        size_t memoryBudget, size_t diskBudget)
+        : m_compiler(compiler), m_directory(directory), m_memoryBudget(memoryBudget), m_diskBudget(diskBudget),
+        m_clock(0), m_stats()
+    {
+        if (!compiler)
+        {
+            throw std::invalid_argument("ShaderCache: null compiler");
+        }
+        m_compilerVersion = compiler->GetVersion();
+        if (!m_directory.empty())
+        {
+            MakeDirectory(m_directory);
+            std::lock_guard<std::mutex> lock(m_mutex);
+            LoadIndexLocked();
+        }
+    }
+
+    ShaderCache::~ShaderCache()
+    {
+        if (!m_directory.empty())
+        {
+            // ディスクから読んだエントリの使用順を次回に引き継ぎます。
+            std::lock_guard<std::mutex> lock(m_mutex);
+            SaveIndexLocked();
+        }
+    }
+
+    uint64_t ShaderCache::ComputeKey(const ShaderCompileRequest &request, const std::string &compilerVersion)
+    {
+        uint64_t hash = FnvOffsetBasis;
+        HashString(hash, compilerVersion);
+        HashString(hash, request.source);
+        HashString(hash, request.entryPoint);
+        HashString(hash, request.target);
+        HashString(hash, std::to_string(request.defines.size()));
+        for (const auto &define : request.defines)
+        {
+            HashString(hash, define.name);
+            HashString(hash, define.value);
+        }
+        return hash;
+    }
+
+    std::shared_ptr<const ShaderBytecode> ShaderCache::GetOrCompile(const ShaderCompileRequest &request)
+    {
+        uint64_t key = ComputeKey(request, m_compilerVersion);
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            auto found = FindLocked(key);
+            if (found)
+            {
+                return found;
+            }
+        }
+
+        // 同じキーを同時にコンパイルすることがありますが、結果は同じなので後から来た方で上書きします。
+        auto bytecode = std::make_shared<const ShaderBytecode>(m_compiler->Compile(request));
+
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_stats.compiles++;
+        InsertMemoryLocked(key, bytecode);
+        if (!m_directory.empty())
+        {
+            InsertDiskLocked(key, *bytecode);
+            SaveIndexLocked();
+        }
+        return bytecode;
+    }
+
+    void ShaderCache::ClearMemory()
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_memory.clear();
+        m_stats.memoryBytes = 0;
+    }
+
+    ShaderCacheStats ShaderCache::GetStats() const
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        return m_stats;
+    }
+
+    std::shared_ptr<const ShaderBytecode> ShaderCache::FindLocked(uint64_t key)
+    {
+        auto memory = m_memory.find(key);
+        if (memory != m_memory.end())
+        {
+            memory->second.lastUse = ++m_clock;
+            m_stats.memoryHits++;
+            return memory->second.bytecode;
+        }
+
+        auto disk = m_disk.find(key);
+        if (disk == m_disk.end())
+        {
+            return nullptr;
+        }
+        auto bytecode = std::make_shared<ShaderBytecode>();
+        if (!ReadBlobFile(GetBlobPath(key), disk->second.size, *bytecode))
+        {
+            m_stats.diskBytes -= disk->second.size;
+            m_disk.erase(disk);
+            return nullptr;
+        }
+        disk->second.lastUse = ++m_clock;
+        m_stats.diskHits++;
+        InsertMemoryLocked(key, bytecode);
+        return bytecode;
+    }
+
+    void ShaderCache::InsertMemoryLocked(uint64_t key, const std::shared_ptr<const ShaderBytecode> &bytecode)
+    {
+        auto &entry = m_memory[key];
+        if (entry.bytecode)
+        {
+            m_stats.memoryBytes -= entry.bytecode->size();
+        }
+        entry.bytecode = bytecode;
+        entry.lastUse = ++m_clock;
+        m_stats.memoryBytes += bytecode->size();
+
+        // 挿入したエントリ以外を古い順に追い出します。エントリ数は多くないので線形に探します。
+        while (m_stats.memoryBytes > m_memoryBudget && m_memory.size() > 1)
+        {
+            auto oldest = m_memory.end();
+            for (auto it = m_memory.begin(); it != m_memory.end(); ++it)
+            {
+                if (it->first != key && (oldest == m_memory.end() || it->second.lastUse < oldest->second.lastUse))
+                {
+                    oldest = it;
+                }
+            }
+            m_stats.memoryBytes -= oldest->second.bytecode->size();
+            m_memory.erase(oldest);
+            m_stats.evictions++;
+        }
+    }
+
+    void ShaderCache::InsertDiskLocked(uint64_t key, const ShaderBytecode &bytecode)
+    {
+        if (!WriteBlobFile(GetBlobPath(key), bytecode))
+        {
+            // ディスクに書けなくてもメモリには残るので、エラーにはしません。
+            return;
+        }
+        auto &entry = m_disk[key];
+        m_stats.diskBytes -= entry.size;
+        entry.size = bytecode.size();
+        entry.lastUse = ++m_clock;
+        m_stats.diskBytes += entry.size;
+
+        while (m_stats.diskBytes > m_diskBudget && m_disk.size() > 1)
+        {
+            auto oldest = m_disk.end();
+            for (auto it = m_disk.begin(); it != m_disk.end(); ++it)
+            {
+                if (it->first != key && (oldest == m_disk.end() || it->second.lastUse < oldest->second.lastUse))
+                {
+                    oldest = it;
+                }
+            }
+            RemoveFile(GetBlobPath(oldest->first));
+            m_stats.diskBytes -= oldest->second.size;
+            m_disk.erase(oldest);
+            m_stats.evictions++;
+        }
+    }
+
+    void ShaderCache::LoadIndexLocked()
+    {
+        std::ifstream file;
+        OpenInputFile(file, m_directory + "/index.txt");
+        std::string line;
+        if (!file || !std::getline(file, line) || line != IndexHeader)
+        {
+            return;
+        }
+        // 1 行に "<キー (16 進)> <サイズ> <最終使用>" を記録しています。
+        while (std::getline(file, line))
+        {
+            std::istringstream fields(line);
+            std::string hex;
+            DiskEntry entry;
+            // 壊れた行は読み飛ばします (16 桁の 16 進なら stoull は例外を投げません)。
+            if (!(fields >> hex >> entry.size >> entry.lastUse) || hex.size() != 16 ||
+                hex.find_first_not_of("0123456789abcdefABCDEF") != std::string::npos)
+            {
+                continue;
+            }
+            uint64_t key = std::stoull(hex, nullptr, 16);
+            m_disk[key] = entry;
+            m_stats.diskBytes += entry.size;
+            m_clock = std::max(m_clock, entry.lastUse);
+        }
+    }
+
+    void ShaderCache::SaveIndexLocked()
+    {
+        std::string path = m_directory + "/index.txt";
+        std::string temporary = path + ".tmp";
+        {
+            std::ofstream file;
+            OpenOutputFile(file, temporary);
+            file << IndexHeader << '\n';
+            for (const auto &entry : m_disk)
+            {
+                file << ToHex(entry.first) << ' ' << entry.second.size << ' ' << entry.second.lastUse << '\n';
+            }
+            file.close();
+            if (file.fail())
+            {
+                return;
+            }
+        }
+        ReplaceExistingFile(temporary, path);
+    }
+
+    std::string ShaderCache::GetBlobPath(uint64_t key) const
+    {
+        return m_directory + "/" + ToHex(key) + ".bin";
+    }
+}
@@ -0,0 +1,89 @@
+﻿#pragma once
+#include "ShaderCompiler.h"
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include <cstdint>
+
+
+namespace thinr
+{
+    typedef std::vector<uint8_t> ShaderBytecode;
+
+    struct ShaderCacheStats
+    {
+        uint64_t memoryHits;
+        uint64_t diskHits;
+        uint64_t compiles;
+        // 容量を超えて追い出した数 (メモリとディスクの合計)。
+        uint64_t evictions;
+        size_t memoryBytes;
+        size_t diskBytes;
+    };
+
+    // コンパイル済みのシェーダーを、ソース、define、エントリ ポイント、プロファイル、コンパイラーのバージョンの
+    // ハッシュをキーにしてメモリとディスクに保存します。どちらも容量を超えたら最後に使った時刻が古い順に追い出します。
+    // ディスクには directory 以下に <キー>.bin と、サイズと使用順を記録した index.txt を置きます。
+    // 複数のスレッドから同時に使えます。コンパイル中はロックを保持しません。
+    class ShaderCache
+    {
+    public:
+        static const size_t DefaultMemoryBudget = 16 * 1024 * 1024;
+        static const size_t DefaultDiskBudget = 64 * 1024 * 1024;
+
+        // directory が空の場合はメモリだけに保存します。directory は UTF-8 で、無ければ作成します。
+        ShaderCache(const std::shared_ptr<IShaderCompiler> &compiler, const std::string &directory = std::string(),
+            size_t memoryBudget = DefaultMemoryBudget, size_t diskBudget = DefaultDiskBudget);
+        // ディスクの index を書き出します。
+        ~ShaderCache();
+        ShaderCache(const ShaderCache &) = delete;
+        ShaderCache &operator=(const ShaderCache &) = delete;
+
+        // キャッシュに無ければコンパイルして保存します。コンパイル エラーは ShaderCompileError で送出されます。
+        std::shared_ptr<const ShaderBytecode> GetOrCompile(const ShaderCompileRequest &request);
+
+        // 要求とコンパイラーのバージョンから求める 64 ビットのキー (FNV-1a)。
+        static uint64_t ComputeKey(const ShaderCompileRequest &request, const std::string &compilerVersion);
+
+        // メモリ上のエントリを捨てます。ディスクのエントリは残ります。
+        void ClearMemory();
+
+        const std::string &GetDirectory() const { return m_directory; }
+        ShaderCacheStats GetStats() const;
+
+    private:
+        struct MemoryEntry
+        {
+            std::shared_ptr<const ShaderBytecode> bytecode;
+            uint64_t lastUse;
+        };
+
+        struct DiskEntry
+        {
+            size_t size;
+            uint64_t lastUse;
+        };
+
+        std::shared_ptr<const ShaderBytecode> FindLocked(uint64_t key);
+        void InsertMemoryLocked(uint64_t key, const std::shared_ptr<const ShaderBytecode> &bytecode);
+        void InsertDiskLocked(uint64_t key, const ShaderBytecode &bytecode);
+        void LoadIndexLocked();
+        void SaveIndexLocked();
+        std::string GetBlobPath(uint64_t key) const;
+
+        std::shared_ptr<IShaderCompiler> m_compiler;
+        std::string m_compilerVersion;
+        std::string m_directory;
+        size_t m_memoryBudget;
+        size_t m_diskBudget;
+
+        mutable std::mutex m_mutex;
+        // 使用順を表す単調増加のカウンター。ディスクの index にも保存して、起動をまたいで引き継ぎます。
+        uint64_t m_clock;
+        std::unordered_map<uint64_t, MemoryEntry> m_memory;
+        std::unordered_map<uint64_t, DiskEntry> m_disk;
+        ShaderCacheStats m_stats;
+    };
+}
@@ -0,0 +1,48 @@
+﻿#pragma once
+#include <string>
+#include <vector>
+#include <stdexcept>
+#include <cstdint>
+
+
+namespace thinr
+{
+    struct ShaderDefine
+    {
+        std::string name;
+        std::string value;
+    };
+
+    // HLSL をバイトコードにコンパイルする要求。ShaderCache のキーはこのすべてのフィールドから求めます。
+    struct ShaderCompileRequest
+    {
+        std::string source;
+        // エラー メッセージに表示するファイル名。キーには含めません。
+        std::string sourceName;
+        std::string entryPoint;
+        // "vs_4_0_level_9_3" などのプロファイル。
+        std::string target;
+        std::vector<ShaderDefine> defines;
+    };
+
+    // コンパイル エラー。what() にコンパイラーの出力が入ります。
+    class ShaderCompileError : public std::runtime_error
+    {
+    public:
+        explicit ShaderCompileError(const std::string &message) : std::runtime_error(message) {}
+    };
+
+    // コンパイラーの実装 (Windows では D3DShaderCompiler)。テストでは決まった結果を返すスタブに差し替えられます。
+    // 複数のスレッドから同時に呼び出されることがあります。
+    class IShaderCompiler
+    {
+    public:
+        virtual ~IShaderCompiler() {}
+
+        // 失敗したら ShaderCompileError を送出します。
+        virtual std::vector<uint8_t> Compile(const ShaderCompileRequest &request) = 0;
+
+        // コンパイラーやオプションが変わったら別の値を返します。キャッシュのキーに含まれます。
+        virtual std::string GetVersion() const = 0;
+    };
+}
@@ -0,0 +1,151 @@
+﻿#include "pch.h"
+#include "ShaderHotReloader.h"
+#include <algorithm>
+#include <stdexcept>
+
+
+namespace thinr
+{
+    ShaderHotReloader::ShaderHotReloader(const std::shared_ptr<ShaderCache> &cache)
+        : m_cache(cache), m_stats(), m_watcher([this](const std::string &path) { Reload(path); })
+    {
+        if (!cache)
+        {
+            throw std::invalid_argument("ShaderHotReloader: null cache");
+        }
+    }
+
+    ShaderHotReloader::~ShaderHotReloader()
+    {
+    }
+
+    uint32_t ShaderHotReloader::Watch(const std::string &path, const std::shared_ptr<const ShaderPermutationSet> &permutations)
+    {
+        if (!permutations)
+        {
+            throw std::invalid_argument("ShaderHotReloader: null permutations");
+        }
+        uint32_t shader;
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            shader = static_cast<uint32_t>(m_entries.size());
+            m_entries.push_back(Entry{ path, permutations->GetBaseRequest(), permutations, std::vector<ShaderPermutationKey>() });
+        }
+        m_watcher.Watch(path);
+        return shader;
+    }
+
+    void ShaderHotReloader::AddKey(uint32_t shader, ShaderPermutationKey key, const ShaderPermutationSet &from)
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if (shader >= m_entries.size())
+        {
+            throw std::out_of_range("ShaderHotReloader: unknown shader");
+        }
+        Entry &entry = m_entries[shader];
+        ShaderPermutationKey translated = entry.reference->TranslateKey(key, from);
+        if (std::find(entry.keys.begin(), entry.keys.end(), translated) == entry.keys.end())
+        {
+            entry.keys.push_back(translated);
+        }
+    }
+
+    bool ShaderHotReloader::TakeReloads(std::vector<ShaderReload> &reloads)
+    {
+        std::unique_lock<std::mutex> lock(m_mutex, std::try_to_lock);
+        if (!lock.owns_lock())
+        {
+            return false;
+        }
+        reloads.insert(reloads.end(), m_reloads.begin(), m_reloads.end());
+        m_reloads.clear();
+        return true;
+    }
+
+    std::string ShaderHotReloader::GetLastError() const
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        return m_lastError;
+    }
+
+    ShaderHotReloadStats ShaderHotReloader::GetStats() const
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        return m_stats;
+    }
+
+    void ShaderHotReloader::Reload(const std::string &path)
+    {
+        std::vector<uint32_t> shaders;
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            for (uint32_t shader = 0; shader < m_entries.size(); ++shader)
+            {
+                if (m_entries[shader].path == path)
+                {
+                    shaders.push_back(shader);
+                }
+            }
+        }
+        for (uint32_t shader : shaders)
+        {
+            ReloadEntry(shader);
+        }
+    }
+
+    // 監視スレッドで呼ばれます。コンパイル中はロックを保持しません。
+    void ShaderHotReloader::ReloadEntry(uint32_t shader)
+    {
+        std::string path;
+        ShaderCompileRequest request;
+        std::shared_ptr<const ShaderPermutationSet> reference;
+        std::vector<ShaderPermutationKey> keys;
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            const Entry &entry = m_entries[shader];
+            path = entry.path;
+            request = entry.request;
+            reference = entry.reference;
+            keys = entry.keys;
+        }
+
+        std::shared_ptr<ShaderPermutationSet> permutations;
+        try
+        {
+            if (!ReadWholeFile(path, request.source))
+            {
+                throw std::runtime_error("ShaderHotReloader: cannot read " + path);
+            }
+            permutations = std::make_shared<ShaderPermutationSet>(m_cache, request);
+            for (ShaderPermutationKey key : keys)
+            {
+                permutations->Build(permutations->TranslateKey(key, *reference));
+            }
+        }
+        catch (const std::exception &error)
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_lastError = error.what();
+            m_stats.failures++;
+            return;
+        }
+
+        std::lock_guard<std::mutex> lock(m_mutex);
+        Entry &entry = m_entries[shader];
+        // コンパイル中に追加されたキーも含めて、新しいセットの機能の並びに置き換えます。
+        std::vector<ShaderPermutationKey> translated;
+        for (ShaderPermutationKey key : entry.keys)
+        {
+            ShaderPermutationKey newKey = permutations->TranslateKey(key, *entry.reference);
+            if (std::find(translated.begin(), translated.end(), newKey) == translated.end())
+            {
+                translated.push_back(newKey);
+            }
+        }
+        entry.keys.swap(translated);
+        entry.reference = permutations;
+        m_reloads.push_back(ShaderReload{ shader, permutations });
+        m_lastError.clear();
+        m_stats.reloads++;
+    }
+}
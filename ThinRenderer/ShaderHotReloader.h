@@ -0,0 +1,76 @@
+﻿#pragma once
+#include "ShaderPermutations.h"
+#include "FileWatcher.h"
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+
+namespace thinr
+{
+    // 作り直しが完了したシェーダー。shader は ShaderHotReloader::Watch の戻り値です。
+    struct ShaderReload
+    {
+        uint32_t shader;
+        std::shared_ptr<ShaderPermutationSet> permutations;
+    };
+
+    struct ShaderHotReloadStats
+    {
+        uint64_t reloads;
+        uint64_t failures;
+    };
+
+    // シェーダーのソースを FileWatcher で監視し、変更されたら監視スレッドで ShaderPermutationSet を作り直して、
+    // それまでに使っていた組み合わせをコンパイルしておきます。描画スレッドは TakeReloads で受け取ったセットに
+    // フレームの合間で差し替えます。コンパイルに失敗した場合は何も渡さないので、最後に成功したセットが使われ続けます。
+    class ShaderHotReloader
+    {
+    public:
+        explicit ShaderHotReloader(const std::shared_ptr<ShaderCache> &cache);
+        // 監視スレッドを止めます。作り直しの途中なら完了を待ちます。
+        ~ShaderHotReloader();
+        ShaderHotReloader(const ShaderHotReloader &) = delete;
+        ShaderHotReloader &operator=(const ShaderHotReloader &) = delete;
+
+        // path (UTF-8) のソースを監視します。permutations は現在使っているセットで、作り直すときは
+        // その GetBaseRequest の source だけを差し替えます。シェーダーの番号を返します。
+        uint32_t Watch(const std::string &path, const std::shared_ptr<const ShaderPermutationSet> &permutations);
+
+        // 作り直すときにもコンパイルしておく組み合わせを追加します。key は from (使っているセット) のキーです。
+        // 機能の並びが変わっても、同じ名前の機能の組み合わせに置き換えてコンパイルします。
+        void AddKey(uint32_t shader, ShaderPermutationKey key, const ShaderPermutationSet &from);
+
+        // 前回から作り直しが完了したセットを reloads に追加します。同じシェーダーが何回か作り直された場合は、
+        // 新しい順に処理すれば最後のものが残ります。監視スレッドがロックしている場合は待たずに false を返します。
+        bool TakeReloads(std::vector<ShaderReload> &reloads);
+
+        // 最後に失敗した作り直しのエラー (コンパイラーの出力など)。
+        std::string GetLastError() const;
+        ShaderHotReloadStats GetStats() const;
+
+    private:
+        struct Entry
+        {
+            std::string path;
+            ShaderCompileRequest request;
+            // キーの機能の並びの基準。最後に作り直したセットです。
+            std::shared_ptr<const ShaderPermutationSet> reference;
+            std::vector<ShaderPermutationKey> keys;
+        };
+
+        void Reload(const std::string &path);
+        void ReloadEntry(uint32_t shader);
+
+        std::shared_ptr<ShaderCache> m_cache;
+        mutable std::mutex m_mutex;
+        std::vector<Entry> m_entries;
+        std::vector<ShaderReload> m_reloads;
+        std::string m_lastError;
+        ShaderHotReloadStats m_stats;
+
+        // 最後に宣言して、他のメンバーより先に監視スレッドを止めます。
+        FileWatcher m_watcher;
+    };
+}
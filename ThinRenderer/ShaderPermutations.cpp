@@ -0,0 +1,168 @@
+﻿#include "pch.h"
+#include "ShaderPermutations.h"
+#include <algorithm>
+#include <stdexcept>
+#include <cstring>
+
+
+namespace thinr
+{
+    namespace
+    {
+        const char *const FeatureDirective = "thinr:feature";
+
+        bool IsSpace(char c)
+        {
+            return c == ' ' || c == '\t' || c == '\r';
+        }
+
+        bool IsIdentifier(const std::string &name)
+        {
+            if (name.empty() || (name[0] >= '0' && name[0] <= '9'))
+            {
+                return false;
+            }
+            for (char c : name)
+            {
+                bool valid = (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9') || c == '_';
+                if (!valid)
+                {
+                    return false;
+                }
+            }
+            return true;
+        }
+    }
+
+    ShaderPermutationSet::ShaderPermutationSet(const std::shared_ptr<ShaderCache> &cache, const ShaderCompileRequest &base)
+        : m_cache(cache), m_base(base), m_features(ParseFeatures(base.source)), m_builtCount(0)
+    {
+        if (!cache)
+        {
+            throw std::invalid_argument("ShaderPermutationSet: null cache");
+        }
+        m_table.resize(size_t(1) << m_features.size());
+    }
+
+    std::vector<std::string> ShaderPermutationSet::ParseFeatures(const std::string &source)
+    {
+        std::vector<std::string> features;
+        size_t lineBegin = 0;
+        while (lineBegin < source.size())
+        {
+            size_t lineEnd = source.find('\n', lineBegin);
+            if (lineEnd == std::string::npos)
+            {
+                lineEnd = source.size();
+            }
+
+            // 行頭の空白、"//"、空白、"thinr:feature"、空白、名前、行末の空白の順に読みます。
+            size_t i = lineBegin;
+            while (i < lineEnd && IsSpace(source[i]))
+            {
+                ++i;
+            }
+            if (source.compare(i, 2, "//") == 0)
+            {
+                i += 2;
+                while (i < lineEnd && IsSpace(source[i]))
+                {
+                    ++i;
+                }
+                size_t directiveLength = strlen(FeatureDirective);
+                if (i + directiveLength < lineEnd && source.compare(i, directiveLength, FeatureDirective) == 0
+                    && IsSpace(source[i + directiveLength]))
+                {
+                    i += directiveLength;
+                    while (i < lineEnd && IsSpace(source[i]))
+                    {
+                        ++i;
+                    }
+                    size_t nameEnd = lineEnd;
+                    while (nameEnd > i && IsSpace(source[nameEnd - 1]))
+                    {
+                        --nameEnd;
+                    }
+                    std::string name = source.substr(i, nameEnd - i);
+                    if (!IsIdentifier(name))
+                    {
+                        throw std::invalid_argument("ShaderPermutationSet: invalid feature name '" + name + "'");
+                    }
+                    if (std::find(features.begin(), features.end(), name) != features.end())
+                    {
+                        throw std::invalid_argument("ShaderPermutationSet: duplicate feature '" + name + "'");
+                    }
+                    features.push_back(name);
+                }
+            }
+            lineBegin = lineEnd + 1;
+        }
+
+        if (features.size() > MaxFeatures)
+        {
+            throw std::invalid_argument("ShaderPermutationSet: too many features");
+        }
+        return features;
+    }
+
+    ShaderPermutationKey ShaderPermutationSet::GetFeatureMask(const std::string &name) const
+    {
+        ShaderPermutationKey mask = FindFeatureMask(name);
+        if (mask == 0)
+        {
+            throw std::invalid_argument("ShaderPermutationSet: unknown feature '" + name + "'");
+        }
+        return mask;
+    }
+
+    ShaderPermutationKey ShaderPermutationSet::FindFeatureMask(const std::string &name) const
+    {
+        auto found = std::find(m_features.begin(), m_features.end(), name);
+        if (found == m_features.end())
+        {
+            return 0;
+        }
+        return 1u << (found - m_features.begin());
+    }
+
+    ShaderPermutationKey ShaderPermutationSet::TranslateKey(ShaderPermutationKey key, const ShaderPermutationSet &from) const
+    {
+        ShaderPermutationKey translated = 0;
+        for (size_t i = 0; i < from.m_features.size(); ++i)
+        {
+            if (key & (1u << i))
+            {
+                translated |= FindFeatureMask(from.m_features[i]);
+            }
+        }
+        return translated;
+    }
+
+    ShaderCompileRequest ShaderPermutationSet::MakeRequest(ShaderPermutationKey key) const
+    {
+        if (key >= m_table.size())
+        {
+            throw std::invalid_argument("ShaderPermutationSet: key out of range");
+        }
+        // 無効な機能も 0 で define して、キーごとに define の並びが決まるようにします。
+        ShaderCompileRequest request = m_base;
+        for (size_t i = 0; i < m_features.size(); ++i)
+        {
+            request.defines.push_back(ShaderDefine{ m_features[i], (key & (1u << i)) ? "1" : "0" });
+        }
+        return request;
+    }
+
+    const ShaderBytecode &ShaderPermutationSet::Build(ShaderPermutationKey key)
+    {
+        const ShaderBytecode *found = Find(key);
+        if (found)
+        {
+            return *found;
+        }
+        auto bytecode = m_cache->GetOrCompile(MakeRequest(key));
+        m_table[key] = bytecode;
+        m_builtCount++;
+        return *bytecode;
+    }
+}
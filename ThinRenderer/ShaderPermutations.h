@@ -0,0 +1,61 @@
+﻿#pragma once
+#include "ShaderCache.h"
+#include <memory>
+#include <string>
+#include <vector>
+#include <cstdint>
+
+
+namespace thinr
+{
+    // シェーダーの機能の組み合わせ。ビット i が ShaderPermutationSet::GetFeatures()[i] の機能です。
+    typedef uint32_t ShaderPermutationKey;
+
+    // ソースに "// thinr:feature NAME" の行で宣言した機能の組み合わせごとに、NAME を 1 か 0 に define して
+    // コンパイルします (シェーダー側は #if NAME で分岐します)。要求されたパーミュテーションだけを ShaderCache で作り、
+    // キーをそのまま添字にした表に保存します。
+    class ShaderPermutationSet
+    {
+    public:
+        // キーを RenderQueue のシェーダー番号 (12 ビット) にそのまま使えるようにします。
+        static const uint32_t MaxFeatures = 12;
+
+        // base.source から機能の宣言を読み取ります。base.defines はすべてのパーミュテーションに付きます。
+        ShaderPermutationSet(const std::shared_ptr<ShaderCache> &cache, const ShaderCompileRequest &base);
+
+        // 宣言された順の機能名。名前が不正か重複している場合と、MaxFeatures を超える場合は std::invalid_argument を送出します。
+        static std::vector<std::string> ParseFeatures(const std::string &source);
+
+        const ShaderCompileRequest &GetBaseRequest() const { return m_base; }
+        const std::vector<std::string> &GetFeatures() const { return m_features; }
+        uint32_t GetPermutationCount() const { return static_cast<uint32_t>(m_table.size()); }
+
+        // 機能のビット。宣言されていない名前の場合は std::invalid_argument を送出します。
+        ShaderPermutationKey GetFeatureMask(const std::string &name) const;
+        // 宣言されていない機能は 0 を返します (頂点とピクセル シェーダーで一方にしか無い機能など)。
+        ShaderPermutationKey FindFeatureMask(const std::string &name) const;
+        // from のキーを、同じ名前の機能のビットに置き換えます。このセットに無い機能は落とします。
+        ShaderPermutationKey TranslateKey(ShaderPermutationKey key, const ShaderPermutationSet &from) const;
+
+        ShaderCompileRequest MakeRequest(ShaderPermutationKey key) const;
+
+        // 作成済みでなければコンパイルして表に入れます。コンパイル エラーは ShaderCompileError で送出されます。
+        const ShaderBytecode &Build(ShaderPermutationKey key);
+
+        // 描画中に使う検索です。作成済みでなければ nullptr を返します。Build と同時には呼ばないでください。
+        const ShaderBytecode *Find(ShaderPermutationKey key) const
+        {
+            return key < m_table.size() ? m_table[key].get() : nullptr;
+        }
+
+        size_t GetBuiltCount() const { return m_builtCount; }
+
+    private:
+        std::shared_ptr<ShaderCache> m_cache;
+        ShaderCompileRequest m_base;
+        std::vector<std::string> m_features;
+        // 1 << 機能数 の要素を持つ、キーで引く表。
+        std::vector<std::shared_ptr<const ShaderBytecode>> m_table;
+        size_t m_builtCount;
+    };
+}
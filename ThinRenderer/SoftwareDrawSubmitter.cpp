@@ -0,0 +1,131 @@
+﻿#include "pch.h"
+#include "SoftwareDrawSubmitter.h"
+#include "SoftwareRasterizer.h"
+#include <stdexcept>
+
+
+namespace thinr
+{
+    SoftwareDrawSubmitter::SoftwareDrawSubmitter(SoftwareRasterizer &rasterizer)
+        : m_rasterizer(rasterizer), m_instanceTransforms(nullptr), m_instanceColors(nullptr), m_instanceCount(0),
+        m_mesh(UINT32_MAX), m_material(UINT32_MAX), m_batchBegin(0), m_batchCount(0)
+    {
+    }
+
+    void SoftwareDrawSubmitter::SetMesh(uint32_t mesh, const VertexPositionColor *vertices, size_t vertexCount,
+        const uint16_t *indices, size_t indexCount)
+    {
+        FlushBatch();
+        if (m_meshes.size() <= mesh)
+        {
+            m_meshes.resize(mesh + 1, Mesh{ nullptr, 0, nullptr, nullptr, 0 });
+        }
+        m_meshes[mesh] = Mesh{ vertices, vertexCount, indices, nullptr, indexCount };
+    }
+
+    void SoftwareDrawSubmitter::SetMesh(uint32_t mesh, const VertexPositionColor *vertices, size_t vertexCount,
+        const uint32_t *indices, size_t indexCount)
+    {
+        FlushBatch();
+        if (m_meshes.size() <= mesh)
+        {
+            m_meshes.resize(mesh + 1, Mesh{ nullptr, 0, nullptr, nullptr, 0 });
+        }
+        m_meshes[mesh] = Mesh{ vertices, vertexCount, nullptr, indices, indexCount };
+    }
+
+    void SoftwareDrawSubmitter::SetMaterial(uint32_t material, const ModelViewProjectionConstantBuffer &constants)
+    {
+        FlushBatch();
+        if (m_materials.size() <= material)
+        {
+            m_materials.resize(material + 1);
+            m_materialValid.resize(material + 1, 0);
+        }
+        m_materials[material] = constants;
+        m_materialValid[material] = 1;
+    }
+
+    void SoftwareDrawSubmitter::SetInstances(const Float4x4 *transforms, const Float3 *colors, size_t count)
+    {
+        FlushBatch();
+        m_instanceTransforms = transforms;
+        m_instanceColors = colors;
+        m_instanceCount = count;
+    }
+
+    void SoftwareDrawSubmitter::BindPass(uint32_t /*pass*/)
+    {
+        FlushBatch();
+    }
+
+    void SoftwareDrawSubmitter::BindShader(uint32_t /*shader*/)
+    {
+        FlushBatch();
+    }
+
+    void SoftwareDrawSubmitter::BindMaterial(uint32_t material)
+    {
+        FlushBatch();
+        m_material = material;
+    }
+
+    void SoftwareDrawSubmitter::BindMesh(uint32_t mesh)
+    {
+        FlushBatch();
+        m_mesh = mesh;
+    }
+
+    void SoftwareDrawSubmitter::Draw(uint32_t payload)
+    {
+        if (m_mesh >= m_meshes.size() || !m_meshes[m_mesh].vertices)
+        {
+            throw std::out_of_range("SoftwareDrawSubmitter: mesh is not registered");
+        }
+        if (m_material >= m_materials.size() || !m_materialValid[m_material])
+        {
+            throw std::out_of_range("SoftwareDrawSubmitter: material is not registered");
+        }
+        if (payload >= m_instanceCount)
+        {
+            throw std::out_of_range("SoftwareDrawSubmitter: instance index out of range");
+        }
+
+        if (m_batchCount != 0 && payload == m_batchBegin + m_batchCount)
+        {
+            m_batchCount++;
+            return;
+        }
+        FlushBatch();
+        m_batchBegin = payload;
+        m_batchCount = 1;
+    }
+
+    void SoftwareDrawSubmitter::Flush()
+    {
+        FlushBatch();
+        m_rasterizer.Flush();
+    }
+
+    void SoftwareDrawSubmitter::FlushBatch()
+    {
+        if (m_batchCount == 0)
+        {
+            return;
+        }
+        const Mesh &mesh = m_meshes[m_mesh];
+        const Float4x4 *transforms = m_instanceTransforms + m_batchBegin;
+        const Float3 *colors = m_instanceColors ? m_instanceColors + m_batchBegin : nullptr;
+        if (mesh.indices16)
+        {
+            m_rasterizer.DrawIndexedInstanced(mesh.vertices, mesh.vertexCount, mesh.indices16, mesh.indexCount,
+                transforms, colors, m_batchCount, m_materials[m_material]);
+        }
+        else
+        {
+            m_rasterizer.DrawIndexedInstanced(mesh.vertices, mesh.vertexCount, mesh.indices32, mesh.indexCount,
+                transforms, colors, m_batchCount, m_materials[m_material]);
+        }
+        m_batchCount = 0;
+    }
+}
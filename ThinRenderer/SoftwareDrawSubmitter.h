@@ -0,0 +1,67 @@
+﻿#pragma once
+#include "RenderQueue.h"
+#include "VertexTypes.h"
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+
+
+namespace thinr
+{
+    class SoftwareRasterizer;
+
+    // SoftwareRasterizer に描画する IDrawSubmitter。CommandList や RenderQueue の参照実装で、D3D が無い環境でも動きます。
+    // mesh と material の番号で SetMesh と SetMaterial で登録したものを使い、Draw の payload はインスタンスの番号です。
+    // 同じステートで payload が連続する Draw は 1 回の DrawIndexedInstanced にまとめます。
+    // パスとシェーダーはラスタライザーのパイプラインが 1 つだけなので区切りとしてのみ扱います。
+    class SoftwareDrawSubmitter : public IDrawSubmitter
+    {
+    public:
+        explicit SoftwareDrawSubmitter(SoftwareRasterizer &rasterizer);
+
+        // データはコピーしません。Flush まで有効にしておいてください。
+        void SetMesh(uint32_t mesh, const VertexPositionColor *vertices, size_t vertexCount,
+            const uint16_t *indices, size_t indexCount);
+        void SetMesh(uint32_t mesh, const VertexPositionColor *vertices, size_t vertexCount,
+            const uint32_t *indices, size_t indexCount);
+        void SetMaterial(uint32_t material, const ModelViewProjectionConstantBuffer &constants);
+        // Draw の payload で参照するインスタンスの変換と色。colors は nullptr でもかまいません。データはコピーしません。
+        void SetInstances(const Float4x4 *transforms, const Float3 *colors, size_t count);
+
+        void BindPass(uint32_t pass) override;
+        void BindShader(uint32_t shader) override;
+        void BindMaterial(uint32_t material) override;
+        void BindMesh(uint32_t mesh) override;
+        // 登録されていないメッシュやマテリアル、範囲外のインスタンスの場合は std::out_of_range を送出します。
+        void Draw(uint32_t payload) override;
+
+        // まとめている描画をラスタライザーに渡し、SoftwareRasterizer::Flush を呼びます。
+        void Flush();
+
+    private:
+        struct Mesh
+        {
+            const VertexPositionColor *vertices;
+            size_t vertexCount;
+            const uint16_t *indices16;
+            const uint32_t *indices32;
+            size_t indexCount;
+        };
+
+        void FlushBatch();
+
+        SoftwareRasterizer &m_rasterizer;
+        std::vector<Mesh> m_meshes;
+        std::vector<ModelViewProjectionConstantBuffer> m_materials;
+        std::vector<uint8_t> m_materialValid;
+        const Float4x4 *m_instanceTransforms;
+        const Float3 *m_instanceColors;
+        size_t m_instanceCount;
+
+        uint32_t m_mesh;
+        uint32_t m_material;
+        // まとめている描画の最初のインスタンスと数。
+        uint32_t m_batchBegin;
+        uint32_t m_batchCount;
+    };
+}
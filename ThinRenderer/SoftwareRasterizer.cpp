@@ -0,0 +1,513 @@
+﻿#include "pch.h"
+#include "SoftwareRasterizer.h"
+#include "ThreadPool.h"
+#include "RasterKernels.h"
+#include "Profiler.h"
+#include <algorithm>
+#include <cmath>
+
+
+namespace thinr
+{
+    namespace
+    {
+        // 1 チャンクで処理する頂点数と三角形数。
+        const size_t VertexGrain = 4096;
+        const size_t TriangleGrain = 1024;
+
+        // ガード バンド。これより外にはみ出す三角形だけ x, y でもクリップします。
+        const float GuardBand = 8.0f;
+
+        // D3D11 と同じ 1/256 ピクセルのサブピクセル精度にスナップします。
+        const float SubPixel = 256.0f;
+
+        struct ClipVertex
+        {
+            float x;
+            float y;
+            float z;
+            float w;
+            float color[3];
+        };
+
+        ClipVertex Lerp(const ClipVertex &a, const ClipVertex &b, float t)
+        {
+            ClipVertex r;
+            r.x = a.x + (b.x - a.x) * t;
+            r.y = a.y + (b.y - a.y) * t;
+            r.z = a.z + (b.z - a.z) * t;
+            r.w = a.w + (b.w - a.w) * t;
+            for (int i = 0; i < 3; ++i)
+            {
+                r.color[i] = a.color[i] + (b.color[i] - a.color[i]) * t;
+            }
+            return r;
+        }
+
+        // クリップ平面。distance >= 0 が内側です。
+        enum ClipPlane
+        {
+            ClipNear,   // z >= 0
+            ClipFar,    // z <= w
+            ClipLeft,   // x >= -G * w
+            ClipRight,  // x <= G * w
+            ClipBottom, // y >= -G * w
+            ClipTop,    // y <= G * w
+            ClipPlaneCount
+        };
+
+        float PlaneDistance(const ClipVertex &v, int plane)
+        {
+            switch (plane)
+            {
+            case ClipNear: return v.z;
+            case ClipFar: return v.w - v.z;
+            case ClipLeft: return v.x + GuardBand * v.w;
+            case ClipRight: return GuardBand * v.w - v.x;
+            case ClipBottom: return v.y + GuardBand * v.w;
+            default: return GuardBand * v.w - v.y;
+            }
+        }
+
+        uint32_t OutCode(const Float4 &p)
+        {
+            ClipVertex v = { p.x, p.y, p.z, p.w, { 0, 0, 0 } };
+            uint32_t code = 0;
+            for (int i = 0; i < ClipPlaneCount; ++i)
+            {
+                if (PlaneDistance(v, i) < 0)
+                {
+                    code |= 1u << i;
+                }
+            }
+            return code;
+        }
+
+        // 画面外まで含めた完全に外側の判定用 (ガード バンドではなく本来の視錐台)。
+        uint32_t FrustumCode(const Float4 &p)
+        {
+            uint32_t code = 0;
+            if (p.z < 0) code |= 1;
+            if (p.z > p.w) code |= 2;
+            if (p.x < -p.w) code |= 4;
+            if (p.x > p.w) code |= 8;
+            if (p.y < -p.w) code |= 16;
+            if (p.y > p.w) code |= 32;
+            return code;
+        }
+
+        // Sutherland-Hodgman で多角形を clipMask の平面に対してクリップします。
+        int ClipPolygon(ClipVertex *poly, int count, uint32_t clipMask)
+        {
+            ClipVertex tmp[16];
+            for (int plane = 0; plane < ClipPlaneCount && count > 0; ++plane)
+            {
+                if (!(clipMask & (1u << plane)))
+                {
+                    continue;
+                }
+                int out = 0;
+                for (int i = 0; i < count; ++i)
+                {
+                    const ClipVertex &a = poly[i];
+                    const ClipVertex &b = poly[(i + 1) % count];
+                    float da = PlaneDistance(a, plane);
+                    float db = PlaneDistance(b, plane);
+                    if (da >= 0)
+                    {
+                        tmp[out++] = a;
+                    }
+                    if ((da >= 0) != (db >= 0))
+                    {
+                        tmp[out++] = Lerp(a, b, da / (da - db));
+                    }
+                }
+                std::copy(tmp, tmp + out, poly);
+                count = out;
+            }
+            return count;
+        }
+
+        void SetupPlane(const float f[3], const float a[3], const float b[3], const float c[3], float invArea, float out[3])
+        {
+            // f(x, y) = (f0 * E12 + f1 * E20 + f2 * E01) / area
+            out[0] = (f[0] * a[1] + f[1] * a[2] + f[2] * a[0]) * invArea;
+            out[1] = (f[0] * b[1] + f[1] * b[2] + f[2] * b[0]) * invArea;
+            out[2] = (f[0] * c[1] + f[1] * c[2] + f[2] * c[0]) * invArea;
+        }
+
+        // スクリーン空間の三角形をセットアップします。描画不要なら false を返します。
+        bool SetupScreenTriangle(const ClipVertex &v0, const ClipVertex &v1, const ClipVertex &v2,
+            float width, float height, RasterTriangle &tri)
+        {
+            const ClipVertex *v[3] = { &v0, &v1, &v2 };
+            float sx[3], sy[3], sz[3], rw[3];
+            for (int i = 0; i < 3; ++i)
+            {
+                rw[i] = 1.0f / v[i]->w;
+                float ndcX = v[i]->x * rw[i];
+                float ndcY = v[i]->y * rw[i];
+                sx[i] = std::floor((ndcX * 0.5f + 0.5f) * width * SubPixel + 0.5f) / SubPixel;
+                sy[i] = std::floor((0.5f - ndcY * 0.5f) * height * SubPixel + 0.5f) / SubPixel;
+                sz[i] = v[i]->z * rw[i];
+            }
+
+            // y 下向きのスクリーン座標で正の面積が時計回り (表面)。
+            float area = (sx[1] - sx[0]) * (sy[2] - sy[0]) - (sx[2] - sx[0]) * (sy[1] - sy[0]);
+            if (!(area > 0))
+            {
+                return false;
+            }
+
+            // ピクセル中心 (x + 0.5) が入る範囲。
+            float fminX = std::min(sx[0], std::min(sx[1], sx[2]));
+            float fmaxX = std::max(sx[0], std::max(sx[1], sx[2]));
+            float fminY = std::min(sy[0], std::min(sy[1], sy[2]));
+            float fmaxY = std::max(sy[0], std::max(sy[1], sy[2]));
+            tri.minX = std::max(0, static_cast<int32_t>(std::ceil(fminX - 0.5f)));
+            tri.minY = std::max(0, static_cast<int32_t>(std::ceil(fminY - 0.5f)));
+            tri.maxX = std::min(static_cast<int32_t>(width) - 1, static_cast<int32_t>(std::floor(fmaxX - 0.5f)));
+            tri.maxY = std::min(static_cast<int32_t>(height) - 1, static_cast<int32_t>(std::floor(fmaxY - 0.5f)));
+            if (tri.minX > tri.maxX || tri.minY > tri.maxY)
+            {
+                return false;
+            }
+
+            // 辺 i は頂点 i -> i+1。隣接三角形と同じ値になるよう、端点を辞書順に並べてから計算し、
+            // 逆向きなら符号を反転します (浮動小数点でも共有辺に隙間や二重描画が出ません)。
+            tri.topLeftMask = 0;
+            for (int i = 0; i < 3; ++i)
+            {
+                int j = (i + 1) % 3;
+                int p = i;
+                int q = j;
+                bool swapped = sx[p] > sx[q] || (sx[p] == sx[q] && sy[p] > sy[q]);
+                if (swapped)
+                {
+                    std::swap(p, q);
+                }
+                float a = sy[p] - sy[q];
+                float b = sx[q] - sx[p];
+                float c = sx[p] * sy[q] - sx[q] * sy[p];
+                if (swapped)
+                {
+                    a = -a;
+                    b = -b;
+                    c = -c;
+                }
+                tri.edgeA[i] = a;
+                tri.edgeB[i] = b;
+                tri.edgeC[i] = c;
+                if (a > 0 || (a == 0 && b > 0))
+                {
+                    tri.topLeftMask |= 1u << i;
+                }
+            }
+
+            float invArea = 1.0f / area;
+            SetupPlane(sz, tri.edgeA, tri.edgeB, tri.edgeC, invArea, tri.z);
+            SetupPlane(rw, tri.edgeA, tri.edgeB, tri.edgeC, invArea, tri.invW);
+            for (int c = 0; c < 3; ++c)
+            {
+                float f[3] = { v0.color[c] * rw[0], v1.color[c] * rw[1], v2.color[c] * rw[2] };
+                SetupPlane(f, tri.edgeA, tri.edgeB, tri.edgeC, invArea, tri.color[c]);
+            }
+            return true;
+        }
+
+        // クリップ空間の三角形を必要ならクリップしてセットアップし、out に追加します。
+        void SetupTriangle(const ClipVertex &v0, const ClipVertex &v1, const ClipVertex &v2,
+            uint32_t code0, uint32_t code1, uint32_t code2,
+            float width, float height, std::vector<RasterTriangle> &out)
+        {
+            RasterTriangle tri;
+            uint32_t clipMask = code0 | code1 | code2;
+            if (clipMask == 0)
+            {
+                if (SetupScreenTriangle(v0, v1, v2, width, height, tri))
+                {
+                    out.push_back(tri);
+                }
+                return;
+            }
+
+            ClipVertex poly[16] = { v0, v1, v2 };
+            int count = ClipPolygon(poly, 3, clipMask);
+            for (int i = 2; i < count; ++i)
+            {
+                if (SetupScreenTriangle(poly[0], poly[i - 1], poly[i], width, height, tri))
+                {
+                    out.push_back(tri);
+                }
+            }
+        }
+    }
+
+    SoftwareRasterizer::SoftwareRasterizer(ThreadPool *pool)
+        : m_pool(pool ? pool : &ThreadPool::GetDefault()),
+        m_target(nullptr),
+        m_kernel(ResolveRasterKernel(RasterKernel::Auto)),
+        m_kernelFunc(SelectRasterKernel(m_kernel)),
+        m_tilesX(0),
+        m_tilesY(0),
+        m_binChunkCount(0),
+        m_stats()
+    {
+    }
+
+    void SoftwareRasterizer::SetRasterKernel(RasterKernel kernel)
+    {
+        Flush();
+        m_kernel = ResolveRasterKernel(kernel);
+        m_kernelFunc = SelectRasterKernel(m_kernel);
+    }
+
+    void SoftwareRasterizer::SetRenderTarget(RenderTarget *target)
+    {
+        Flush();
+        m_target = target;
+    }
+
+    void SoftwareRasterizer::Clear(const float color[4], float depth)
+    {
+        Flush();
+        THINR_PROFILE_ZONE("SoftwareRasterizer::Clear");
+        if (!m_target)
+        {
+            return;
+        }
+        uint32_t packed = RenderTarget::PackColor(m_target->GetFormat(), color[0], color[1], color[2], color[3]);
+        RenderTarget *target = m_target;
+        m_pool->ParallelFor(target->GetHeight(), TileSize, [target, packed, depth](size_t begin, size_t end)
+        {
+            target->ClearRows(static_cast<uint32_t>(begin), static_cast<uint32_t>(end), packed, depth);
+        });
+    }
+
+    void SoftwareRasterizer::DrawIndexed(const VertexPositionColor *vertices, size_t vertexCount,
+        const uint16_t *indices, size_t indexCount,
+        const ModelViewProjectionConstantBuffer &constants)
+    {
+        Float4x4 identity = Float4x4::Identity();
+        DrawIndexedImpl(vertices, vertexCount, indices, indexCount, &identity, nullptr, 1, constants);
+    }
+
+    void SoftwareRasterizer::DrawIndexed(const VertexPositionColor *vertices, size_t vertexCount,
+        const uint32_t *indices, size_t indexCount,
+        const ModelViewProjectionConstantBuffer &constants)
+    {
+        Float4x4 identity = Float4x4::Identity();
+        DrawIndexedImpl(vertices, vertexCount, indices, indexCount, &identity, nullptr, 1, constants);
+    }
+
+    void SoftwareRasterizer::DrawIndexedInstanced(const VertexPositionColor *vertices, size_t vertexCount,
+        const uint16_t *indices, size_t indexCount,
+        const Float4x4 *instanceTransforms, const Float3 *instanceColors, size_t instanceCount,
+        const ModelViewProjectionConstantBuffer &constants)
+    {
+        DrawIndexedImpl(vertices, vertexCount, indices, indexCount, instanceTransforms, instanceColors, instanceCount, constants);
+    }
+
+    void SoftwareRasterizer::DrawIndexedInstanced(const VertexPositionColor *vertices, size_t vertexCount,
+        const uint32_t *indices, size_t indexCount,
+        const Float4x4 *instanceTransforms, const Float3 *instanceColors, size_t instanceCount,
+        const ModelViewProjectionConstantBuffer &constants)
+    {
+        DrawIndexedImpl(vertices, vertexCount, indices, indexCount, instanceTransforms, instanceColors, instanceCount, constants);
+    }
+
+    template<typename INDEX>
+    void SoftwareRasterizer::DrawIndexedImpl(const VertexPositionColor *vertices, size_t vertexCount,
+        const INDEX *indices, size_t indexCount,
+        const Float4x4 *instanceTransforms, const Float3 *instanceColors, size_t instanceCount,
+        const ModelViewProjectionConstantBuffer &constants)
+    {
+        if (!m_target || indexCount < 3 || instanceCount == 0)
+        {
+            return;
+        }
+        m_stats.drawCalls++;
+        m_stats.instances += instanceCount;
+        THINR_PROFILE_ZONE("SoftwareRasterizer::DrawIndexed");
+
+        // 頂点シェーダー相当: pos * model * instance * view * projection
+        // インスタンス i の頂点は clip[i * vertexCount + v] に置きます。
+        Float4x4 viewProjection = Multiply(constants.projection, constants.view);
+        const Float4x4 &model = constants.model;
+        m_clipPositions.resize(vertexCount * instanceCount);
+        Float4 *clip = m_clipPositions.data();
+        size_t instanceGrain = std::max<size_t>(1, VertexGrain / std::max<size_t>(1, vertexCount));
+        m_pool->ParallelFor(instanceCount, instanceGrain, [&](size_t begin, size_t end)
+        {
+            for (size_t instance = begin; instance < end; ++instance)
+            {
+                Float4x4 mvp = Multiply(Multiply(viewProjection, instanceTransforms[instance]), model);
+                Float4 *out = clip + instance * vertexCount;
+                for (size_t i = 0; i < vertexCount; ++i)
+                {
+                    const Float3 &p = vertices[i].pos;
+                    out[i] = Transform(mvp, Float4{ p.x, p.y, p.z, 1.0f });
+                }
+            }
+        });
+
+        // 三角形の組み立て、クリップ、セットアップ。チャンクごとに出力し、投入順を保って連結します。
+        // D3D と同じく、インスタンス 0 の全三角形、インスタンス 1 の全三角形... の順です。
+        size_t meshTriangleCount = indexCount / 3;
+        size_t triangleCount = meshTriangleCount * instanceCount;
+        size_t chunkCount = (triangleCount + TriangleGrain - 1) / TriangleGrain;
+        if (m_setupChunks.size() < chunkCount)
+        {
+            m_setupChunks.resize(chunkCount);
+        }
+        float width = static_cast<float>(m_target->GetWidth());
+        float height = static_cast<float>(m_target->GetHeight());
+        auto &chunks = m_setupChunks;
+        m_pool->ParallelFor(triangleCount, TriangleGrain, [&](size_t begin, size_t end)
+        {
+            auto &out = chunks[begin / TriangleGrain];
+            out.clear();
+            size_t instance = begin / meshTriangleCount;
+            size_t t = begin - instance * meshTriangleCount;
+            for (size_t n = begin; n < end; ++n, ++t)
+            {
+                if (t == meshTriangleCount)
+                {
+                    t = 0;
+                    instance++;
+                }
+                size_t i0 = indices[t * 3 + 0];
+                size_t i1 = indices[t * 3 + 1];
+                size_t i2 = indices[t * 3 + 2];
+                if (i0 >= vertexCount || i1 >= vertexCount || i2 >= vertexCount)
+                {
+                    continue;
+                }
+                const Float4 *instanceClip = clip + instance * vertexCount;
+                const Float4 &p0 = instanceClip[i0];
+                const Float4 &p1 = instanceClip[i1];
+                const Float4 &p2 = instanceClip[i2];
+                if (FrustumCode(p0) & FrustumCode(p1) & FrustumCode(p2))
+                {
+                    continue;
+                }
+
+                Float3 tint = instanceColors ? instanceColors[instance] : Float3{ 1.0f, 1.0f, 1.0f };
+                const Float3 &c0 = vertices[i0].color;
+                const Float3 &c1 = vertices[i1].color;
+                const Float3 &c2 = vertices[i2].color;
+                ClipVertex v0 = { p0.x, p0.y, p0.z, p0.w, { c0.x * tint.x, c0.y * tint.y, c0.z * tint.z } };
+                ClipVertex v1 = { p1.x, p1.y, p1.z, p1.w, { c1.x * tint.x, c1.y * tint.y, c1.z * tint.z } };
+                ClipVertex v2 = { p2.x, p2.y, p2.z, p2.w, { c2.x * tint.x, c2.y * tint.y, c2.z * tint.z } };
+                SetupTriangle(v0, v1, v2, OutCode(p0), OutCode(p1), OutCode(p2), width, height, out);
+            }
+        });
+
+        m_stats.trianglesSubmitted += triangleCount;
+        for (size_t i = 0; i < chunkCount; ++i)
+        {
+            m_triangles.insert(m_triangles.end(), m_setupChunks[i].begin(), m_setupChunks[i].end());
+        }
+    }
+
+    void SoftwareRasterizer::Flush()
+    {
+        if (!m_target || m_triangles.empty())
+        {
+            m_triangles.clear();
+            return;
+        }
+
+        int32_t width = static_cast<int32_t>(m_target->GetWidth());
+        int32_t height = static_cast<int32_t>(m_target->GetHeight());
+        m_tilesX = (width + TileSize - 1) / TileSize;
+        m_tilesY = (height + TileSize - 1) / TileSize;
+        uint32_t tileCount = m_tilesX * m_tilesY;
+
+        THINR_PROFILE_ZONE("SoftwareRasterizer::Flush");
+
+        // ビニング。チャンクごとに別のビンへ書くのでロックは不要です。
+        size_t triangleCount = m_triangles.size();
+        m_binChunkCount = static_cast<uint32_t>((triangleCount + TriangleGrain - 1) / TriangleGrain);
+        m_bins.resize(static_cast<size_t>(m_binChunkCount) * tileCount);
+        for (auto &bin : m_bins)
+        {
+            bin.clear();
+        }
+
+        const RasterTriangle *triangles = m_triangles.data();
+        uint32_t tilesX = m_tilesX;
+        auto &bins = m_bins;
+        m_pool->ParallelFor(triangleCount, TriangleGrain, [&](size_t begin, size_t end)
+        {
+            std::vector<uint32_t> *chunkBins = &bins[(begin / TriangleGrain) * tileCount];
+            for (size_t t = begin; t < end; ++t)
+            {
+                const RasterTriangle &tri = triangles[t];
+                int32_t tx0 = tri.minX / TileSize;
+                int32_t ty0 = tri.minY / TileSize;
+                int32_t tx1 = tri.maxX / TileSize;
+                int32_t ty1 = tri.maxY / TileSize;
+                for (int32_t ty = ty0; ty <= ty1; ++ty)
+                {
+                    float py0 = ty * TileSize + 0.5f;
+                    float py1 = py0 + (TileSize - 1);
+                    for (int32_t tx = tx0; tx <= tx1; ++tx)
+                    {
+                        float px0 = tx * TileSize + 0.5f;
+                        float px1 = px0 + (TileSize - 1);
+                        // タイル内のピクセル中心で辺関数が最大になる角でも外側なら、このタイルには掛かりません。
+                        bool outside = false;
+                        for (int e = 0; e < 3 && !outside; ++e)
+                        {
+                            float px = tri.edgeA[e] > 0 ? px1 : px0;
+                            float py = tri.edgeB[e] > 0 ? py1 : py0;
+                            outside = tri.edgeA[e] * px + tri.edgeB[e] * py + tri.edgeC[e] < 0;
+                        }
+                        if (!outside)
+                        {
+                            chunkBins[ty * tilesX + tx].push_back(static_cast<uint32_t>(t));
+                        }
+                    }
+                }
+            }
+        });
+
+        // タイルごとに並列描画。1 タイルは 1 スレッドだけが触るので、投入順に描けば結果は決定的です。
+        m_pool->ParallelFor(tileCount, 1, [this](size_t begin, size_t end)
+        {
+            THINR_PROFILE_ZONE("SoftwareRasterizer::RasterizeTile");
+            for (size_t tile = begin; tile < end; ++tile)
+            {
+                RasterizeTile(static_cast<uint32_t>(tile));
+            }
+        });
+
+        m_stats.trianglesRasterized += triangleCount;
+        for (auto &bin : m_bins)
+        {
+            m_stats.tileTriangles += bin.size();
+        }
+        m_triangles.clear();
+    }
+
+    void SoftwareRasterizer::RasterizeTile(uint32_t tileIndex)
+    {
+        uint32_t tileCount = m_tilesX * m_tilesY;
+        int32_t x0 = static_cast<int32_t>(tileIndex % m_tilesX) * TileSize;
+        int32_t y0 = static_cast<int32_t>(tileIndex / m_tilesX) * TileSize;
+        int32_t x1 = x0 + TileSize - 1;
+        int32_t y1 = y0 + TileSize - 1;
+
+        RasterSurface surface = MakeRasterSurface(*m_target);
+
+        RasterizeTriangleFunc rasterize = m_kernelFunc;
+        for (uint32_t chunk = 0; chunk < m_binChunkCount; ++chunk)
+        {
+            for (uint32_t t : m_bins[chunk * tileCount + tileIndex])
+            {
+                rasterize(m_triangles[t], x0, y0, x1, y1, surface);
+            }
+        }
+    }
+}
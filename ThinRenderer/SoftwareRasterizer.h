@@ -0,0 +1,124 @@
+﻿#pragma once
+#include "VertexTypes.h"
+#include "RenderTarget.h"
+#include <vector>
+#include <cstdint>
+
+
+namespace thinr
+{
+    class ThreadPool;
+    struct RasterSurface;
+    enum class RasterKernel;
+
+    // 三角形セットアップ済みのデータ。スクリーン空間の辺関数と属性平面を持ちます。
+    struct RasterTriangle
+    {
+        // 辺関数 E(x, y) = A * x + B * y + C。3 辺とも内側で正になります。
+        float edgeA[3];
+        float edgeB[3];
+        float edgeC[3];
+        // E == 0 のピクセルを含める辺 (top-left rule)。ビット i が辺 i に対応します。
+        uint32_t topLeftMask;
+
+        // ピクセル単位の外接矩形 (両端を含む)。描画先の範囲にクランプ済み。
+        int32_t minX;
+        int32_t minY;
+        int32_t maxX;
+        int32_t maxY;
+
+        // スクリーン空間で線形な属性の平面 f(x, y) = a * x + b * y + c。
+        // z は深度、invW は 1/w、color は色/w (パースペクティブ補正用)。
+        float z[3];
+        float invW[3];
+        float color[3][3];
+    };
+
+    // 描画統計。
+    struct RasterizerStats
+    {
+        uint64_t drawCalls;
+        uint64_t instances;
+        uint64_t trianglesSubmitted;
+        uint64_t trianglesRasterized;
+        uint64_t tileTriangles;
+    };
+
+    // タイル ベースのソフトウェア ラスタライザー。
+    // Sample3DSceneRenderer::Render と同じインデックス付き三角形リストを受け取り、
+    // 三角形を画面タイルにビニングしてから、タイル単位で全コアに分散して描画します。
+    // 深度テストは D3D11 の既定 (LESS, 書き込みあり)、カリングは CULL_BACK (時計回りが表面) です。
+    class SoftwareRasterizer
+    {
+    public:
+        static const int TileSize = 64;
+
+        // pool が nullptr の場合は ThreadPool::GetDefault を使用します。
+        explicit SoftwareRasterizer(ThreadPool *pool = nullptr);
+
+        void SetRenderTarget(RenderTarget *target);
+        RenderTarget *GetRenderTarget() const { return m_target; }
+
+        // 保留中の描画を Flush してから描画先をクリアします。
+        void Clear(const float color[4], float depth = 1.0f);
+
+        // 頂点変換と三角形セットアップを行い、描画を保留します。実際の描画は Flush で行います。
+        void DrawIndexed(const VertexPositionColor *vertices, size_t vertexCount,
+            const uint16_t *indices, size_t indexCount,
+            const ModelViewProjectionConstantBuffer &constants);
+        void DrawIndexed(const VertexPositionColor *vertices, size_t vertexCount,
+            const uint32_t *indices, size_t indexCount,
+            const ModelViewProjectionConstantBuffer &constants);
+
+        // 同じメッシュを instanceCount 個まとめて描画します (DrawIndexedInstanced 相当)。
+        // インスタンス i の頂点は projection * view * instanceTransforms[i] * model で変換されます。
+        // instanceTransforms は定数バッファーと同じく転置して格納します。
+        // instanceColors を指定すると頂点色に乗算します (nullptr なら頂点色のまま)。
+        void DrawIndexedInstanced(const VertexPositionColor *vertices, size_t vertexCount,
+            const uint16_t *indices, size_t indexCount,
+            const Float4x4 *instanceTransforms, const Float3 *instanceColors, size_t instanceCount,
+            const ModelViewProjectionConstantBuffer &constants);
+        void DrawIndexedInstanced(const VertexPositionColor *vertices, size_t vertexCount,
+            const uint32_t *indices, size_t indexCount,
+            const Float4x4 *instanceTransforms, const Float3 *instanceColors, size_t instanceCount,
+            const ModelViewProjectionConstantBuffer &constants);
+
+        // 保留中の三角形をビニングし、タイルを並列に描画します。
+        void Flush();
+
+        const RasterizerStats &GetStats() const { return m_stats; }
+        void ResetStats() { m_stats = RasterizerStats(); }
+
+        ThreadPool *GetThreadPool() const { return m_pool; }
+
+        // 内側ループのカーネル (スカラー / SSE2 / AVX2)。既定は CPUID で選んだ最速のものです。
+        void SetRasterKernel(RasterKernel kernel);
+        RasterKernel GetRasterKernel() const { return m_kernel; }
+
+    private:
+        template<typename INDEX>
+        void DrawIndexedImpl(const VertexPositionColor *vertices, size_t vertexCount,
+            const INDEX *indices, size_t indexCount,
+            const Float4x4 *instanceTransforms, const Float3 *instanceColors, size_t instanceCount,
+            const ModelViewProjectionConstantBuffer &constants);
+
+        void RasterizeTile(uint32_t tileIndex);
+
+        ThreadPool *m_pool;
+        RenderTarget *m_target;
+        RasterKernel m_kernel;
+        void (*m_kernelFunc)(const RasterTriangle &, int32_t, int32_t, int32_t, int32_t, const RasterSurface &);
+
+        std::vector<Float4> m_clipPositions;
+        std::vector<RasterTriangle> m_triangles;
+        std::vector<std::vector<RasterTriangle>> m_setupChunks;
+
+        // m_bins[chunk * tileCount + tile] に三角形番号を投入順に並べます。
+        uint32_t m_tilesX;
+        uint32_t m_tilesY;
+        uint32_t m_binChunkCount;
+        std::vector<std::vector<uint32_t>> m_bins;
+
+        RasterizerStats m_stats;
+    };
+}
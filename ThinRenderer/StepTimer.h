@@ -0,0 +1,218 @@
+﻿#pragma once
+#include "FrameStatistics.h"
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+
+
+namespace thinr
+{
+    // アニメーションとシミュレーションのタイミング用のヘルパー クラス。
+    // DX::StepTimer と同じインターフェイスで、QueryPerformanceCounter の代わりに std::chrono::steady_clock を使います。
+    // 加えて、Tick ごとの実時間を FrameStatistics に記録します。
+    class StepTimer
+    {
+    public:
+        typedef std::chrono::steady_clock Clock;
+
+        StepTimer() :
+            m_lastTime(Clock::now()),
+            m_elapsedTicks(0),
+            m_totalTicks(0),
+            m_leftOverTicks(0),
+            m_frameCount(0),
+            m_framesPerSecond(0),
+            m_framesThisSecond(0),
+            m_secondCounter(0),
+            m_isFixedTimeStep(false),
+            m_targetElapsedTicks(TicksPerSecond / 60),
+            m_maxStepsPerTick(0),
+            m_droppedTicks(0),
+            m_lastDroppedTicks(0)
+        {
+            // 最大デルタを 1 秒の 1/10 に初期化します。
+            m_maxDelta = TicksPerSecond / 10;
+        }
+
+        // 前の Update 呼び出しから経過した時間を取得します。
+        uint64_t GetElapsedTicks() const					{ return m_elapsedTicks; }
+        double GetElapsedSeconds() const					{ return TicksToSeconds(m_elapsedTicks); }
+
+        // プログラム開始から経過した合計時間を取得します。
+        uint64_t GetTotalTicks() const						{ return m_totalTicks; }
+        double GetTotalSeconds() const						{ return TicksToSeconds(m_totalTicks); }
+
+        // プログラム開始からの合計更新回数を取得します。
+        uint32_t GetFrameCount() const						{ return m_frameCount; }
+
+        // 現在のフレーム レートを取得します。
+        uint32_t GetFramesPerSecond() const					{ return m_framesPerSecond; }
+
+        // Tick ごとの実時間 (クランプ前) の統計。
+        const FrameStatistics &GetFrameStatistics() const	{ return m_statistics; }
+        FrameStatistics &GetFrameStatistics()				{ return m_statistics; }
+
+        // 固定または可変のどちらのタイムステップ モードを使用するかを設定します。
+        void SetFixedTimeStep(bool isFixedTimestep)			{ m_isFixedTimeStep = isFixedTimestep; }
+        bool IsFixedTimeStep() const						{ return m_isFixedTimeStep; }
+
+        // 固定タイムステップ モードでは、Update の呼び出し頻度を設定します。
+        void SetTargetElapsedTicks(uint64_t targetElapsed)	{ m_targetElapsedTicks = targetElapsed; }
+        void SetTargetElapsedSeconds(double targetElapsed)	{ m_targetElapsedTicks = SecondsToTicks(targetElapsed); }
+        uint64_t GetTargetElapsedTicks() const				{ return m_targetElapsedTicks; }
+        double GetTargetElapsedSeconds() const				{ return TicksToSeconds(m_targetElapsedTicks); }
+
+        // 固定タイムステップ モードで、1 回の Tick で呼び出す Update の最大回数を設定します (0 は無制限)。
+        // 遅れたフレームの後に追いつこうとして Update が増え、さらに遅れる悪循環を防ぎます。
+        // 上限を超えた分のステップは実行せずに捨て、GetDroppedTicks に加算します。
+        void SetMaxStepsPerTick(uint32_t maxSteps)			{ m_maxStepsPerTick = maxSteps; }
+        uint32_t GetMaxStepsPerTick() const					{ return m_maxStepsPerTick; }
+
+        // 捨てたシミュレーション時間の合計と、直近の Tick で捨てた時間。
+        // ステップ数の上限のほか、極端に大きな時間差のクランプで捨てた分も含みます。
+        uint64_t GetDroppedTicks() const					{ return m_droppedTicks; }
+        double GetDroppedSeconds() const					{ return TicksToSeconds(m_droppedTicks); }
+        uint64_t GetLastDroppedTicks() const				{ return m_lastDroppedTicks; }
+
+        // 固定タイムステップ モードで、最後の Update から次の Update までのどこにいるかを [0, 1) で返します。
+        // 描画では直前と最新の Update の状態をこの値で補間すると、更新と描画の頻度が違ってもなめらかに動きます。
+        // 可変タイムステップ モードでは Update が毎回現在の時刻まで進めるので 1 です。
+        double GetInterpolationAlpha() const
+        {
+            if (!m_isFixedTimeStep || m_targetElapsedTicks == 0)
+            {
+                return 1.0;
+            }
+            return static_cast<double>(m_leftOverTicks) / m_targetElapsedTicks;
+        }
+
+        // 整数形式は 1 秒あたり 10,000,000 ティックを使用して時間を表します。
+        static const uint64_t TicksPerSecond = 10000000;
+
+        static double TicksToSeconds(uint64_t ticks)		{ return static_cast<double>(ticks) / TicksPerSecond; }
+        static uint64_t SecondsToTicks(double seconds)		{ return static_cast<uint64_t>(seconds * TicksPerSecond); }
+
+        // 意図的なタイミングの不連続性の後 (IO のブロック操作など)
+        // これを呼び出すと、固定タイムステップ ロジックによって一連のキャッチアップが試行されるのを回避できます。
+        void ResetElapsedTime()
+        {
+            m_lastTime = Clock::now();
+
+            m_leftOverTicks = 0;
+            m_framesPerSecond = 0;
+            m_framesThisSecond = 0;
+            m_secondCounter = 0;
+        }
+
+        // タイマー状態を更新し、指定の Update 関数を適切な回数だけ呼び出します。
+        template<typename TUpdate>
+        void Tick(const TUpdate& update)
+        {
+            // 現在の時刻をクエリします。
+            Clock::time_point currentTime = Clock::now();
+
+            uint64_t timeDelta = static_cast<uint64_t>(
+                std::chrono::duration_cast<std::chrono::duration<int64_t, std::ratio<1, TicksPerSecond>>>(
+                    currentTime - m_lastTime).count());
+
+            m_lastTime = currentTime;
+            m_secondCounter += timeDelta;
+            m_statistics.Record(TicksToSeconds(timeDelta));
+            m_lastDroppedTicks = 0;
+
+            //極端に大きな時間差 (デバッガーで一時停止した後など) をクランプします。
+            if (timeDelta > m_maxDelta)
+            {
+                m_lastDroppedTicks += timeDelta - m_maxDelta;
+                timeDelta = m_maxDelta;
+            }
+
+            uint32_t lastFrameCount = m_frameCount;
+
+            if (m_isFixedTimeStep)
+            {
+                // 固定タイムステップ更新ロジック
+
+                // ターゲット経過時間 (1/4 ミリ秒以内) に非常に近い場合は、ターゲット値と正確に一致するようにクランプし、
+                // 小さな誤差の蓄積でフレームをドロップしないようにします (DX::StepTimer と同じ)。
+                if (std::llabs(static_cast<long long>(timeDelta - m_targetElapsedTicks)) < static_cast<long long>(TicksPerSecond / 4000))
+                {
+                    timeDelta = m_targetElapsedTicks;
+                }
+
+                m_leftOverTicks += timeDelta;
+
+                uint32_t steps = 0;
+                while (m_leftOverTicks >= m_targetElapsedTicks)
+                {
+                    if (m_maxStepsPerTick != 0 && steps == m_maxStepsPerTick)
+                    {
+                        // 残りのステップは捨てます。1 ステップ未満の端数は補間のために残します。
+                        uint64_t dropped = m_leftOverTicks - m_leftOverTicks % m_targetElapsedTicks;
+                        m_leftOverTicks -= dropped;
+                        m_lastDroppedTicks += dropped;
+                        break;
+                    }
+
+                    m_elapsedTicks = m_targetElapsedTicks;
+                    m_totalTicks += m_targetElapsedTicks;
+                    m_leftOverTicks -= m_targetElapsedTicks;
+                    m_frameCount++;
+                    steps++;
+
+                    update();
+                }
+            }
+            else
+            {
+                // 可変タイムステップ更新ロジック。
+                m_elapsedTicks = timeDelta;
+                m_totalTicks += timeDelta;
+                m_leftOverTicks = 0;
+                m_frameCount++;
+
+                update();
+            }
+
+            m_droppedTicks += m_lastDroppedTicks;
+
+            // 現在のフレーム レートを追跡します。
+            if (m_frameCount != lastFrameCount)
+            {
+                m_framesThisSecond++;
+            }
+
+            if (m_secondCounter >= TicksPerSecond)
+            {
+                m_framesPerSecond = m_framesThisSecond;
+                m_framesThisSecond = 0;
+                m_secondCounter %= TicksPerSecond;
+            }
+        }
+
+    private:
+        Clock::time_point m_lastTime;
+        uint64_t m_maxDelta;
+
+        // 派生タイミング データでは、標準の目盛り形式を使用します。
+        uint64_t m_elapsedTicks;
+        uint64_t m_totalTicks;
+        uint64_t m_leftOverTicks;
+
+        // フレーム レートの追跡用メンバー。
+        uint32_t m_frameCount;
+        uint32_t m_framesPerSecond;
+        uint32_t m_framesThisSecond;
+        uint64_t m_secondCounter;
+
+        // 固定タイムステップ モードの構成用メンバー。
+        bool m_isFixedTimeStep;
+        uint64_t m_targetElapsedTicks;
+        uint32_t m_maxStepsPerTick;
+
+        uint64_t m_droppedTicks;
+        uint64_t m_lastDroppedTicks;
+
+        FrameStatistics m_statistics;
+    };
+}
@@ -0,0 +1,691 @@
+﻿#include "pch.h"
+#include "SweepAndPrune.h"
+#include "ThreadPool.h"
+#include "CpuFeatures.h"
+#include "Profiler.h"
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <stdexcept>
+#include <utility>
+
+#if defined(_M_IX86) || defined(_M_X64) || defined(__i386__) || defined(__x86_64__)
+#define THINR_X86 1
+#include <emmintrin.h>
+#endif
+
+
+namespace thinr
+{
+    namespace
+    {
+        // 1 チャンクで掃引する項目数。
+        const size_t SweepGrain = 2048;
+        // セルの区切りと末尾に入れる番兵の数 (SIMD の幅)。
+        const size_t SentinelCount = 4;
+        // 挿入ソートの入れ替えが項目数のこの倍を超えたら、残りは std::sort で並べ直します。
+        const size_t MaxSwapsPerBody = 8;
+        // 今の掃引軸より分散がこの倍以上大きい軸があれば切り替えます。
+        const float AxisSwitchRatio = 2.0f;
+        // これより多くのセルに重なるボディはセルに入れず、すべてのボディと直接判定します。
+        const int64_t MaxCellsPerBody = 64;
+
+        // 並べ替えた境界。p が掃引軸、q と r が残りの 2 軸です。
+        struct SweepArrays
+        {
+            const float *minP;
+            const float *maxP;
+            const float *minQ;
+            const float *maxQ;
+            const float *minR;
+            const float *maxR;
+            const uint32_t *order;
+        };
+
+        typedef void (*SweepFunc)(const SweepArrays &, size_t, size_t, std::vector<uint64_t> &);
+
+        uint64_t MakePairKey(uint32_t a, uint32_t b)
+        {
+            return a < b ? (static_cast<uint64_t>(a) << 32) | b : (static_cast<uint64_t>(b) << 32) | a;
+        }
+
+        // セルの番号は軸ごとに下位 16 ビットだけを使います。遠く離れたセルが同じキーになっても、
+        // 同じリストで掃引する候補が増えるだけで結果は変わりません。
+        const int32_t MaxCellIndex = 1 << 30;
+        const int32_t CellKeyMask = 0xffff;
+
+        void ComputeCellRange(float minValue, float maxValue, float invCellSize, int32_t &first, int32_t &last)
+        {
+            if (invCellSize == 0.0f)
+            {
+                first = last = 0;
+                return;
+            }
+            float lo = std::floor(minValue * invCellSize);
+            float hi = std::floor(maxValue * invCellSize);
+            first = static_cast<int32_t>(std::max(-static_cast<float>(MaxCellIndex), std::min(lo, static_cast<float>(MaxCellIndex))));
+            last = static_cast<int32_t>(std::max(-static_cast<float>(MaxCellIndex), std::min(hi, static_cast<float>(MaxCellIndex))));
+        }
+
+        // q と r の 2 軸のセルの範囲を range (q の最小、最大、r の最小、最大) に求めます。
+        // セルの数が MaxCellsPerBody を超える場合は range を空にして false を返します。
+        bool ComputeCellRanges(float minQ, float maxQ, float minR, float maxR, float invCellSize, int32_t *range)
+        {
+            ComputeCellRange(minQ, maxQ, invCellSize, range[0], range[1]);
+            ComputeCellRange(minR, maxR, invCellSize, range[2], range[3]);
+            int64_t cells = (static_cast<int64_t>(range[1]) - range[0] + 1) * (static_cast<int64_t>(range[3]) - range[2] + 1);
+            if (cells <= MaxCellsPerBody)
+            {
+                return true;
+            }
+            range[0] = range[2] = 0;
+            range[1] = range[3] = -1;
+            return false;
+        }
+
+        uint32_t MakeCellKey(int32_t cellQ, int32_t cellR)
+        {
+            return (static_cast<uint32_t>(cellQ) & CellKeyMask) | ((static_cast<uint32_t>(cellR) & CellKeyMask) << 16);
+        }
+
+        // キーの 16 ビットの値 cell から、そのキーを作ったときの範囲 [first, first + CellKeyMask] の中のセルの番号を戻します。
+        // 1 つのボディの範囲は MaxCellsPerBody 以下なので、この中に収まります。
+        int32_t RestoreCellIndex(uint32_t cell, int32_t first)
+        {
+            return first + static_cast<int32_t>((cell - static_cast<uint32_t>(first)) & CellKeyMask);
+        }
+
+        // (セル, 掃引軸の min) の順。
+        struct EntryLess
+        {
+            template<typename ENTRY>
+            bool operator()(const ENTRY &a, const ENTRY &b) const
+            {
+                return a.cell < b.cell || (a.cell == b.cell && a.key < b.key);
+            }
+        };
+
+        BroadphasePair KeyToPair(uint64_t key)
+        {
+            return BroadphasePair{ static_cast<uint32_t>(key >> 32), static_cast<uint32_t>(key) };
+        }
+
+        // 掃引軸の min が i の max 以下のボディだけを調べます。セルの区切りの番兵 (+inf) で必ず止まります。
+        void SweepScalar(const SweepArrays &s, size_t begin, size_t end, std::vector<uint64_t> &out)
+        {
+            for (size_t i = begin; i < end; ++i)
+            {
+                float maxP = s.maxP[i];
+                float minQ = s.minQ[i];
+                float maxQ = s.maxQ[i];
+                float minR = s.minR[i];
+                float maxR = s.maxR[i];
+                for (size_t j = i + 1; s.minP[j] <= maxP; ++j)
+                {
+                    if (s.minQ[j] <= maxQ && s.maxQ[j] >= minQ && s.minR[j] <= maxR && s.maxR[j] >= minR)
+                    {
+                        out.push_back(MakePairKey(s.order[i], s.order[j]));
+                    }
+                }
+            }
+        }
+
+#if THINR_X86
+        // 4 ボディずつ判定します。掃引軸の min は昇順なので、4 つのうち 1 つでも範囲外ならそこで終わりです。
+        void SweepSSE2(const SweepArrays &s, size_t begin, size_t end, std::vector<uint64_t> &out)
+        {
+            for (size_t i = begin; i < end; ++i)
+            {
+                __m128 maxP = _mm_set1_ps(s.maxP[i]);
+                __m128 minQ = _mm_set1_ps(s.minQ[i]);
+                __m128 maxQ = _mm_set1_ps(s.maxQ[i]);
+                __m128 minR = _mm_set1_ps(s.minR[i]);
+                __m128 maxR = _mm_set1_ps(s.maxR[i]);
+                for (size_t j = i + 1; ; j += 4)
+                {
+                    __m128 inP = _mm_cmple_ps(_mm_loadu_ps(s.minP + j), maxP);
+                    unsigned maskP = static_cast<unsigned>(_mm_movemask_ps(inP));
+                    if (maskP == 0)
+                    {
+                        break;
+                    }
+                    __m128 overlap = _mm_and_ps(inP, _mm_cmple_ps(_mm_loadu_ps(s.minQ + j), maxQ));
+                    overlap = _mm_and_ps(overlap, _mm_cmpge_ps(_mm_loadu_ps(s.maxQ + j), minQ));
+                    overlap = _mm_and_ps(overlap, _mm_cmple_ps(_mm_loadu_ps(s.minR + j), maxR));
+                    overlap = _mm_and_ps(overlap, _mm_cmpge_ps(_mm_loadu_ps(s.maxR + j), minR));
+                    unsigned mask = static_cast<unsigned>(_mm_movemask_ps(overlap));
+                    while (mask)
+                    {
+                        unsigned lane = 0;
+                        while (!(mask & (1u << lane)))
+                        {
+                            lane++;
+                        }
+                        mask &= mask - 1;
+                        out.push_back(MakePairKey(s.order[i], s.order[j + lane]));
+                    }
+                    if (maskP != 0xf)
+                    {
+                        break;
+                    }
+                }
+            }
+        }
+#endif
+
+        BroadphaseKernel ResolveBroadphaseKernel(BroadphaseKernel kernel)
+        {
+            const CpuFeatures &cpu = GetCpuFeatures();
+            if (kernel == BroadphaseKernel::Scalar || !cpu.sse2)
+            {
+                return BroadphaseKernel::Scalar;
+            }
+            return BroadphaseKernel::SSE2;
+        }
+
+        SweepFunc SelectSweepKernel(BroadphaseKernel kernel)
+        {
+            switch (kernel)
+            {
+#if THINR_X86
+            case BroadphaseKernel::SSE2:
+                return &SweepSSE2;
+#endif
+            default:
+                return &SweepScalar;
+            }
+        }
+    }
+
+    SweepAndPrune::SweepAndPrune(ThreadPool *pool)
+        : m_pool(pool ? pool : &ThreadPool::GetDefault()), m_kernel(ResolveBroadphaseKernel(BroadphaseKernel::Auto)),
+        m_cellSize(0.0f), m_bodyCount(0), m_axis(0), m_rebuild(true), m_stats()
+    {
+    }
+
+    void SweepAndPrune::SetKernel(BroadphaseKernel kernel)
+    {
+        m_kernel = ResolveBroadphaseKernel(kernel);
+    }
+
+    void SweepAndPrune::SetCellSize(float cellSize)
+    {
+        cellSize = cellSize > 0.0f ? cellSize : 0.0f;
+        if (cellSize != m_cellSize)
+        {
+            m_cellSize = cellSize;
+            m_rebuild = true;
+        }
+    }
+
+    uint32_t SweepAndPrune::AddBody(const Aabb &bounds)
+    {
+        uint32_t body;
+        if (!m_freeBodies.empty())
+        {
+            body = m_freeBodies.back();
+            m_freeBodies.pop_back();
+        }
+        else
+        {
+            if (m_alive.size() >= UINT32_MAX)
+            {
+                throw std::length_error("SweepAndPrune: too many bodies");
+            }
+            body = static_cast<uint32_t>(m_alive.size());
+            m_alive.push_back(0);
+            m_cellRanges.resize(m_cellRanges.size() + 4);
+            for (int axis = 0; axis < 3; ++axis)
+            {
+                m_min[axis].push_back(0.0f);
+                m_max[axis].push_back(0.0f);
+            }
+        }
+        // まだどのセルにも入っていません。次の Update で掃引リストに加えます。
+        int32_t *range = &m_cellRanges[body * 4];
+        range[0] = range[2] = 0;
+        range[1] = range[3] = -1;
+        m_alive[body] = 1;
+        SetBounds(body, bounds);
+        m_bodyCount++;
+        return body;
+    }
+
+    void SweepAndPrune::SetBounds(uint32_t body, const Aabb &bounds)
+    {
+        m_min[0][body] = bounds.min.x;
+        m_min[1][body] = bounds.min.y;
+        m_min[2][body] = bounds.min.z;
+        m_max[0][body] = bounds.max.x;
+        m_max[1][body] = bounds.max.y;
+        m_max[2][body] = bounds.max.z;
+    }
+
+    void SweepAndPrune::RemoveBody(uint32_t body)
+    {
+        if (!IsValidBody(body))
+        {
+            throw std::invalid_argument("SweepAndPrune: invalid body");
+        }
+        m_alive[body] = 0;
+        m_removedBodies.push_back(body);
+        m_bodyCount--;
+    }
+
+    void SweepAndPrune::Clear()
+    {
+        for (int axis = 0; axis < 3; ++axis)
+        {
+            m_min[axis].clear();
+            m_max[axis].clear();
+        }
+        m_alive.clear();
+        m_cellRanges.clear();
+        m_freeBodies.clear();
+        m_removedBodies.clear();
+        m_bodyCount = 0;
+        m_entries.clear();
+        m_oversizedBodies.clear();
+        m_rebuild = true;
+        m_previousPairKeys.clear();
+        m_pairs.clear();
+        m_addedPairs.clear();
+        m_removedPairs.clear();
+        m_stats = BroadphaseStats();
+    }
+
+    void SweepAndPrune::Update()
+    {
+        THINR_PROFILE_ZONE("SweepAndPrune::Update");
+        m_stats = BroadphaseStats();
+
+        SelectAxis();
+        UpdateEntries();
+        SortEntries();
+        GatherEntries();
+        FindPairs();
+        SortPairKeys();
+        DiffPairs();
+
+        // 取り除いた番号は、重なりの差分を報告し終えてから再利用します。
+        m_freeBodies.insert(m_freeBodies.end(), m_removedBodies.begin(), m_removedBodies.end());
+        m_removedBodies.clear();
+
+        m_stats.bodies = m_bodyCount;
+        m_stats.entries = m_entries.size();
+        m_stats.oversizedBodies = m_oversizedBodies.size();
+        m_stats.pairs = m_pairs.size();
+        m_stats.addedPairs = m_addedPairs.size();
+        m_stats.removedPairs = m_removedPairs.size();
+        m_stats.axis = m_axis;
+    }
+
+    void SweepAndPrune::SelectAxis()
+    {
+        if (m_bodyCount < 2)
+        {
+            return;
+        }
+
+        double sum[3] = {};
+        double sumSq[3] = {};
+        for (size_t body = 0; body < m_alive.size(); ++body)
+        {
+            if (!m_alive[body])
+            {
+                continue;
+            }
+            for (int axis = 0; axis < 3; ++axis)
+            {
+                double center = 0.5 * (static_cast<double>(m_min[axis][body]) + m_max[axis][body]);
+                sum[axis] += center;
+                sumSq[axis] += center * center;
+            }
+        }
+        float variance[3];
+        uint32_t best = 0;
+        for (int axis = 0; axis < 3; ++axis)
+        {
+            double mean = sum[axis] / m_bodyCount;
+            variance[axis] = static_cast<float>(sumSq[axis] / m_bodyCount - mean * mean);
+            if (variance[axis] > variance[best])
+            {
+                best = axis;
+            }
+        }
+
+        // 切り替えると作り直しになるので、差がはっきりしているときだけ切り替えます。
+        if (best != m_axis && (m_rebuild || variance[best] > variance[m_axis] * AxisSwitchRatio))
+        {
+            m_axis = best;
+            m_rebuild = true;
+        }
+    }
+
+    void SweepAndPrune::UpdateEntries()
+    {
+        uint32_t p = m_axis;
+        uint32_t q = (m_axis + 1) % 3;
+        uint32_t r = (m_axis + 2) % 3;
+        float invCellSize = m_cellSize > 0.0f ? 1.0f / m_cellSize : 0.0f;
+        const float *minP = m_min[p].data();
+
+        if (m_rebuild)
+        {
+            m_entries.clear();
+            for (size_t body = 0; body < m_alive.size(); ++body)
+            {
+                int32_t *range = &m_cellRanges[body * 4];
+                range[0] = range[2] = 0;
+                range[1] = range[3] = -1;
+            }
+        }
+
+        // 前回の項目のうち、まだ入っているセルのものを順番を保って残し、キーを今の値にします。
+        // 下位 16 ビットが同じ別のセルと取り違えないよう、前回の範囲からセルの番号を戻して今の範囲と比べます。
+        size_t kept = 0;
+        for (const SweepEntry &entry : m_entries)
+        {
+            uint32_t body = entry.body;
+            if (!m_alive[body])
+            {
+                continue;
+            }
+            const int32_t *previous = &m_cellRanges[body * 4];
+            int32_t range[4];
+            ComputeCellRanges(m_min[q][body], m_max[q][body], m_min[r][body], m_max[r][body], invCellSize, range);
+            int32_t cellQ = RestoreCellIndex(entry.cell & CellKeyMask, previous[0]);
+            int32_t cellR = RestoreCellIndex(entry.cell >> 16, previous[2]);
+            if (cellQ < range[0] || cellQ > range[1] || cellR < range[2] || cellR > range[3])
+            {
+                continue;
+            }
+            m_entries[kept++] = SweepEntry{ entry.cell, minP[body], body };
+        }
+        m_entries.resize(kept);
+
+        // 新しく入ったセルの項目。前回のセルの範囲に無いものだけを加えます。
+        // 大きすぎるボディはセルに入れず、FindPairs ですべてのボディと判定します。
+        m_newEntries.clear();
+        m_oversizedBodies.clear();
+        for (size_t index = 0; index < m_alive.size(); ++index)
+        {
+            if (!m_alive[index])
+            {
+                continue;
+            }
+            uint32_t body = static_cast<uint32_t>(index);
+            int32_t *previous = &m_cellRanges[index * 4];
+            int32_t range[4];
+            if (!ComputeCellRanges(m_min[q][body], m_max[q][body], m_min[r][body], m_max[r][body], invCellSize, range))
+            {
+                m_oversizedBodies.push_back(body);
+            }
+            if (range[0] != previous[0] || range[1] != previous[1] || range[2] != previous[2] || range[3] != previous[3])
+            {
+                for (int32_t cellR = range[2]; cellR <= range[3]; ++cellR)
+                {
+                    for (int32_t cellQ = range[0]; cellQ <= range[1]; ++cellQ)
+                    {
+                        if (cellQ >= previous[0] && cellQ <= previous[1] && cellR >= previous[2] && cellR <= previous[3])
+                        {
+                            continue;
+                        }
+                        m_newEntries.push_back(SweepEntry{ MakeCellKey(cellQ, cellR), minP[body], body });
+                    }
+                }
+                std::copy(range, range + 4, previous);
+            }
+        }
+    }
+
+    void SweepAndPrune::SortEntries()
+    {
+        // 前の順番の上で挿入ソートします。フレーム間の動きが小さければほぼ線形時間です。
+        size_t count = m_entries.size();
+        bool fullSort = m_rebuild;
+        size_t swaps = 0;
+        if (!fullSort)
+        {
+            size_t maxSwaps = count * MaxSwapsPerBody;
+            SweepEntry *entries = m_entries.data();
+            for (size_t i = 1; i < count && !fullSort; ++i)
+            {
+                SweepEntry entry = entries[i];
+                size_t j = i;
+                while (j > 0 && EntryLess()(entry, entries[j - 1]))
+                {
+                    entries[j] = entries[j - 1];
+                    --j;
+                }
+                entries[j] = entry;
+                swaps += i - j;
+                fullSort = swaps > maxSwaps;
+            }
+        }
+        if (fullSort)
+        {
+            std::sort(m_entries.begin(), m_entries.end(), EntryLess());
+        }
+
+        // 新しい項目は別に並べてからマージします (末尾から挿入ソートで運ぶと遠くまで動くため)。
+        if (!m_newEntries.empty())
+        {
+            std::sort(m_newEntries.begin(), m_newEntries.end(), EntryLess());
+            m_mergedEntries.resize(m_entries.size() + m_newEntries.size());
+            std::merge(m_entries.begin(), m_entries.end(), m_newEntries.begin(), m_newEntries.end(),
+                m_mergedEntries.begin(), EntryLess());
+            m_entries.swap(m_mergedEntries);
+        }
+
+        m_rebuild = false;
+        m_stats.sortSwaps = swaps;
+        m_stats.fullSort = fullSort;
+    }
+
+    void SweepAndPrune::GatherEntries()
+    {
+        // セルの区切りごとに番兵を入れるので、その分を数えます。
+        size_t count = m_entries.size();
+        size_t cellCount = 0;
+        for (size_t i = 0; i < count; ++i)
+        {
+            if (i == 0 || m_entries[i].cell != m_entries[i - 1].cell)
+            {
+                cellCount++;
+            }
+        }
+        size_t total = count + (cellCount + 1) * SentinelCount;
+        m_sortedBodies.resize(total);
+        for (int axis = 0; axis < 3; ++axis)
+        {
+            m_sortedMin[axis].resize(total);
+            m_sortedMax[axis].resize(total);
+        }
+
+        const float inf = std::numeric_limits<float>::infinity();
+        size_t out = 0;
+        auto writeSentinels = [&]()
+        {
+            for (size_t k = 0; k < SentinelCount; ++k, ++out)
+            {
+                m_sortedBodies[out] = UINT32_MAX;
+                for (int axis = 0; axis < 3; ++axis)
+                {
+                    m_sortedMin[axis][out] = inf;
+                    m_sortedMax[axis][out] = -inf;
+                }
+            }
+        };
+        for (size_t i = 0; i < count; ++i, ++out)
+        {
+            if (i != 0 && m_entries[i].cell != m_entries[i - 1].cell)
+            {
+                writeSentinels();
+            }
+            uint32_t body = m_entries[i].body;
+            m_sortedBodies[out] = body;
+            for (int axis = 0; axis < 3; ++axis)
+            {
+                m_sortedMin[axis][out] = m_min[axis][body];
+                m_sortedMax[axis][out] = m_max[axis][body];
+            }
+        }
+        writeSentinels();
+    }
+
+    void SweepAndPrune::FindPairs()
+    {
+        // 末尾の番兵は掃引しません。
+        size_t count = m_sortedBodies.size() >= SentinelCount ? m_sortedBodies.size() - SentinelCount : 0;
+        size_t chunkCount = (count + SweepGrain - 1) / SweepGrain;
+        size_t bodyCount = m_oversizedBodies.empty() ? 0 : m_alive.size();
+        size_t oversizedChunkCount = (bodyCount + SweepGrain - 1) / SweepGrain;
+        if (m_chunkPairs.size() < chunkCount + oversizedChunkCount)
+        {
+            m_chunkPairs.resize(chunkCount + oversizedChunkCount);
+        }
+
+        uint32_t q = (m_axis + 1) % 3;
+        uint32_t r = (m_axis + 2) % 3;
+        SweepArrays arrays = {
+            m_sortedMin[m_axis].data(), m_sortedMax[m_axis].data(),
+            m_sortedMin[q].data(), m_sortedMax[q].data(),
+            m_sortedMin[r].data(), m_sortedMax[r].data(),
+            m_sortedBodies.data(),
+        };
+        SweepFunc sweep = SelectSweepKernel(m_kernel);
+        auto &chunks = m_chunkPairs;
+        m_pool->ParallelFor(count, SweepGrain, [&](size_t begin, size_t end)
+        {
+            auto &out = chunks[begin / SweepGrain];
+            out.clear();
+            sweep(arrays, begin, end, out);
+        });
+
+        // 大きすぎるボディは、ボディの番号の順にすべてのボディと判定します。
+        // 大きすぎるボディどうしは両方から見つかりますが、SortPairKeys で 1 つにします。
+        const uint32_t *oversized = m_oversizedBodies.data();
+        size_t oversizedCount = m_oversizedBodies.size();
+        m_pool->ParallelFor(bodyCount, SweepGrain, [&](size_t begin, size_t end)
+        {
+            auto &out = chunks[chunkCount + begin / SweepGrain];
+            out.clear();
+            for (size_t index = begin; index < end; ++index)
+            {
+                if (!m_alive[index])
+                {
+                    continue;
+                }
+                uint32_t body = static_cast<uint32_t>(index);
+                for (size_t k = 0; k < oversizedCount; ++k)
+                {
+                    uint32_t other = oversized[k];
+                    if (other != body &&
+                        m_min[0][body] <= m_max[0][other] && m_max[0][body] >= m_min[0][other] &&
+                        m_min[1][body] <= m_max[1][other] && m_max[1][body] >= m_min[1][other] &&
+                        m_min[2][body] <= m_max[2][other] && m_max[2][body] >= m_min[2][other])
+                    {
+                        out.push_back(MakePairKey(body, other));
+                    }
+                }
+            }
+        });
+
+        m_pairKeys.clear();
+        for (size_t i = 0; i < chunkCount + oversizedChunkCount; ++i)
+        {
+            m_pairKeys.insert(m_pairKeys.end(), m_chunkPairs[i].begin(), m_chunkPairs[i].end());
+        }
+    }
+
+    void SweepAndPrune::SortPairKeys()
+    {
+        size_t count = m_pairKeys.size();
+        if (count < 2)
+        {
+            return;
+        }
+
+        // RenderQueue::Sort と同じく 8 ビットずつの LSD 基数ソートで、全項目で同じバイトのパスは飛ばします。
+        size_t histogram[8][256] = {};
+        for (uint64_t key : m_pairKeys)
+        {
+            for (int pass = 0; pass < 8; ++pass)
+            {
+                histogram[pass][(key >> (pass * 8)) & 0xff]++;
+            }
+        }
+
+        m_scratch.resize(count);
+        uint64_t *src = m_pairKeys.data();
+        uint64_t *dst = m_scratch.data();
+        for (int pass = 0; pass < 8; ++pass)
+        {
+            size_t *counts = histogram[pass];
+            if (counts[(src[0] >> (pass * 8)) & 0xff] == count)
+            {
+                continue;
+            }
+
+            size_t offset = 0;
+            for (int digit = 0; digit < 256; ++digit)
+            {
+                size_t n = counts[digit];
+                counts[digit] = offset;
+                offset += n;
+            }
+            for (size_t i = 0; i < count; ++i)
+            {
+                dst[counts[(src[i] >> (pass * 8)) & 0xff]++] = src[i];
+            }
+            std::swap(src, dst);
+        }
+
+        if (src != m_pairKeys.data())
+        {
+            m_pairKeys.swap(m_scratch);
+        }
+
+        // 格子を使う場合、複数のセルにまたがる 2 つのボディはセルごとに見つかるので 1 つにします。
+        if (m_cellSize > 0.0f)
+        {
+            m_pairKeys.erase(std::unique(m_pairKeys.begin(), m_pairKeys.end()), m_pairKeys.end());
+        }
+    }
+
+    void SweepAndPrune::DiffPairs()
+    {
+        // どちらも昇順なので、マージしながら差分を取ります。
+        m_pairs.resize(m_pairKeys.size());
+        m_addedPairs.clear();
+        m_removedPairs.clear();
+        const uint64_t *current = m_pairKeys.data();
+        const uint64_t *previous = m_previousPairKeys.data();
+        size_t currentCount = m_pairKeys.size();
+        size_t previousCount = m_previousPairKeys.size();
+        size_t i = 0;
+        size_t j = 0;
+        while (i < currentCount || j < previousCount)
+        {
+            if (j == previousCount || (i < currentCount && current[i] < previous[j]))
+            {
+                m_addedPairs.push_back(KeyToPair(current[i]));
+                m_pairs[i] = KeyToPair(current[i]);
+                i++;
+            }
+            else if (i == currentCount || previous[j] < current[i])
+            {
+                m_removedPairs.push_back(KeyToPair(previous[j]));
+                j++;
+            }
+            else
+            {
+                m_pairs[i] = KeyToPair(current[i]);
+                i++;
+                j++;
+            }
+        }
+        m_previousPairKeys.swap(m_pairKeys);
+    }
+}
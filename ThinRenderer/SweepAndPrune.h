@@ -0,0 +1,152 @@
+﻿#pragma once
+#include "Bvh.h"
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+
+
+namespace thinr
+{
+    class ThreadPool;
+
+    // 重なっている 2 つのボディ。a < b です。
+    struct BroadphasePair
+    {
+        uint32_t a;
+        uint32_t b;
+    };
+
+    inline bool operator==(const BroadphasePair &l, const BroadphasePair &r) { return l.a == r.a && l.b == r.b; }
+
+    enum class BroadphaseKernel
+    {
+        // CPUID で使える中で最速のものを選びます。
+        Auto,
+        Scalar,
+        // 4 ボディ同時 (SSE2)
+        SSE2,
+    };
+
+    struct BroadphaseStats
+    {
+        // 直近の Update の時点のボディ数と重なりの数。
+        size_t bodies;
+        size_t pairs;
+        // 直近の Update で増えた重なりと、無くなった重なり。
+        size_t addedPairs;
+        size_t removedPairs;
+        // 掃引リストの項目数。セルを使う場合は、複数のセルにまたがるボディをセルごとに数えます。
+        size_t entries;
+        // セルに入れずにすべてのボディと判定した、大きすぎるボディの数。
+        size_t oversizedBodies;
+        // 直近の Update の挿入ソートで入れ替えた回数。前のフレームからの動きが小さいほど少なくなります。
+        size_t sortSwaps;
+        // 挿入ソートをやめてすべて並べ直した場合に true です (初回、掃引軸の変更、大きな移動の後など)。
+        bool fullSort;
+        // 掃引に使った軸 (0 = x, 1 = y, 2 = z)。
+        uint32_t axis;
+    };
+
+    // AABB の重なりを見つけるブロードフェーズ (sweep and prune)。
+    // 掃引軸の min の端点で並べたボディの順番をフレーム間で保ち、毎回の Update では挿入ソートで直すだけにします。
+    // 並べた順に、掃引軸で重なる範囲のボディと残りの 2 軸を SIMD でまとめて判定し、ThreadPool で並列に処理します。
+    // 重なりは前回の Update との差分 (増えたもの、無くなったもの) としても取得できます。
+    // 掃引軸はボディの中心の分散が最も大きい軸で、偏りが大きく変わったときだけ切り替えます。
+    // 広いワールドでは掃引軸だけでは候補が減らないので、SetCellSize で残りの 2 軸を格子に分け、セルごとに掃引します。
+    class SweepAndPrune
+    {
+    public:
+        // pool が nullptr の場合は ThreadPool::GetDefault を使用します。
+        explicit SweepAndPrune(ThreadPool *pool = nullptr);
+
+        void SetKernel(BroadphaseKernel kernel);
+        BroadphaseKernel GetKernel() const { return m_kernel; }
+
+        // 掃引軸以外の 2 軸の格子の間隔。0 (既定) なら格子を使わず、すべてのボディを 1 つのリストで掃引します。
+        // ボディは重なるすべてのセルに入るので、典型的なボディの数倍の大きさにしてください。次の Update で並べ直します。
+        // 64 より多くのセルに重なるボディ (地面など) はセルに入れず、すべてのボディと直接判定します。
+        void SetCellSize(float cellSize);
+        float GetCellSize() const { return m_cellSize; }
+
+        // ボディを追加して番号を返します。RemoveBody した番号は次の Update の後で再利用します。
+        uint32_t AddBody(const Aabb &bounds);
+        // 境界に NaN を含めないでください。
+        void SetBounds(uint32_t body, const Aabb &bounds);
+        // ボディを取り除きます。このボディの重なりは次の Update で GetRemovedPairs に入ります。
+        void RemoveBody(uint32_t body);
+        void Clear();
+
+        // 取り除いていないボディの数。
+        size_t GetBodyCount() const { return m_bodyCount; }
+        bool IsValidBody(uint32_t body) const { return body < m_alive.size() && m_alive[body]; }
+
+        // 重なりを計算し直します。境界の辺が接しているだけの場合も重なりとみなします。
+        void Update();
+
+        // 直近の Update の時点のすべての重なり。(a, b) の昇順です。
+        const std::vector<BroadphasePair> &GetPairs() const { return m_pairs; }
+        // 前回の Update から増えた重なりと、無くなった重なり。どちらも (a, b) の昇順です。
+        const std::vector<BroadphasePair> &GetAddedPairs() const { return m_addedPairs; }
+        const std::vector<BroadphasePair> &GetRemovedPairs() const { return m_removedPairs; }
+
+        const BroadphaseStats &GetStats() const { return m_stats; }
+
+    private:
+        // 掃引リストの項目。セルの中で掃引軸の min の昇順に並べます。
+        struct SweepEntry
+        {
+            uint32_t cell;
+            float key;
+            uint32_t body;
+        };
+
+        void SelectAxis();
+        void UpdateEntries();
+        void SortEntries();
+        void GatherEntries();
+        void FindPairs();
+        void SortPairKeys();
+        void DiffPairs();
+
+        ThreadPool *m_pool;
+        BroadphaseKernel m_kernel;
+        float m_cellSize;
+
+        // ボディの番号で引く境界 (軸ごとの SoA)。
+        std::vector<float> m_min[3];
+        std::vector<float> m_max[3];
+        std::vector<uint8_t> m_alive;
+        // 前回の Update で入ったセルの範囲 (ボディごとに q の最小、最大、r の最小、最大)。
+        std::vector<int32_t> m_cellRanges;
+        std::vector<uint32_t> m_freeBodies;
+        // RemoveBody した番号。Update の後で m_freeBodies に移します。
+        std::vector<uint32_t> m_removedBodies;
+        size_t m_bodyCount;
+
+        uint32_t m_axis;
+        // 次の Update で掃引リストを作り直します (掃引軸やセルの大きさの変更後)。
+        bool m_rebuild;
+        // (セル, 掃引軸の min) の昇順の掃引リスト。前回の順番を保ちます。
+        std::vector<SweepEntry> m_entries;
+        std::vector<SweepEntry> m_newEntries;
+        std::vector<SweepEntry> m_mergedEntries;
+        // セルに入れなかった大きすぎるボディ。Update のたびに作り直します。
+        std::vector<uint32_t> m_oversizedBodies;
+        // 掃引リストの順に集めたボディの番号と境界。セルの区切りと末尾には番兵 (min = +inf, max = -inf) を
+        // SIMD の幅だけ入れてあるので、掃引はそこで止まり、末尾を越えて読むこともできます。
+        std::vector<uint32_t> m_sortedBodies;
+        std::vector<float> m_sortedMin[3];
+        std::vector<float> m_sortedMax[3];
+
+        // チャンクごとに見つけた重なりのキー (a << 32 | b) と、それを連結して並べたもの。
+        std::vector<std::vector<uint64_t>> m_chunkPairs;
+        std::vector<uint64_t> m_pairKeys;
+        std::vector<uint64_t> m_previousPairKeys;
+        std::vector<uint64_t> m_scratch;
+
+        std::vector<BroadphasePair> m_pairs;
+        std::vector<BroadphasePair> m_addedPairs;
+        std::vector<BroadphasePair> m_removedPairs;
+        BroadphaseStats m_stats;
+    };
+}
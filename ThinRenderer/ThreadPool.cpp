@@ -0,0 +1,169 @@
+﻿#include "pch.h"
+#include "ThreadPool.h"
+#include "Profiler.h"
+#include <algorithm>
+#include <exception>
+
+
+namespace thinr
+{
+    struct ThreadPool::ForJob
+    {
+        const std::function<void(size_t, size_t)> *body;
+        size_t count;
+        size_t grain;
+        size_t chunkCount;
+        std::atomic<size_t> nextChunk;
+        std::atomic<size_t> doneChunks;
+
+        std::mutex mutex;
+        std::condition_variable done;
+        std::exception_ptr error;
+
+        ForJob()
+            : body(nullptr), count(0), grain(1), chunkCount(0), nextChunk(0), doneChunks(0)
+        {}
+    };
+
+    ThreadPool::ThreadPool(unsigned threadCount)
+        : m_quit(false)
+    {
+        if (threadCount == 0)
+        {
+            threadCount = std::max(1u, std::thread::hardware_concurrency());
+        }
+        // 呼び出し元スレッドも処理するので、ワーカーは 1 つ少なくします。
+        for (unsigned i = 1; i < threadCount; ++i)
+        {
+            m_workers.emplace_back([this]() { WorkerLoop(); });
+        }
+    }
+
+    ThreadPool::~ThreadPool()
+    {
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_quit = true;
+        }
+        m_wake.notify_all();
+        for (auto &t : m_workers)
+        {
+            t.join();
+        }
+    }
+
+    ThreadPool &ThreadPool::GetDefault()
+    {
+        static ThreadPool s_pool;
+        return s_pool;
+    }
+
+    // チャンクを 1 つ処理します。処理するチャンクが無ければ false を返します。
+    bool ThreadPool::RunChunk(ForJob &job)
+    {
+        size_t chunk = job.nextChunk.fetch_add(1);
+        if (chunk >= job.chunkCount)
+        {
+            return false;
+        }
+
+        size_t begin = chunk * job.grain;
+        size_t end = std::min(job.count, begin + job.grain);
+        try
+        {
+            (*job.body)(begin, end);
+        }
+        catch (...)
+        {
+            std::lock_guard<std::mutex> lock(job.mutex);
+            if (!job.error)
+            {
+                job.error = std::current_exception();
+            }
+        }
+
+        if (job.doneChunks.fetch_add(1) + 1 == job.chunkCount)
+        {
+            std::lock_guard<std::mutex> lock(job.mutex);
+            job.done.notify_all();
+        }
+        return true;
+    }
+
+    void ThreadPool::ParallelFor(size_t count, size_t grain, const std::function<void(size_t, size_t)> &body)
+    {
+        if (count == 0)
+        {
+            return;
+        }
+        grain = std::max<size_t>(1, grain);
+        if (m_workers.empty() || count <= grain)
+        {
+            body(0, count);
+            return;
+        }
+
+        auto job = std::make_shared<ForJob>();
+        job->body = &body;
+        job->count = count;
+        job->grain = grain;
+        job->chunkCount = (count + grain - 1) / grain;
+
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_jobs.push_back(job);
+        }
+        m_wake.notify_all();
+
+        while (RunChunk(*job))
+        {
+        }
+
+        {
+            std::unique_lock<std::mutex> lock(job->mutex);
+            job->done.wait(lock, [&job]() { return job->doneChunks.load() == job->chunkCount; });
+        }
+
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            auto found = std::find(m_jobs.begin(), m_jobs.end(), job);
+            if (found != m_jobs.end())
+            {
+                m_jobs.erase(found);
+            }
+        }
+
+        if (job->error)
+        {
+            std::rethrow_exception(job->error);
+        }
+    }
+
+    void ThreadPool::WorkerLoop()
+    {
+        THINR_PROFILE_THREAD("ThreadPool worker");
+        for (;;)
+        {
+            std::shared_ptr<ForJob> job;
+            {
+                std::unique_lock<std::mutex> lock(m_mutex);
+                m_wake.wait(lock, [this]() { return m_quit || !m_jobs.empty(); });
+                if (m_quit)
+                {
+                    return;
+                }
+                job = m_jobs.front();
+                if (job->nextChunk.load() >= job->chunkCount)
+                {
+                    // 配り終えたジョブはキューから外し、次のジョブを待ちます。
+                    m_jobs.pop_front();
+                    continue;
+                }
+            }
+
+            while (RunChunk(*job))
+            {
+            }
+        }
+    }
+}
@@ -0,0 +1,46 @@
+﻿#pragma once
+#include <functional>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <deque>
+#include <memory>
+#include <vector>
+
+
+namespace thinr
+{
+    // 全コアに処理を分散するためのスレッド プール。
+    // ParallelFor の呼び出し元スレッドも処理に参加するので、入れ子で呼び出してもデッドロックしません。
+    class ThreadPool
+    {
+    public:
+        // threadCount が 0 の場合は std::thread::hardware_concurrency を使用します。
+        explicit ThreadPool(unsigned threadCount = 0);
+        ~ThreadPool();
+        ThreadPool(const ThreadPool &) = delete;
+        ThreadPool &operator=(const ThreadPool &) = delete;
+
+        // 呼び出し元スレッドを含めた並列数。
+        unsigned GetConcurrency() const { return static_cast<unsigned>(m_workers.size()) + 1; }
+
+        // [0, count) を grain 個ずつの範囲に分割して body(begin, end) を並列に実行し、完了まで待ちます。
+        // body が投げた例外は呼び出し元で再送出されます。
+        void ParallelFor(size_t count, size_t grain, const std::function<void(size_t, size_t)> &body);
+
+        // プロセス共有のプール。
+        static ThreadPool &GetDefault();
+
+    private:
+        struct ForJob;
+        void WorkerLoop();
+        static bool RunChunk(ForJob &job);
+
+        std::vector<std::thread> m_workers;
+        std::mutex m_mutex;
+        std::condition_variable m_wake;
+        std::deque<std::shared_ptr<ForJob>> m_jobs;
+        bool m_quit;
+    };
+}
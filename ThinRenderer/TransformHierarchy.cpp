@@ -0,0 +1,134 @@
+﻿#include "pch.h"
+#include "TransformHierarchy.h"
+#include "Profiler.h"
+#include <algorithm>
+#include <atomic>
+#include <stdexcept>
+
+
+namespace thinr
+{
+    TransformHierarchy::TransformHierarchy()
+        : m_updateStamp(0), m_dirtyCount(0), m_minDirtyDepth(UINT32_MAX), m_maxDirtyDepth(0), m_stats()
+    {
+    }
+
+    void TransformHierarchy::Reserve(size_t count)
+    {
+        m_parents.reserve(count);
+        m_depths.reserve(count);
+        m_local.reserve(count);
+        m_world.reserve(count);
+        m_dirty.reserve(count);
+        m_updateStamps.reserve(count);
+    }
+
+    void TransformHierarchy::Clear()
+    {
+        m_parents.clear();
+        m_depths.clear();
+        m_local.clear();
+        m_world.clear();
+        m_dirty.clear();
+        m_updateStamps.clear();
+        m_levels.clear();
+        m_dirtyCount = 0;
+        m_minDirtyDepth = UINT32_MAX;
+        m_maxDirtyDepth = 0;
+    }
+
+    uint32_t TransformHierarchy::AddNode(uint32_t parent, const Float4x4 &local)
+    {
+        if (parent != NoParent && parent >= m_parents.size())
+        {
+            throw std::invalid_argument("TransformHierarchy: parent must be added before its children");
+        }
+        if (m_parents.size() >= NoParent)
+        {
+            throw std::length_error("TransformHierarchy: too many nodes");
+        }
+        uint32_t node = static_cast<uint32_t>(m_parents.size());
+        uint32_t depth = parent == NoParent ? 0 : m_depths[parent] + 1;
+        m_parents.push_back(parent);
+        m_depths.push_back(depth);
+        m_local.push_back(local);
+        m_world.push_back(local);
+        m_dirty.push_back(0);
+        m_updateStamps.push_back(0);
+        if (m_levels.size() <= depth)
+        {
+            m_levels.resize(depth + 1);
+        }
+        m_levels[depth].push_back(node);
+        SetLocal(node, local);
+        return node;
+    }
+
+    void TransformHierarchy::SetLocal(uint32_t node, const Float4x4 &local)
+    {
+        m_local[node] = local;
+        if (!m_dirty[node])
+        {
+            m_dirty[node] = 1;
+            m_dirtyCount++;
+            m_minDirtyDepth = std::min(m_minDirtyDepth, m_depths[node]);
+            m_maxDirtyDepth = std::max(m_maxDirtyDepth, m_depths[node]);
+        }
+    }
+
+    void TransformHierarchy::Update(ThreadPool &pool)
+    {
+        m_stats = TransformHierarchyStats();
+        if (m_dirtyCount == 0)
+        {
+            return;
+        }
+        THINR_PROFILE_ZONE("TransformHierarchy::Update");
+
+        if (++m_updateStamp == 0)
+        {
+            std::fill(m_updateStamps.begin(), m_updateStamps.end(), 0);
+            m_updateStamp = 1;
+        }
+        uint32_t stamp = m_updateStamp;
+
+        // m_minDirtyDepth より浅いノードは変わっていないので調べません。最も深い変更より下は、
+        // 1 つ上の深さで何も変わらなかった時点で打ち切ります。
+        for (size_t depth = m_minDirtyDepth; depth < m_levels.size(); ++depth)
+        {
+            const std::vector<uint32_t> &level = m_levels[depth];
+            std::atomic<size_t> updated(0);
+            pool.ParallelFor(level.size(), NodeGrain, [&](size_t begin, size_t end)
+            {
+                size_t count = 0;
+                for (size_t i = begin; i < end; ++i)
+                {
+                    uint32_t node = level[i];
+                    uint32_t parent = m_parents[node];
+                    bool parentUpdated = parent != NoParent && m_updateStamps[parent] == stamp;
+                    if (!m_dirty[node] && !parentUpdated)
+                    {
+                        continue;
+                    }
+                    m_world[node] = parent == NoParent ? m_local[node] : Multiply(m_world[parent], m_local[node]);
+                    m_updateStamps[node] = stamp;
+                    m_dirty[node] = 0;
+                    count++;
+                }
+                updated += count;
+            });
+
+            m_stats.levels++;
+            m_stats.visitedNodes += level.size();
+            m_stats.updatedNodes += updated.load();
+            if (updated.load() == 0 && depth >= m_maxDirtyDepth)
+            {
+                break;
+            }
+        }
+
+        m_dirtyCount = 0;
+        m_minDirtyDepth = UINT32_MAX;
+        m_maxDirtyDepth = 0;
+    }
+}
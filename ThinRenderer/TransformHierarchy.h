@@ -0,0 +1,80 @@
+﻿#pragma once
+#include "MathTypes.h"
+#include "ThreadPool.h"
+#include <vector>
+#include <cstddef>
+#include <cstdint>
+
+
+namespace thinr
+{
+    struct TransformHierarchyStats
+    {
+        // 直近の Update でワールド行列を計算し直したノード数。
+        size_t updatedNodes;
+        // 直近の Update で変更を調べたノード数。
+        size_t visitedNodes;
+        // 直近の Update で処理した深さの数。
+        size_t levels;
+    };
+
+    // 多数のノードの変換の階層。ノードはポインターでつながず、親の番号を平らな配列で持ちます。
+    // 親は必ず子より前に追加するので、配列の順がそのままトポロジカル順です。
+    // 親の番号、ローカル行列、ワールド行列などは項目ごとに連続した配列 (SoA) で持ち、
+    // Update では同じ深さのノードを ThreadPool で並列に計算します。幅優先の順に追加すると同じ深さのノードが
+    // 配列の上で連続するので、最も速くなります (GltfModel::nodes はこの順です)。
+    // 行列は Float4x4 の規約どおり転置済みで、ワールド行列は Multiply(親のワールド, ローカル) です。
+    class TransformHierarchy
+    {
+    public:
+        static const uint32_t NoParent = UINT32_MAX;
+
+        TransformHierarchy();
+
+        void Reserve(size_t count);
+        void Clear();
+
+        // ノードを追加して番号を返します。番号は追加した順です。parent は追加済みのノードか NoParent です。
+        // 不正な parent の場合は std::invalid_argument を送出します。ワールド行列は次の Update で計算します。
+        uint32_t AddNode(uint32_t parent, const Float4x4 &local = Float4x4::Identity());
+
+        // ローカル行列を変更します。このノードと子孫のワールド行列は次の Update で計算し直します。
+        void SetLocal(uint32_t node, const Float4x4 &local);
+
+        size_t GetNodeCount() const { return m_parents.size(); }
+        uint32_t GetParent(uint32_t node) const { return m_parents[node]; }
+        // ルートは 0 です。
+        uint32_t GetDepth(uint32_t node) const { return m_depths[node]; }
+        const Float4x4 &GetLocal(uint32_t node) const { return m_local[node]; }
+        // 最後の Update の時点の値です。
+        const Float4x4 &GetWorld(uint32_t node) const { return m_world[node]; }
+        const Float4x4 *GetWorldMatrices() const { return m_world.data(); }
+
+        // 変更されたノードとその子孫だけ、浅い方から深さごとにワールド行列を計算します。
+        // 同じ深さのノードは互いに依存しないので並列に計算できます。変更が無ければすぐに戻ります。
+        void Update(ThreadPool &pool = ThreadPool::GetDefault());
+
+        const TransformHierarchyStats &GetStats() const { return m_stats; }
+
+    private:
+        // 1 つのジョブで処理するノード数。
+        static const size_t NodeGrain = 4096;
+
+        std::vector<uint32_t> m_parents;
+        std::vector<uint32_t> m_depths;
+        std::vector<Float4x4> m_local;
+        std::vector<Float4x4> m_world;
+        // SetLocal か AddNode の後、まだワールド行列を計算していないノード。
+        std::vector<uint8_t> m_dirty;
+        // ワールド行列を最後に計算した Update の番号。親の値が今回の番号なら子も計算し直します。
+        std::vector<uint32_t> m_updateStamps;
+        // 深さごとのノードの番号 (昇順)。
+        std::vector<std::vector<uint32_t>> m_levels;
+
+        uint32_t m_updateStamp;
+        size_t m_dirtyCount;
+        uint32_t m_minDirtyDepth;
+        uint32_t m_maxDirtyDepth;
+        TransformHierarchyStats m_stats;
+    };
+}
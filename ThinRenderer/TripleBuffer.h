@@ -0,0 +1,65 @@
+﻿#pragma once
+#include <atomic>
+#include <cstdint>
+
+
+namespace thinr
+{
+    // 1 つの書き込みスレッドから 1 つの読み込みスレッドへ、最新の値をロック無しで渡すトリプル バッファー。
+    // 書き込み側と読み込み側がそれぞれ 1 つずつバッファーを持ち、残りの 1 つと atomic に交換するだけなので、
+    // どちらも相手を待ちません。読み込み側は公開された最新の値だけを受け取り、読まれなかった値は上書きされます。
+    template<typename T>
+    class TripleBuffer
+    {
+    public:
+        TripleBuffer() : m_buffers(), m_write(0), m_middle(1), m_read(2) {}
+        TripleBuffer(const TripleBuffer &) = delete;
+        TripleBuffer &operator=(const TripleBuffer &) = delete;
+
+        // 書き込み側: 次に公開する値を書き込むバッファー。Publish までは読み込み側から見えません。
+        // 前に公開した値が残っているとは限らないので、毎回すべて書き直してください。
+        T &GetWriteBuffer() { return m_buffers[m_write]; }
+
+        // 書き込み側: GetWriteBuffer の内容を公開します。
+        void Publish()
+        {
+            m_write = m_middle.exchange(m_write | FreshBit, std::memory_order_acq_rel) & IndexMask;
+        }
+
+        // 読み込み側: 前回から新しい値が公開されていれば受け取って true を返します。
+        bool Consume()
+        {
+            if (!(m_middle.load(std::memory_order_relaxed) & FreshBit))
+            {
+                return false;
+            }
+            m_read = m_middle.exchange(m_read, std::memory_order_acq_rel) & IndexMask;
+            return true;
+        }
+
+        // 読み込み側: 最後に Consume で受け取った値。一度も受け取っていなければ T() です。
+        const T &GetReadBuffer() const { return m_buffers[m_read]; }
+
+        // すべてのバッファーを T() に戻し、公開済みの値も捨てます。書き込み側と読み込み側のどちらも使っていないときに呼んでください。
+        void Reset()
+        {
+            for (T &buffer : m_buffers)
+            {
+                buffer = T();
+            }
+            m_write = 0;
+            m_middle.store(1, std::memory_order_relaxed);
+            m_read = 2;
+        }
+
+    private:
+        static const uint32_t IndexMask = 3;
+        // 中間のバッファーが公開されてからまだ読まれていないことを示します。
+        static const uint32_t FreshBit = 4;
+
+        T m_buffers[3];
+        uint32_t m_write;
+        std::atomic<uint32_t> m_middle;
+        uint32_t m_read;
+    };
+}
@@ -0,0 +1,25 @@
+﻿#pragma once
+#include "MathTypes.h"
+
+
+namespace thinr
+{
+    // ThinRendererUWP::ModelViewProjectionConstantBuffer と同じレイアウト。
+    // 各行列は XMMatrixTranspose したものを格納します。
+    struct ModelViewProjectionConstantBuffer
+    {
+        Float4x4 model;
+        Float4x4 view;
+        Float4x4 projection;
+    };
+
+    // ThinRendererUWP::VertexPositionColor と同じレイアウト。
+    struct VertexPositionColor
+    {
+        Float3 pos;
+        Float3 color;
+    };
+
+    static_assert(sizeof(ModelViewProjectionConstantBuffer) == 4 * 4 * 4 * 3, "layout");
+    static_assert(sizeof(VertexPositionColor) == 4 * 6, "layout");
+}
@@ -1,12 +1,17 @@
-﻿#pragma once
-
-#include "targetver.h"
-
-#ifndef WIN32_LEAN_AND_MEAN
-#define WIN32_LEAN_AND_MEAN
-#endif
-
-#include <windows.h>
+﻿#pragma once
+
+#ifdef _WIN32
+#include "targetver.h"
+
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+// std::min / std::max と衝突しないようにします。
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+
+#include <windows.h>
 //#include <wrl.h>
 #include <wrl/client.h>
 #include <dxgi1_4.h>
@@ -17,6 +22,11 @@
 #include <wincodec.h>
 #include <DirectXColors.h>
 #include <DirectXMath.h>
+#endif
+
+// ここから下は Windows 以外 (ソフトウェア ラスタライザー) でも使用します。
 #include <memory>
+#include <vector>
+#include <cstdint>
 //#include <agile.h>
 //#include <concrt.h>
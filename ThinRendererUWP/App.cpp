@@ -2,6 +2,7 @@
 #include "App.h"
 
 #include <ppltasks.h>
+#include <fstream>
 
 using namespace ThinRendererUWP;
 
@@ -66,6 +67,9 @@ void App::SetWindow(CoreWindow^ window)
 	window->Closed += 
 		ref new TypedEventHandler<CoreWindow^, CoreWindowEventArgs^>(this, &App::OnWindowClosed);
 
+	window->KeyDown +=
+		ref new TypedEventHandler<CoreWindow^, KeyEventArgs^>(this, &App::OnKeyDown);
+
 	DisplayInformation^ currentDisplayInformation = DisplayInformation::GetForCurrentView();
 
 	currentDisplayInformation->DpiChanged +=
@@ -172,6 +176,20 @@ void App::OnWindowClosed(CoreWindow^ sender, CoreWindowEventArgs^ args)
 	m_windowClosed = true;
 }
 
+void App::OnKeyDown(CoreWindow^ sender, KeyEventArgs^ args)
+{
+	// F9 でプロファイラーのトレースをローカル フォルダーに書き出します (chrome://tracing で開けます)。
+	// ゾーンは THINR_ENABLE_PROFILER を定義した構成 (既定では Debug) でだけ記録されます。
+#ifdef THINR_ENABLE_PROFILER
+	if (args->VirtualKey == VirtualKey::F9)
+	{
+		std::wstring path(Windows::Storage::ApplicationData::Current->LocalFolder->Path->Data());
+		std::ofstream file(path + L"\\trace.json", std::ios::binary);
+		thinr::Profiler::Get().WriteChromeTrace(file);
+	}
+#endif
+}
+
 // DisplayInformation イベント ハンドラー。
 
 void App::OnDpiChanged(DisplayInformation^ sender, Object^ args)
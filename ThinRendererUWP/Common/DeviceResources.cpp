@@ -419,6 +419,8 @@ void DX::DeviceResources::Trim()
 // スワップ チェーンの内容を画面に表示します。
 void DX::DeviceResources::Present() 
 {
+	THINR_PROFILE_ZONE("DeviceResources::Present");
+
 	// 最初の引数は、DXGI に VSync までブロックするよう指示し、アプリケーションを次の VSync まで
 	// スリープさせます。これにより、画面に表示されることのないフレームをレンダリングして
 	// サイクルを無駄にすることがなくなります。
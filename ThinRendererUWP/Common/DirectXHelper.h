@@ -33,6 +33,19 @@ namespace DX
 		});
 	}
 
+	// ワイド文字列を UTF-8 に変換します (thinr のファイル パスなど)。
+	inline std::string ToUtf8(const std::wstring& text)
+	{
+		if (text.empty())
+		{
+			return std::string();
+		}
+		int length = WideCharToMultiByte(CP_UTF8, 0, text.data(), static_cast<int>(text.size()), nullptr, 0, nullptr, nullptr);
+		std::string result(length, '\0');
+		WideCharToMultiByte(CP_UTF8, 0, text.data(), static_cast<int>(text.size()), &result[0], length, nullptr, nullptr);
+		return result;
+	}
+
 	// デバイスに依存しないピクセル単位 (DIP) の長さを物理的なピクセルの長さに変換します。
 	inline float ConvertDipsToPixels(float dips, float dpi)
 	{
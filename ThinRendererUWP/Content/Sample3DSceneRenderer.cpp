@@ -1,6 +1,12 @@
 ﻿#include "pch.h"
 #include "Sample3DSceneRenderer.h"
 #include "..\Common\DirectXHelper.h"
+#include "../../ThinRenderer/D3DShaderCompiler.h"
+#include "../../ThinRenderer/FileSystem.h"
+#include "../../ThinRenderer/MeshFile.h"
+#include "../../ThinRenderer/GltfImporter.h"
+#include "../../ThinRenderer/MeshOptimizer.h"
+#include <cmath>
 
 
 using namespace ThinRendererUWP;
@@ -13,9 +19,32 @@ Sample3DSceneRenderer::Sample3DSceneRenderer(const std::shared_ptr<thinr::Device
 	m_loadingComplete(false),
 	m_degreesPerSecond(45),
 	m_indexCount(0),
+	m_indexFormat(DXGI_FORMAT_R16_UINT),
+	m_instanceCapacity(0),
+	m_instancesDirty(true),
+	m_instanceColors(false),
+	m_vertexColorFeature(0),
+	m_instanceColorFeature(0),
+	m_vertexShaderReloadId(0),
+	m_loadGeneration(0),
+	m_pendingAssets(0),
+	m_pixelShaderReloadId(0),
+	m_sceneInstancesDirty(true),
 	m_tracking(false),
+	m_trackingRadians(NAN),
 	m_deviceResources(deviceResources)
 {
+	m_modelNode = m_transforms.AddNode(thinr::TransformHierarchy::NoParent);
+
+	thinr::Float4x4 identity = thinr::Float4x4::Identity();
+	SetInstances(&identity, nullptr, 1);
+
+	auto localFolder = Windows::Storage::ApplicationData::Current->LocalFolder->Path;
+	m_shaderCache = std::make_shared<thinr::ShaderCache>(
+		std::make_shared<thinr::D3DShaderCompiler>(),
+		DX::ToUtf8(localFolder->Data()) + "\\ShaderCache"
+		);
+
 	CreateDeviceDependentResources();
 	CreateWindowSizeDependentResources();
 }
@@ -68,6 +97,17 @@ void Sample3DSceneRenderer::CreateWindowSizeDependentResources()
 // フレームごとに 1 回呼び出し、キューブを回転させてから、モデルおよびビューのマトリックスを計算します。
 void Sample3DSceneRenderer::Update(DX::StepTimer const& timer)
 {
+	SceneSnapshot snapshot;
+	Simulate(timer, snapshot);
+	ApplySnapshot(snapshot);
+}
+
+void Sample3DSceneRenderer::Simulate(DX::StepTimer const& timer, SceneSnapshot &snapshot)
+{
+	THINR_PROFILE_FUNCTION();
+
+	snapshot.previousModel = m_transforms.GetWorld(m_modelNode);
+
 	if (!m_tracking)
 	{
 		// 度をラジアンに変換し、秒を回転角度に変換します
@@ -77,27 +117,203 @@ void Sample3DSceneRenderer::Update(DX::StepTimer const& timer)
 
 		Rotate(radians);
 	}
+	else
+	{
+		// 追跡を始めてからまだポインターが動いていなければ (NaN)、今の角度のままにします。
+		float radians = m_trackingRadians;
+		if (!std::isnan(radians))
+		{
+			Rotate(radians);
+		}
+	}
+
+	snapshot.model = m_transforms.GetWorld(m_modelNode);
+}
+
+void Sample3DSceneRenderer::ApplySnapshot(const SceneSnapshot &snapshot, float alpha)
+{
+	// 2 つの状態の間を補間したワールド行列をシェーダーに渡す準備をします
+	static_assert(sizeof(thinr::Float4x4) == sizeof(XMFLOAT4X4), "layout");
+	if (alpha >= 1.0f)
+	{
+		memcpy(&m_constantBufferData.model, &snapshot.model, sizeof(XMFLOAT4X4));
+	}
+	else
+	{
+		XMStoreFloat4x4(
+			&m_constantBufferData.model,
+			InterpolateTransform(
+				reinterpret_cast<const XMFLOAT4X4 &>(snapshot.previousModel),
+				reinterpret_cast<const XMFLOAT4X4 &>(snapshot.model),
+				alpha
+				)
+			);
+	}
+
+	UpdateSceneBvh();
+}
+
+// 転置済みの 2 つのアフィン変換を、拡大・回転・平行移動に分けて補間します (回転は球面線形補間)。
+// 行列の要素をそのまま線形補間すると、回転の途中で縮んで見えます。
+XMMATRIX Sample3DSceneRenderer::InterpolateTransform(const XMFLOAT4X4 &from, const XMFLOAT4X4 &to, float alpha)
+{
+	XMVECTOR fromScale, fromRotation, fromTranslation;
+	XMVECTOR toScale, toRotation, toTranslation;
+	if (!XMMatrixDecompose(&fromScale, &fromRotation, &fromTranslation, XMMatrixTranspose(XMLoadFloat4x4(&from))) ||
+		!XMMatrixDecompose(&toScale, &toRotation, &toTranslation, XMMatrixTranspose(XMLoadFloat4x4(&to))))
+	{
+		// 分解できない (拡大率が 0 など) 場合は補間せずに新しい方を使います。
+		return XMLoadFloat4x4(&to);
+	}
+
+	XMMATRIX interpolated = XMMatrixAffineTransformation(
+		XMVectorLerp(fromScale, toScale, alpha),
+		XMVectorZero(),
+		XMQuaternionSlerp(fromRotation, toRotation, alpha),
+		XMVectorLerp(fromTranslation, toTranslation, alpha)
+		);
+	return XMMatrixTranspose(interpolated);
 }
 
 //3D キューブ モデルを、ラジアン単位で設定された大きさだけ回転させます。
 void Sample3DSceneRenderer::Rotate(float radians)
 {
-	//更新されたモデル マトリックスをシェーダーに渡す準備をします
-	XMStoreFloat4x4(&m_constantBufferData.model, XMMatrixTranspose(XMMatrixRotationY(radians)));
+	// モデルは変換の階層のノードです。ワールド行列は Update で計算し直します
+	XMFLOAT4X4 rotation;
+	XMStoreFloat4x4(&rotation, XMMatrixTranspose(XMMatrixRotationY(radians)));
+	m_transforms.SetLocal(m_modelNode, *reinterpret_cast<const thinr::Float4x4 *>(&rotation));
+	m_transforms.Update();
+}
+
+void Sample3DSceneRenderer::SetInstances(const thinr::Float4x4 *transforms, const thinr::Float3 *colors, size_t count)
+{
+	m_instanceData.resize(count);
+	for (size_t i = 0; i < count; ++i)
+	{
+		static_assert(sizeof(thinr::Float4x4) == sizeof(XMFLOAT4X4), "layout");
+		memcpy(&m_instanceData[i].transform, &transforms[i], sizeof(XMFLOAT4X4));
+		m_instanceData[i].color = colors ? XMFLOAT3(colors[i].x, colors[i].y, colors[i].z) : XMFLOAT3(1.0f, 1.0f, 1.0f);
+	}
+
+	// キューブ (±0.5) は原点中心で回転するだけなので、モデル変換によらず半径 √3/2 の球に収まります。
+	// インスタンス変換の平行移動を中心とし、軸ごとの拡大率の最大値で半径を広げます。
+	m_instanceBounds.Clear();
+	for (size_t i = 0; i < count; ++i)
+	{
+		const float (*m)[4] = transforms[i].m;
+		float maxScaleSq = 0.0f;
+		for (int axis = 0; axis < 3; ++axis)
+		{
+			float scaleSq = m[0][axis] * m[0][axis] + m[1][axis] * m[1][axis] + m[2][axis] * m[2][axis];
+			maxScaleSq = scaleSq > maxScaleSq ? scaleSq : maxScaleSq;
+		}
+		m_instanceBounds.Add(thinr::Float3{ m[0][3], m[1][3], m[2][3] }, 0.8660254f * sqrtf(maxScaleSq));
+	}
+	m_visibleInstances.clear();
+	m_instancesDirty = true;
+	m_instanceColors = colors != nullptr;
+	m_sceneInstancesDirty = true;
+}
+
+// インスタンスの変換とモデルの回転を、レイキャスト用の BVH に反映します。
+void Sample3DSceneRenderer::UpdateSceneBvh()
+{
+	if (!m_loadingComplete || !m_cubeBvh)
+	{
+		return;
+	}
+
+	// インスタンス i のワールド変換は instance * model です (シェーダーと同じ順)。
+	thinr::Float4x4 model;
+	memcpy(&model, &m_constantBufferData.model, sizeof(model));
+	if (m_sceneInstancesDirty)
+	{
+		m_sceneBvh.Clear();
+	}
+	for (size_t i = 0; i < m_instanceData.size(); ++i)
+	{
+		thinr::Float4x4 instance;
+		memcpy(&instance, &m_instanceData[i].transform, sizeof(instance));
+		thinr::Float4x4 world = thinr::Multiply(instance, model);
+		if (m_sceneInstancesDirty)
+		{
+			m_sceneBvh.AddInstance(m_cubeBvh, world);
+		}
+		else
+		{
+			m_sceneBvh.SetTransform(static_cast<uint32_t>(i), world);
+		}
+	}
+
+	if (m_sceneInstancesDirty)
+	{
+		m_sceneBvh.Build();
+		m_sceneInstancesDirty = false;
+	}
+	else
+	{
+		m_sceneBvh.Refit();
+	}
+}
+
+// インスタンス データか見えるインスタンスが変わったときだけ書き込みます。容量が足りなければ作り直します。
+void Sample3DSceneRenderer::UpdateInstanceBuffer()
+{
+	if (!m_instancesDirty || m_visibleInstances.empty())
+	{
+		return;
+	}
+
+	auto device = m_deviceResources->GetD3DDevice();
+	auto context = m_deviceResources->GetD3DDeviceContext();
+	size_t visibleCount = m_visibleInstances.size();
+	if (!m_instanceBuffer || m_instanceCapacity < visibleCount)
+	{
+		// 毎回作り直さないよう倍々で確保します。
+		m_instanceCapacity = m_instanceCapacity * 2 > visibleCount ? m_instanceCapacity * 2 : visibleCount;
+		CD3D11_BUFFER_DESC instanceBufferDesc(
+			static_cast<UINT>(m_instanceCapacity * sizeof(InstanceTransformColor)),
+			D3D11_BIND_VERTEX_BUFFER,
+			D3D11_USAGE_DYNAMIC,
+			D3D11_CPU_ACCESS_WRITE
+			);
+		m_instanceBuffer.Reset();
+		DX::ThrowIfFailed(
+			device->CreateBuffer(
+				&instanceBufferDesc,
+				nullptr,
+				&m_instanceBuffer
+				)
+			);
+	}
+
+	D3D11_MAPPED_SUBRESOURCE mapped;
+	DX::ThrowIfFailed(
+		context->Map(m_instanceBuffer.Get(), 0, D3D11_MAP_WRITE_DISCARD, 0, &mapped)
+		);
+	// 見えるインスタンスだけを詰めて書き込みます。
+	auto destination = static_cast<InstanceTransformColor *>(mapped.pData);
+	for (size_t i = 0; i < visibleCount; ++i)
+	{
+		destination[i] = m_instanceData[m_visibleInstances[i]];
+	}
+	context->Unmap(m_instanceBuffer.Get(), 0);
+	m_instancesDirty = false;
 }
 
 void Sample3DSceneRenderer::StartTracking()
 {
+	m_trackingRadians = NAN;
 	m_tracking = true;
 }
 
 // 追跡時に、出力画面の幅方向を基準としてポインターの位置を追跡することにより、3D キューブを Y 軸に沿って回転させることができます。
+// 更新スレッドで動かす場合もあるので、ここでは角度を記録するだけで、回転は次の Simulate で行います。
 void Sample3DSceneRenderer::TrackingUpdate(float positionX)
 {
 	if (m_tracking)
 	{
-		float radians = XM_2PI * 2.0f * positionX / m_deviceResources->GetScreenViewport().Width;
-		Rotate(radians);
+		m_trackingRadians = XM_2PI * 2.0f * positionX / m_deviceResources->GetScreenViewport().Width;
 	}
 }
 
@@ -109,216 +325,578 @@ void Sample3DSceneRenderer::StopTracking()
 // 頂点とピクセル シェーダーを使用して、1 つのフレームを描画します。
 void Sample3DSceneRenderer::Render()
 {
-	// 読み込みは非同期です。読み込みが完了した後にのみ描画してください。
+	// 読み込みは非同期です。完了はここで受け取り、読み込みが完了した後にのみ描画してください。
+	m_assetLoader.Poll();
 	if (!m_loadingComplete)
 	{
 		return;
 	}
 
-	auto context = m_deviceResources->GetD3DDeviceContext();
+	THINR_PROFILE_FUNCTION();
 
-	// 定数バッファーを準備して、グラフィックス デバイスに送信します。
-	context->UpdateSubresource1(
-		m_constantBuffer.Get(),
-		0,
-		NULL,
-		&m_constantBufferData,
-		0,
-		0,
-		0
-		);
+	ApplyShaderReloads();
 
-	// 各頂点は、VertexPositionColor 構造体の 1 つのインスタンスです。
-	UINT stride = sizeof(VertexPositionColor);
-	UINT offset = 0;
-	context->IASetVertexBuffers(
-		0,
-		1,
-		m_vertexBuffer.GetAddressOf(),
-		&stride,
-		&offset
-		);
+	// 定数バッファーの行列は転置済みなので、そのまま thinr の行列として扱えます。
+	thinr::Float4x4 view;
+	thinr::Float4x4 projection;
+	static_assert(sizeof(thinr::Float4x4) == sizeof(XMFLOAT4X4), "layout");
+	memcpy(&view, &m_constantBufferData.view, sizeof(view));
+	memcpy(&projection, &m_constantBufferData.projection, sizeof(projection));
+	auto frustum = thinr::Frustum::FromViewProjection(thinr::Multiply(projection, view));
 
-	context->IASetIndexBuffer(
-		m_indexBuffer.Get(),
-		DXGI_FORMAT_R16_UINT, //各インデックスは、1 つの 16 ビット符号なし整数 (short) です。
-		0
-		);
+	m_culler.Cull(frustum, m_instanceBounds, m_culledInstances);
+	if (m_culledInstances != m_visibleInstances)
+	{
+		m_visibleInstances.swap(m_culledInstances);
+		m_instancesDirty = true;
+	}
+	if (m_visibleInstances.empty())
+	{
+		return;
+	}
 
-	context->IASetPrimitiveTopology(D3D11_PRIMITIVE_TOPOLOGY_TRIANGLELIST);
+	UpdateInstanceBuffer();
+
+	// このサンプルのオブジェクトはキューブ 1 つだけですが、オブジェクトが増えても
+	// 同じシェーダー、マテリアル、メッシュが続く間は再バインドされません。
+	// 初めて使う機能の組み合わせはここで作成します (ShaderCache にあればコンパイルはしません)。
+	uint32_t shader = RequestShaderProgram(GetShaderKey());
+
+	m_renderQueue.Clear();
+	m_renderQueue.Push(thinr::RenderQueue::MakeSortKey(0, shader, 0, 0, 0.0f), 0);
+	m_renderQueue.Sort();
+	m_renderQueue.Submit(*this);
+}
+
+// レンダー ターゲットは ThinRendererUWPMain::Render で設定済みです。
+void Sample3DSceneRenderer::BindPass(uint32_t pass)
+{
+}
+
+void Sample3DSceneRenderer::BindShader(uint32_t shader)
+{
+	auto context = m_deviceResources->GetD3DDeviceContext();
+	const ShaderProgram &program = m_shaderPrograms[shader];
 
-	context->IASetInputLayout(m_inputLayout.Get());
+	context->IASetInputLayout(program.inputLayout.Get());
 
 	// 頂点シェーダーをアタッチします。
 	context->VSSetShader(
-		m_vertexShader.Get(),
+		program.vertexShader.Get(),
+		nullptr,
+		0
+		);
+
+	// ピクセル シェーダーをアタッチします。
+	context->PSSetShader(
+		program.pixelShader.Get(),
 		nullptr,
 		0
 		);
+}
+
+void Sample3DSceneRenderer::BindMaterial(uint32_t material)
+{
+	// 共有リングを使う場合は描画ごとにオフセットが変わるので、Draw でバインドします。
+	if (m_deviceResources->GetConstantBufferRing())
+	{
+		return;
+	}
 
 	// 定数バッファーをグラフィックス デバイスに送信します。
-	context->VSSetConstantBuffers1(
+	m_deviceResources->GetD3DDeviceContext()->VSSetConstantBuffers1(
 		0,
 		1,
 		m_constantBuffer.GetAddressOf(),
 		nullptr,
 		nullptr
 		);
+}
 
-	// ピクセル シェーダーをアタッチします。
-	context->PSSetShader(
-		m_pixelShader.Get(),
-		nullptr,
+void Sample3DSceneRenderer::BindMesh(uint32_t mesh)
+{
+	auto context = m_deviceResources->GetD3DDeviceContext();
+
+	// 各頂点は、VertexPositionColor 構造体の 1 つのインスタンスです。
+	// スロット 1 にはインスタンスごとの InstanceTransformColor を設定します。
+	ID3D11Buffer *const buffers[2] = { m_vertexBuffer.Get(), m_instanceBuffer.Get() };
+	UINT strides[2] = { sizeof(VertexPositionColor), sizeof(InstanceTransformColor) };
+	UINT offsets[2] = { 0, 0 };
+	context->IASetVertexBuffers(
+		0,
+		2,
+		buffers,
+		strides,
+		offsets
+		);
+
+	context->IASetIndexBuffer(
+		m_indexBuffer.Get(),
+		m_indexFormat, // メッシュ ファイルのインデックスの幅 (16 ビットか 32 ビット) です。
 		0
 		);
 
-	// オブジェクトを描画します。
-	context->DrawIndexed(
+	context->IASetPrimitiveTopology(D3D11_PRIMITIVE_TOPOLOGY_TRIANGLELIST);
+}
+
+void Sample3DSceneRenderer::Draw(uint32_t payload)
+{
+	auto context = m_deviceResources->GetD3DDeviceContext();
+
+	if (auto ring = m_deviceResources->GetConstantBufferRing())
+	{
+		// リングの空き領域に書き込み、その範囲だけをバインドします。
+		thinr::ConstantBufferAllocation constants = ring->Upload(context, &m_constantBufferData, sizeof(m_constantBufferData));
+		context->VSSetConstantBuffers1(
+			0,
+			1,
+			&constants.buffer,
+			&constants.firstConstant,
+			&constants.numConstants
+			);
+	}
+	else
+	{
+		// 定数バッファーを準備して、グラフィックス デバイスに送信します。
+		context->UpdateSubresource1(
+			m_constantBuffer.Get(),
+			0,
+			NULL,
+			&m_constantBufferData,
+			0,
+			0,
+			0
+			);
+	}
+
+	// 見えるインスタンスをすべて 1 回で描画します。
+	context->DrawIndexedInstanced(
 		m_indexCount,
+		static_cast<UINT>(m_visibleInstances.size()),
+		0,
 		0,
 		0
 		);
 }
 
-void Sample3DSceneRenderer::CreateDeviceDependentResources()
+// path のシェーダーのソースを読み込み、宣言された機能の組み合わせを ShaderCache でコンパイルできるようにします。
+// 既定の組み合わせはワーカーでコンパイルしておきます。ソースがパッケージに含まれていない場合、permutations は nullptr のままです。
+void Sample3DSceneRenderer::LoadShaderSource(const std::string &path, const std::string &target, std::shared_ptr<thinr::ShaderPermutationSet> &permutations)
 {
-	// シェーダーを非同期で読み込みます。
-	auto loadVSTask = DX::ReadDataAsync(L"SampleVertexShader.cso");
-	auto loadPSTask = DX::ReadDataAsync(L"SamplePixelShader.cso");
+	auto cache = m_shaderCache;
+	std::string name = thinr::GetFileName(path);
+	bool instanceColors = m_instanceColors;
+	uint32_t generation = m_loadGeneration;
+
+	thinr::AssetRequest request;
+	request.path = path;
+	request.decode = [cache, name, target](std::vector<uint8_t> &data) -> std::shared_ptr<void>
+	{
+		thinr::ShaderCompileRequest compileRequest;
+		compileRequest.source.assign(data.begin(), data.end());
+		compileRequest.sourceName = name;
+		compileRequest.entryPoint = "main";
+		compileRequest.target = target;
+		return std::make_shared<thinr::ShaderPermutationSet>(cache, compileRequest);
+	};
+	request.create = [instanceColors](const std::shared_ptr<void> &decoded) -> std::shared_ptr<void>
+	{
+		// GetShaderKey と同じ選び方です。ピクセル シェーダーに無い機能のビットは 0 になります。
+		auto set = std::static_pointer_cast<thinr::ShaderPermutationSet>(decoded);
+		thinr::ShaderPermutationKey key = set->FindFeatureMask("VERTEX_COLOR")
+			| (instanceColors ? set->FindFeatureMask("INSTANCE_COLOR") : 0);
+		try
+		{
+			set->Build(key);
+		}
+		catch (const thinr::ShaderCompileError &error)
+		{
+			// セットは残して、ホット リロードで直せるようにします。描画では .cso を使います。
+			OutputDebugStringA(error.what());
+		}
+		return set;
+	};
+	request.completed = [this, generation, &permutations](const thinr::Asset &asset)
+	{
+		if (generation != m_loadGeneration)
+		{
+			return;
+		}
+		permutations = asset.Get<thinr::ShaderPermutationSet>();
+		if (!permutations)
+		{
+			OutputDebugStringA((asset.GetError() + "\n").c_str());
+		}
+		OnAssetLoaded();
+	};
+	m_assetLoader.Load(std::move(request));
+}
 
-	// 頂点シェーダー ファイルを読み込んだ後、シェーダーと入力レイアウトを作成します。
-	auto createVSTask = loadVSTask.then([this](const std::vector<byte>& fileData) {
-		DX::ThrowIfFailed(
-			m_deviceResources->GetD3DDevice()->CreateVertexShader(
-				&fileData[0],
-				fileData.size(),
-				nullptr,
-				&m_vertexShader
-				)
-			);
+// ビルド時にコンパイルした .cso を読み込みます。
+void Sample3DSceneRenderer::LoadShaderBytecode(const std::string &path, std::vector<byte> &bytecode)
+{
+	uint32_t generation = m_loadGeneration;
 
-		static const D3D11_INPUT_ELEMENT_DESC vertexDesc [] =
+	thinr::AssetRequest request;
+	request.path = path;
+	request.completed = [this, generation, &bytecode](const thinr::Asset &asset)
+	{
+		if (generation != m_loadGeneration)
 		{
-			{ "POSITION", 0, DXGI_FORMAT_R32G32B32_FLOAT, 0, 0, D3D11_INPUT_PER_VERTEX_DATA, 0 },
-			{ "COLOR", 0, DXGI_FORMAT_R32G32B32_FLOAT, 0, 12, D3D11_INPUT_PER_VERTEX_DATA, 0 },
-		};
+			return;
+		}
+		auto data = asset.Get<std::vector<uint8_t>>();
+		if (data)
+		{
+			bytecode.swap(*data);
+		}
+		else
+		{
+			OutputDebugStringA((asset.GetError() + "\n").c_str());
+		}
+		OnAssetLoaded();
+	};
+	m_assetLoader.Load(std::move(request));
+}
 
-		DX::ThrowIfFailed(
-			m_deviceResources->GetD3DDevice()->CreateInputLayout(
-				vertexDesc,
-				ARRAYSIZE(vertexDesc),
-				&fileData[0],
-				fileData.size(),
-				&m_inputLayout
-				)
-			);
-	});
+// シェーダーとメッシュのファイルがすべて揃ったら、既定の組み合わせのシェーダーを作成します。
+// 他の組み合わせは描画で初めて使うときに作成します。
+void Sample3DSceneRenderer::OnAssetLoaded()
+{
+	if (--m_pendingAssets > 0)
+	{
+		return;
+	}
 
-	// ピクセル シェーダー ファイルを読み込んだ後、シェーダーと定数バッファーを作成します。
-	auto createPSTask = loadPSTask.then([this](const std::vector<byte>& fileData) {
-		DX::ThrowIfFailed(
-			m_deviceResources->GetD3DDevice()->CreatePixelShader(
-				&fileData[0],
-				fileData.size(),
-				nullptr,
-				&m_pixelShader
-				)
-			);
+	ResetShaderPrograms();
+	WatchShaderSources();
+	RequestShaderProgram(GetShaderKey());
+
+	CD3D11_BUFFER_DESC constantBufferDesc(sizeof(ModelViewProjectionConstantBuffer) , D3D11_BIND_CONSTANT_BUFFER);
+	DX::ThrowIfFailed(
+		m_deviceResources->GetD3DDevice()->CreateBuffer(
+			&constantBufferDesc,
+			nullptr,
+			&m_constantBuffer
+			)
+		);
 
-		CD3D11_BUFFER_DESC constantBufferDesc(sizeof(ModelViewProjectionConstantBuffer) , D3D11_BIND_CONSTANT_BUFFER);
-		DX::ThrowIfFailed(
-			m_deviceResources->GetD3DDevice()->CreateBuffer(
-				&constantBufferDesc,
-				nullptr,
-				&m_constantBuffer
-				)
-			);
-	});
+	// キューブが読み込まれたら、オブジェクトを描画する準備が完了します。
+	m_loadingComplete = true;
+}
+
+// 読み込んだ ShaderPermutationSet に合わせて、機能のビットとシェーダーの表を作り直します。
+void Sample3DSceneRenderer::ResetShaderPrograms()
+{
+	m_shaderPrograms.clear();
+	if (m_vertexShaderPermutations)
+	{
+		m_vertexColorFeature = m_vertexShaderPermutations->FindFeatureMask("VERTEX_COLOR");
+		m_instanceColorFeature = m_vertexShaderPermutations->FindFeatureMask("INSTANCE_COLOR");
+		m_shaderPrograms.resize(m_vertexShaderPermutations->GetPermutationCount());
+	}
+	else
+	{
+		m_vertexColorFeature = 0;
+		m_instanceColorFeature = 0;
+		m_shaderPrograms.resize(1);
+	}
+}
 
-	// 両方のシェーダーの読み込みが完了したら、メッシュを作成します。
-	auto createCubeTask = (createPSTask && createVSTask).then([this] () {
+// インストール先の Content\*.hlsl を監視します。Visual Studio から配置し直すか、直接編集すると反映されます。
+void Sample3DSceneRenderer::WatchShaderSources()
+{
+#ifdef _DEBUG
+	if (!m_vertexShaderPermutations || !m_pixelShaderPermutations)
+	{
+		return;
+	}
+	auto installedLocation = Windows::ApplicationModel::Package::Current->InstalledLocation->Path;
+	std::string content = DX::ToUtf8(installedLocation->Data()) + "\\Content\\";
+	auto reloader = std::make_unique<thinr::ShaderHotReloader>(m_shaderCache);
+	m_vertexShaderReloadId = reloader->Watch(content + "SampleVertexShader.hlsl", m_vertexShaderPermutations);
+	m_pixelShaderReloadId = reloader->Watch(content + "SamplePixelShader.hlsl", m_pixelShaderPermutations);
+	m_shaderReloader = std::move(reloader);
+#endif
+}
 
-		// メッシュの頂点を読み込みます。各頂点には、位置と色があります。
-		static const VertexPositionColor cubeVertices[] = 
+// 監視スレッドがコンパイルまで済ませたシェーダーに差し替えます。失敗したものは渡されないので、前のシェーダーのままです。
+void Sample3DSceneRenderer::ApplyShaderReloads()
+{
+	if (!m_shaderReloader || !m_shaderReloader->TakeReloads(m_shaderReloads) || m_shaderReloads.empty())
+	{
+		return;
+	}
+	for (const auto &reload : m_shaderReloads)
+	{
+		if (reload.shader == m_vertexShaderReloadId)
 		{
-			{XMFLOAT3(-0.5f, -0.5f, -0.5f), XMFLOAT3(0.0f, 0.0f, 0.0f)},
-			{XMFLOAT3(-0.5f, -0.5f,  0.5f), XMFLOAT3(0.0f, 0.0f, 1.0f)},
-			{XMFLOAT3(-0.5f,  0.5f, -0.5f), XMFLOAT3(0.0f, 1.0f, 0.0f)},
-			{XMFLOAT3(-0.5f,  0.5f,  0.5f), XMFLOAT3(0.0f, 1.0f, 1.0f)},
-			{XMFLOAT3( 0.5f, -0.5f, -0.5f), XMFLOAT3(1.0f, 0.0f, 0.0f)},
-			{XMFLOAT3( 0.5f, -0.5f,  0.5f), XMFLOAT3(1.0f, 0.0f, 1.0f)},
-			{XMFLOAT3( 0.5f,  0.5f, -0.5f), XMFLOAT3(1.0f, 1.0f, 0.0f)},
-			{XMFLOAT3( 0.5f,  0.5f,  0.5f), XMFLOAT3(1.0f, 1.0f, 1.0f)},
-		};
+			m_vertexShaderPermutations = reload.permutations;
+		}
+		else if (reload.shader == m_pixelShaderReloadId)
+		{
+			m_pixelShaderPermutations = reload.permutations;
+		}
+	}
+	m_shaderReloads.clear();
 
-		D3D11_SUBRESOURCE_DATA vertexBufferData = {0};
-		vertexBufferData.pSysMem = cubeVertices;
-		vertexBufferData.SysMemPitch = 0;
-		vertexBufferData.SysMemSlicePitch = 0;
-		CD3D11_BUFFER_DESC vertexBufferDesc(sizeof(cubeVertices), D3D11_BIND_VERTEX_BUFFER);
-		DX::ThrowIfFailed(
-			m_deviceResources->GetD3DDevice()->CreateBuffer(
-				&vertexBufferDesc,
-				&vertexBufferData,
-				&m_vertexBuffer
-				)
-			);
+	// 機能の並びが変わることもあるので表ごと作り直します。使っていた組み合わせはコンパイル済みなので、
+	// ここではシェーダー オブジェクトを作るだけです。
+	ResetShaderPrograms();
+}
+
+// SetInstances の内容から、頂点シェーダーの機能の組み合わせを選びます。
+thinr::ShaderPermutationKey Sample3DSceneRenderer::GetShaderKey() const
+{
+	return m_vertexColorFeature | (m_instanceColors ? m_instanceColorFeature : 0);
+}
+
+// key の組み合わせのシェーダーと入力レイアウトを、まだ無ければ作成します。描画キューに渡すシェーダー番号を返します。
+// コンパイルに失敗した場合は、ビルド時にコンパイルした .cso を代わりに使います。
+uint32_t Sample3DSceneRenderer::RequestShaderProgram(thinr::ShaderPermutationKey key)
+{
+	if (!m_vertexShaderPermutations)
+	{
+		key = 0;
+	}
+	ShaderProgram &program = m_shaderPrograms[key];
+	if (program.vertexShader)
+	{
+		return key;
+	}
 
-		// メッシュのインデックスを読み込みます。インデックスの 3 つ 1 組の値のそれぞれは、次のものを表します
-		// 画面上に描画される三角形を表します。
-		// たとえば、0,2,1 とは、頂点バッファーのインデックス
-		//0、2、1 にある頂点が、このメッシュの
-		// 最初の三角形を構成することを意味します。
-		static const unsigned short cubeIndices [] =
+	const std::vector<byte> *vertexShader = &m_vertexShaderFallback;
+	const std::vector<byte> *pixelShader = &m_pixelShaderFallback;
+	try
+	{
+		if (m_vertexShaderPermutations)
+		{
+			vertexShader = &m_vertexShaderPermutations->Build(key);
+		}
+		if (m_pixelShaderPermutations)
 		{
-			0,2,1, // -x
-			1,2,3,
+			thinr::ShaderPermutationKey pixelKey = m_vertexShaderPermutations
+				? m_pixelShaderPermutations->TranslateKey(key, *m_vertexShaderPermutations)
+				: 0;
+			pixelShader = &m_pixelShaderPermutations->Build(pixelKey);
+		}
+		if (m_shaderReloader)
+		{
+			// ソースが変わったときに、この組み合わせも作り直しておきます。ピクセル シェーダーのキーは機能名で置き換わります。
+			m_shaderReloader->AddKey(m_vertexShaderReloadId, key, *m_vertexShaderPermutations);
+			m_shaderReloader->AddKey(m_pixelShaderReloadId, key, *m_vertexShaderPermutations);
+		}
+	}
+	catch (const thinr::ShaderCompileError &error)
+	{
+		OutputDebugStringA(error.what());
+		vertexShader = &m_vertexShaderFallback;
+		pixelShader = &m_pixelShaderFallback;
+	}
+
+	auto device = m_deviceResources->GetD3DDevice();
+	DX::ThrowIfFailed(
+		device->CreateVertexShader(
+			vertexShader->data(),
+			vertexShader->size(),
+			nullptr,
+			&program.vertexShader
+			)
+		);
 
-			4,5,6, // +x
-			5,7,6,
+	static const D3D11_INPUT_ELEMENT_DESC vertexDesc [] =
+	{
+		{ "POSITION", 0, DXGI_FORMAT_R32G32B32_FLOAT, 0, 0, D3D11_INPUT_PER_VERTEX_DATA, 0 },
+		{ "COLOR", 0, DXGI_FORMAT_R32G32B32_FLOAT, 0, 12, D3D11_INPUT_PER_VERTEX_DATA, 0 },
+		{ "INSTANCE_TRANSFORM", 0, DXGI_FORMAT_R32G32B32A32_FLOAT, 1, 0, D3D11_INPUT_PER_INSTANCE_DATA, 1 },
+		{ "INSTANCE_TRANSFORM", 1, DXGI_FORMAT_R32G32B32A32_FLOAT, 1, 16, D3D11_INPUT_PER_INSTANCE_DATA, 1 },
+		{ "INSTANCE_TRANSFORM", 2, DXGI_FORMAT_R32G32B32A32_FLOAT, 1, 32, D3D11_INPUT_PER_INSTANCE_DATA, 1 },
+		{ "INSTANCE_TRANSFORM", 3, DXGI_FORMAT_R32G32B32A32_FLOAT, 1, 48, D3D11_INPUT_PER_INSTANCE_DATA, 1 },
+		{ "INSTANCE_COLOR", 0, DXGI_FORMAT_R32G32B32_FLOAT, 1, 64, D3D11_INPUT_PER_INSTANCE_DATA, 1 },
+	};
+
+	// 機能を無効にした組み合わせが使わない要素があっても、同じレイアウトで作成できます。
+	DX::ThrowIfFailed(
+		device->CreateInputLayout(
+			vertexDesc,
+			ARRAYSIZE(vertexDesc),
+			vertexShader->data(),
+			vertexShader->size(),
+			&program.inputLayout
+			)
+		);
 
-			0,1,5, // -y
-			0,5,4,
+	DX::ThrowIfFailed(
+		device->CreatePixelShader(
+			pixelShader->data(),
+			pixelShader->size(),
+			nullptr,
+			&program.pixelShader
+			)
+		);
+	return key;
+}
 
-			2,6,7, // +y
-			2,7,3,
+void Sample3DSceneRenderer::CreateDeviceDependentResources()
+{
+	// シェーダーのソース、ビルド時にコンパイルした .cso、キューブのメッシュをジョブ システムで並行して読み込みます。
+	m_loadGeneration++;
+	m_pendingAssets = 5;
+	auto installedLocation = Windows::ApplicationModel::Package::Current->InstalledLocation->Path;
+	std::string installed = DX::ToUtf8(installedLocation->Data()) + "\\";
+	LoadShaderSource(installed + "Content\\SampleVertexShader.hlsl", "vs_4_0_level_9_3", m_vertexShaderPermutations);
+	LoadShaderSource(installed + "Content\\SamplePixelShader.hlsl", "ps_4_0_level_9_3", m_pixelShaderPermutations);
+	LoadShaderBytecode(installed + "SampleVertexShader.cso", m_vertexShaderFallback);
+	LoadShaderBytecode(installed + "SamplePixelShader.cso", m_pixelShaderFallback);
+	LoadMesh(installed + "Content\\Cube.tmesh");
+}
 
-			0,4,6, // -z
-			0,6,2,
+// .tmesh はマップし、頂点とインデックスをコピーせずにそのままバッファーと BVH の作成に使います。
+// .gltf と .glb は読み込んでノードの変換を適用した 1 つのメッシュにし、OptimizeMesh で並べ替えます。
+// Direct3D のデバイスはフリー スレッドなので、バッファーもワーカーで作成します。
+void Sample3DSceneRenderer::LoadMesh(const std::string &path)
+{
+	Microsoft::WRL::ComPtr<ID3D11Device3> device = m_deviceResources->GetD3DDevice();
+	uint32_t generation = m_loadGeneration;
 
-			1,3,7, // +z
-			1,7,5,
+	thinr::AssetRequest request;
+	request.path = path;
+	std::string extension = path.substr(path.find_last_of('.') + 1);
+	if (extension == "gltf" || extension == "glb")
+	{
+		request.open = [](const std::string &path) -> std::shared_ptr<void>
+		{
+			// 作成されたままの順番なので、頂点キャッシュと重ね描きのために並べ替えてから使います。
+			auto data = std::make_shared<thinr::MeshData>(thinr::FlattenGltfModel(thinr::ImportGltf(path)));
+			thinr::MeshOptimizeStats stats = thinr::OptimizeMesh(*data);
+			char message[128];
+			sprintf_s(message, "%s: ACMR %.3f -> %.3f\n", thinr::GetFileName(path).c_str(), stats.acmrBefore, stats.acmrAfter);
+			OutputDebugStringA(message);
+			return data;
 		};
+		request.create = [device](const std::shared_ptr<void> &opened) -> std::shared_ptr<void>
+		{
+			auto data = std::static_pointer_cast<thinr::MeshData>(opened);
+			// BVH の作成でインデックスを確かめてから、GPU に渡します。
+			auto bvh = std::make_shared<thinr::MeshBvh>();
+			bvh->Build(data->vertices.data(), data->vertices.size(), data->indices.data(), data->indices.size());
+			return CreateMeshResources(
+				device.Get(),
+				data->vertices.data(),
+				static_cast<uint32>(data->vertices.size()),
+				data->indices.data(),
+				sizeof(uint32_t),
+				static_cast<uint32>(data->indices.size()),
+				bvh
+				);
+		};
+	}
+	else
+	{
+		request.open = [](const std::string &path) -> std::shared_ptr<void>
+		{
+			return std::make_shared<thinr::MeshFile>(path);
+		};
+		request.create = [device](const std::shared_ptr<void> &opened) -> std::shared_ptr<void>
+		{
+			auto file = std::static_pointer_cast<thinr::MeshFile>(opened);
+			// BVH の作成でインデックスを確かめてから、GPU に渡します。
+			auto bvh = std::make_shared<thinr::MeshBvh>();
+			if (file->GetIndices16())
+			{
+				bvh->Build(file->GetVertices(), file->GetVertexCount(), file->GetIndices16(), file->GetIndexCount());
+			}
+			else
+			{
+				bvh->Build(file->GetVertices(), file->GetVertexCount(), file->GetIndices32(), file->GetIndexCount());
+			}
+			return CreateMeshResources(
+				device.Get(),
+				file->GetVertices(),
+				file->GetVertexCount(),
+				file->GetIndexData(),
+				file->GetIndexSize(),
+				file->GetIndexCount(),
+				bvh
+				);
+		};
+	}
+	request.completed = [this, generation](const thinr::Asset &asset)
+	{
+		if (generation != m_loadGeneration)
+		{
+			return;
+		}
+		auto mesh = asset.Get<MeshResources>();
+		if (mesh)
+		{
+			m_vertexBuffer = mesh->vertexBuffer;
+			m_indexBuffer = mesh->indexBuffer;
+			m_indexFormat = mesh->indexFormat;
+			m_indexCount = mesh->indexCount;
+			m_cubeBvh = mesh->bvh;
+			m_sceneInstancesDirty = true;
+		}
+		else
+		{
+			OutputDebugStringA((asset.GetError() + "\n").c_str());
+		}
+		OnAssetLoaded();
+	};
+	m_assetLoader.Load(std::move(request));
+}
 
-		m_indexCount = ARRAYSIZE(cubeIndices);
-
-		D3D11_SUBRESOURCE_DATA indexBufferData = {0};
-		indexBufferData.pSysMem = cubeIndices;
-		indexBufferData.SysMemPitch = 0;
-		indexBufferData.SysMemSlicePitch = 0;
-		CD3D11_BUFFER_DESC indexBufferDesc(sizeof(cubeIndices), D3D11_BIND_INDEX_BUFFER);
-		DX::ThrowIfFailed(
-			m_deviceResources->GetD3DDevice()->CreateBuffer(
-				&indexBufferDesc,
-				&indexBufferData,
-				&m_indexBuffer
-				)
-			);
-	});
+// 頂点とインデックスのバッファーを作成します。bvh は呼び出し元がインデックスの型に合わせて作成済みのものです。
+// インデックスの範囲は MeshBvh::Build が確かめるので、Build が成功した後で呼んでください。
+std::shared_ptr<Sample3DSceneRenderer::MeshResources> Sample3DSceneRenderer::CreateMeshResources(
+	ID3D11Device3 *device,
+	const thinr::VertexPositionColor *vertices,
+	uint32 vertexCount,
+	const void *indices,
+	uint32 indexSize,
+	uint32 indexCount,
+	const std::shared_ptr<thinr::MeshBvh> &bvh
+	)
+{
+	auto mesh = std::make_shared<MeshResources>();
+
+	// 頂点のレイアウトは thinr::VertexPositionColor と同じです。
+	static_assert(sizeof(VertexPositionColor) == sizeof(thinr::VertexPositionColor), "layout");
+	D3D11_SUBRESOURCE_DATA vertexBufferData = {0};
+	vertexBufferData.pSysMem = vertices;
+	CD3D11_BUFFER_DESC vertexBufferDesc(vertexCount * sizeof(VertexPositionColor), D3D11_BIND_VERTEX_BUFFER);
+	DX::ThrowIfFailed(
+		device->CreateBuffer(
+			&vertexBufferDesc,
+			&vertexBufferData,
+			&mesh->vertexBuffer
+			)
+		);
 
-	// キューブが読み込まれたら、オブジェクトを描画する準備が完了します。
-	createCubeTask.then([this] () {
-		m_loadingComplete = true;
-	});
+	D3D11_SUBRESOURCE_DATA indexBufferData = {0};
+	indexBufferData.pSysMem = indices;
+	CD3D11_BUFFER_DESC indexBufferDesc(indexCount * indexSize, D3D11_BIND_INDEX_BUFFER);
+	DX::ThrowIfFailed(
+		device->CreateBuffer(
+			&indexBufferDesc,
+			&indexBufferData,
+			&mesh->indexBuffer
+			)
+		);
+	mesh->indexFormat = indexSize == 2 ? DXGI_FORMAT_R16_UINT : DXGI_FORMAT_R32_UINT;
+	mesh->indexCount = indexCount;
+	mesh->bvh = bvh;
+	return mesh;
 }
 
 void Sample3DSceneRenderer::ReleaseDeviceDependentResources()
 {
 	m_loadingComplete = false;
-	m_vertexShader.Reset();
-	m_inputLayout.Reset();
-	m_pixelShader.Reset();
+	m_shaderReloader.reset();
+	m_shaderPrograms.clear();
 	m_constantBuffer.Reset();
 	m_vertexBuffer.Reset();
 	m_indexBuffer.Reset();
+	m_instanceBuffer.Reset();
+	m_instancesDirty = true;
 }
\ No newline at end of file
@@ -3,11 +3,26 @@
 #include "..\Common\DeviceResources.h"
 #include "ShaderStructures.h"
 #include "..\Common\StepTimer.h"
+#include "../../ThinRenderer/RenderQueue.h"
+#include "../../ThinRenderer/FrustumCuller.h"
+#include "../../ThinRenderer/SceneBvh.h"
+#include "../../ThinRenderer/ShaderHotReloader.h"
+#include "../../ThinRenderer/AssetLoader.h"
+#include "../../ThinRenderer/TransformHierarchy.h"
+#include <atomic>
 
 namespace ThinRendererUWP
 {
+	// Simulate の結果のうち描画に必要なもの。更新スレッドで書き込み、描画スレッドでは読むだけです。
+	struct SceneSnapshot
+	{
+		// 変換の階層で計算したキューブのワールド行列 (転置済み)。previousModel は 1 つ前の Simulate の値です。
+		thinr::Float4x4 previousModel;
+		thinr::Float4x4 model;
+	};
+
 	// このサンプル レンダリングでは、基本的なレンダリング パイプラインをインスタンス化します。
-	class Sample3DSceneRenderer
+	class Sample3DSceneRenderer : public thinr::IDrawSubmitter
 	{
 	public:
 		Sample3DSceneRenderer(const std::shared_ptr<thinr::DeviceManager>& deviceResources);
@@ -15,36 +30,151 @@ namespace ThinRendererUWP
 		void CreateWindowSizeDependentResources();
 		void ReleaseDeviceDependentResources();
 		void Update(DX::StepTimer const& timer);
+		// Update のうち、描画のリソースに触れない部分です。更新スレッドから呼べます。
+		void Simulate(DX::StepTimer const& timer, SceneSnapshot &snapshot);
+		// Update のうち、Simulate の結果を描画とレイキャストに反映する部分です。描画スレッドで呼んでください。
+		// 変換は previousModel と model を alpha (StepTimer::GetInterpolationAlpha) で補間します。
+		void ApplySnapshot(const SceneSnapshot &snapshot, float alpha = 1.0f);
 		void Render();
 		void StartTracking();
 		void TrackingUpdate(float positionX);
 		void StopTracking();
 		bool IsTracking() { return m_tracking; }
 
+		// キューブを count 個のインスタンスとして 1 回の DrawIndexedInstanced で描画します。
+		// colors が nullptr の場合は頂点色のままです (インスタンス色の無いシェーダーの組み合わせで描画します)。
+		// 既定は単位行列のインスタンス 1 つです。
+		// 描画時に視錐台の外にあるインスタンスは除外されます。
+		void SetInstances(const thinr::Float4x4 *transforms, const thinr::Float3 *colors, size_t count);
+
+		// ワールド空間のレイで回転中のキューブを判定します (ピッキング用)。hit.instance は SetInstances の番号です。
+		// 読み込みが完了するまでは常に false を返します。
+		bool Raycast(const thinr::Ray &ray, thinr::RayHit &hit) const { return m_sceneBvh.Raycast(ray, hit); }
+
+		// 視錐台カリングで判定したインスタンス数と見えた数。
+		const thinr::CullStats &GetCullStats() const { return m_culler.GetStats(); }
+
+		// 描画キューが省略したバインド数などの統計。
+		const thinr::RenderQueueStats &GetRenderQueueStats() const { return m_renderQueue.GetStats(); }
+
+		// IDrawSubmitter
+		virtual void BindPass(uint32_t pass);
+		virtual void BindShader(uint32_t shader);
+		virtual void BindMaterial(uint32_t material);
+		virtual void BindMesh(uint32_t mesh);
+		virtual void Draw(uint32_t payload);
 
 	private:
 		void Rotate(float radians);
+		static DirectX::XMMATRIX InterpolateTransform(const DirectX::XMFLOAT4X4 &from, const DirectX::XMFLOAT4X4 &to, float alpha);
+		void UpdateInstanceBuffer();
+		void UpdateSceneBvh();
+		void LoadShaderSource(const std::string &path, const std::string &target, std::shared_ptr<thinr::ShaderPermutationSet> &permutations);
+		void LoadShaderBytecode(const std::string &path, std::vector<byte> &bytecode);
+		void LoadMesh(const std::string &path);
+		void OnAssetLoaded();
+		void ResetShaderPrograms();
+		void WatchShaderSources();
+		void ApplyShaderReloads();
+		thinr::ShaderPermutationKey GetShaderKey() const;
+		uint32_t RequestShaderProgram(thinr::ShaderPermutationKey key);
 
 	private:
+		// 頂点シェーダーの機能の組み合わせ 1 つ分の Direct3D リソース。
+		struct ShaderProgram
+		{
+			Microsoft::WRL::ComPtr<ID3D11InputLayout>	inputLayout;
+			Microsoft::WRL::ComPtr<ID3D11VertexShader>	vertexShader;
+			Microsoft::WRL::ComPtr<ID3D11PixelShader>	pixelShader;
+		};
+
+		// メッシュのファイルからワーカーで作成したリソース。
+		struct MeshResources
+		{
+			Microsoft::WRL::ComPtr<ID3D11Buffer>	vertexBuffer;
+			Microsoft::WRL::ComPtr<ID3D11Buffer>	indexBuffer;
+			DXGI_FORMAT								indexFormat;
+			uint32									indexCount;
+			std::shared_ptr<thinr::MeshBvh>			bvh;
+		};
+
+		static std::shared_ptr<MeshResources> CreateMeshResources(
+			ID3D11Device3 *device,
+			const thinr::VertexPositionColor *vertices,
+			uint32 vertexCount,
+			const void *indices,
+			uint32 indexSize,
+			uint32 indexCount,
+			const std::shared_ptr<thinr::MeshBvh> &bvh
+			);
+
 		// デバイス リソースへのキャッシュされたポインター。
 		std::shared_ptr<thinr::DeviceManager> m_deviceResources;
 
 		// キューブ ジオメトリの Direct3D リソース。
-		Microsoft::WRL::ComPtr<ID3D11InputLayout>	m_inputLayout;
 		Microsoft::WRL::ComPtr<ID3D11Buffer>		m_vertexBuffer;
 		Microsoft::WRL::ComPtr<ID3D11Buffer>		m_indexBuffer;
-		Microsoft::WRL::ComPtr<ID3D11VertexShader>	m_vertexShader;
-		Microsoft::WRL::ComPtr<ID3D11PixelShader>	m_pixelShader;
 		Microsoft::WRL::ComPtr<ID3D11Buffer>		m_constantBuffer;
+		Microsoft::WRL::ComPtr<ID3D11Buffer>		m_instanceBuffer;
+
+		// シェーダーやメッシュのファイルをジョブ システムで読み込みます。完了は Render の Poll で受け取ります。
+		thinr::AssetLoader	m_assetLoader;
+		// デバイスを作り直す前に始めた読み込みの結果を捨てるための番号。
+		uint32_t			m_loadGeneration;
+		uint32_t			m_pendingAssets;
+
+		// 実行時にコンパイルしたシェーダーを LocalFolder\ShaderCache に保存します。
+		std::shared_ptr<thinr::ShaderCache>			m_shaderCache;
+
+		// シェーダーの機能の組み合わせ。ソースが無い場合は nullptr で、ビルド時の .cso (すべての機能が有効) だけを使います。
+		std::shared_ptr<thinr::ShaderPermutationSet>	m_vertexShaderPermutations;
+		std::shared_ptr<thinr::ShaderPermutationSet>	m_pixelShaderPermutations;
+		std::vector<byte>								m_vertexShaderFallback;
+		std::vector<byte>								m_pixelShaderFallback;
+		thinr::ShaderPermutationKey						m_vertexColorFeature;
+		thinr::ShaderPermutationKey						m_instanceColorFeature;
+		// 頂点シェーダーのキーで引く表。描画キューのシェーダー番号にもキーを使います。
+		std::vector<ShaderProgram>						m_shaderPrograms;
+
+		// デバッグ ビルドでは、パッケージの Content\*.hlsl の変更を監視して作り直したシェーダーにフレームの合間で差し替えます。
+		std::unique_ptr<thinr::ShaderHotReloader>		m_shaderReloader;
+		uint32_t										m_vertexShaderReloadId;
+		uint32_t										m_pixelShaderReloadId;
+		std::vector<thinr::ShaderReload>				m_shaderReloads;
+
+		// シーンの変換の階層。今はキューブのモデル変換だけのノードを持ちます。Simulate だけが使います。
+		thinr::TransformHierarchy	m_transforms;
+		uint32_t					m_modelNode;
 
 		// キューブ ジオメトリのシステム リソース。
 		ModelViewProjectionConstantBuffer	m_constantBufferData;
 		uint32	m_indexCount;
+		DXGI_FORMAT	m_indexFormat;
+		std::vector<InstanceTransformColor>	m_instanceData;
+		size_t	m_instanceCapacity;
+		bool	m_instancesDirty;
+		bool	m_instanceColors;
+
+		// インスタンスごとの境界球と、視錐台カリングで残ったインスタンスの番号 (昇順)。
+		thinr::BoundingSphereSet	m_instanceBounds;
+		thinr::FrustumCuller		m_culler;
+		std::vector<uint32_t>		m_visibleInstances;
+		std::vector<uint32_t>		m_culledInstances;
+
+		// レイキャスト用の BVH。毎フレームの回転は Refit で反映し、インスタンスが変わったら作り直します。
+		std::shared_ptr<thinr::MeshBvh>	m_cubeBvh;
+		thinr::SceneBvh					m_sceneBvh;
+		bool							m_sceneInstancesDirty;
+
+		// 描画項目をステート順に並べ替えて、変化したステートだけをバインドします。
+		thinr::RenderQueue	m_renderQueue;
 
 		// レンダリング ループで使用する変数。
 		bool	m_loadingComplete;
 		float	m_degreesPerSecond;
-		bool	m_tracking;
+		// 入力のスレッドで書き込み、Simulate で読みます。m_trackingRadians は TrackingUpdate で決めた角度です。
+		std::atomic<bool>	m_tracking;
+		std::atomic<float>	m_trackingRadians;
 	};
 }
 
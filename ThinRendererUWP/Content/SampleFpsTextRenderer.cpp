@@ -51,6 +51,15 @@ void SampleFpsTextRenderer::Update(DX::StepTimer const& timer)
 
 	m_text = (fps > 0) ? std::to_wstring(fps) + L" FPS" : L" - FPS";
 
+	// SLA はフレーム時間のパーセンタイルで決めているので p99 も表示します。
+	thinr::FrameTimeSummary summary = timer.GetFrameStatistics().Summarize();
+	if (summary.sampleCount > 0)
+	{
+		wchar_t line[64];
+		swprintf_s(line, L"\np99 %.1f ms", summary.p99Seconds * 1000.0);
+		m_text += line;
+	}
+
 	ComPtr<IDWriteTextLayout> textLayout;
 	DX::ThrowIfFailed(
 		m_deviceResources->GetDWriteFactory()->CreateTextLayout(
@@ -58,7 +67,7 @@ void SampleFpsTextRenderer::Update(DX::StepTimer const& timer)
 			(uint32) m_text.length(),
 			m_textFormat.Get(),
 			240.0f, // 入力テキストの最大幅。
-			50.0f, // 入力テキストの最大高さ。
+			100.0f, // 入力テキストの最大高さ。
 			&textLayout
 			)
 		);
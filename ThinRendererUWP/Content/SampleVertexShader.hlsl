@@ -1,3 +1,13 @@
+// thinr::ShaderPermutationSet őgݍ킹Iԋ@\łBrhɃRpC .cso łׂ͂ėLɂȂ܂B
+// thinr:feature VERTEX_COLOR
+// thinr:feature INSTANCE_COLOR
+#ifndef VERTEX_COLOR
+#define VERTEX_COLOR 1
+#endif
+#ifndef INSTANCE_COLOR
+#define INSTANCE_COLOR 1
+#endif
+
 // WIg쐬邽߂ 3 ̊{IȗD̃}gbNXۑ萔obt@[B
 cbuffer ModelViewProjectionConstantBuffer : register(b0)
 {
@@ -11,6 +21,13 @@ struct VertexShaderInput
 {
 	float3 pos : POSITION;
 	float3 color : COLOR0;
+
+	// CX^XƂ̃f[^ (Xbg 1)Bϊ XMMatrixTranspose ̂sƂɊi[܂B
+	float4 transform0 : INSTANCE_TRANSFORM0;
+	float4 transform1 : INSTANCE_TRANSFORM1;
+	float4 transform2 : INSTANCE_TRANSFORM2;
+	float4 transform3 : INSTANCE_TRANSFORM3;
+	float3 instanceColor : INSTANCE_COLOR;
 };
 
 // sNZ VF[_[ʂēnsNZƂ̐Ff[^B
@@ -28,12 +45,21 @@ PixelShaderInput main(VertexShaderInput input)
 
 	// _̈ʒuAˉeꂽ̈ɕϊ܂B
 	pos = mul(pos, model);
+	pos = mul(float4x4(input.transform0, input.transform1, input.transform2, input.transform3), pos);
 	pos = mul(pos, view);
 	pos = mul(pos, projection);
 	output.pos = pos;
 
-	// ύXɐFpXX[܂B
+#if VERTEX_COLOR
 	output.color = input.color;
+#else
+	output.color = float3(1.0f, 1.0f, 1.0f);
+#endif
+
+#if INSTANCE_COLOR
+	// CX^X̐FZ܂B
+	output.color *= input.instanceColor;
+#endif
 
 	return output;
 }
@@ -16,4 +16,12 @@ namespace ThinRendererUWP
 		DirectX::XMFLOAT3 pos;
 		DirectX::XMFLOAT3 color;
 	};
+
+	// 頂点バッファー スロット 1 で送信するインスタンスごとのデータ。
+	// transform は定数バッファーと同じく XMMatrixTranspose したものを格納します。
+	struct InstanceTransformColor
+	{
+		DirectX::XMFLOAT4X4 transform;
+		DirectX::XMFLOAT3 color;
+	};
 }
\ No newline at end of file
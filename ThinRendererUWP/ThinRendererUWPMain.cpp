@@ -10,7 +10,9 @@ using namespace Concurrency;
 
 // アプリケーションの読み込み時にアプリケーション資産を読み込んで初期化します。
 ThinRendererUWPMain::ThinRendererUWPMain(const std::shared_ptr<DX::DeviceResources>& deviceResources) :
-	m_deviceResources(deviceResources)
+	m_deviceResources(deviceResources),
+	m_stopSimulation(false),
+	m_simulationFailed(false)
 {
 	// デバイスが失われたときや再作成されたときに通知を受けるように登録します
 	m_deviceResources->RegisterDeviceNotify(this);
@@ -26,10 +28,22 @@ ThinRendererUWPMain::ThinRendererUWPMain(const std::shared_ptr<DX::DeviceResourc
 	m_timer.SetFixedTimeStep(true);
 	m_timer.SetTargetElapsedSeconds(1.0 / 60);
 	*/
+
+	// 固定タイムステップで遅れたときに追いつこうとする Update は 1 フレームあたり 4 回までにし、残りは捨てます。
+	// 捨てた時間は m_timer.GetDroppedSeconds() で確認できます。
+	m_timer.SetMaxStepsPerTick(4);
+
+	// マルチコアでシミュレーションと描画を並行して進めるには、次を呼び出します:
+	/*
+	SetThreadedUpdate(true);
+	*/
 }
 
 ThinRendererUWPMain::~ThinRendererUWPMain()
 {
+	// レンダラーを解放する前に更新スレッドを止めます。
+	SetThreadedUpdate(false);
+
 	// デバイスの通知を登録解除しています
 	m_deviceResources->RegisterDeviceNotify(nullptr);
 }
@@ -44,13 +58,113 @@ void ThinRendererUWPMain::CreateWindowSizeDependentResources()
 // アプリケーション状態をフレームごとに 1 回更新します。
 void ThinRendererUWPMain::Update() 
 {
+	THINR_PROFILE_ZONE("ThinRendererUWPMain::Update");
+
+	if (IsThreadedUpdate())
+	{
+		if (m_simulationFailed)
+		{
+			SetThreadedUpdate(false);
+			std::rethrow_exception(m_simulationError);
+		}
+
+		// 更新スレッドが新しいスナップショットを公開していれば受け取ります。無ければ前のものを使い続けます。
+		m_snapshots.Consume();
+		const FrameSnapshot &snapshot = m_snapshots.GetReadBuffer();
+		if (snapshot.frameCount != 0)
+		{
+			// 公開した時点の補間係数を、公開してから経った時間の分だけ進めます。
+			double alpha = snapshot.interpolationAlpha;
+			if (snapshot.stepSeconds > 0.0)
+			{
+				std::chrono::duration<double> sincePublish = DX::StepTimer::Clock::now() - snapshot.publishTime;
+				alpha += sincePublish.count() / snapshot.stepSeconds;
+			}
+			m_sceneRenderer->ApplySnapshot(snapshot.scene, static_cast<float>(alpha < 1.0 ? alpha : 1.0));
+		}
+		m_renderTimer.Tick([&]()
+		{
+			m_fpsTextRenderer->Update(m_renderTimer);
+		});
+		return;
+	}
+
 	// シーン オブジェクトを更新します。
 	m_timer.Tick([&]()
 	{
 		// TODO: これをアプリのコンテンツの更新関数で置き換えます。
-		m_sceneRenderer->Update(m_timer);
+		m_sceneRenderer->Simulate(m_timer, m_sceneSnapshot);
 		m_fpsTextRenderer->Update(m_timer);
 	});
+
+	// 固定タイムステップでは、直前と最新の Update の間を次の Update までの進み具合で補間して描画します。
+	if (m_timer.GetFrameCount() != 0)
+	{
+		m_sceneRenderer->ApplySnapshot(m_sceneSnapshot, static_cast<float>(m_timer.GetInterpolationAlpha()));
+	}
+}
+
+void ThinRendererUWPMain::SetThreadedUpdate(bool threaded)
+{
+	if (threaded == IsThreadedUpdate())
+	{
+		return;
+	}
+
+	if (threaded)
+	{
+		// 前回の更新スレッドのスナップショットを読み込み側の分も含めて捨てます。
+		// 新しいスレッドが最初に公開するまで frameCount は 0 なので、Render は描画しません。
+		m_snapshots.Reset();
+		m_stopSimulation = false;
+		m_simulationFailed = false;
+		m_simulationError = nullptr;
+		m_renderTimer.ResetElapsedTime();
+		m_simulationThread = std::thread([this]() { SimulationLoop(); });
+	}
+	else
+	{
+		m_stopSimulation = true;
+		m_simulationThread.join();
+		m_timer.ResetElapsedTime();
+	}
+}
+
+// 更新スレッドの本体です。シーンの状態を進め、描画に必要なものだけをスナップショットとして公開します。
+void ThinRendererUWPMain::SimulationLoop()
+{
+	try
+	{
+		while (!m_stopSimulation)
+		{
+			uint32 lastFrameCount = m_timer.GetFrameCount();
+			m_timer.Tick([&]()
+			{
+				THINR_PROFILE_ZONE("ThinRendererUWPMain::Simulate");
+
+				// 固定タイムステップで追いつくために複数回呼ばれても、公開するのは最後の結果だけです。
+				FrameSnapshot &snapshot = m_snapshots.GetWriteBuffer();
+				m_sceneRenderer->Simulate(m_timer, snapshot.scene);
+				snapshot.frameCount = m_timer.GetFrameCount();
+			});
+			if (m_timer.GetFrameCount() != lastFrameCount)
+			{
+				FrameSnapshot &snapshot = m_snapshots.GetWriteBuffer();
+				snapshot.interpolationAlpha = m_timer.GetInterpolationAlpha();
+				snapshot.stepSeconds = m_timer.IsFixedTimeStep() ? m_timer.GetTargetElapsedSeconds() : 0.0;
+				snapshot.publishTime = DX::StepTimer::Clock::now();
+				m_snapshots.Publish();
+			}
+
+			// 可変タイムステップでもコアを占有しないよう、1 回ごとに少し休みます。
+			std::this_thread::sleep_for(std::chrono::milliseconds(1));
+		}
+	}
+	catch (...)
+	{
+		m_simulationError = std::current_exception();
+		m_simulationFailed = true;
+	}
 }
 
 // 現在のアプリケーション状態に応じて現在のフレームをレンダリングします。
@@ -58,11 +172,20 @@ void ThinRendererUWPMain::Update()
 bool ThinRendererUWPMain::Render() 
 {
 	// 初回更新前にレンダリングは行わないようにしてください。
-	if (m_timer.GetFrameCount() == 0)
+	uint32 frameCount = IsThreadedUpdate() ? m_snapshots.GetReadBuffer().frameCount : m_timer.GetFrameCount();
+	if (frameCount == 0)
 	{
 		return false;
 	}
 
+	THINR_PROFILE_ZONE("ThinRendererUWPMain::Render");
+
+	// 描画ごとの定数はこのフレーム用の領域に書き込まれます。
+	if (auto ring = m_deviceResources->GetManager()->GetConstantBufferRing())
+	{
+		ring->BeginFrame();
+	}
+
 	auto context = m_deviceResources->GetManager()->GetD3DDeviceContext();
 
 	// ビューポートをリセットして全画面をターゲットとします。
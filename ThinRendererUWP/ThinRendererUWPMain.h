@@ -4,6 +4,10 @@
 #include "Common\DeviceResources.h"
 #include "Content\Sample3DSceneRenderer.h"
 #include "Content\SampleFpsTextRenderer.h"
+#include "../ThinRenderer/TripleBuffer.h"
+#include <atomic>
+#include <exception>
+#include <thread>
 
 // Direct2D および 3D コンテンツを画面上でレンダリングします。
 namespace ThinRendererUWP
@@ -17,11 +21,32 @@ namespace ThinRendererUWP
 		void Update();
 		bool Render();
 
+		// true にすると、シミュレーション (Sample3DSceneRenderer::Simulate) を専用のスレッドで実行します。
+		// 更新スレッドはフレームのスナップショットをトリプル バッファーで公開し、Update は最新のものを受け取るだけになるので、
+		// 更新と描画はそれぞれの速さで進み、更新が遅れても描画は前のスナップショットで続きます。
+		void SetThreadedUpdate(bool threaded);
+		bool IsThreadedUpdate() const { return m_simulationThread.joinable(); }
+
 		// IDeviceNotify
 		virtual void OnDeviceLost();
 		virtual void OnDeviceRestored();
 
 	private:
+		// 更新スレッドから描画スレッドへ渡す 1 フレーム分の状態。公開した後は書き換えません。
+		struct FrameSnapshot
+		{
+			// 0 は、まだ一度も更新していないことを示します。
+			uint32 frameCount;
+			SceneSnapshot scene;
+			// 公開した時点の StepTimer::GetInterpolationAlpha と、その時刻。
+			double interpolationAlpha;
+			DX::StepTimer::Clock::time_point publishTime;
+			// 固定タイムステップの間隔。可変タイムステップでは 0 で、補間しません。
+			double stepSeconds;
+		};
+
+		void SimulationLoop();
+
 		// デバイス リソースへのキャッシュされたポインター。
 		std::shared_ptr<DX::DeviceResources> m_deviceResources;
 
@@ -29,7 +54,18 @@ namespace ThinRendererUWP
 		std::unique_ptr<Sample3DSceneRenderer> m_sceneRenderer;
 		std::unique_ptr<SampleFpsTextRenderer> m_fpsTextRenderer;
 
-		// ループ タイマーをレンダリングしています。
+		// ループ タイマーをレンダリングしています。更新スレッドがあるときは、そのスレッドだけが使います。
 		DX::StepTimer m_timer;
+		// 更新スレッドが無いときの、直近の Simulate の結果。
+		SceneSnapshot m_sceneSnapshot;
+
+		// 更新スレッドがあるときの、描画スレッドのフレーム レートの計測用。
+		DX::StepTimer m_renderTimer;
+		thinr::TripleBuffer<FrameSnapshot> m_snapshots;
+		std::thread m_simulationThread;
+		std::atomic<bool> m_stopSimulation;
+		// 更新スレッドで送出された例外。描画スレッドの Update で再送出します。
+		std::exception_ptr m_simulationError;
+		std::atomic<bool> m_simulationFailed;
 	};
 }
\ No newline at end of file
@@ -15,3 +15,4 @@
 #include <concrt.h>
 
 #include "../../ThinRenderer/DeviceManager.h"
+#include "../../ThinRenderer/Profiler.h"